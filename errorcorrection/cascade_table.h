@@ -0,0 +1,93 @@
+/* cascade_table.h: Cascade parameters for the adaptive mode of ecd2.
+   generated by cascade_tablegen 1024 4000 - do not edit.
+   rows: error rate bins of 1% width, columns: block sizes from 4096 bits
+   in factors of two. entries: k0, k1, probability of residual errors after
+   the two passes. comments: leakage including BICONF corrections
+   relative to the Shannon limit. */
+
+struct cascade_param cascade_table[14][4] = {
+    { /* QBER 0.010 */
+	{  65,   227, 3.783e-01}, /*  5792 bits: 1.069 */
+	{  65,   260, 4.185e-01}, /* 11585 bits: 1.064 */
+	{  65,   260, 4.223e-01}, /* 23170 bits: 1.060 */
+	{  65,   260, 4.290e-01}  /* 46340 bits: 1.056 */
+    },
+    { /* QBER 0.020 */
+	{  32,   128, 4.230e-01}, /*  5792 bits: 1.069 */
+	{  32,   128, 4.263e-01}, /* 11585 bits: 1.066 */
+	{  32,   128, 4.095e-01}, /* 23170 bits: 1.062 */
+	{  32,   128, 4.157e-01}  /* 46340 bits: 1.061 */
+    },
+    { /* QBER 0.030 */
+	{  31,    62, 3.860e-01}, /*  5792 bits: 1.075 */
+	{  31,    62, 3.913e-01}, /* 11585 bits: 1.073 */
+	{  31,    62, 4.108e-01}, /* 23170 bits: 1.071 */
+	{  31,    62, 3.985e-01}  /* 46340 bits: 1.070 */
+    },
+    { /* QBER 0.040 */
+	{  16,    64, 3.993e-01}, /*  5792 bits: 1.077 */
+	{  16,    64, 3.985e-01}, /* 11585 bits: 1.075 */
+	{  16,    64, 4.040e-01}, /* 23170 bits: 1.073 */
+	{  16,    64, 4.103e-01}  /* 46340 bits: 1.072 */
+    },
+    { /* QBER 0.050 */
+	{  16,    64, 5.200e-01}, /*  5792 bits: 1.079 */
+	{  16,    64, 5.270e-01}, /* 11585 bits: 1.076 */
+	{  16,    64, 5.428e-01}, /* 23170 bits: 1.074 */
+	{  16,    64, 5.230e-01}  /* 46340 bits: 1.073 */
+    },
+    { /* QBER 0.060 */
+	{  16,    32, 4.103e-01}, /*  5792 bits: 1.088 */
+	{  16,    32, 4.070e-01}, /* 11585 bits: 1.085 */
+	{  16,    32, 4.017e-01}, /* 23170 bits: 1.084 */
+	{  16,    32, 4.095e-01}  /* 46340 bits: 1.084 */
+    },
+    { /* QBER 0.070 */
+	{  16,    32, 4.870e-01}, /*  5792 bits: 1.096 */
+	{  16,    32, 4.773e-01}, /* 11585 bits: 1.094 */
+	{  16,    32, 4.865e-01}, /* 23170 bits: 1.092 */
+	{  16,    32, 4.940e-01}  /* 46340 bits: 1.091 */
+    },
+    { /* QBER 0.080 */
+	{   8,    32, 3.865e-01}, /*  5792 bits: 1.092 */
+	{   8,    32, 3.955e-01}, /* 11585 bits: 1.091 */
+	{   8,    32, 3.870e-01}, /* 23170 bits: 1.090 */
+	{   8,    32, 3.940e-01}  /* 46340 bits: 1.089 */
+    },
+    { /* QBER 0.090 */
+	{   8,    32, 4.487e-01}, /*  5792 bits: 1.092 */
+	{   8,    32, 4.555e-01}, /* 11585 bits: 1.092 */
+	{   8,    32, 4.473e-01}, /* 23170 bits: 1.090 */
+	{   8,    32, 4.577e-01}  /* 46340 bits: 1.089 */
+    },
+    { /* QBER 0.100 */
+	{   8,    32, 5.213e-01}, /*  5792 bits: 1.098 */
+	{   8,    32, 5.117e-01}, /* 11585 bits: 1.096 */
+	{   8,    32, 5.048e-01}, /* 23170 bits: 1.095 */
+	{   8,    32, 5.132e-01}  /* 46340 bits: 1.094 */
+    },
+    { /* QBER 0.110 */
+	{   8,    32, 5.635e-01}, /*  5792 bits: 1.107 */
+	{   8,    32, 5.713e-01}, /* 11585 bits: 1.106 */
+	{   8,    32, 5.698e-01}, /* 23170 bits: 1.103 */
+	{   8,    32, 5.648e-01}  /* 46340 bits: 1.102 */
+    },
+    { /* QBER 0.120 */
+	{   8,    16, 3.938e-01}, /*  5792 bits: 1.114 */
+	{   8,    16, 3.812e-01}, /* 11585 bits: 1.113 */
+	{   8,    16, 3.808e-01}, /* 23170 bits: 1.113 */
+	{   8,    16, 3.890e-01}  /* 46340 bits: 1.112 */
+    },
+    { /* QBER 0.130 */
+	{   8,    16, 4.190e-01}, /*  5792 bits: 1.120 */
+	{   8,    16, 4.383e-01}, /* 11585 bits: 1.119 */
+	{   8,    16, 4.248e-01}, /* 23170 bits: 1.119 */
+	{   8,    16, 4.270e-01}  /* 46340 bits: 1.118 */
+    },
+    { /* QBER 0.140 */
+	{   4,    16, 2.948e-01}, /*  5792 bits: 1.127 */
+	{   4,    16, 2.932e-01}, /* 11585 bits: 1.127 */
+	{   4,    16, 2.825e-01}, /* 23170 bits: 1.127 */
+	{   4,    16, 2.910e-01}  /* 46340 bits: 1.127 */
+    }
+};
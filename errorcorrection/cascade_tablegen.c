@@ -0,0 +1,262 @@
+/* cascade_tablegen.c: Part of the quantum key distribution software. Offline
+                       generator for the Cascade parameter table used by ecd2
+		       in adaptive mode (option -A). Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   This program simulates the two-pass Cascade with cascading back-corrections
+   as done in ecd2 on random error patterns, for a grid of error rates and
+   block sizes. For each grid point, it scans the first block length k0 and
+   the ratio k1/k0, and keeps the pair with the smallest average leakage
+   (parities plus binary search bits, plus an estimate for the BICONF
+   corrections of the residual errors). It then records the probability
+   that a block still carries errors after the two passes, which ecd2 uses
+   to choose the number of BICONF rounds for a given target block error rate.
+
+   Residual errors come in pairs which share a block in both passes; a
+   BICONF round finds one of them with a search over half of the block, and
+   the cascade then finds the other one in its second pass block. Charging
+   two full searches per error instead overrated them about threefold
+   against the leakage ecd2 reports, and favoured short first pass blocks.
+   The error rate rows are centered at whole percents, where links are
+   usually run, and each covers half a percent on either side; with rows
+   centered in between, a block at 3% got the short blocks of the 3.5% row.
+   The trials of a row are spread over its range, so that the choice holds
+   up for the scatter of the error rate which ecd2 estimates from a sample.
+
+   All pairs of a grid point are run on the same error patterns and
+   permutations, so the comparison between them is not blurred by the
+   trials drawn for each. The leakage is flat around its minimum, and the
+   first pass block of the minimum still wanders a bit with the block size;
+   as the leakage per bit only depends on the block size through the
+   BICONF term, k0 should not grow with it. The block lengths of a row
+   are therefore made non-increasing with the block size, keeping the
+   smaller k0 and the k1/k0 ratio that goes with it.
+
+   usage: cascade_tablegen [scantrials [residualtrials]] > cascade_table.h
+
+   The output is the C table included by ecd2.c, and make table in this
+   directory regenerates it with the default trials below. Regenerate it
+   when the grid definitions below are changed; they have to match the
+   lookup in ecd2.c.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* grid; must match CASCADE_TABLE_* definitions in ecd2.c */
+#define QBER_BINS 14      /* error rate bins of 1% width, centers from 1% */
+#define QBER_STEP 0.01
+#define SIZE_BINS 4       /* block sizes from 4k, factors of two; the last
+			     one ends at MAXBITSPERTHREAD (64k) of ecd2 */
+#define SIZE_FIRST 4096
+#define DEFAULT_SCANTRIALS 1024
+#define DEFAULT_RESIDUALTRIALS 4000
+
+/* scan range of the k0*QBER product and the k1/k0 ratio */
+#define C_MIN 0.40
+#define C_STEP 0.05
+#define C_NUM 21
+#define R_MIN 2.0
+#define R_STEP 0.5
+#define R_NUM 5
+#define K0_MIN 4 /* smallest first pass block */
+#define K0_MAX 2048 /* largest first pass block */
+
+#define MIN(A,B) ((A) > (B)? (B) : (A) )
+
+int n;                  /* bits in the block */
+unsigned char *err;     /* error pattern */
+int *errpos, nerr;      /* positions of the errors in the pattern */
+int *perm, *inv;        /* second pass permutation and its inverse */
+unsigned char *par0, *par1; /* parity differences of the blocks */
+
+/* simple xorshift generator; quality is sufficient for this purpose */
+unsigned int rs = 0x12345678;
+static inline unsigned int rnd32(void) {
+    rs ^= rs<<13; rs ^= rs>>17; rs ^= rs<<5;
+    return rs;
+}
+
+/* bit index of position p in pass 0 or 1 */
+static inline int bit_at(int pass, int p) { return pass?perm[p]:p; }
+
+/* do a binary search in block b of a pass with block length k, correct the
+   error found, and return the number of leaked bits. Toggles the parity of
+   the block of the other pass containing the corrected bit. */
+int binsearch(int pass, int b, int k0, int k1) {
+    int k=pass?k1:k0;
+    int lo=b*k, hi=MIN(lo+k, n), mid, i, p, leak=0;
+    while (hi-lo>1) {
+	mid=(lo+hi)/2; p=0;
+	for (i=lo;i<mid;i++) p^=err[bit_at(pass,i)];
+	leak++;
+	if (p) hi=mid; else lo=mid;
+    }
+    i=bit_at(pass,lo);
+    err[i]=0;
+    if (pass) {
+	par1[b]^=1; par0[i/k0]^=1;
+    } else {
+	par0[b]^=1; par1[inv[i]/k1]^=1;
+    }
+    return leak;
+}
+
+/* draw a new error pattern with error rate q, and a new permutation for the
+   second pass */
+void new_pattern(float q) {
+    unsigned int thr = (unsigned int)(q*4294967296.);
+    int i, j, t;
+
+    for (i=0,nerr=0;i<n;i++) {
+	err[i]=(rnd32()<thr);
+	if (err[i]) errpos[nerr++]=i;
+    }
+    for (i=0;i<n;i++) perm[i]=i;
+    for (i=n-1;i>0;i--) {
+	j=rnd32()%(i+1); t=perm[i]; perm[i]=perm[j]; perm[j]=t;
+    }
+    for (i=0;i<n;i++) inv[perm[i]]=i;
+}
+
+/* run one block on the current pattern with block lengths k0, k1. Returns
+   leaked bits, and the number of residual errors in *residual */
+int run_block(int k0, int k1, int *residual) {
+    int nb0, nb1, i, t, leak, any;
+
+    nb0=(n+k0-1)/k0; nb1=(n+k1-1)/k1;
+    for (i=0;i<nb0;i++) par0[i]=0;
+    for (i=0;i<nb1;i++) par1[i]=0;
+    for (i=0;i<nerr;i++) { /* restore the pattern from a previous run */
+	t=errpos[i]; err[t]=1;
+	par0[t/k0]^=1; par1[inv[t]/k1]^=1;
+    }
+    leak=nb0+nb1; /* both parity lists are sent in one message */
+
+    /* cascade between both passes until no odd block is left */
+    do {
+	any=0;
+	for (i=0;i<nb0;i++) if (par0[i]) {leak+=binsearch(0,i,k0,k1); any=1;}
+	for (i=0;i<nb1;i++) if (par1[i]) {leak+=binsearch(1,i,k0,k1); any=1;}
+    } while (any);
+
+    for (i=0,t=0;i<nerr;i++) t+=err[errpos[i]];
+    *residual=t;
+    return leak;
+}
+
+/* estimated leakage of the BICONF correction of one residual error, for
+   second pass blocks of length k1: half of one BICONF parity, a search
+   over half of the block, and a search in a second pass block */
+double residual_cost(int k1) {
+    return (1.+log(n/2)/log(2)+log(k1)/log(2))/2.;
+}
+
+/* error rate of trial tr out of trials in row qi. The trials are spread
+   evenly over the row, as ecd2 looks it up with an estimated error rate */
+float bin_q(int qi, int tr, int trials) {
+    return (qi+0.5+(tr+0.5)/trials)*QBER_STEP;
+}
+
+/* block lengths for scan point ci, ri at error rate q */
+int scan_k0(float q, int ci) {
+    int k0=(int)((C_MIN+ci*C_STEP)/q);
+    if (k0<K0_MIN) k0=K0_MIN;
+    if (k0>K0_MAX) k0=K0_MAX;
+    return k0;
+}
+int scan_k1(int k0, int ri) {
+    return (int)((R_MIN+ri*R_STEP)*k0);
+}
+
+int main(int argc, char *argv[]) {
+    int scantrials=DEFAULT_SCANTRIALS, residualtrials=DEFAULT_RESIDUALTRIALS;
+    int qi, si, tr, ci, ri, res, failed, kk;
+    int k0[SIZE_BINS], k1[SIZE_BINS], nbits[SIZE_BINS];
+    float q, h, best_cost;
+    double cost[C_NUM][R_NUM], leaksum;
+
+    if (argc>1) scantrials=atoi(argv[1]);
+    if (argc>2) residualtrials=atoi(argv[2]);
+    n=SIZE_FIRST<<SIZE_BINS;
+    err=malloc(n); perm=malloc(n*sizeof(int)); inv=malloc(n*sizeof(int));
+    errpos=malloc(n*sizeof(int)); par0=malloc(n); par1=malloc(n);
+    if (!err || !perm || !inv || !errpos || !par0 || !par1) return -1;
+
+    printf("/* cascade_table.h: Cascade parameters for the adaptive mode of "
+	   "ecd2.\n   generated by cascade_tablegen %d %d - do not edit.\n"
+	   "   rows: error rate bins of %.0f%% width, columns: block sizes "
+	   "from %d bits\n   in factors of two. entries: k0, k1, probability "
+	   "of residual errors after\n   the two passes. comments: leakage "
+	   "including BICONF corrections\n   relative to the Shannon limit."
+	   " */\n\n",
+	   scantrials, residualtrials, QBER_STEP*100, SIZE_FIRST);
+    printf("struct cascade_param cascade_table[%d][%d] = {\n",
+	   QBER_BINS, SIZE_BINS);
+
+    for (qi=0;qi<QBER_BINS;qi++) {
+	q=(qi+1)*QBER_STEP;
+	h=-q*log(q)/log(2)-(1-q)*log(1-q)/log(2);
+	printf("    { /* QBER %.3f */\n", q);
+	for (si=0;si<SIZE_BINS;si++) {
+	    n=(int)((SIZE_FIRST<<si)*1.41421356); /* geometric bin center */
+	    nbits[si]=n;
+	    for (ci=0;ci<C_NUM;ci++) for (ri=0;ri<R_NUM;ri++) cost[ci][ri]=0;
+	    for (tr=0;tr<scantrials;tr++) {
+		new_pattern(bin_q(qi,tr,scantrials)); /* same for all pairs */
+		for (ci=0;ci<C_NUM;ci++) for (ri=0;ri<R_NUM;ri++) {
+		    kk=scan_k1(scan_k0(q,ci),ri);
+		    cost[ci][ri]+=run_block(scan_k0(q,ci),kk,&res);
+		    cost[ci][ri]+=res*residual_cost(kk);
+		}
+	    }
+	    best_cost=1E30;
+	    for (ci=0;ci<C_NUM;ci++) for (ri=0;ri<R_NUM;ri++)
+		if (cost[ci][ri]<best_cost) {
+		    best_cost=cost[ci][ri];
+		    k0[si]=scan_k0(q,ci); k1[si]=scan_k1(k0[si],ri);
+		}
+	}
+	/* k0 does not grow with the block size */
+	for (si=1;si<SIZE_BINS;si++) if (k0[si]>k0[si-1]) {
+	    k0[si]=k0[si-1]; k1[si]=k1[si-1];
+	}
+	for (si=0;si<SIZE_BINS;si++) {
+	    /* residual error probability at the optimum */
+	    n=nbits[si]; failed=0; leaksum=0;
+	    for (tr=0;tr<residualtrials;tr++) {
+		new_pattern(bin_q(qi,tr,residualtrials));
+		leaksum+=run_block(k0[si],k1[si],&res);
+		leaksum+=res*residual_cost(k1[si]);
+		if (res) failed++;
+	    }
+	    printf("\t{%4d, %5d, %.3e}%s /* %5d bits: %.3f */\n",
+		   k0[si], k1[si],
+		   failed?(float)failed/residualtrials:0.5/residualtrials,
+		   (si<SIZE_BINS-1)?",":" ", n, leaksum/residualtrials/n/h);
+	}
+	printf("    }%s\n",(qi<QBER_BINS-1)?",":"");
+    }
+    printf("};\n");
+    return 0;
+}
@@ -45,7 +45,7 @@ usage:
 	-l notificationpipe
 	-q responsepipe -Q querypipe
 	[ -e errormargin ]
-	[ -E expectederror ]
+	[ -E expectederror ] [ -S statname ]
 	[ -k ]
 	[ -J basicerror ]
 	[ -T errorbehaviour ]
@@ -54,6 +54,16 @@ usage:
 	[ -i ]
 	[ -p ]
 	[ -B BER | -b rounds ]
+	[ -A ]
+	[ -m passes ]
+	[ -R rawstreampipe [ -N targetbits ] ]
+	[ -t tracefile ]
+	[ -C profile ]
+
+  or, for replaying a recorded trace:
+
+  errcd -P tracefile -f finalkeydirectory -l notificationpipe
+        [ -V verbosity ]
 
 options/parameters:
 
@@ -69,7 +79,10 @@ options/parameters:
 			other side. Could be replaced by sockets later.
   -r receivepipe:       same as sendpipe, but for incoming packets.
   -d rawkeydirectory:   directory which contains epoch files for raw keys in
-                        stream-3 format
+                        stream-3 format. If the name is of the form log:dir,
+			the raw keys are taken from the epoch segment log in
+			dir written by splicer, and the -k option retires
+			log segments which only contain processed epochs.
   -f finalkeydirectory: Directory which contains the final key files.
   -l notificationpipe:  whenever a final key block is processed, its epoch name
                         is written into this pipe or file. The content of the
@@ -78,6 +91,48 @@ options/parameters:
                         block, requests may be sent into this pipe. Syntax TBD.
   -q respondpipe:       Answers to requests will be written into this pipe or
                         file.
+  -R rawstreampipe:     stream intake mode. Instead of reading stream-3 raw
+                        key files from the rawkeydirectory, type-3 packets
+			are read directly from this pipe (e.g. the -o output
+			of splicer or costream) and kept in memory until they
+			are used in a block. The -d option is not needed in
+			this mode. A new block from the other side whose raw
+			key has not arrived yet is held back, while the
+			packets of other blocks are served; if the raw key
+			is still incomplete after 20 seconds, the packet is
+			dropped with an error message.
+  -N targetbits:        automatic block formation in stream intake mode.
+                        Consecutive epochs arriving in the raw key stream are
+			collected until at least targetbits raw key bits are
+			present, and then a block is started as if a command
+			had been received. This side takes the role of Alice;
+			the other side should run with -R only. Blocks are
+			restarted on gaps in the epoch sequence and never
+			exceed the thread limit of 2^16 bits.
+
+ TRACE RECORDING / REPLAY:
+
+  -t tracefile:         records a binary trace of this instance into
+                        tracefile. The trace starts with a header containing
+			the control parameters, followed by records of
+			commands, incoming and outgoing packets, seeds taken
+			from the random source (with the block epoch) and raw
+			key read in, each with a timestamp. See the trace_head
+			and trace_record structures below for the format.
+  -P tracefile:         replay mode. Drives this instance from a recorded
+                        trace at full speed without a peer: commands, raw key
+			and incoming packets are taken from the trace in their
+			original order, seeds are re-used, and outgoing
+			packets are compared with the recorded ones instead
+			of being sent. Control parameters are taken from the
+			trace header. Final keys and notifications are written
+			as usual. At the end, the number of mismatching
+			outgoing packets and the original and replay
+			processing times are reported on stdout. Traces of
+			older format versions are accepted; fields and
+			records they lack take their defaults (no table
+			parameters, two Cascade passes, no -S statistics, a
+			perfect Bell value).
 
  CONTROL OPTIONS:
  
@@ -92,6 +147,18 @@ options/parameters:
                         length of the first test. Default is 0.05. This may
 			be overridden by a servoed quantity or by an explicit
 			statement in a command.
+  -S statname:          take the accidental coincidences into the expected
+                        error. costream -P statname publishes its
+			statistics in shared memory (see epochstat.c in
+			remotecrypto). For a block without an explicit error
+			in the command, and for automatic blocks, the
+			expected error is the -E value plus half the fraction
+			of accidentals among the coincidences of the epochs
+			published since the previous block, with one standard
+			error of the accidentals on top. Until costream has
+			published some epochs, the -E value is used. The
+			values are recorded in a trace and taken from it on
+			replay.
   -k                    killfile option. If set, the raw key files will be
                         deleted after writing the final key into a file.
   -J basicerror:        Error rate which is assumed to be generated outside the
@@ -119,7 +186,14 @@ options/parameters:
   -i                    deviceindependent option. If this option is set,
                         the deamon expects to receive a value for the Bell
 			violation parameter to estimate the knowledge of an 
-			eavesdropper.
+			eavesdropper. If the command has no Bell value, it
+			is taken from the page of -S: costream -P (protocol
+			3) or splicer -P (protocols 3 and 4) count the Bell
+			test events of every epoch, and the CHSH value of
+			the events since the previous block, less one
+			standard error, is used. Until test events have
+			been published, or without -S, a perfect Bell value
+			of 2 sqrt(2) is assumed.
   -p                    avoid privacy amplification. For debugging purposes, to
                         find the residual error rate
   -B BER:               choose the number of BICONF rounds to meet a final
@@ -127,6 +201,34 @@ options/parameters:
 			error rate of 10^-4 after the first two rounds.
   -b rounds:            choose the number of BICONF rounds. Defaults to 10,
                         corresponding to a BER of 10^-7.
+  -A:                   adaptive Cascade parameters. The block lengths k0
+                        and k1 are taken from a table generated offline by
+			simulation (cascade_table.h, see cascade_tablegen.c)
+			for the measured error rate and block size, instead
+			of the fixed k0=0.92/QBER, k1=3k0 rule. The number
+			of BICONF rounds is chosen per block from the
+			simulated probability p that errors are left after
+			the two passes: the rounds set with -B or -b, less
+			the -log2(p) rounds which p accounts for (one or
+			two). The side doing the
+			permutation sends k0 and k1 with its parity lists,
+			and the other side follows these values.
+  -m passes:            number of Cascade passes (2 to 8). With this option,
+                        every pass uses its own permutation, and the binary
+			searches of all passes with a parity mismatch are
+			carried out together in the same message rounds.
+			Errors found are corrected in all passes before the
+			parities are compared again, until no pass shows a
+			mismatch. Passes beyond the second double the block
+			length of the previous one, up to half the bits of
+			the key block. Without this option, the
+			classic two passes are used alternately. Only the
+			side doing the permutation needs this option.
+  -C profile:           run on the cores and NUMA node given in profile, of
+                        the form cpus[:node[:h]] (see cpupin.c in
+			remotecrypto), like the other programs of the chain.
+			The key blocks are small enough for the heap, so h
+			has no effect here.
 
 
 History: first specs 17.9.05chk
@@ -173,14 +275,21 @@ open questions / issues:
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <math.h>
+#include <time.h>
 
 /* definitions of packet headers */
 #include "errcorrect.h" 
 #include "rnd.h"
+#include "epochlog.h"
+#include "epochstat.h"
+#include "chsh.h"
+#include "cpupin.h"
 
 
 /* #define SYSTPERMUTATION */  /* for systematic rather than rand permut */
@@ -258,20 +367,36 @@ typedef struct keyblock {
     int finalerrors; /* number of discovered errors */
     int RNG_usage; /* defines mode of randomness. 0: PRNG, 1: good stuff */
     unsigned int RNG_state; /* keeps the state of the PRNG for this thread */
-    int k0, k1; /* binary block search lengths */
+    int passes; /* number of Cascade passes */
+    int k[MAX_CASCADE_PASSES]; /* binary block search lengths */
     int workbits; /* bits to work with for BICONF/parity check */
-    int partitions0, partitions1; /* number of partitions of k0,k1 length */
-    unsigned int *lp0, *lp1; /* pointer to local parity info 0 / 1 */
-    unsigned int *rp0, *rp1; /* pointer to remote parity info 0 / 1 */
-    unsigned int *pd0, *pd1; /* pointer to parity difference fileld */
+    int partitions[MAX_CASCADE_PASSES]; /* number of partitions of length k */
+    unsigned int *paritymem; /* buffer root for parity lists */
+    unsigned int *lp[MAX_CASCADE_PASSES]; /* pointer to local parity info */
+    unsigned int *rp[MAX_CASCADE_PASSES]; /* pointer to remote parity info */
+    unsigned int *pd[MAX_CASCADE_PASSES]; /* pointer to parity differences */
+    unsigned int *passbuf[MAX_CASCADE_PASSES]; /* key in order of a pass;
+						 0: mainbuf, 1: permutebuf */
+    unsigned short int *passindex[MAX_CASCADE_PASSES]; /* permutation of a
+							 pass from mainbuf */
+    unsigned short int *passreverse[MAX_CASCADE_PASSES]; /* ..and reverse */
+    unsigned int *extramem; /* buffer root for passes beyond the second */
+    unsigned int *searchmark; /* bits covered in a multipass search round */
+    int multipass; /* 1 if searches of all passes share message rounds */
+    int search_k; /* largest block length in a multipass search round */
     int diffnumber;  /* number of different blocks in current round */
     int diffnumber_max; /* number of malloced entries for diff indices */
     unsigned int *diffidx; /* pointer to a list of parity mismatch blocks */
     unsigned int *diffidxe; /* end of interval */
+    unsigned int *diffpass; /* pass of an interval in multipass rounds */
+    unsigned int *corrpos; /* corrected bits (mainbuf order) in multipass */
+    int corrnumber; /* number of entries in corrpos */
     int binsearch_depth; /* encodes state of the scan. Starts with 0,
 			    and contains the pass (0/1) in the MSB */
     int biconf_round; /* contains the biconf round number, starting with 0 */
     int biconflength; /* current length of a biconf check range */
+    int biconfparity; /* parity of the full biconf test bit string */
+    int biconf_rounds; /* number of BICONF rounds for this block */
     int correctederrors; /* number of corrected bits */
     int finalkeybits; /* how much is left */
     float BellValue; /* for Ekert-type protocols */
@@ -299,6 +424,9 @@ struct blockpointer *blocklist=NULL;
 
 /* forward decl */
 void dumpmsg(struct keyblock *kb, char *msg);
+int start_multipass_round(struct keyblock *kb);
+int single_line_parity(unsigned int *d, int start, int end);
+int finish_cascade(struct keyblock *kb);
 
 
 /* -------------------------------------------------------------------- */
@@ -316,6 +444,7 @@ typedef struct packet_received {
     int length; /* in bytes */
     char *packet; /* pointer to content */
     struct packet_received *next; /* next in chain */
+    time_t waitstart; /* stream intake: waiting for raw key since, or 0 */
 } pack_r;
 /* head node pointing to a simply joined list of entries */
 struct packet_received *rec_packetlist=NULL;
@@ -403,7 +532,32 @@ char *errormessage[] = {
   "biconf round number exceeds bounds of 1...100",
   "cannot parse final BER argument",
   "BER argument out of range",
-
+  "Error reading name for raw key stream pipe.", /* 80 */
+  "Cannot stat/open raw key stream pipe",
+  "raw key stream pipe is not a pipe",
+  "Error parsing target bit number for automatic blocks",
+  "target bit number out of range (1024...65535)",
+  "error reading raw key stream", /* 85 */
+  "wrong packet type in raw key stream",
+  "cannot malloc raw key stream buffer",
+  "automatic block formation (-N) needs stream intake (-R)",
+  "raw key epoch not found in stream memory",
+  "Error reading trace file name.", /* 90 */
+  "cannot open trace file",
+  "cannot write trace file",
+  "trace file has wrong header",
+  "trace out of sync with replay",
+  "error reading trace file", /* 95 */
+  "cannot malloc trace buffer",
+  "cannot malloc buffers for additional Cascade passes",
+  "illegal number of Cascade passes (2...8)",
+  "Error parsing number of Cascade passes",
+  "illegal pass number in multi-pass binary search", /* 100 */
+  "cannot open raw key epoch log",
+  "cannot parse statistics page name (option -S)",
+  "cannot parse cpu profile. needs -C cpus[:node[:h]]",
+  "cannot apply cpu profile (option -C)", /* 104 */
+  "raw key for a new block did not arrive in time; packet dropped",
 };
 
 int emsg(int code) {
@@ -446,6 +600,22 @@ int emsg(int code) {
 				    for block lengths between 5k-40k */
 #define DEFAULT_ERR_SKIPMODE 0 /* initial error estimation is done */
 #define CMD_INBUFLEN 200
+#define MIN_AUTOBLOCK_BITS 1024 /* smallest target for automatic blocks */
+#define MAX_STREAMED_EPOCHS 1024 /* raw key epochs kept in stream memory */
+#define RAWSTREAM_MAXWAIT 20 /* seconds to wait for streamed raw key */
+
+/* adaptive Cascade parameters, see cascade_tablegen.c. The grid has to
+   match the definitions there. */
+#define CASCADE_TABLE_QBINS 14  /* error rate bins, centers from 1% */
+#define CASCADE_TABLE_QSTEP 0.01  /* width of an error rate bin */
+#define CASCADE_TABLE_SIZEBINS 4  /* block size bins in factors of two, the
+				     last one up to MAXBITSPERTHREAD */
+#define CASCADE_TABLE_FIRSTSIZE 4096 /* lower edge of first size bin */
+struct cascade_param {
+    int k0, k1; /* block lengths of the two passes */
+    float residual; /* probability of residual errors after two passes */
+};
+#include "cascade_table.h"
 
 /* helpers */
 #define MAX(A,B) ((A) > (B)? (A) : (B) )
@@ -470,13 +640,118 @@ __inline__ unsigned int bt_mask(int i) {
     return 1<<(31-(i&31));
 }
 
+/* ------------------------------------------------------------------------- */
+/* trace file definitions for recording and replaying the message exchange.
+   A trace consists of one trace_head, followed by records with a trace_record
+   header and length bytes of content each. */
+typedef struct trace_head {
+    unsigned int tag; /* always ECD2_TRACE_TAG */
+    unsigned int version;
+    float errormargin, initialerr, intrinsicerr;
+    int runtimeerrormode, biconf_rounds, ini_err_skipmode;
+    int disable_privacyamplification, bellmode;
+    int rawstreammode, autoblock_bits;
+    int adaptivemode, cascade_passes;
+    int statmode;
+} trh__;
+#define ECD2_TRACE_TAG 0x65637472
+#define ECD2_TRACE_VERSION 5
+/* the head grew with the versions: 1 ends before adaptivemode, 2 before
+   cascade_passes, 3 before statmode. Version 4 has one float in a
+   TRACE_PRIOR record, without the Bell value. */
+#define TRACE_HEADFIX (2*sizeof(unsigned int)) /* tag and version */
+
+typedef struct trace_record {
+    unsigned int type; /* record type, see below */
+    unsigned int length; /* bytes of content following this header */
+    unsigned int epoch; /* block epoch or 0 if not applicable */
+    unsigned int sec, usec; /* time of recording */
+} trr__;
+#define TRACE_CMD 1 /* command line; content is the 0-terminated string */
+#define TRACE_IN 2 /* packet processed; content is the packet */
+#define TRACE_OUT 3 /* packet generated for sending; content is packet */
+#define TRACE_SEED 4 /* seed from random source; content is the seed */
+#define TRACE_RAWKEY 5 /* raw key read from file; content is header+data */
+#define TRACE_RAWSTREAM 6 /* raw key from stream; content is header+data */
+#define TRACE_PRIOR 7 /* expected error and Bell value from -S; content
+			 are the two floats */
+
+int tracemode = 0; /* 0: off, 1: record trace, 2: replay trace */
+FILE *tracehandle = NULL;
+char tracefname[FNAMELENGTH]="";
+int trace_records = 0, trace_mismatches = 0; /* for replay statistics */
+unsigned int trace_version = ECD2_TRACE_VERSION; /* of the replayed trace */
+
+/* size of the trace head for a given format version */
+int trace_headsize(unsigned int version) {
+    switch (version) {
+	case 1: return offsetof(struct trace_head, adaptivemode);
+	case 2: return offsetof(struct trace_head, cascade_passes);
+	case 3: return offsetof(struct trace_head, statmode);
+    }
+    return sizeof(struct trace_head);
+}
+
+/* helper to write a trace record. Parameters are the record type, the epoch,
+   a pointer to the content and its length, and an optional second content
+   part and its length. returns 0 or an error code */
+int trace_write(unsigned int type, unsigned int epoch,
+		void *content, int length, void *content2, int length2) {
+    struct trace_record tr;
+    struct timeval now;
+    gettimeofday(&now,NULL);
+    tr.type=type; tr.length=length+length2; tr.epoch=epoch;
+    tr.sec=now.tv_sec; tr.usec=now.tv_usec;
+    if (1!=fwrite(&tr,sizeof(struct trace_record),1,tracehandle)) return 92;
+    if (length && (1!=fwrite(content,length,1,tracehandle))) return 92;
+    if (length2 && (1!=fwrite(content2,length2,1,tracehandle))) return 92;
+    if (fflush(tracehandle)) return 92;
+    return 0;
+}
+
+/* helper to read the next trace record. Parameters are a pointer to a record
+   header to be filled, and a pointer to a content pointer which receives a
+   malloced buffer (or NULL for empty content). returns 0 on success, -1 at
+   the end of the trace or an error code. */
+int trace_read(struct trace_record *tr, char **content) {
+    *content=NULL;
+    if (1!=fread(tr,sizeof(struct trace_record),1,tracehandle))
+	return feof(tracehandle)?-1:95;
+    trace_records++;
+    if (!tr->length) return 0;
+    if (!(*content=(char *)malloc2(tr->length))) return 96;
+    if (1!=fread(*content,tr->length,1,tracehandle)) {
+	free2(*content); *content=NULL;
+	return 95;
+    }
+    return 0;
+}
+
 /* helper to insert a send packet in the sendpacket queue. Parameters are
    a pointer to the structure and its length. Return value is 0 on success
-   or !=0 on malloc failure */
+   or !=0 on malloc failure. A failed trace record is reported, but the
+   packet is still sent. */
 int pidx=0;
 int insert_sendpacket(char *message, int length) {
     struct packet_to_send *newpacket, *lp;
+    struct trace_record tr; /* for comparing replayed packets */
+    char *recorded;
     pidx++;
+
+    switch (tracemode) {
+	case 1: /* record outgoing packet */
+	    if (trace_write(TRACE_OUT, ((unsigned int *)message)[3],
+			    message, length, NULL, 0)) emsg(92);
+	    break;
+	case 2: /* compare with recorded packet instead of sending */
+	    if (trace_read(&tr, &recorded) || (tr.type!=TRACE_OUT) ||
+		(tr.length!=length) || memcmp(recorded, message, length)) {
+		trace_mismatches++;
+	    }
+	    if (recorded) free2(recorded);
+	    free2(message);
+	    return 0;
+    }
     newpacket = (struct packet_to_send *)malloc2(sizeof(struct packet_to_send));
     if (!newpacket) return 43;
 
@@ -489,16 +764,13 @@ int insert_sendpacket(char *message, int length) {
     last_packet_to_send = newpacket;
     if (!next_packet_to_send) next_packet_to_send=newpacket;
 
-    /* for debug: send message, take identity from first available slot */
-    /*dumpmsg(blocklist->content, message); */
-
     return 0; /* success */
 }
 
 /* global parameters and variables */
-char fname[8][FNAMELENGTH]={"","","","","","","",""}; /* filenames */
-int handle[8]; /* handles for files accessed by raw I/O */
-FILE* fhandle[8]; /* handles for files accessed by buffered I/O */
+char fname[9][FNAMELENGTH]={"","","","","","","","",""}; /* filenames */
+int handle[9]; /* handles for files accessed by raw I/O */
+FILE* fhandle[9]; /* handles for files accessed by buffered I/O */
 float errormargin=DEFAULT_ERR_MARGIN;
 float initialerr=DEFAULT_INIERR;  /* What error to assume initially */
 int killmode=DEFAULT_KILLMODE; /* decides on removal of raw key files */
@@ -507,9 +779,22 @@ int runtimeerrormode=DEFAULT_RUNTIMEERRORMODE;
 int verbosity_level=DEFAULT_VERBOSITY;
 int biconf_length = DEFAULT_BICONF_LENGTH; /* how long is a biconf */
 int biconf_rounds = DEFAULT_BICONF_ROUNDS; /* how many times */
+int adaptivemode = 0; /* 1: take Cascade parameters from table */
+int cascade_passes = 0; /* 0: classic two passes, else shared rounds */
 int ini_err_skipmode = DEFAULT_ERR_SKIPMODE; /* 1 if error est to be skipped */
 int disable_privacyamplification = 0; /* off normally, != 0 for debugging */
+int statmode = 0; /* 1: expected error with accidentals from costream */
+char statname[FNAMELENGTH]=""; /* statistics page of costream */
+struct epochstat statpage;
+int statattached = 0; /* if statpage is mapped */
+struct epochstat_page statlast; /* totals at the previous block */
+float statprior = -1.; /* expected error from the page, <0 if none yet */
+float statbell = -1.; /* Bell value from the page, <0 if none yet */
 int bellmode = 0; /* 0: use estimated error, 1: use supplied bell value */
+int rawstreammode = 0; /* 0: raw key from files, 1: from raw key stream */
+int rawlogmode = 0; /* 1: raw key files are taken from an epoch log */
+struct epochlog rawlog; /* raw key epoch log if rawlogmode is set */
+int autoblock_bits = 0; /* target bits for automatic blocks, 0: off */
 
 /* ------------------------------------------------------------------------- */
 /* code to check if a requested bunch of epochs already exists in the thread
@@ -537,6 +822,151 @@ void atohex(char* target,unsigned int v) {
     for (i=1;i<9;i++) target[i]=hexdigits[(v>>(32-i*4)) & 15];
     target[9]=0;
 }
+/* ------------------------------------------------------------------------- */
+/* in-memory store for raw key epochs received via the raw key stream. Entries
+   are kept in arrival order until they are used in a thread. */
+typedef struct rawkey_epoch {
+    unsigned int epoch;
+    int length; /* number of raw key bits */
+    unsigned int *data; /* packed bits, msb first; follows this structure */
+    struct rawkey_epoch *next;
+} rke__;
+struct rawkey_epoch *rawkeylist=NULL; /* oldest entry */
+struct rawkey_epoch *last_rawkey=NULL; /* newest entry */
+int rawkey_epochs_held = 0;
+/* epochs collected for the next automatic block */
+unsigned int acc_startepoch;
+int acc_epochs = 0, acc_bits = 0;
+
+/* helper to find a streamed epoch and unlink it from the store. Returns a
+   pointer to the entry (to be freed by the caller) or NULL if not there. */
+struct rawkey_epoch *take_rawkey_epoch(unsigned int epoch) {
+    struct rawkey_epoch *rp = rawkeylist, *prev = NULL;
+    while (rp) {
+	if (rp->epoch==epoch) break;
+	prev=rp; rp=rp->next;
+    }
+    if (!rp) return NULL;
+    if (prev) {prev->next=rp->next;} else {rawkeylist=rp->next;}
+    if (last_rawkey==rp) last_rawkey=prev;
+    rawkey_epochs_held--;
+    return rp;
+}
+
+/* helper to check if a series of epochs is completely present in the raw key
+   store. returns 1 if all are there, otherwise 0. */
+int rawkey_available(unsigned int epoch, int num) {
+    struct rawkey_epoch *rp;
+    int i;
+    for (i=0;i<num;i++) {
+	for (rp=rawkeylist;rp;rp=rp->next) if (rp->epoch==epoch+i) break;
+	if (!rp) return 0;
+    }
+    return 1;
+}
+
+/* helper to obtain the raw key of one epoch, either from a stream-3 file in
+   the raw key directory or from the raw key stream store. Parameters are
+   the epoch, a header to be filled, the target buffer and the number of bits
+   already in the thread. Returns 0 on success or an error code. */
+int get_rawkey_epoch(unsigned int epi, struct header_3 *h3,
+		     unsigned int *target, int bitcount) {
+    char ffnam[FNAMELENGTH+10]; /* to store filename */
+    struct rawkey_epoch *rp;
+    int i, retval;
+    struct trace_record tr; /* for replay */
+    char *recorded;
+    char *logpacket; /* raw key packet in the epoch log */
+    int loglen;
+
+    if ((tracemode==2) && !rawstreammode) { /* take it from the trace */
+	if (trace_read(&tr, &recorded) || (tr.type!=TRACE_RAWKEY) ||
+	    (tr.epoch!=epi) || (tr.length<sizeof(struct header_3))) {
+	    if (recorded) free2(recorded);
+	    return 94;
+	}
+	*h3=((struct header_3 *)recorded)[0];
+	if (bitcount+h3->length>=MAXBITSPERTHREAD) {
+	    free2(recorded);
+	    return 71;  /* not enough space */
+	}
+	memcpy(target, &recorded[sizeof(struct header_3)],
+	       tr.length-sizeof(struct header_3));
+	free2(recorded);
+	return 0;
+    }
+
+    if (rawstreammode) { /* take it from memory */
+	if (!(rp=take_rawkey_epoch(epi))) {
+	    fprintf(stderr,"epoch %08x: ",epi);
+	    return 89;
+	}
+	if (bitcount+rp->length>=MAXBITSPERTHREAD) {
+	    free2(rp);
+	    return 71;  /* not enough space */
+	}
+	h3->tag=TYPE_3_TAG; h3->epoc=epi; h3->length=rp->length;
+	h3->bitsperentry=1;
+	memcpy(target,rp->data,((rp->length+31)/32)*sizeof(unsigned int));
+	free2(rp);
+	return 0;
+    }
+
+    if (rawlogmode) { /* packet is mapped from the epoch log */
+	if (epochlog_read(&rawlog,3,epi,&logpacket,&loglen,0,0)) {
+	    fprintf(stderr,"epoch %08x not in raw key log\n",epi);
+	    return 67;
+	}
+	if (loglen<sizeof(struct header_3)) return 68;
+	*h3=((struct header_3 *)logpacket)[0];
+    } else {
+	strncpy(ffnam, fname[3], FNAMELENGTH);
+	atohex(&ffnam[strlen(ffnam)],epi);
+	handle[3]=open(ffnam,FILEINMODE); /* in blocking mode */
+	if(-1==handle[3]) {
+	    fprintf(stderr,"cannot open file >%s< errno: %d\n",ffnam,errno);
+	    return 67; /* error opening file */
+	}
+	/* read in file 3 header */
+	if (sizeof(struct header_3)!=(i=read(handle[3],h3,
+					      sizeof(struct header_3)))) {
+	    fprintf(stderr,"error in read: return val:%d errno: %d\n",i,errno);
+	    return 68;
+	}
+    }
+    if (h3->epoc !=epi) {
+	fprintf(stderr,"incorrect epoch; want: %08x have: %08x\n",
+		epi,h3->epoc);
+	return 69; /* not correct epoch */
+    }
+
+    if (h3->bitsperentry !=1 )  return 70; /* not a BB84 raw key */
+    if (bitcount+h3->length>=MAXBITSPERTHREAD)
+	return 71;  /* not enough space */
+
+    i=(h3->length/32)+((h3->length&0x1f)?1:0); /* number of words to read */
+    if (rawlogmode) {
+	if (loglen<sizeof(struct header_3)+i*sizeof(unsigned int))
+	    return 72; /* packet too short */
+	memcpy(target,&logpacket[sizeof(struct header_3)],
+	       i*sizeof(unsigned int));
+	/* retire log segments which only hold older epochs */
+	if (killmode && epochlog_drop(&rawlog,epi)) return 66;
+    } else {
+	retval=read(handle[3],target,i*sizeof(unsigned int));
+	if (retval!=i*sizeof(unsigned int)) return 72; /* not enough read */
+
+	/* close and possibly remove file */
+	close(handle[3]);
+	if (killmode) {retval = unlink(ffnam); if (retval) return 66;}
+    }
+
+    if (tracemode==1)
+	return trace_write(TRACE_RAWKEY, epi, h3, sizeof(struct header_3),
+			   target, i*sizeof(unsigned int));
+    return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 /* code to prepare a new thread from a series of raw key files. Takes epoch,
    number of epochs and an initially estimated error as parameters. Returns
@@ -550,7 +980,6 @@ int create_thread(unsigned int epoch, int num, float inierr, float BellValue) {
     unsigned int epi; /* epoch index */
     unsigned int enu;
     int retval,i,bitcount;
-    char ffnam[FNAMELENGTH+10]; /* to store filename */
     struct blockpointer*bp; /* to hold new thread */
     int getbytes; /* how much memory to ask for */
     unsigned int *rawmem; /* to store raw key */
@@ -559,35 +988,10 @@ int create_thread(unsigned int epoch, int num, float inierr, float BellValue) {
     newindex=0;resbitnumber=0;residue=0;bitcount=0;
     for (enu=0;enu<num;enu++) {
 	epi=epoch+enu; /* current epoch index */
-	strncpy(ffnam, fname[3], FNAMELENGTH);
-	atohex(&ffnam[strlen(ffnam)],epi);
-	handle[3]=open(ffnam,FILEINMODE); /* in blocking mode */
-	if(-1==handle[3]) {
-	    fprintf(stderr,"cannot open file >%s< errno: %d\n",ffnam,errno);
-	    return 67; /* error opening file */
-	}
-	/* read in file 3 header */
-	if (sizeof(h3)!=(i=read(handle[3],&h3,sizeof(h3)))) {
-	    fprintf(stderr,"error in read: return val:%d errno: %d\n",i,errno);    
-	    return 68;
-	}
-	if (h3.epoc !=epi) {
-	    fprintf(stderr,"incorrect epoch; want: %08x have: %08x\n",
-		    epi,h3.epoc);	    	    
-	    return 69; /* not correct epoch */
-	}
-	
-	if (h3.bitsperentry !=1 )  return 70; /* not a BB84 raw key */
-	if (bitcount+h3.length>=MAXBITSPERTHREAD)
-	    return 71;  /* not enough space */
-	
-	i=(h3.length/32)+((h3.length&0x1f)?1:0); /* number of words to read */
-	retval=	read(handle[3],&temparray[newindex],i*sizeof(unsigned int));
-	if (retval!=i*sizeof(unsigned int)) return 72; /* not enough read */
-    
-	/* close and possibly remove file */
-	close(handle[3]);
-	if (killmode) {retval = unlink(ffnam); if (retval) return 66;}
+	/* get raw key of this epoch from file or stream memory */
+	retval=get_rawkey_epoch(epi, &h3, &temparray[newindex], bitcount);
+	if (retval) return retval;
+	i=(h3.length/32)+((h3.length&0x1f)?1:0); /* number of words read */
 
 	/* residue update */
 	tmp=temparray[newindex+i-1] & ((~1)<<(31-(h3.length & 0x1f)));
@@ -648,6 +1052,7 @@ int create_thread(unsigned int epoch, int num, float inierr, float BellValue) {
     bp->content->processingstate=PRS_JUSTLOADED; /* just read in */
     bp->content->initialerror=(int)(inierr*(1<<16));
     bp->content->BellValue=BellValue;
+    bp->content->biconf_rounds=biconf_rounds;
     /* insert thread in thread list */
     bp->epoch=epoch;
     bp->previous=NULL;bp->next=blocklist;
@@ -682,7 +1087,8 @@ int remove_thread(unsigned int epoch) {
     if (!bp) return 49; /* no block there */
     /* remove all internal structures */
     free2(bp->content->rawmem); /* bit buffers, changed to rawmem 11.6.06chk */
-    if (bp->content->lp0) free (bp->content->lp0); /* parity storage */
+    if (bp->content->paritymem) free2(bp->content->paritymem); /* parities */
+    if (bp->content->extramem) free2(bp->content->extramem); /* passes>2 */
     if (bp->content->diffidx) free2(bp->content->diffidx);
     free2(bp->content); /* main thread frame */
     
@@ -781,6 +1187,148 @@ unsigned int get_r_seed(void) {
     return reply;
 }
 
+/* helper to find the entry in the Cascade parameter table for a given error
+   rate and block size */
+struct cascade_param *cascade_lookup(float localerror, int bits) {
+    int qi, si;
+    qi = (int)(localerror/CASCADE_TABLE_QSTEP+0.5)-1; /* nearest center */
+    if (qi<0) qi=0;
+    if (qi>=CASCADE_TABLE_QBINS) qi=CASCADE_TABLE_QBINS-1;
+    for (si=0; (si<CASCADE_TABLE_SIZEBINS-1) &&
+	     (bits >= (CASCADE_TABLE_FIRSTSIZE<<(si+1))); si++);
+    return &cascade_table[qi][si];
+}
+
+/* helper to set the number of passes, their block lengths and the number of
+   BICONF rounds for a keyblock. Parameters are the keyblock and the error
+   rate. Uses either the fixed rule or the table in adaptive mode. The fixed
+   rule runs the -b or -B rounds as if the block still had errors after the
+   two passes, each round halving the chance that one goes undetected. With
+   the table, the rounds which the simulated probability of residual errors
+   already accounts for are left out, for the same final probability. */
+void choose_blocklengths(struct keyblock *kb, float localerror) {
+    struct cascade_param *cp;
+    int r;
+    kb->passes = cascade_passes?cascade_passes:2;
+    kb->multipass = cascade_passes?1:0;
+    if (!adaptivemode) {
+	if (localerror <0.01444) { kb->k[0] = 64; /* min bitnumber */
+	} else { kb->k[0] = (int) (0.92419642 / localerror); }
+	kb->k[1] = 3*kb->k[0]; /* block length second array */
+	kb->biconf_rounds = biconf_rounds;
+    } else {
+	cp = cascade_lookup(localerror, kb->initialbits);
+	kb->k[0] = cp->k0; kb->k[1] = cp->k1;
+	/* target: 2^-biconf_rounds */
+	r = (int)ceil(log(cp->residual)/log(2.)+biconf_rounds);
+	if (r<1) r=1;
+	if (r>MAX_BICONF_ROUNDS) r=MAX_BICONF_ROUNDS;
+	kb->biconf_rounds = r;
+    }
+    /* further passes double the block length */
+    for (r=2;r<kb->passes;r++) kb->k[r]=2*kb->k[r-1];
+}
+
+/* helper to get a new seed for a block. Uses the random device, and records
+   the seed in the trace, or takes it from the trace in replay mode. Parameter
+   is the keyblock, returns the seed or 0 on error */
+unsigned int get_block_seed(struct keyblock *kb) {
+    struct trace_record tr;
+    char *recorded;
+    unsigned int seed;
+
+    if (tracemode==2) { /* take seed from trace */
+	if (trace_read(&tr, &recorded) || (tr.type!=TRACE_SEED) ||
+	    (tr.epoch!=kb->startepoch) || (tr.length!=sizeof(unsigned int))) {
+	    if (recorded) free2(recorded);
+	    fprintf(stderr,"no seed in trace for epoch %08x\n",
+		    kb->startepoch);
+	    return 0;
+	}
+	seed=((unsigned int *)recorded)[0];
+	free2(recorded);
+	return seed;
+    }
+    seed=get_r_seed();
+    if ((tracemode==1) &&
+	trace_write(TRACE_SEED, kb->startepoch, &seed, sizeof(seed), NULL, 0))
+	emsg(92);
+    return seed;
+}
+
+/* helper for the error rate expected in a new block without an explicit
+   one. With -S, accidental coincidences give a wrong bit in half of the
+   cases, so half their fraction among the coincidences costream published
+   since the previous block is added to the -E value, with one standard
+   error of the accidentals on top. With -i, the Bell value for the block
+   is the CHSH value of the test events published since the previous block,
+   less one standard error; it goes to *bell. Without -S or test events,
+   a perfect Bell value is assumed. The values are recorded in the trace,
+   or taken from it in replay mode. Parameter is the block epoch. */
+float expected_error(unsigned int epoch, float *bell) {
+    struct epochstat_page p;
+    struct trace_record tr;
+    char *recorded;
+    double acc, var, coinc, c[EPOCHSTAT_BELL], sv, serr;
+    float v[2];
+    int i;
+
+    *bell=2.*sqrt(2.); /* assume perfect Bell */
+    if (!statmode) return initialerr;
+    if (tracemode==2) { /* take values from trace */
+	if (trace_read(&tr, &recorded) || (tr.type!=TRACE_PRIOR) ||
+	    (tr.epoch!=epoch) || (tr.length!=((trace_version<5)?
+					      sizeof(float):sizeof(v)))) {
+	    if (recorded) free2(recorded);
+	    fprintf(stderr,"no expected error in trace for epoch %08x\n",
+		    epoch);
+	    return initialerr;
+	}
+	v[1]=*bell; /* version 4 has no Bell value */
+	memcpy(v,recorded,tr.length);
+	free2(recorded);
+	*bell=v[1];
+	return v[0];
+    }
+    if (!statattached && !epochstat_attach(&statpage,statname)) {
+	statattached=1;
+	memset(&statlast,0,sizeof(struct epochstat_page));
+    }
+    if (statattached) {
+	switch (epochstat_read(&statpage,&p)) {
+	    case EPOCHSTAT_OK:
+		acc=p.total[EPOCHSTAT_ACCIDENTAL]
+		    -statlast.total[EPOCHSTAT_ACCIDENTAL];
+		coinc=p.total[EPOCHSTAT_TRUE]-statlast.total[EPOCHSTAT_TRUE];
+		var=p.accvar-statlast.accvar;
+		if (coinc>0)
+		    statprior=initialerr+(acc+sqrt(var>0?var:0))/(2.*coinc);
+		for (i=0;i<EPOCHSTAT_BELL;i++)
+		    c[i]=p.belltotal[i]-statlast.belltotal[i];
+		if (!chsh_value(c,&sv,&serr)) {
+		    sv-=serr; /* within the quantum bound 2 sqrt(2) */
+		    statbell=(sv>0)?((sv<2.*sqrt(2.))?sv:2.*sqrt(2.)):0;
+		} else { /* too few test events; keep collecting them */
+		    memcpy(p.belltotal,statlast.belltotal,
+			   sizeof(p.belltotal));
+		}
+		statlast=p;
+		break;
+	    case EPOCHSTAT_CHANGED: /* costream restarted; attach next time */
+		epochstat_close(&statpage);
+		statattached=0;
+		break;
+	}
+    }
+    v[0]=(statprior<0)?initialerr:statprior;
+    if (v[0]>MAX_INI_ERR) v[0]=MAX_INI_ERR;
+    v[1]=(statbell<0 || !bellmode)?*bell:statbell;
+    if ((tracemode==1) &&
+	trace_write(TRACE_PRIOR, epoch, v, sizeof(v), NULL, 0)) emsg(92);
+    *bell=v[1];
+    return v[0];
+}
+
 /* ------------------------------------------------------------------------ */
 /* function to provide the number of bits needed in the initial error
    estimation; eats the local error (estimated or guessed) as a float. Uses
@@ -814,7 +1362,7 @@ int errorest_1(unsigned int epoch) {
     /* seed the rng, (the state has to be kept with the thread, use a lock
        system for the rng in case several ) */
     kb->RNG_usage = 0; /* use simple RNG */
-    if (!(kb->RNG_state = get_r_seed())) return 39; 
+    if (!(kb->RNG_state = get_block_seed(kb))) return 39; 
    
     /*  evaluate how many bits are needed in this round */
     f_inierr=kb->initialerror/65536.; /* float version */
@@ -990,9 +1538,7 @@ int process_esti_message_0(char *receivebuf) {
 	    kb->estimatedsamplesize = kb->leakagebits; /* is this needed? */
 	    /****** more to do here *************/
 	    /* calculate k0 and k1 for further uses */
-	    if (localerror <0.01444) { kb->k0 = 64; /* min bitnumber */
-	    } else { kb->k0 = (int) (0.92419642 / localerror); }
-	    kb->k1 = 3*kb->k0; /* block length second array */
+	    choose_blocklengths(kb, localerror);
 	    break;
     }
 
@@ -1049,9 +1595,25 @@ void output_permutation(struct keyblock *kb) {
 }
 
 /* -------------------------------------------------------------------------*/
+/* helper to transfer the bits of a source buffer into a destination buffer
+   according to a permutation index. Parameters are the source, destination,
+   index (destination position for each source bit) and number of bits. */
+void permute_bits(unsigned int *src, unsigned int *dst, unsigned short *idx,
+		  int workbits) {
+    int i,k;
+    bzero(dst, ((workbits+31)/32)*4); /* clear destination */
+    for (i=0;i<workbits;i++) {
+	k=idx[i]; /* permuted bit index */
+	if (bt_mask(i) & src[i/32]) dst[k/32] |= bt_mask(k);
+    }
+    return;
+}
+
 /* permutation core function; is used both for biconf and initial
-   permutation */
-void prepare_permut_core(struct keyblock *kb) {
+   permutation. Parameters are the keyblock, the permutation and reverse
+   index arrays to fill, and the target buffer for the permuted mainbuf. */
+void prepare_permut_core(struct keyblock *kb, unsigned short *permuteindex,
+			 unsigned short *reverseindex, unsigned int *dst) {
     int workbits;
     unsigned int rn_order;
     int i,j,k;
@@ -1063,31 +1625,28 @@ void prepare_permut_core(struct keyblock *kb) {
     /* this prepares a systematic permutation  - seems not to be better, but
        blocknumber must be coprime with 127 - larger primes? */
     for (i=0;i<workbits;i++) {
-	k=(127*i*kb->k0 + i*kb->k0/workbits)%workbits;
-	kb->permuteindex[k]=i;
-	kb->reverseindex[i]=k;
+	k=(127*i*kb->k[0] + i*kb->k[0]/workbits)%workbits;
+	permuteindex[k]=i;
+	reverseindex[i]=k;
     }
 #else 
     /* this is prepares a pseudorandom distribution */
-    for (i=0;i<workbits;i++) kb->permuteindex[i] = 0xffff; /* mark unused */
+    for (i=0;i<workbits;i++) permuteindex[i] = 0xffff; /* mark unused */
     /* this routine causes trouble */
     for (i=0;i<workbits;i++) { /* do permutation  */
 	do {  /* find a permutation index */
 	    j = PRNG_value2(rn_order,&kb->RNG_state);
 	} while ((j>=workbits) || 
-		 (kb->permuteindex[j]!=0xffff)); /* out of range */
+		 (permuteindex[j]!=0xffff)); /* out of range */
 	k=j; 
-	kb->permuteindex[k]=i;
-	kb->reverseindex[i]=k;
+	permuteindex[k]=i;
+	reverseindex[i]=k;
     }
  
 #endif
 
-    bzero(kb->permutebuf, ((workbits+31)/32)*4); /* clear permuted buffer */
-    for (i=0;i<workbits;i++) { /*  do bit permutation  */
-	k=kb->permuteindex[i]; 
-	if (bt_mask(i) & kb->mainbuf[i/32]) kb->permutebuf[k/32] |= bt_mask(k);
-    } 
+    /*  do bit permutation  */
+    permute_bits(kb->mainbuf, dst, permuteindex, workbits);
 
     /* for debug: output that stuff */
     /* output_permutation(kb); */
@@ -1141,9 +1700,12 @@ void cleanup_revealed_bits(struct keyblock *kb) {
 /* helper function to do generate the permutation array in the kb structure.
    does also re-ordering (in future), and truncates the discussed key to a
    length of multiples of k1so there are noleftover bits in the two passes.
-   Parameter: pointer to kb structure */
-void prepare_permutation(struct keyblock *kb) {
-    int workbits;
+   For more than two passes, the permutations of the additional passes are
+   taken from the same PRNG sequence, and the key length is a multiple of the
+   block length of the last pass.
+   Parameter: pointer to kb structure, returns 0 or an error code */
+int prepare_permutation(struct keyblock *kb) {
+    int workbits, kl, p, words, bufwords;
     unsigned int *tmpbuf;
 
     /* do bit compression */
@@ -1154,20 +1716,51 @@ void prepare_permutation(struct keyblock *kb) {
        also: take more care about the leakage_bits here */
     
     /* assume last k1 block is filled with good bits and zeros */
-    workbits = ((workbits/kb->k1)+1)*kb->k1;
+    kl = kb->k[1];
+    workbits = ((workbits/kl)+1)*kl;
     /* forget the last bits if it is larger than the buffer */
-    if (workbits > kb->initialbits) workbits -= kb->k1;
+    if (workbits > kb->initialbits) workbits -= kl;
 
     kb->workbits = workbits;
 
+    /* further passes double the block length, but keep at least two blocks
+       each. Their last block may reach beyond workbits into the zeros at
+       the end of their buffers. Both sides cap the same way. */
+    for (p=2;p<kb->passes;p++)
+	if (2*kb->k[p] > workbits) kb->k[p] = MAX(workbits/2, kb->k[p-1]);
+
     /* do first permutation - this is only the initial permutation */
-    prepare_permut_core(kb);
+    prepare_permut_core(kb, kb->permuteindex, kb->reverseindex,
+			kb->permutebuf);
     /* now the permutated buffer is renamed and the final permutation is
        performed */
     tmpbuf=kb->mainbuf; kb->mainbuf=kb->permutebuf; kb->permutebuf = tmpbuf;
     /* fo final permutation */
-    prepare_permut_core(kb);
-    return;
+    prepare_permut_core(kb, kb->permuteindex, kb->reverseindex,
+			kb->permutebuf);
+    kb->passbuf[0]=kb->mainbuf; kb->passbuf[1]=kb->permutebuf;
+    kb->passindex[1]=kb->permuteindex; kb->passreverse[1]=kb->reverseindex;
+
+    if (!kb->multipass) return 0;
+    /* further passes: buffer and two indices each, plus the search marker.
+       The buffers have room for a last block of up to workbits/2 bits. */
+    words = (kb->initialbits+31)/32+1;
+    bufwords = (kb->initialbits+kb->initialbits/2+31)/32+1;
+    kb->extramem = (unsigned int *)
+	malloc2((kb->passes-2)*(bufwords*4+kb->initialbits*2*2)+words*4);
+    if (!kb->extramem) return 97;
+    bzero(kb->extramem, (kb->passes-2)*(bufwords*4+kb->initialbits*2*2));
+    tmpbuf = kb->extramem;
+    for (p=2;p<kb->passes;p++) {
+	kb->passbuf[p]=tmpbuf;
+	kb->passindex[p]=(unsigned short *)&tmpbuf[bufwords];
+	kb->passreverse[p]=&kb->passindex[p][kb->initialbits];
+	tmpbuf=(unsigned int *)&kb->passreverse[p][kb->initialbits];
+	prepare_permut_core(kb, kb->passindex[p], kb->passreverse[p],
+			    kb->passbuf[p]);
+    }
+    kb->searchmark = tmpbuf;
+    return 0;
 }
  
 /* helper function for parity isolation */
@@ -1215,10 +1808,9 @@ void prepare_paritylist_basic(unsigned int *d, unsigned int *t, int k, int w) {
    buffer. parameters are a keyblock pointer, and a seed for the RNG.
    the rest is extracted out of the kb structure (for final parity test) */
 void generate_selectbitstring(struct keyblock *kb, unsigned int seed){
-    int i; /* number of bits to be set */
     kb->RNG_state = seed;  /* set new seed */
-    for (i=0;i<(kb->workbits)/32;i++) /* take care of the full bits */
-	kb->testmarker[i]=PRNG_value2_32(&kb->RNG_state);
+    /* take care of the full bits */
+    PRNG_fill(kb->testmarker, kb->workbits/32, &kb->RNG_state);
     kb->testmarker[kb->workbits/32]= /* prepare last few bits */
 	PRNG_value2_32(&kb->RNG_state) & lastmask((kb->workbits-1)& 31);
     return;
@@ -1229,18 +1821,20 @@ void generate_selectbitstring(struct keyblock *kb, unsigned int seed){
    buffer AND transfer the permuted key buffer into it for a more compact
    parity generation in the last round.
    Parameters are a keyblock pointer.
-   the rest is extracted out of the kb structure (for final parity test) */
+   the rest is extracted out of the kb structure (for final parity test).
+   The parity over the whole test bit string (workbits) is computed in the
+   same pass and left in kb->biconfparity. */
 void generate_BICONF_bitstring(struct keyblock *kb){
-    int i; /* number of bits to be set */
-    for (i=0;i<(kb->workbits)/32;i++) {/* take care of the full bits */
-	kb->testmarker[i] = 
-	    PRNG_value2_32(&kb->RNG_state) 
-	    & kb->permutebuf[i]; /* get permuted bit */
-    }
-    kb->testmarker[kb->workbits/32]= /* prepare last few bits */
+    int i; /* number of full words */
+    i=kb->workbits/32;
+    /* take care of the full bits and get their parity */
+    kb->biconfparity = PRNG_fill_masked(kb->testmarker, kb->permutebuf,
+					 i, &kb->RNG_state);
+    kb->testmarker[i]= /* prepare last few bits */
 	PRNG_value2_32(&kb->RNG_state) 
 	& lastmask((kb->workbits-1)& 31) 
-	& kb->permutebuf[kb->workbits/32];    
+	& kb->permutebuf[i];    
+    if (kb->workbits & 31) kb->biconfparity ^= parity(kb->testmarker[i]);
     return;
 }
 
@@ -1258,21 +1852,12 @@ int do_paritylist_and_diffs(struct keyblock *kb, int pass) {
     int numberofbits = 0;
     int i, partitions; /* counting index, num of blocks */
     unsigned int *lp, *rp, *pd; /* local/received & diff parity pointer */
-    unsigned int *d; /* for paritylist */
-    int k;
-    switch (pass) {
-	case 0:  k=kb->k0; d=kb->mainbuf;
-	    lp=kb->lp0; rp=kb->rp0; pd= kb->pd0;
-	    partitions=kb->partitions0;
-	    break;
-	case 1:  k=kb->k1; d=kb->permutebuf;
-	    lp=kb->lp1; rp=kb->rp1; pd= kb->pd1;
-	    partitions=kb->partitions1;
-	    break;
-	default: /* wrong index */
-	    return -1;
-    }
-    prepare_paritylist_basic(d,lp,k,kb->workbits); /* prepare bitlist */
+
+    if ((pass<0) || (pass>=kb->passes)) return -1; /* wrong index */
+    lp=kb->lp[pass]; rp=kb->rp[pass]; pd=kb->pd[pass];
+    partitions=kb->partitions[pass];
+    prepare_paritylist_basic(kb->passbuf[pass],lp,kb->k[pass],
+			     kb->workbits); /* prepare bitlist */
     
 
     /* evaluate parity mismatch  */
@@ -1284,14 +1869,47 @@ int do_paritylist_and_diffs(struct keyblock *kb, int pass) {
 }
 
 /* helper function to prepare parity lists from original and unpermutated key.
-   arguments are a pointer to the thread structure, a pointer to the target 
-   parity buffer 0 and another pointer to paritybuffer 1. No return value,
-   as no errors are tested here. */
-void prepare_paritylist1(struct keyblock *kb,
-			 unsigned int *d0, unsigned int *d1) {    
-    prepare_paritylist_basic(kb->mainbuf, d0, kb->k0, kb->workbits);
-    prepare_paritylist_basic(kb->permutebuf, d1, kb->k1, kb->workbits);
-    return;
+   arguments are a pointer to the thread structure and a pointer to the target
+   parity buffer; the lists of all passes follow each other, starting at
+   word boundaries. Returns the number of words used. No errors are tested. */
+int prepare_paritylists(struct keyblock *kb, unsigned int *d) {
+    int p, w=0;
+    for (p=0;p<kb->passes;p++) {
+	prepare_paritylist_basic(kb->passbuf[p], &d[w], kb->k[p],
+				 kb->workbits);
+	w+=(kb->partitions[p]+31)/32;
+    }
+    return w;
+}
+
+/* helper to determine the partitions for all passes of a keyblock. Returns
+   the total number of partitions. */
+int set_partitions(struct keyblock *kb) {
+    int p, n=0;
+    for (p=0;p<kb->passes;p++) {
+	kb->partitions[p] = (kb->workbits + kb->k[p]-1) / kb->k[p];
+	n += kb->partitions[p];
+    }
+    return n;
+}
+
+/* helper to reserve memory for the difference index lists, which consist of
+   the start and end bit index of the intervals, the pass of an interval and
+   a list for corrected bit positions. Parameters are the keyblock and the
+   number of entries. Returns 0 or an error code. */
+int reserve_diffidx(struct keyblock *kb, int entries) {
+    if (kb->diffidx) {
+	if (kb->diffnumber_max >= entries) return 0; /* enough space */
+	free2(kb->diffidx);
+    }
+    kb->diffnumber_max = entries;
+    kb->diffidx=(unsigned int *)
+	malloc2((entries?entries:1)*sizeof(unsigned int)*4);
+    if (!kb->diffidx) return 54; /* can't malloc */
+    kb->diffidxe = &kb->diffidx[entries]; /* end of interval */
+    kb->diffpass = &kb->diffidxe[entries]; /* pass of interval */
+    kb->corrpos = &kb->diffpass[entries]; /* corrected bits */
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1305,9 +1923,10 @@ int prepare_dualpass(char *receivebuf) {
     float localerror,ldi;
     int errormark, newbitsneeded;
     unsigned int newseed; /* seed for permutation */
-    int msg4datalen;
+    int msg4datalen, p;
     struct ERRC_ERRDET_4 *h4; /* header pointer */
-    unsigned int *h4_d0, *h4_d1; /* pointer to data tracks  */
+    struct ERRC_ERRDET_9 *h9; /* header pointer for multi-pass */
+    unsigned int *h4_d0; /* pointer to data tracks  */
     int retval;
     
     /* get pointers for header...*/
@@ -1352,46 +1971,60 @@ int prepare_dualpass(char *receivebuf) {
 
     /****** more to do here *************/
     /* calculate k0 and k1 for further uses */
-    if (localerror <0.01444) { kb->k0 = 64; /* min bitnumber */
-    } else { kb->k0 = (int) (0.92419642 / localerror); }
-    kb->k1 = 3*kb->k0; /* block length second array */
+    choose_blocklengths(kb, localerror);
     
     /* install new seed */
     kb->RNG_usage = 0; /* use simple RNG */
-    if (!(newseed = get_r_seed())) return 39; 
+    if (!(newseed = get_block_seed(kb))) return 39; 
     kb->RNG_state = newseed;  /* get new seed for RNG */
     
     /* prepare permutation array */
-    prepare_permutation(kb);
+    if ((retval=prepare_permutation(kb))) return retval;
 
     /* prepare message 5 frame - this should go into prepare_permutation? */
-    kb->partitions0 = (kb->workbits + kb->k0-1) / kb->k0; 
-    kb->partitions1 = (kb->workbits + kb->k1-1) / kb->k1;
+    set_partitions(kb);
 
     /* get raw buffer */
-    msg4datalen = ((kb->partitions0+31)/32+(kb->partitions1+31)/32)*4;
-    h4 = (struct ERRC_ERRDET_4 *)
-	malloc2(sizeof(struct ERRC_ERRDET_4)+msg4datalen);
-    if (!h4) return 43; /* cannot malloc */
-    /* both data arrays */
-    h4_d0 = (unsigned int *)&h4[1];
-    h4_d1 = &h4_d0[(kb->partitions0+31)/32];
-    h4->tag = ERRC_PROTO_tag;
-    h4->bytelength = sizeof(struct ERRC_ERRDET_4)+msg4datalen;
-    h4->subtype = ERRC_ERRDET_4_subtype;
-    h4->epoch = kb->startepoch;
-    h4->number_of_epochs = kb->numberofepochs;  /* length of the block */
-    h4->seed = newseed; /* permutator seed */
-
-    /* these are optional; should we drop them? */
-    h4->k0 = kb->k0;  h4->k1 = kb->k1; h4->totalbits = kb->workbits;
+    msg4datalen = 0;
+    for (p=0;p<kb->passes;p++) msg4datalen += ((kb->partitions[p]+31)/32)*4;
+    if (kb->multipass) { /* message 9 with block length list */
+	h9 = (struct ERRC_ERRDET_9 *)
+	    malloc2(sizeof(struct ERRC_ERRDET_9)+kb->passes*4+msg4datalen);
+	if (!h9) return 43; /* cannot malloc */
+	h4_d0 = (unsigned int *)&h9[1];
+	for (p=0;p<kb->passes;p++) h4_d0[p]=kb->k[p];
+	h4_d0 = &h4_d0[kb->passes]; /* parity lists follow */
+	h9->tag = ERRC_PROTO_tag;
+	h9->bytelength = sizeof(struct ERRC_ERRDET_9)+kb->passes*4+msg4datalen;
+	h9->subtype = ERRC_ERRDET_9_subtype;
+	h9->epoch = kb->startepoch;
+	h9->number_of_epochs = kb->numberofepochs;  /* length of the block */
+	h9->passes = kb->passes; h9->totalbits = kb->workbits;
+	h9->seed = newseed; /* permutator seed */
+	h4 = (struct ERRC_ERRDET_4 *)h9; /* for sending */
+    } else {
+	h4 = (struct ERRC_ERRDET_4 *)
+	    malloc2(sizeof(struct ERRC_ERRDET_4)+msg4datalen);
+	if (!h4) return 43; /* cannot malloc */
+	/* both data arrays */
+	h4_d0 = (unsigned int *)&h4[1];
+	h4->tag = ERRC_PROTO_tag;
+	h4->bytelength = sizeof(struct ERRC_ERRDET_4)+msg4datalen;
+	h4->subtype = ERRC_ERRDET_4_subtype;
+	h4->epoch = kb->startepoch;
+	h4->number_of_epochs = kb->numberofepochs;  /* length of the block */
+	h4->seed = newseed; /* permutator seed */
+
+	/* these are optional; should we drop them? */
+	h4->k0 = kb->k[0];  h4->k1 = kb->k[1]; h4->totalbits = kb->workbits;
+    }
     
     /* evaluate parity in blocks */
-    prepare_paritylist1(kb, h4_d0, h4_d1);
+    prepare_paritylists(kb, h4_d0);
   
     /* update status */
     kb->processingstate = PRS_PERFORMEDPARITY1;
-    kb->leakagebits += kb->partitions0 + kb->partitions1;
+    for (p=0;p<kb->passes;p++) kb->leakagebits += kb->partitions[p];
 
     /* transmit message */
     retval=insert_sendpacket((char *)h4, h4->bytelength);
@@ -1421,18 +2054,9 @@ int prepare_first_binsearch_msg(struct keyblock *kb, int pass) {
     int kdiff, fbi, lbi, fi, li, ri; /* working variables for parity eval */
     int partitions; /* local partitions o go through for diff idx */
 
-    switch (pass) { /* sort out specifics */
-	case 0: /* unpermutated pass */
-	    pd=kb->pd0; k=kb->k0; partitions = kb->partitions0;
-	    d=kb->mainbuf; /* unpermuted key */
-	    break;
-	case 1: /* permutated pass */
-	    pd=kb->pd1; k=kb->k1;partitions = kb->partitions1;
-	    d=kb->permutebuf; /* permuted key */
-	    break;
-	default: /* illegal */
-	    return 59; /* illegal pass arg */
-    }
+    if ((pass<0) || (pass>=kb->passes)) return 59; /* illegal pass arg */
+    pd=kb->pd[pass]; k=kb->k[pass]; partitions = kb->partitions[pass];
+    d=kb->passbuf[pass]; /* key in the order of this pass */
     
 
     /* fill difference index memory */
@@ -1504,11 +2128,15 @@ int prepare_first_binsearch_msg(struct keyblock *kb, int pass) {
 
 int start_binarysearch(char *receivebuf) {
     struct  ERRC_ERRDET_4 *in_head; /* holds received message header */
+    struct  ERRC_ERRDET_9 *h9; /* same for multi-pass message */
     struct keyblock *kb; /* points to thread info */
-    int l0, l1; /* helpers;  number of words for bitarrays */
+    unsigned int *rdata; /* received parity lists */
+    int l[MAX_CASCADE_PASSES], lt; /* number of words for bitarrays */
+    int p, retval;
 
     /* get pointers for header...*/
     in_head = (struct  ERRC_ERRDET_4 *)receivebuf;
+    h9 = (struct  ERRC_ERRDET_9 *)receivebuf;
     
     /* ...and find thread: */
     kb = get_thread(in_head->epoch);
@@ -1517,41 +2145,55 @@ int start_binarysearch(char *receivebuf) {
 	return 49;
     }
 
+    /* take block lengths from the permuting side */
+    if (in_head->subtype == ERRC_ERRDET_9_subtype) {
+	if ((h9->passes<2) || (h9->passes>MAX_CASCADE_PASSES)) return 98;
+	kb->passes = h9->passes; kb->multipass = 1;
+	rdata = (unsigned int *)&h9[1];
+	for (p=0;p<kb->passes;p++) kb->k[p] = rdata[p];
+	rdata = &rdata[kb->passes];
+	kb->RNG_state = h9->seed; /* new rng seed */
+    } else {
+	kb->passes = 2; kb->multipass = 0;
+	kb->k[0] = in_head->k0; kb->k[1] = in_head->k1;
+	rdata = (unsigned int *)&in_head[1];
+	kb->RNG_state = in_head->seed; /* new rng seed */
+    }
+
     /* prepare local parity info */
-    kb->RNG_state = in_head->seed; /* new rng seed */
-    prepare_permutation(kb); /* also updates workbits */
+    if ((retval=prepare_permutation(kb))) return retval; /* updates workbits */
     
     /* update partition numbers and leakagebits */
-    kb->partitions0 = (kb->workbits + kb->k0-1) / kb->k0; 
-    kb->partitions1 = (kb->workbits + kb->k1-1) / kb->k1;
-
     /* freshen up internal info on bit numbers etc */
-    kb->leakagebits += kb->partitions0 + kb->partitions1;
+    kb->leakagebits += set_partitions(kb);
     
     /* prepare parity list and difference buffers  */
-    l0=(kb->partitions0+31)/32; l1=(kb->partitions1+31)/32; /* size in words */
-    kb->lp0 = (unsigned int *)malloc2((l0+l1)*4*3);
-    if (!kb->lp0) return 53; /* can't malloc */
-    kb->lp1 = &kb->lp0[l0]; /* ptr to permuted parities */
-    kb->rp0 = &kb->lp1[l1]; /* prt to rmt parities 0 */
-    kb->rp1 = &kb->rp0[l0]; /* prt to rmt parities 1 */
-    kb->pd0 = &kb->rp1[l1]; /* prt to rmt parities 0 */
-    kb->pd1 = &kb->pd0[l0]; /* prt to rmt parities 1 */
-
+    lt=0;
+    for (p=0;p<kb->passes;p++) { /* size in words */
+	l[p]=(kb->partitions[p]+31)/32; lt+=l[p];
+    }
+    kb->paritymem = (unsigned int *)malloc2(lt*4*3);
+    if (!kb->paritymem) return 53; /* can't malloc */
+    /* local, remote and difference parities, each for all passes */
+    kb->lp[0] = kb->paritymem; kb->rp[0] = &kb->lp[0][lt];
+    kb->pd[0] = &kb->rp[0][lt];
+    for (p=1;p<kb->passes;p++) {
+	kb->lp[p] = &kb->lp[p-1][l[p-1]];
+	kb->rp[p] = &kb->rp[p-1][l[p-1]];
+	kb->pd[p] = &kb->pd[p-1][l[p-1]];
+    }
 
     /* store received parity lists as a direct copy into the rp structure */
-    memcpy(kb->rp0, &in_head[1], /* this is the start of the data section */
-	   (l0+l1)*4);
+    memcpy(kb->rp[0], rdata, lt*4);
+
+    if (kb->multipass) return start_multipass_round(kb);
 
     /* fill local parity list, get the number of differences */
     kb->diffnumber = do_paritylist_and_diffs(kb, 0);
     if (kb->diffnumber == -1) return 74;
-    kb->diffnumber_max = kb->diffnumber;
     
     /* reserve difference index memory for pass 0 */
-    kb->diffidx=(unsigned int *)malloc2(kb->diffnumber*sizeof(unsigned int)*2);
-        if (!kb->diffidx) return 54; /* can't malloc */
-    kb->diffidxe = &kb->diffidx[kb->diffnumber]; /* end of interval */
+    if ((retval=reserve_diffidx(kb, kb->diffnumber))) return retval;
 
     /* now hand over to the procedure preoaring the first binsearch msg 
        for the first pass 0 */
@@ -1603,21 +2245,17 @@ void correct_bit(unsigned int *d, int bitindex) {
     d[bitindex/32] ^= bt_mask(bitindex); /* flip bit */
     return;
 }
-/* helper to fix the permuted/unpermuted bit changes; decides via a parameter
-   in kb->binsearch_depth MSB what polarity to take */
-void fix_permutedbits(struct keyblock *kb) {
-    int i,k;
-    unsigned int *src, *dst;
-    unsigned short *idx; /* pointers to data loc and permute idx */
-    if (kb->binsearch_depth & RUNLEVEL_LEVELMASK) { /* we are in pass 1 */
-	src=kb->permutebuf; dst=kb->mainbuf; idx=kb->reverseindex;
-    } else { /* we are in pass 0 */
-	src=kb->mainbuf; dst=kb->permutebuf; idx=kb->permuteindex;
-    }
-    bzero(dst,((kb->workbits+31)/32)*4); /* clear dest */
-    for (i=0;i<kb->workbits;i++) {
-	k=idx[i]; /* permuted bit index */
-	if (bt_mask(i) & src[i/32]) dst[k/32] |= bt_mask(k);
+/* helper to fix the permuted/unpermuted bit changes; transfers the bits of
+   the pass given as parameter into the buffers of all other passes */
+void sync_passbuffers(struct keyblock *kb, int srcpass) {
+    int p;
+    if (srcpass) /* bring changes back to the main buffer first */
+	permute_bits(kb->passbuf[srcpass], kb->mainbuf,
+		     kb->passreverse[srcpass], kb->workbits);
+    for (p=1;p<kb->passes;p++) {
+	if (p==srcpass) continue;
+	permute_bits(kb->mainbuf, kb->passbuf[p], kb->passindex[p],
+		     kb->workbits);
     }
     return;
 }
@@ -1640,39 +2278,25 @@ int process_binsearch_alice (
     unsigned int fm, lm, tmp_par; /* for parity evaluation */
     int fbi,lbi, mbi, fi, li, ri; /* for parity evaluation */
     int lost_bits; /* number of key bits revealed in this round */
+    int multipass; /* entries of different passes in this round */
 
     inh_data = (unsigned int *) &in_head[1]; /* parity pattern */
 
     /* find out if difference index should be installed */
-    while (in_head->index_present) {
-	if (kb->diffidx) { /* there is already a diffindex */
-	    if (kb->diffnumber_max>=in_head->number_entries ){
-		/* just re-assign */
-		kb->diffnumber = in_head->number_entries;
-		break;
-	    }
-	    /* otherwise: not enough space; remove the old one... */
-	    free2(kb->diffidx); 
-	    /* ....and continue re-assigning... */
-	}
-	/* allocate difference idx memory */
+    if (in_head->index_present) {
+	if ((i=reserve_diffidx(kb, in_head->number_entries))) return i;
 	kb->diffnumber =in_head->number_entries; /* from far cons check? */
-	kb->diffnumber_max = kb->diffnumber;
-	kb->diffidx=(unsigned int *)
-	malloc2(kb->diffnumber*sizeof(unsigned int)*2);
-	if (!kb->diffidx) return 54; /* can't malloc */
-	kb->diffidxe = &kb->diffidx[kb->diffnumber]; /* end of interval */
-	break;
     }
 
     inh_idx = &inh_data[(kb->diffnumber+31)/32]; /* index or matching part */
 
     /* sort out pass-dependent variables */
     if (in_head->runlevel &  RUNLEVEL_LEVELMASK) { /* this is pass 1 */
-	d=kb->permutebuf; k = kb->k1; 
+	d=kb->permutebuf; k = kb->k[1]; 
     } else { /* this is pass 0 */
-	d=kb->mainbuf; k = kb->k0;
+	d=kb->mainbuf; k = kb->k[0];
     }
+    multipass = (in_head->runlevel & RUNLEVEL_MULTIPASS)?1:0;
 
     /* special case to take care of if this is a BICONF localizing round:
        the variables d and k contain worng values at this point.
@@ -1695,6 +2319,14 @@ int process_binsearch_alice (
 	case 4: /* only one entry; from biconf run. should end be biconflen? */
 	    kb->diffidx[0]=inh_idx[0];kb->diffidxe[0]=kb->workbits-1;
 	    break;
+	case 5: /* multi-pass round; pass number in upper bits */
+	    for (i=0;i<kb->diffnumber;i++) {
+		kb->diffpass[i]=inh_idx[i]>>MULTIPASS_PASSSHIFT;
+		if (kb->diffpass[i]>=kb->passes) return 100;
+		kb->diffidx[i]=inh_idx[i] & MULTIPASS_BITMASK;
+		kb->diffidxe[i]=kb->diffidx[i]+(kb->k[kb->diffpass[i]]-1);
+	    }
+	    break;
 	    /* should have a case 3 here for direct bit encoding */
 	default: /* do not know encoding */
 	    return 57;
@@ -1704,7 +2336,8 @@ int process_binsearch_alice (
     kb->leakagebits += kb->diffnumber; /* for incoming parity bits */
     /* check if this masking is correct? let biconf status survive  */
     kb->binsearch_depth = ((in_head->runlevel +1) & RUNLEVEL_ROUNDMASK)
-	+ (in_head->runlevel & (RUNLEVEL_LEVELMASK | RUNLEVEL_BICONF));
+	+ (in_head->runlevel & (RUNLEVEL_LEVELMASK | RUNLEVEL_BICONF |
+				RUNLEVEL_MULTIPASS));
     
     /* prepare outgoing message header */
     out_head = make_messagehead_5(kb); if (!out_head) return 58;
@@ -1722,6 +2355,7 @@ int process_binsearch_alice (
 	    lost_bits-=2;
 	    goto skpar2;
 	}
+	if (multipass) d=kb->passbuf[kb->diffpass[i]];
 	if (fbi==lbi) {
 	    lost_bits-=2; /* one less lost on receive, 1 not sent */
 	    kb->diffidx[i]=fbi+1; /* mark as emty */
@@ -1796,7 +2430,7 @@ int initiate_biconf(struct keyblock *kb) {
     if (!h6) return 60;
 
     /* prepare seed */
-    seed = get_r_seed();
+    seed = get_block_seed(kb);
 
     /* update state variables */
     kb->biconflength = kb->workbits; /* old was /2 - do we still need this? */
@@ -1831,7 +2465,6 @@ int do_privacy_amplification(struct keyblock *kb, unsigned int seed,
     int sneakloss;
     float trueerror, cheeky_error, safe_error;
     unsigned int *finalkey; /* pointer to final key */
-    unsigned int m; /* addition register */
     int numwords, mlen; /* number of words in final key / message length */
     struct header_7 *outmsg; /* keeps output message */
     int i,j; /* counting indices */
@@ -1893,6 +2526,8 @@ int do_privacy_amplification(struct keyblock *kb, unsigned int seed,
 	    BellHelper=kb->BellValue* kb->BellValue/4.-1.;
 	    if (BellHelper<0.) { /* we have no key...*/
 		sneakloss=kb->workbits;
+	    } else if (BellHelper>=1.) { /* at or beyond the quantum bound */
+		sneakloss=0;
 	    } else { /* there is hope... */
 		sneakloss=(int)
 		    (kb->workbits*binentrop((1.+sqrt(BellHelper))/2.));
@@ -1949,10 +2584,8 @@ int do_privacy_amplification(struct keyblock *kb, unsigned int seed,
     } else { /* do privacy amplification */
 	/* create compression matrix on the fly while preparing key */
 	for (i=0;i<kb->finalkeybits;i++) { /* go through all targetbits */
-	    m=0; /* initial word */
-	    for (j=0;j<numwords;j++) m ^= (kb->mainbuf[j] &
-					   PRNG_value2_32(&kb->RNG_state));
-	    if (parity(m)) finalkey[i/32] |= bt_mask(i);
+	    if (PRNG_masked_parity(kb->mainbuf, numwords, &kb->RNG_state))
+		finalkey[i/32] |= bt_mask(i);
 	}
     }
 
@@ -2023,7 +2656,7 @@ int initiate_privacyamplification(struct keyblock *kb) {
     struct  ERRC_ERRDET_8 *h8; /* head for trigger message */
     
     /* generate local RNG seed */
-    seed=get_r_seed();
+    seed=get_block_seed(kb);
 
     /* prepare messagehead */
     h8=(struct ERRC_ERRDET_8 *)malloc2(sizeof(struct ERRC_ERRDET_8));
@@ -2068,6 +2701,132 @@ int receive_privamp_msg(char *receivebuf) {
     return do_privacy_amplification(kb, in_head->seed, in_head->lostbits);
 }
 
+/* ------------------------------------------------------------------------- */
+/* helper for multi-pass rounds on bob side: remembers the position of an
+   error found in entry i at bit fbi of its pass in main buffer order. The
+   key buffers stay untouched until the round is complete. */
+void note_correction(struct keyblock *kb, int i, int fbi) {
+    int p = kb->diffpass[i];
+    kb->corrpos[kb->corrnumber++] = p ? kb->passreverse[p][fbi] : fbi;
+}
+
+/* compare function for sorting corrected positions */
+int cmp_uint(const void *a, const void *b) {
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x>y) - (x<y);
+}
+
+/* helper to apply the corrections collected in a multi-pass round. Blocks of
+   different passes may have located the same error, so every position is
+   toggled only once. Afterwards, all pass buffers are updated. */
+void apply_corrections(struct keyblock *kb) {
+    int i;
+    qsort(kb->corrpos, kb->corrnumber, sizeof(unsigned int), cmp_uint);
+    for (i=0;i<kb->corrnumber;i++) {
+	if (i && (kb->corrpos[i]==kb->corrpos[i-1])) continue; /* duplicate */
+	correct_bit(kb->mainbuf, kb->corrpos[i]);
+	kb->correctederrors++;
+    }
+    kb->corrnumber = 0;
+    sync_passbuffers(kb, 0);
+}
+
+/* helper for multi-pass rounds: tests if a block of a pass shares bits with
+   the blocks already selected for this round, and marks its bits otherwise.
+   Parameters are the keyblock, the pass and the block index; returns 1 if
+   the block can be searched in this round, or 0 if it has to wait. */
+int select_block(struct keyblock *kb, int p, int i) {
+    int b, m, fbi, lbi;
+    fbi = i*kb->k[p]; lbi = fbi+kb->k[p];
+    if (lbi > kb->workbits) lbi = kb->workbits;
+    for (b=fbi;b<lbi;b++) {
+	m = p ? kb->passreverse[p][b] : b;
+	if (kb->searchmark[m/32] & bt_mask(m)) return 0; /* overlaps */
+    }
+    for (b=fbi;b<lbi;b++) {
+	m = p ? kb->passreverse[p][b] : b;
+	kb->searchmark[m/32] |= bt_mask(m);
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* function to start a multi-pass round on bob side: evaluates the parity
+   differences of all passes, and emits a binary search message containing
+   the mismatching blocks of all passes (index mode 5). Blocks sharing bits
+   with a block of a lower pass are left for a later round, so no error is
+   searched twice. If no pass shows a mismatch, the cascade is finished.
+   Returns 0 or an error code. */
+int start_multipass_round(struct keyblock *kb) {
+    int p, i, j, n, retval;
+    unsigned int msg5size;        /* size of message */
+    struct ERRC_ERRDET_5 *h5;     /* pointer to first message */
+    unsigned int *h5_data, *h5_idx; /* data pointers */
+    unsigned int resbuf; /* parity collection */
+
+    /* get differences of all passes */
+    n=0;
+    for (p=0;p<kb->passes;p++) {
+	j=do_paritylist_and_diffs(kb, p);
+	if (j == -1) return 74; /* wrong pass */
+	n+=j;
+    }
+    if (n==0) return finish_cascade(kb); /* no more errors in any pass */
+    if ((retval=reserve_diffidx(kb, n))) return retval;
+
+    /* fill difference index memory */
+    j=0; kb->search_k=0;
+    bzero(kb->searchmark, ((kb->workbits+31)/32)*4);
+    for (p=0;p<kb->passes;p++) {
+	for (i=0;i<kb->partitions[p];i++) {
+	    if ((bt_mask(i) & kb->pd[p][i/32]) && /* block is mismatched */
+		select_block(kb, p, i)) {
+		kb->diffidx[j]=i*kb->k[p];
+		kb->diffidxe[j]=i*kb->k[p]+(kb->k[p]-1);
+		kb->diffpass[j]=p;
+		if (kb->k[p]>kb->search_k) kb->search_k=kb->k[p];
+		j++;
+	    }
+	}
+    }
+    n = j; /* entries in this round */
+    kb->diffnumber = n; kb->corrnumber = 0;
+    kb->binsearch_depth = RUNLEVEL_MULTIPASS | 0; /* first round */
+
+    /* prepare message buffer for first binsearch message  */
+    msg5size = sizeof(struct ERRC_ERRDET_5 ) /* header need */
+	+ ((n+31)/32)*sizeof(unsigned int) /* parity data need */
+	+ n*sizeof(unsigned int); /* indexing need */
+    h5 = (struct ERRC_ERRDET_5 *)malloc2(msg5size);
+    if (!h5) return 55;
+    h5_data = (unsigned int *) &h5[1]; /* start of data */
+    h5->tag = ERRC_PROTO_tag; h5->subtype = ERRC_ERRDET_5_subtype;
+    h5->bytelength = msg5size; h5->epoch = kb->startepoch;
+    h5->number_of_epochs = kb->numberofepochs;
+    h5->number_entries = n;
+    h5->index_present = 5; /* start bits with pass numbers */
+    h5->runlevel = kb->binsearch_depth; /* keep local status */
+
+    /* index list and parities of the lower halves */
+    h5_idx = &h5_data[((n+31)/32)];
+    resbuf=0;
+    for (i=0;i<n;i++) {
+	h5_idx[i]=kb->diffidx[i] | (kb->diffpass[i]<<MULTIPASS_PASSSHIFT);
+	resbuf = (resbuf <<1) +
+	    single_line_parity(kb->passbuf[kb->diffpass[i]], kb->diffidx[i],
+			       kb->diffidx[i]+
+			       (kb->diffidxe[i]-kb->diffidx[i]+1)/2-1);
+	if ((i&31)==31) h5_data[i/32]=resbuf;
+    }
+    if (i&31) h5_data[i/32]=resbuf<<(32-(i&31)); /* last parity bits */
+
+    /* increment lost bits */
+    kb->leakagebits += n;
+
+    /* send out message */
+    return insert_sendpacket((char *)h5, msg5size);
+}
+
 /* ------------------------------------------------------------------------- */
 /* function to process a binarysearch request on bob identity. Checks parity
    lists and does corrections if necessary. 
@@ -2088,6 +2847,7 @@ int process_binsearch_bob (
     int lost_bits; /* number of key bits revealed in this round */
     int thispass; /* indincates the current pass */
     int biconfmark; /* indicates if this is a biconf round */
+    int multipass; /* entries of different passes in this round */
 
     inh_data = (unsigned int *) &in_head[1]; /* parity pattern */
     inh_idx = &inh_data[(kb->diffnumber+31)/32]; /* index or matching part */
@@ -2120,6 +2880,7 @@ int process_binsearch_bob (
     }
     
     biconfmark=0; /* default is no biconf */
+    multipass = (kb->binsearch_depth & RUNLEVEL_MULTIPASS)?1:0;
 
     /* select test buffer in case this is a BICONF test round */
     if (kb->binsearch_depth & RUNLEVEL_BICONF) {
@@ -2138,9 +2899,14 @@ int process_binsearch_bob (
 	    lost_bits-=2; /* No initial parity, no outgoing */
 	    goto skipparity; /* no more parity evaluation, skip rest */
 	}	    
+	if (multipass) d=kb->passbuf[kb->diffpass[i]];
 	if (fbi==lbi) { /* we have found the bit error */
-	    if (biconfmark) correct_bit(d2,fbi);
-	    correct_bit(d,fbi);kb->correctederrors++;
+	    if (multipass) {
+		note_correction(kb, i, fbi);
+	    } else {
+		if (biconfmark) correct_bit(d2,fbi);
+		correct_bit(d,fbi);kb->correctederrors++;
+	    }
 	    lost_bits-=2; /* No initial parity, no outgoing */
 	    kb->diffidx[i]=fbi+1; /* mark as emty */
 	    goto skipparity; /* no more parity evaluation, skip rest */
@@ -2161,8 +2927,12 @@ int process_binsearch_bob (
 	    lbi=mbi; kb->diffidxe[i]=lbi; /* update last bit idx */
 	}
 	if (fbi==lbi) { /* end of interval, correct for error */
-	    if (biconfmark) correct_bit(d2,fbi);
-	    correct_bit(d,fbi); kb->correctederrors++;
+	    if (multipass) {
+		note_correction(kb, i, fbi);
+	    } else {
+		if (biconfmark) correct_bit(d2,fbi);
+		correct_bit(d,fbi); kb->correctederrors++;
+	    }
 	    lost_bits--; /* we don't reveal anything on this one anymore */
 	    goto skipparity;
 	}
@@ -2189,9 +2959,10 @@ int process_binsearch_bob (
 
     /* a blocklength k decides on a max number of rounds */
     if ((kb->binsearch_depth & RUNLEVEL_ROUNDMASK ) <
-	get_order_2((kb->processingstate==PRS_DOING_BICONF)?
+	get_order_2(multipass?kb->search_k:
+		    (kb->processingstate==PRS_DOING_BICONF)?
 		    (kb->biconflength):
-		    (thispass?kb->k1:kb->k0))) {
+		    (thispass?kb->k[1]:kb->k[0]))) {
 	/* need to continue with this search; make packet 5 ready to send */
 	kb->leakagebits += lost_bits;
 	insert_sendpacket((char *)out_head, out_head->bytelength);
@@ -2200,8 +2971,16 @@ int process_binsearch_bob (
 
     kb->leakagebits +=lost_bits; /* correction for unreceived parity bits and nonsent parities */
     
+    if (multipass) { /* apply all corrections found in this round at once */
+	apply_corrections(kb);
+	return start_multipass_round(kb);
+    }
+
     /* cleanup changed bits in the other permuted field */
-    fix_permutedbits(kb);
+    sync_passbuffers(kb, thispass);
+
+    /* after a BICONF correction, all passes are checked again together */
+    if (kb->multipass) return start_multipass_round(kb);
     
     /* prepare for alternate round; start with re-evaluation of parity. */
     while (1) { /* just a break construction.... */
@@ -2210,14 +2989,7 @@ int process_binsearch_bob (
 	    do_paritylist_and_diffs(kb, 1-thispass); /* new differences */
 	if (kb->diffnumber == -1) return 74; /* wrong pass */
 	if ((kb->diffnumber==0) && (thispass ==1)) break; /* no more errors */
-	if (kb->diffnumber>kb->diffnumber_max) { /* need more space */
-	    free2(kb->diffidx);  /* re-assign diff buf */
-	    kb->diffnumber_max = kb->diffnumber;
-	    kb->diffidx=(unsigned int *)
-		malloc2(kb->diffnumber*sizeof(unsigned int)*2);
-	    if (!kb->diffidx) return 54; /* can't malloc */
-	    kb->diffidxe = &kb->diffidx[kb->diffnumber]; /* end of interval */
-	}
+	if ((i=reserve_diffidx(kb, kb->diffnumber))) return i;
 	
 	/* do basically a start_binarysearch for next round */
 	return prepare_first_binsearch_msg(kb,1-thispass); 
@@ -2225,7 +2997,14 @@ int process_binsearch_bob (
     
     /* now we have finished a consecutive the second round; there are no more
        errors in both passes.  */
+    return finish_cascade(kb);
+}
 
+/* ------------------------------------------------------------------------- */
+/* function to continue after all passes show matching parities. Initiates
+   the first or next BICONF round, or the privacy amplification after the
+   last BICONF round. Argument is the keyblock, returns 0 or an error code. */
+int finish_cascade(struct keyblock *kb) {
     /* check for biconf reply  */
     if (kb->processingstate==PRS_DOING_BICONF) { /* we are finally finished
 					       with the BICONF corrections */
@@ -2233,7 +3012,7 @@ int process_binsearch_bob (
 	kb->biconf_round++;
 	
 	/* eventully generate new biconf request */
-	if (kb->biconf_round< biconf_rounds) {
+	if (kb->biconf_round< kb->biconf_rounds) {
 	    return initiate_biconf(kb); /* request another one */
 	}
 	/* initiate the privacy amplificaton */
@@ -2363,7 +3142,8 @@ int generate_biconfreply(char *receivebuf) {
     h7->number_of_epochs = kb->numberofepochs;
 
     /* evaluate the parity (updated to use testbit buffer */
-    h7->parity = single_line_parity(kb->testmarker,0,bitlen-1);
+    h7->parity = (bitlen==kb->workbits) ? kb->biconfparity :
+	single_line_parity(kb->testmarker,0,bitlen-1);
 
     /* update bitloss */
     kb->leakagebits++; /* one is lost */
@@ -2457,7 +3237,8 @@ int receive_biconfreply(char *receivebuf){
     kb->leakagebits++;
 
     /* evaluate local parity */
-    localparity= single_line_parity(kb->testmarker,0,kb->biconflength-1);
+    localparity= (kb->biconflength==kb->workbits) ? kb->biconfparity :
+	single_line_parity(kb->testmarker,0,kb->biconflength-1);
 
     /* eventually start binary search */
     if (localparity != in_head->parity) {
@@ -2469,7 +3250,7 @@ int receive_biconfreply(char *receivebuf){
     kb->biconf_round++;
 
     /* eventully generate new biconf request */
-    if (kb->biconf_round< biconf_rounds) {
+    if (kb->biconf_round< kb->biconf_rounds) {
 	return initiate_biconf(kb); /* request another one */
     }
     /* initiate the privacy amplificaton */
@@ -2496,7 +3277,7 @@ void dumpstate(struct keyblock *kb) {
 			       2*kb->initialbits+
 			       3*((kb->initialbits+31)/32)));
 
-    if (kb->lp0) write(dha,kb->lp0,sizeof(unsigned int)*
+    if (kb->paritymem) write(dha,kb->paritymem,sizeof(unsigned int)*
 		       6*((kb->workbits+31)/32));
 
     if (kb->diffidx) write(dha,kb->diffidx,sizeof(unsigned int)*
@@ -2532,6 +3313,144 @@ void dumpmsg(struct keyblock *kb, char *msg) {
     return;
 }
     
+/* ------------------------------------------------------------------------- */
+/* automatic block formation for the stream intake mode. The epochs collected
+   so far are turned into a thread, and the error estimation is initiated as
+   if a command had been received. Returns 0 or an error code. */
+int form_autoblock(void) {
+    unsigned int epoch = acc_startepoch;
+    int num = acc_epochs;
+    int retval;
+    float err, bell;
+
+    acc_epochs=0; acc_bits=0; /* start a fresh collection */
+    if (check_epochoverlap(epoch, num)) return 33;
+    err=expected_error(epoch, &bell);
+    if ((retval=create_thread(epoch, num, err, bell))) return retval;
+    printf("automatic block: epoch %08x, %d epochs\n",epoch,num);
+    return errorest_1(epoch);
+}
+
+/* helper to discard the epochs collected for an automatic block, e.g. after
+   a gap in the epoch sequence */
+void drop_autoblock(void) {
+    struct rawkey_epoch *rp;
+    int i;
+    for (i=0;i<acc_epochs;i++)
+	if ((rp=take_rawkey_epoch(acc_startepoch+i))) free2(rp);
+    printf("dropped %d raw key bits from epoch %08x\n",acc_bits,
+	   acc_startepoch);
+    acc_epochs=0; acc_bits=0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* function to digest a complete epoch from the raw key stream. Inserts the
+   entry into the raw key store, limits the store size and eventually forms an
+   automatic block. Returns 0 or an error code. */
+int rawkey_intake(struct rawkey_epoch *re) {
+    struct rawkey_epoch *rp;
+    int retval;
+
+    /* append to store */
+    if (last_rawkey) {last_rawkey->next=re;} else {rawkeylist=re;}
+    last_rawkey=re; rawkey_epochs_held++;
+
+    /* forget the oldest epoch if it was never asked for */
+    if (rawkey_epochs_held>MAX_STREAMED_EPOCHS) {
+	rp=rawkeylist;
+	if (acc_epochs && (rp->epoch-acc_startepoch<acc_epochs)) {
+	    drop_autoblock(); /* collection would become incomplete */
+	} else {
+	    rp=take_rawkey_epoch(rp->epoch);
+	    printf("dropped unused raw key epoch %08x\n",rp->epoch);
+	    free2(rp);
+	}
+    }
+
+    if (!autoblock_bits) return 0; /* passive side */
+
+    /* a gap in the sequence terminates the present collection */
+    if (acc_epochs && (re->epoch!=acc_startepoch+acc_epochs)) drop_autoblock();
+    /* don't let a collection exceed the thread limit */
+    if (acc_epochs && (acc_bits+re->length>=MAXBITSPERTHREAD)) {
+	if ((retval=form_autoblock())) return retval;
+    }
+    if (!acc_epochs) acc_startepoch=re->epoch;
+    acc_epochs++; acc_bits+=re->length;
+    if (acc_bits>=autoblock_bits) return form_autoblock();
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* function to read from the raw key stream pipe. Packets are type-3 raw key
+   packets as written by splicer or costream, and may arrive in several
+   pieces. A complete packet is handed over to the raw key intake. Returns 0
+   or an error code. */
+int read_rawkeystream(void) {
+    static struct header_3 sh3; /* header of the packet under construction */
+    static struct rawkey_epoch *re = NULL; /* entry under construction */
+    static int rs_index = 0; /* bytes of current packet read so far */
+    static int rs_bytes; /* data bytes in current packet */
+    int retval;
+
+    if (rs_index<sizeof(struct header_3)) { /* reading the header */
+	retval=read(handle[8],&((char *)&sh3)[rs_index],
+		    sizeof(struct header_3)-rs_index);
+	if (retval==-1) return 85;
+	rs_index+=retval;
+	if (rs_index<sizeof(struct header_3)) return 0; /* come back later */
+	if ((sh3.tag!=TYPE_3_TAG) && (sh3.tag!=TYPE_3_TAG_U)) return 86;
+	if (sh3.bitsperentry !=1 )  return 70; /* not a BB84 raw key */
+	if (sh3.length>=MAXBITSPERTHREAD) return 71;
+	rs_bytes=((sh3.length+31)/32)*sizeof(unsigned int);
+	re=(struct rawkey_epoch *)malloc2(sizeof(struct rawkey_epoch)+rs_bytes);
+	if (!re) return 87;
+	re->epoch=sh3.epoc; re->length=sh3.length;
+	re->data=(unsigned int *)&re[1]; re->next=NULL;
+	if (rs_bytes) return 0; /* data section follows */
+    } else { /* reading the data section */
+	retval=read(handle[8],
+		    &((char *)re->data)[rs_index-sizeof(struct header_3)],
+		    rs_bytes-(rs_index-sizeof(struct header_3)));
+	if (retval==-1) return 85;
+	rs_index+=retval;
+	if (rs_index<sizeof(struct header_3)+rs_bytes) return 0;
+    }
+    /* packet is complete */
+    rs_index=0;
+    if (tracemode==1) {
+	if ((retval=trace_write(TRACE_RAWSTREAM, sh3.epoc, &sh3,
+				sizeof(struct header_3), re->data, rs_bytes)))
+	    return retval;
+    }
+    return rawkey_intake(re);
+}
+
+/* helper for the stream intake mode on the passive side: an initial error
+   estimation packet for a new block is held back until all its raw key epochs
+   have arrived via the stream. Every packet keeps its own waiting time; after
+   RAWSTREAM_MAXWAIT seconds, it is given up. Parameter is the queue entry.
+   returns 0 if the packet can be processed, 1 if it should wait, or 2 if it
+   should be dropped. */
+int rawkey_pending(struct packet_received *p) {
+    struct ERRC_ERRDET_0 *in_head = (struct ERRC_ERRDET_0 *)p->packet;
+
+    if ((in_head->tag != ERRC_PROTO_tag) ||
+	(in_head->subtype != ERRC_ERRDET_0_subtype) ||
+	!in_head->seed) return 0; /* not a new block */
+    if (check_epochoverlap(in_head->epoch, in_head->number_of_epochs))
+	return 0; /* let the packet parser complain */
+    if (rawkey_available(in_head->epoch, in_head->number_of_epochs))
+	return 0;
+    if (!p->waitstart) p->waitstart=time(NULL);
+    if (time(NULL)-p->waitstart>RAWSTREAM_MAXWAIT) { /* give up */
+	fprintf(stderr,"block %08x: ",in_head->epoch);
+	emsg(105);
+	return 2;
+    }
+    return 1;
+}
+
 /*------------------------------------------------------------------------- */
 /* process an input string, terminated with 0 */
 int process_input(char *in) {
@@ -2540,6 +3459,10 @@ int process_input(char *in) {
     int newepochnumber;
     float newesterror=0; /* for initial parsing of a block */
     float BellValue; /* for Ekert-type protocols */
+    float prior; /* error expected from -S */
+
+    if ((tracemode==1) && trace_write(TRACE_CMD, 0, in, strlen(in)+1, NULL, 0))
+	emsg(92);
 
     retval=sscanf(in,"%x %i %f %f",
 		  &newepoch, &newepochnumber, &newesterror, &BellValue);
@@ -2552,9 +3475,9 @@ int process_input(char *in) {
 	case 1: /* no number and error */
 	    newepochnumber=1;
 	case 2: /* no error */
-	    newesterror=initialerr;
-	case 3: /* only error is supplied */
-	    BellValue = 2.*sqrt(2.); /* assume perfect Bell */
+	case 3: /* only error is supplied; Bell value from -S or perfect */
+	    prior=expected_error(newepoch, &BellValue);
+	    if (retval<3) newesterror=prior;
 	case 4: /* everything is there */
 	    if (newesterror<0 || newesterror>MAX_INI_ERR) {
 		if (runtimeerrormode>0) break;
@@ -2587,6 +3510,121 @@ int process_input(char *in) {
 }
 /* ------------------------------------------------------------------------- */
 /* main code */
+/* ------------------------------------------------------------------------- */
+/* function to digest one received packet. Parameter is a pointer to the
+   packet, return is 0 on success or if an error is to be ignored, or an
+   error code otherwise. */
+int process_packet(char *receivebuf) {
+    int retval;
+    if ( ((unsigned int *)receivebuf)[0] != ERRC_PROTO_tag) return 44;
+    /* printf("received message, subtype: %d, len: %d\n",
+       ((unsigned int *)receivebuf)[2],
+       ((unsigned int *)receivebuf)[1]);fflush(stdout); */
+
+    if (tracemode==1) {
+	retval=trace_write(TRACE_IN, ((unsigned int *)receivebuf)[3],
+			   receivebuf, ((unsigned int *)receivebuf)[1],
+			   NULL, 0);
+	if (retval) return retval;
+    }
+
+    switch (((unsigned int *)receivebuf)[2]) { /* subtype */
+	case 0: /* received an error estimation packet */
+	    retval=process_esti_message_0(receivebuf);
+	    break;
+	case 2: /* received request for more bits */
+	    retval=send_more_esti_bits(receivebuf);
+	    break;
+	case 3: /* reveived error confirmation message */
+	    retval=prepare_dualpass(receivebuf);
+	    break;
+	case 4: /* reveived parity list message */
+	case 9: /* reveived multi-pass parity list message */
+	    retval=start_binarysearch(receivebuf);
+	    break;
+	case 5: /* reveive a binarysearch message */
+	    retval=process_binarysearch(receivebuf);
+	    break;
+	case 6: /* receive a BICONF initiating request */
+	    retval=generate_biconfreply(receivebuf);
+	    break;
+	case 7: /* receive a BICONF parity response */
+	    retval=receive_biconfreply(receivebuf);
+	    break;
+	case 8: /* receive a privacy amplification start msg */
+	    retval=receive_privamp_msg(receivebuf);
+	    break;
+	default: /* packet subtype not known */
+	    fprintf(stderr,"received subtype %d; ",
+		    ((unsigned int *)receivebuf)[2]);
+	    return 45;
+    }
+    if (retval && (runtimeerrormode>1)) return 0; /* ignore error */
+    return retval;
+}
+
+/* ------------------------------------------------------------------------- */
+/* replay a recorded trace. Commands, raw key stream packets and received
+   packets are fed to the processing routines in their recorded order;
+   seeds, raw key files and outgoing packets are consumed from the trace by
+   get_block_seed, get_rawkey_epoch and insert_sendpacket, respectively.
+   Returns 0 on success or an error code. */
+int replay_trace(void) {
+    struct trace_record tr;
+    char *content;
+    struct rawkey_epoch *re;
+    int retval, packets=0;
+    unsigned int firstsec=0, firstusec=0, lastsec=0, lastusec=0;
+    struct timeval t0, t1;
+    clock_t c0;
+
+    gettimeofday(&t0,NULL); c0=clock();
+    while (!(retval=trace_read(&tr, &content))) {
+	if (!packets++) {firstsec=tr.sec; firstusec=tr.usec;}
+	lastsec=tr.sec; lastusec=tr.usec;
+	switch (tr.type) {
+	    case TRACE_CMD:
+		content[tr.length-1]=0; /* security termination */
+		retval=process_input(content);
+		if (retval && (runtimeerrormode==0)) return retval;
+		break;
+	    case TRACE_IN:
+		retval=process_packet(content);
+		if (retval) return retval;
+		break;
+	    case TRACE_RAWSTREAM:
+		re=(struct rawkey_epoch *)malloc2(sizeof(struct rawkey_epoch)+
+						  tr.length-
+						  sizeof(struct header_3));
+		if (!re) return 87;
+		re->epoch=((struct header_3 *)content)->epoc;
+		re->length=((struct header_3 *)content)->length;
+		re->data=(unsigned int *)&re[1]; re->next=NULL;
+		memcpy(re->data,&content[sizeof(struct header_3)],
+		       tr.length-sizeof(struct header_3));
+		retval=rawkey_intake(re);
+		if (retval && (runtimeerrormode==0)) return retval;
+		break;
+	    default: /* everything else has to be consumed inline */
+		free2(content);
+		return 94;
+	}
+	if (content) free2(content);
+    }
+    if (retval!=-1) return retval;
+    gettimeofday(&t1,NULL);
+
+    printf("replay: %d records, %d outgoing packet mismatches\n",
+	   trace_records, trace_mismatches);
+    printf("original span: %.3f s, replay: %.3f s wall, %.3f s CPU\n",
+	   (lastsec-firstsec)+((int)lastusec-(int)firstusec)*1E-6,
+	   (t1.tv_sec-t0.tv_sec)+(t1.tv_usec-t0.tv_usec)*1E-6,
+	   (double)(clock()-c0)/CLOCKS_PER_SEC);
+    fflush(stdout);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
 int main (int argc, char *argv[]) {
     int opt;
     int i,noshutdown;
@@ -2604,15 +3642,17 @@ int main (int argc, char *argv[]) {
     char *tmpreadbuf=NULL; /* pointer to hold initial read buffer */
     struct packet_received *msgp; /* temporary storage of message header */
     struct packet_received *sbfp; /* index to go through the linked list */
+    struct packet_received *prevp; /* entry before sbfp, or NULL */
     char instring[CMD_INBUFLEN]; /* for parsing commands */
     int ipt, sl;   /* cmd input variables */
     char *dpnt;  /* ditto */
     char *receivebuf;  /* pointer to the currently processed packet */
     float biconf_BER; /* to keep biconf argument */
+    struct trace_head th; /* for trace recording/replay */
 
     /* parsing parameters */
     opterr=0;
-    while ((opt=getopt(argc, argv, "c:s:r:d:f:l:q:Q:e:E:kJ:T:V:Ipb:B:i"))!=EOF) {
+    while ((opt=getopt(argc, argv, "c:s:r:d:f:l:q:Q:e:E:kJ:T:V:Ipb:B:iR:N:t:P:AS:m:C:"))!=EOF) {
 	i=0; /* for paring filename-containing options */
 	switch (opt) {
 	    case 'V': /* verbosity parameter */
@@ -2675,12 +3715,85 @@ int main (int argc, char *argv[]) {
 		if (biconf_rounds>MAX_BICONF_ROUNDS) return -emsg(77);
 		printf("biconf rounds used: %d\n",biconf_rounds);
 		break;
+	    case 'R': /* raw key stream pipe, idx=8 */
+		if (1!=sscanf(optarg,FNAMFORMAT,fname[8])) return -emsg(80);
+		fname[8][FNAMELENGTH-1]=0;   /* security termination */
+		rawstreammode=1;
+		break;
+	    case 'N': /* target bits for automatic blocks */
+		if (1!=sscanf(optarg,"%d",&autoblock_bits)) return -emsg(83);
+		if ((autoblock_bits<MIN_AUTOBLOCK_BITS) ||
+		    (autoblock_bits>=MAXBITSPERTHREAD)) return -emsg(84);
+		break;
+	    case 'A': /* adaptive Cascade parameters */
+		adaptivemode=1;
+		break;
+	    case 'S': /* statistics page of costream */
+		if (1!=sscanf(optarg,FNAMFORMAT,statname)) return -emsg(102);
+		statname[FNAMELENGTH-1]=0;   /* security termination */
+		statmode=1;
+		break;
+	    case 'm': /* number of Cascade passes */
+		if (1!=sscanf(optarg,"%d",&cascade_passes)) return -emsg(99);
+		if ((cascade_passes<2) || (cascade_passes>MAX_CASCADE_PASSES))
+		    return -emsg(98);
+		break;
+	    case 'C': /* cores and node */
+		switch (cpupin_setup(optarg)) {
+		    case CPUPIN_SYNTAX: return -emsg(103);
+		    case CPUPIN_ERROR: return -emsg(104);
+		}
+		break;
+	    case 't': i++; /* record trace */
+	    case 'P': i++; /* replay trace */
+		if (1!=sscanf(optarg,FNAMFORMAT,tracefname)) return -emsg(90);
+		tracefname[FNAMELENGTH-1]=0;   /* security termination */
+		tracemode=3-i;
+		break;
 	}
     }
+
+    /* replay mode: take parameters from trace and run without peer */
+    if (tracemode==2) {
+	if ((fname[4][0]==0) || (fname[5][0]==0)) return -emsg(17);
+	if (!(tracehandle=fopen(tracefname,"r"))) return -emsg(91);
+	memset(&th,0,sizeof(struct trace_head)); /* defaults for old heads */
+	if ((1!=fread(&th,TRACE_HEADFIX,1,tracehandle)) ||
+	    (th.tag!=ECD2_TRACE_TAG) || (th.version<1) ||
+	    (th.version>ECD2_TRACE_VERSION) ||
+	    (1!=fread((char *)&th+TRACE_HEADFIX,
+		      trace_headsize(th.version)-TRACE_HEADFIX,1,tracehandle)))
+	    return -emsg(93);
+	trace_version=th.version;
+	errormargin=th.errormargin; initialerr=th.initialerr;
+	intrinsicerr=th.intrinsicerr; runtimeerrormode=th.runtimeerrormode;
+	biconf_rounds=th.biconf_rounds; ini_err_skipmode=th.ini_err_skipmode;
+	disable_privacyamplification=th.disable_privacyamplification;
+	bellmode=th.bellmode; rawstreammode=th.rawstreammode;
+	autoblock_bits=th.autoblock_bits; adaptivemode=th.adaptivemode;
+	cascade_passes=th.cascade_passes; statmode=th.statmode;
+	killmode=0; /* there are no raw key files to remove */
+	if (!(fhandle[5]=fopen(fname[5],"w+"))) 
+	    return -emsg(24); /* notify pipeline */
+	handle[5]=fileno(fhandle[5]);
+	blocklist=NULL; rec_packetlist=NULL;
+	next_packet_to_send = NULL; last_packet_to_send = NULL;
+	retval=replay_trace();
+	fclose(tracehandle); fclose(fhandle[5]);
+	if (retval) return -emsg(retval);
+	return 0;
+    }
+
     /* checking parameter cosistency */
     for (i=0;i<8;i++) 
-	if (fname[i][0]==0) 
+	if ((fname[i][0]==0) && !((i==3) && rawstreammode))
 	    return -emsg(17); /* all files and pipes specified ? */
+    if (autoblock_bits && !rawstreammode) return -emsg(88);
+    if (!rawstreammode && epochlog_name(fname[3])) { /* raw key epoch log */
+	if (epochlog_open(&rawlog,epochlog_name(fname[3]),0))
+	    return -emsg(101);
+	rawlogmode=1;
+    }
 
     /* open pipelines */
     if (stat(fname[0],&cmdstat)) return -emsg(18);  /* command pipeline */
@@ -2709,9 +3822,30 @@ int main (int argc, char *argv[]) {
 	return -emsg(27); /* query response pipe */
     handle[7]=fileno(fhandle[7]);
 
+    if (rawstreammode) { /* raw key stream pipeline */
+	if (stat(fname[8],&cmdstat)) return -emsg(81);
+	if (!S_ISFIFO(cmdstat.st_mode)) return -emsg(82);
+	if ((handle[8]=open(fname[8],FIFOINMODE))==-1) return -emsg(81);
+    }
+
+    if (tracemode==1) { /* start trace with the control parameters */
+	if (!(tracehandle=fopen(tracefname,"w"))) return -emsg(91);
+	th.tag=ECD2_TRACE_TAG; th.version=ECD2_TRACE_VERSION;
+	th.errormargin=errormargin; th.initialerr=initialerr;
+	th.intrinsicerr=intrinsicerr; th.runtimeerrormode=runtimeerrormode;
+	th.biconf_rounds=biconf_rounds; th.ini_err_skipmode=ini_err_skipmode;
+	th.disable_privacyamplification=disable_privacyamplification;
+	th.bellmode=bellmode; th.rawstreammode=rawstreammode;
+	th.autoblock_bits=autoblock_bits; th.adaptivemode=adaptivemode;
+	th.cascade_passes=cascade_passes; th.statmode=statmode;
+	if (1!=fwrite(&th,sizeof(struct trace_head),1,tracehandle))
+	    return -emsg(92);
+	fflush(tracehandle);
+    }
+
     /* find largest handle for select call */
     handle[3]=0;handle[4]=0;selectmax=0;
-    for (i=0;i<8;i++) if (selectmax<handle[i]) selectmax=handle[i];
+    for (i=0;i<9;i++) if (selectmax<handle[i]) selectmax=handle[i];
     selectmax+=1;
 
     /* initializing buffers */
@@ -2731,6 +3865,7 @@ int main (int argc, char *argv[]) {
 	FD_SET(handle[6],&readqueue); /* query pipe */
 	FD_SET(handle[2],&readqueue); /* receive pipe */
 	FD_SET(handle[0],&readqueue); /* command pipe */
+	if (rawstreammode) FD_SET(handle[8],&readqueue); /* raw key stream */
 	if (next_packet_to_send || send_index )
 	    FD_SET(handle[1],&writequeue); /* content to send */
 	/* keep timeout short if there is work to do */
@@ -2803,7 +3938,7 @@ int main (int argc, char *argv[]) {
 			    malloc2(sizeof(struct packet_received));
 			if (!msgp) return -emsg(38);
 			/* insert message in message chain */
-			msgp->next=NULL;
+			msgp->next=NULL; msgp->waitstart=0;
 			msgp->length=receive_index;
 			msgp->packet=tmpreadbuf;
 			sbfp = rec_packetlist;
@@ -2817,93 +3952,41 @@ int main (int argc, char *argv[]) {
 		    }
 		}
 	    }
+	    /*  poll raw key stream */
+	    if (rawstreammode && FD_ISSET(handle[8],&readqueue)) {
+		retval2=read_rawkeystream();
+		if (retval2&&(runtimeerrormode==0)){
+		    return -emsg(retval2); /* complain */
+		}
+	    }
 	    /*  check query pipeline */
 	    if (FD_ISSET(handle[6],&readqueue)) {
 		
 	    }
 	    
 	}
-	/* enter working routines for packets here */
-	if ((sbfp=rec_packetlist)) { /* got one message */
-	    receivebuf = sbfp->packet; /* get pointer */
-	    if ( ((unsigned int *)receivebuf)[0] != ERRC_PROTO_tag) {
-		return -emsg(44);
-	    }
-	    /* printf("received message, subtype: %d, len: %d\n",
-		   ((unsigned int *)receivebuf)[2],
-		   ((unsigned int *)receivebuf)[1]);fflush(stdout); */
-    
-	    switch (((unsigned int *)receivebuf)[2]) { /* subtype */
-		case 0: /* received an error estimation packet */
-		    retval=process_esti_message_0(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-		    break;
-		case 2: /* received request for more bits */
-		    retval=send_more_esti_bits(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-
-		    break;
-		case 3: /* reveived error confirmation message */
-		    retval=prepare_dualpass(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-		    break;
-		case 4: /* reveived parity list message */
-		    retval=start_binarysearch(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-		    break;
-		case 5: /* reveive a binarysearch message */
-		    retval=process_binarysearch(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-
-		    break;
-		case 6: /* receive a BICONF initiating request */
-		    retval=generate_biconfreply(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-
-		    break;
-		case 7: /* receive a BICONF parity response */
-		    retval=receive_biconfreply(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-
-		    break;
-		case 8: /* receive a privacy amplification start msg */
-		    retval=receive_privamp_msg(receivebuf);
-		    if (retval) { /* an error occured */
-			if (runtimeerrormode>1) break;
-			return -emsg(retval);
-		    }
-		    break;
-		    
-		default: /* packet subtype not known */
-		    fprintf(stderr,"received subtype %d; ",
-			    ((unsigned int *)receivebuf)[2]);
-		    return -emsg(45);
+	/* enter working routines for packets here. In stream intake mode, a
+	   new block may have to wait for raw key; the packets behind it are
+	   served in the meantime */
+	prevp=NULL; sbfp=rec_packetlist;
+	while (sbfp && rawstreammode && (retval=rawkey_pending(sbfp))) {
+	    if (retval==2) { /* raw key did not come; drop the packet */
+		if (prevp) {prevp->next=sbfp->next;} else {
+		    rec_packetlist=sbfp->next;}
+		free2(sbfp->packet); free2(sbfp);
+		sbfp=prevp?prevp->next:rec_packetlist;
+	    } else {
+		prevp=sbfp; sbfp=sbfp->next;
 	    }
+	}
+	if (sbfp) { /* got one message */
+	    receivebuf = sbfp->packet; /* get pointer */
+	    if ((retval=process_packet(receivebuf))) return -emsg(retval);
 	    /* printf("receive packet successfully digested\n");
 	       fflush(stdout); */
 	    /* remove this packet from the queue */
-	    rec_packetlist = sbfp->next; /* upate packet pointer */
+	    if (prevp) {prevp->next=sbfp->next;} else {
+		rec_packetlist = sbfp->next;} /* upate packet pointer */
 	    free2(receivebuf); /* free data section... */
 	    free2(sbfp); /* ...and pointer entry */
 	}
@@ -2912,5 +3995,7 @@ int main (int argc, char *argv[]) {
     /* close nicely */
     fclose(fhandle[0]);close(handle[1]);close(handle[2]);
     fclose(fhandle[5]);fclose(fhandle[6]);fclose(fhandle[7]);
+    if (rawstreammode) close(handle[8]);
+    if (tracehandle) fclose(tracehandle);
     return 0;
 }
@@ -120,9 +120,11 @@ typedef struct ERRC_ERRDET_5 {
 #define RUNLEVEL_FIRSTPASS 0 /* for message 5 */
 #define RUNLEVEL_SECONDPASS 0x80000000 /* for message 5 */
 #define RUNLEVEL_LEVELMASK 0x80000000 /* for message 5 */
-#define RUNLEVEL_ROUNDMASK 0x3fffffff /* for message 5 */
+#define RUNLEVEL_ROUNDMASK 0x1fffffff /* for message 5 */
 #define RUNLEVEL_BICONF 0x40000000 /* for message 5:
 				      this indicates a biconf search */
+#define RUNLEVEL_MULTIPASS 0x20000000 /* for message 5: entries of all
+					 passes are searched in one round */
 
 
 /* BIOCNF initiating message */
@@ -161,6 +163,23 @@ typedef struct ERRC_ERRDET_8 {
 } errc_ed_8__;	
 #define ERRC_ERRDET_8_subtype 8
 
+/* parity check bit info for more than two passes; followed by the block
+   lengths of all passes and their parity lists */
+typedef struct ERRC_ERRDET_9 {
+    unsigned int tag;               /* 6 for an error correction packet */
+    unsigned int bytelength;        /* the length of the packet incl header */
+    unsigned int subtype;           /* 9 for multi-pass parity packet */
+    unsigned int epoch;             /* defines epoch of first packet */
+    unsigned int number_of_epochs;  /* length of the block */
+    unsigned int passes;            /* number of Cascade passes */
+    unsigned int totalbits;         /* number of bits considered */
+    unsigned int seed;              /* seed for PRNG doing permutations */
+} errc_ed_9__;
+#define ERRC_ERRDET_9_subtype 9
+#define MAX_CASCADE_PASSES 8
+#define MULTIPASS_PASSSHIFT 28 /* index entry: pass in upper bits */
+#define MULTIPASS_BITMASK 0x0fffffff /* ...and start bit in lower bits */
+
 
 
 
@@ -57,6 +57,27 @@ int parity(unsigned int a) {
 
 /* this is an implementation of an m-sequence */
 
+/* The feedback taps 31,30,29 and 9 of the m-sequence allow to advance the
+   generator by 32 steps at once: with a(n)=a(n-32)^a(n-31)^a(n-30)^a(n-10),
+   the next 32 sequence bits N follow from the current state S via
+   N = T ^ (N>>10) ^ (N>>30) ^ (N>>31) with T = S^(S<<1)^(S<<2)^(S<<22). This
+   is resolved from the top bits downwards in three iterations. The sequence
+   is identical to the one produced bit by bit. */
+static inline unsigned int PRNG_step32(unsigned int s) {
+    unsigned int t, n;
+    t = s ^ (s<<1) ^ (s<<2) ^ (s<<22);
+    n = t ^ (t>>10) ^ (t>>30) ^ (t>>31); /* bits 12..31 ok */
+    n = t ^ (n>>10) ^ (n>>30) ^ (n>>31); /* bits 2..31 ok */
+    n = t ^ (n>>10) ^ (n>>30) ^ (n>>31); /* all bits ok */
+    return n;
+}
+
+/* advance a state by k steps (1<=k<=32) */
+static inline unsigned int PRNG_advance(int k, unsigned int s) {
+    if (k==32) return PRNG_step32(s);
+    return (s<<k) | (PRNG_step32(s)>>(32-k));
+}
+
 /* PSRNG fuction which sets a seed */
 unsigned int __PRNG_state;
 void set_PRNG_seed(unsigned int seed) {
@@ -64,36 +85,59 @@ void set_PRNG_seed(unsigned int seed) {
 }
 /* get k bits from PSRNG */
 unsigned int PRNG_value(int k) {
-    int k0;
-    int b;
-    for (k0=k;k0;k0--) {
-	b=parity(__PRNG_state & PRNG_FEEDBACK);
-	__PRNG_state <<= 1; __PRNG_state += b;
-    }
+    __PRNG_state = PRNG_advance(k, __PRNG_state);
     return ((1<<k)-1) & __PRNG_state;
 }
 
 /* version which iterates the PRNG from a given state location */
 unsigned int PRNG_value2(int k, unsigned int *state) {
-    int k0;
-    int b;
-    for (k0=k;k0;k0--) {
-	b=parity( *state & PRNG_FEEDBACK);
-	*state <<= 1; *state += b;
-    }
+    *state = PRNG_advance(k, *state);
     __RNG_calls++;
     return ((1<<k)-1) & *state;
 }
 unsigned int PRNG_value2_32(unsigned int *state) {
-    int k0;
-    int b;
-    for (k0=32;k0;k0--) {
-	b=parity( *state & PRNG_FEEDBACK);
-	*state <<= 1; *state += b;
-    }
+    *state = PRNG_step32(*state);
     __RNG_calls++;
     return *state;
 }
 
+/* bulk versions for mask generation. PRNG_fill writes the next n 32-bit
+   values into buf, PRNG_fill_masked ANDs them with the source d on the way
+   and returns the parity of the resulting mask. Both leave the state and
+   the call count as n calls of PRNG_value2_32 would. */
+void PRNG_fill(unsigned int *buf, int n, unsigned int *state) {
+    unsigned int s = *state;
+    int i;
+    for (i=0;i<n;i++) buf[i] = s = PRNG_step32(s);
+    *state = s;
+    __RNG_calls += n;
+}
+int PRNG_fill_masked(unsigned int *buf, unsigned int *d, int n,
+		     unsigned int *state) {
+    unsigned int s = *state, p = 0;
+    int i;
+    for (i=0;i<n;i++) {
+	s = PRNG_step32(s);
+	p ^= (buf[i] = s & d[i]);
+    }
+    *state = s;
+    __RNG_calls += n;
+    return parity(p);
+}
+
+/* parity of the key bits in d selected by the next n PRNG values, without
+   storing the mask. Used for the compression matrix in privacy
+   amplification. Counts as n calls. */
+int PRNG_masked_parity(unsigned int *d, int n, unsigned int *state) {
+    unsigned int s = *state, p = 0;
+    int i;
+    for (i=0;i<n;i++) {
+	s = PRNG_step32(s);
+	p ^= s & d[i];
+    }
+    *state = s;
+    __RNG_calls += n;
+    return parity(p);
+}
 
 int RNG_calls(void) {return __RNG_calls;};
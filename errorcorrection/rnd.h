@@ -37,3 +37,7 @@ unsigned int PRNG_value(int);
 
 unsigned int PRNG_value2(int, unsigned int *);
 unsigned int PRNG_value2_32(unsigned int *);
+
+void PRNG_fill(unsigned int *, int, unsigned int *);
+int PRNG_fill_masked(unsigned int *, unsigned int *, int, unsigned int *);
+int PRNG_masked_parity(unsigned int *, int, unsigned int *);
@@ -0,0 +1,120 @@
+/* accwin.c:     Part of the quantum key distribution software. Estimate of
+                 accidental coincidences from many windows away from the
+		 coincidence peak. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   costream counts accidental coincidences in a single window of the width
+   of the coincidence window, a distance accdist away from the peak, and
+   only for the event pairs its matcher looks at. That number is small and
+   noisy. Here, every stream-2 event is compared with all stream-1 events
+   in a number of windows on both sides of the peak, the first one ending
+   at accdist and the others following outwards without gaps. Their mean
+   count is the estimate for the accidentals in the coincidence window,
+   and the spread between the windows gives its error.
+
+   The matcher only hands the time of each stream-2 event (shifted by the
+   current time difference) to accwin_add, which notes every step-th of
+   them. Once a batch is full, or the stream-1 packet is about to be
+   replaced, accwin_count looks up the stream-1 events around every noted
+   time in the packet, starting from the position of the matcher in the
+   packet when the event was noted, which is normally at most an event or
+   two away. For each stream-1 event close enough, the time
+   difference is tested against the edges of all windows at once; this
+   loop has a fixed length and no branches, so the compiler vectorizes it.
+   Stream-2 events which are not noted, or whose windows reach beyond the
+   stream-1 packet, are left out, and the estimate is scaled up
+   accordingly. With 8 windows on each side and every fourth event, the
+   estimate still rests on four times the counts of the single window.
+
+*/
+
+#include <math.h>
+#include "accwin.h"
+
+/* prepare windows number of windows on each side of the peak, each of width
+   width, the first ending at a distance dist. Every step-th stream-2 event
+   is used. */
+void accwin_init(struct accwin *a, int windows, int step, long long dist,
+		 long long width) {
+    int k;
+    if (windows>ACCWIN_MAX) windows=ACCWIN_MAX;
+    for (k=0;k<2*ACCWIN_MAX;k++) {
+	a->lower[k]=0; a->upper[k]=0; a->count[k]=0; /* unused: empty */
+    }
+    for (k=0;k<windows;k++) {
+	a->lower[2*k]=dist-width+1+k*width; a->upper[2*k]=dist+1+k*width;
+	a->lower[2*k+1]=-dist-k*width; a->upper[2*k+1]=-dist+width-k*width;
+    }
+    a->windows=windows;
+    a->span=dist+windows*width;
+    a->step=step<1?1:step; a->skip=a->step;
+    a->nb=0; a->used=0; a->seen=0;
+}
+
+/* count the stream-1 events of the packet (n times t1, see evbatch.c) in
+   the windows around the noted stream-2 events, and empty the batch. */
+void accwin_count(struct accwin *a, unsigned long long *t1, int n) {
+    int i, j, k, w, d;
+    long long b, x, first, last;
+
+    if (n<2 || !a->nb) {a->nb=0; return;}
+    first=t1[0]; last=t1[n-1];
+
+    for (i=0;i<a->nb;i++) {
+	b=a->b[i]; x=b-a->span;
+	if (x<first || b+a->span>last) continue; /* not covered */
+	/* first stream-1 event of the windows, normally next to the hint */
+	j=a->hint[i]; if (j>n-1) j=n-1;
+	while (j>0 && (long long)t1[j-1]>=x) j--;
+	while ((long long)t1[j]<x) j++;
+	for (k=j;(long long)t1[k]<b+a->span;k++) {
+	    d=(int)(t1[k]-b);
+	    for (w=0;w<2*ACCWIN_MAX;w++)
+		a->count[w]+=(d>=a->lower[w]) & (d<a->upper[w]);
+	}
+	a->used++;
+    }
+    a->nb=0;
+}
+
+/* estimate of the accidental coincidences in the coincidence window for the
+   stream-2 events since the last call, and its standard error. Clears the
+   counters. */
+void accwin_result(struct accwin *a, double *est, double *err) {
+    int k, m=2*a->windows;
+    double sum=0., sq=0., mean, var, scale;
+
+    if (!a->used || !m) {
+	*est=0.; *err=0.;
+    } else {
+	for (k=0;k<m;k++) {
+	    sum+=a->count[k]; sq+=(double)a->count[k]*a->count[k];
+	}
+	mean=sum/m;
+	scale=(double)a->seen/a->used; /* for stream-2 events left out */
+	*est=mean*scale;
+	var=(m>1)?(sq-sum*mean)/(m-1):mean; /* Poisson for a single window */
+	if (var<0.) var=0.;
+	*err=sqrt(var/m)*scale;
+    }
+    for (k=0;k<2*ACCWIN_MAX;k++) a->count[k]=0;
+    a->used=0; a->seen=0;
+}
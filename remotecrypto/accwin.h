@@ -0,0 +1,55 @@
+/* accwin.h:     Part of the quantum key distribution software. Header for
+                 the multi-window accidental coincidence counter of
+		 costream. Description see accwin.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define ACCWIN_MAX 16    /* windows on each side of the peak */
+#define ACCWIN_BATCH 1024 /* stream-2 times collected before counting */
+
+typedef struct accwin {
+    int windows;   /* on each side; 0: counter off */
+    int lower[2*ACCWIN_MAX], upper[2*ACCWIN_MAX]; /* window edges */
+    long long span; /* outer edge of the farthest window */
+    long long b[ACCWIN_BATCH]; /* stream-2 times in stream-1 time */
+    int hint[ACCWIN_BATCH];    /* stream-1 index of the matcher for each */
+    int nb;         /* entries in b */
+    int step, skip; /* every step-th event is noted; events to go */
+    unsigned int count[2*ACCWIN_MAX]; /* stream-1 events per window */
+    unsigned int used, seen; /* stream-2 events counted / offered */
+} acw;
+
+void accwin_init(struct accwin *a, int windows, int step, long long dist,
+		 long long width);
+void accwin_count(struct accwin *a, unsigned long long *t1, int n);
+void accwin_result(struct accwin *a, double *est, double *err);
+
+/* offer a stream-2 event at time t in stream-1 time, with the index of a
+   stream-1 event close to it. Returns 1 if the batch is full; the caller
+   then runs accwin_count. */
+static inline int accwin_add(struct accwin *a, long long t, int hint) {
+    a->seen++;
+    if (--a->skip) return 0;
+    a->skip=a->step;
+    a->hint[a->nb]=hint;
+    a->b[a->nb++]=t;
+    return a->nb==ACCWIN_BATCH;
+}
@@ -0,0 +1,263 @@
+/* bitbench.c:  Part of the quantum key distribution software. Throughput
+                benchmark for the type-2 decoder in bitunpack.c.
+		Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+   program to measure how many events per second the decoding of a type-2
+   packet takes, from the packed words to absolute times and patterns. It
+   compares the field-by-field decoder with a bit reservoir, as costream,
+   splicer and pfind had it before, with bitunpack(), and checks that both
+   give the same events. For the timing, both decoders
+   write into a buffer of BITUNPACK_BLOCK events which is used over and
+   over, as the programs consume the events block by block; with buffers
+   for a whole epoch, the memory bandwidth would be measured instead.
+
+   The packet is either read from a type-2 file with fixed width differences
+   as chopper writes it, or made up from a Poisson process of the given rate
+   with four detectors, packed with the given width as chopper would do.
+
+   usage: bitbench [-i file] [-r rate] [-Q width] [-n repetitions]
+
+   options:
+   -i file:      type-2 packet to decode. Rice coded packets (chopper -R)
+                 are not supported.
+   -r rate:      events per second for a made-up packet of one epoch
+                 (2^29 nsec). Default is 10000000.
+   -Q width:     bits of the time difference field of a made-up packet.
+                 Default is 17, close to the choice of chopper -Q -1 at
+		 10 Mcps.
+   -n repetitions: how often the packet is decoded with each decoder.
+                 Default is 20.
+
+   output: events per packet, and the events per second of both decoders,
+   from the fastest of the repetitions, which is least disturbed by other
+   processes.
+
+   example: bitbench -r 20000000
+            bitbench -i /tmp/cryptostuff/t2/00001234
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "bitunpack.h"
+
+#define DEFAULT_RATE 10000000
+#define DEFAULT_WIDTH 17
+#define DEFAULT_REPEAT 20
+#define DATABITS 4 /* pattern bits of a made-up packet */
+#define EPOCH_UNITS (1ll<<32) /* epoch length in 1/8 nsec */
+#define TYPE_2_TAG 2
+#define TYPE_2_TAG_U 0x102
+
+char *errormessage[] = {
+  "No error.",
+  "error parsing event rate.", /* 1 */
+  "error parsing difference width (2..27).",
+  "error parsing number of repetitions.",
+  "cannot open or read input file.",
+  "input is not a fixed width type-2 packet.", /* 5 */
+  "cannot malloc buffers.",
+  "decoders disagree.",
+};
+int emsg(int code) {
+  fprintf(stderr,"%s\n",errormessage[code]);
+  return code;
+};
+
+typedef struct header_2 { /* header for type-2 stream packet */
+    int tag;
+    unsigned int epoc;
+    unsigned int length;
+    int timeorder;
+    int basebits;
+    int protocol;
+} h2;
+
+/* bit packer for a made-up packet, as in chopper */
+unsigned int *pk; /* target */
+int pkidx, pkres; /* word index and free bits in the current word */
+void pack(unsigned int v, int bits) {
+    if (bits<pkres) {
+	pk[pkidx]|=v<<(pkres-bits); pkres-=bits;
+    } else {
+	bits-=pkres;
+	pk[pkidx++]|=bits?v>>bits:v;
+	pkres=32-bits;
+	if (bits) pk[pkidx]=v<<pkres;
+    }
+}
+void packevent(unsigned int d, unsigned int p, int timebits) {
+    if (d<(1u<<timebits)) {
+	pack((d<<DATABITS) | p,timebits+DATABITS);
+    } else { /* escape; the pattern field carries the upper bits */
+	pack(d>>(32-DATABITS),timebits+DATABITS);
+	pack((d<<DATABITS) | p,32);
+    }
+}
+
+/* field-by-field decoder with a bit reservoir, as used before bitunpack.c.
+   Event n goes to index n&mask. */
+int olddecode(unsigned int *src, int length, int timebits, int databits,
+	      unsigned long long *times, unsigned char *pattern, int mask) {
+    int width=timebits+databits, res=32, j=0, n;
+    unsigned int rw=src[j++], td, pat, opat;
+    unsigned int tmask=(1u<<timebits)-1, pmask=(1u<<databits)-1;
+    unsigned long long t=0;
+
+    for (n=0;n<length;n++) {
+	if (res>=width) {
+	    td=rw>>(res-width); res-=width;
+	    if (!res) {rw=src[j++]; res=32;}
+	} else {
+	    res=width-res; td=rw<<res;
+	    rw=src[j++]; res=32-res; td|=rw>>res;
+	}
+	pat=td&pmask; td>>=databits;
+	if ((td&=tmask)) {
+	    if (td==1) break; /* end of stream */
+	} else { /* long difference */
+	    td=rw<<(32-res); rw=src[j++];
+	    if (res&0x1f) td|=rw>>res;
+	    opat=pat; pat=td&pmask; td>>=databits;
+	    td|=opat<<(32-databits);
+	}
+	t+=td; times[n&mask]=t; pattern[n&mask]=pat;
+    }
+    return n;
+}
+
+/* the same with bitunpack(); with block set, every block goes to the start
+   of times and pattern */
+int newdecode(unsigned int *src, int words, int timebits, int databits,
+	      unsigned long long *times, unsigned char *pattern, int length,
+	      int block) {
+    struct bitstream s;
+    unsigned long long t=0;
+    int k=0, m, i=0;
+
+    bitunpack_init(&s,src,words,timebits,databits);
+    while (k<=length &&
+	   (m=bitunpack(&s,&t,0,times+i,pattern+i,BITUNPACK_BLOCK))) {
+	k+=m;
+	i=block?0:k;
+    }
+    return k;
+}
+
+double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    double rate=DEFAULT_RATE;
+    int width=DEFAULT_WIDTH, repeat=DEFAULT_REPEAT;
+    char *infile=NULL;
+    struct header_2 head;
+    struct stat st;
+    unsigned int *src;
+    unsigned char *p1, *p2;
+    unsigned long long *t1, *t2;
+    int words, length, n, k, i, r, opt, handle;
+    double t0, dt, told=1e9, tnew=1e9;
+
+    opterr=0; /* be quiet when there are no options */
+    while ((opt=getopt(argc, argv, "i:r:Q:n:")) != EOF) {
+	switch (opt) {
+	    case 'i': infile=optarg; break;
+	    case 'r':
+		if (1!=sscanf(optarg,"%lf",&rate) || rate<=0) return -emsg(1);
+		break;
+	    case 'Q':
+		if (1!=sscanf(optarg,"%d",&width) || width<2 || width>27)
+		    return -emsg(2);
+		break;
+	    case 'n':
+		if (1!=sscanf(optarg,"%d",&repeat) || repeat<1) return -emsg(3);
+		break;
+	}
+    }
+
+    if (infile) { /* packet from chopper */
+	if ((handle=open(infile,O_RDONLY))<0 || fstat(handle,&st))
+	    return -emsg(4);
+	if (read(handle,&head,sizeof(head))!=sizeof(head)) return -emsg(4);
+	if (head.tag!=TYPE_2_TAG && head.tag!=TYPE_2_TAG_U) return -emsg(5);
+	words=(st.st_size-sizeof(head))/sizeof(unsigned int);
+	if (!(src=malloc((words+2)*sizeof(unsigned int)))) return -emsg(6);
+	if (read(handle,src,words*sizeof(unsigned int))
+	    !=words*sizeof(unsigned int)) return -emsg(4);
+	close(handle);
+	src[words]=src[words+1]=0;
+	length=head.length;
+    } else { /* made-up packet of one epoch */
+	length=(int)(rate*EPOCH_UNITS/8e9);
+	head.timeorder=width; head.basebits=DATABITS;
+	/* worst case: every event escapes */
+	words=(length+1)*(width+DATABITS+32)/32+2;
+	if (!(pk=calloc(words,sizeof(unsigned int)))) return -emsg(6);
+	pkidx=0; pkres=32;
+	srand(1);
+	for (i=0;i<length;i++) {
+	    /* exponential difference, at least 2 as in chopper */
+	    n=(int)(-log((rand()+1.0)/(RAND_MAX+1.0))*8e9/rate);
+	    packevent(n<2?2:n,1<<(rand()&3),width);
+	}
+	pack(1<<DATABITS,width+DATABITS); /* end token */
+	src=pk; words=pkidx+1;
+    }
+
+    /* bitunpack may deliver a block beyond the length of a bad packet */
+    p1=malloc(length+1);
+    p2=malloc(length+BITUNPACK_BLOCK);
+    t1=malloc((length+1)*sizeof(unsigned long long));
+    t2=malloc((length+BITUNPACK_BLOCK)*sizeof(unsigned long long));
+    if (!p1 || !p2 || !t1 || !t2) return -emsg(6);
+
+    /* check on the whole packet */
+    n=olddecode(src,length,head.timeorder,head.basebits,t1,p1,-1);
+    k=newdecode(src,words,head.timeorder,head.basebits,t2,p2,length,0);
+    if (n!=k) return -emsg(7);
+    for (i=0;i<n;i++) if (t1[i]!=t2[i] || p1[i]!=p2[i]) return -emsg(7);
+
+    for (r=0;r<repeat;r++) { /* alternating, so both see the same load */
+	t0=now();
+	olddecode(src,length,head.timeorder,head.basebits,t1,p1,
+		  BITUNPACK_BLOCK-1);
+	dt=now()-t0;
+	if (dt<told) told=dt;
+	t0=now();
+	newdecode(src,words,head.timeorder,head.basebits,t2,p2,length,1);
+	dt=now()-t0;
+	if (dt<tnew) tnew=dt;
+    }
+
+    printf("events per packet: %d, difference width: %d\n",n,head.timeorder);
+    printf("bit reservoir: %.1f Mevents/s\tbitunpack: %.1f Mevents/s\n",
+	   n/told/1e6,n/tnew/1e6);
+    return 0;
+}
@@ -0,0 +1,68 @@
+/* bitunpack.h:  Part of the quantum key distribution software. Header for
+                 the block decoder of type-2 and type-4 streams used by
+		 costream, splicer and pfind. Description see bitunpack.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define BITUNPACK_BLOCK 4096 /* suggested number of events per call */
+
+/* adaptive Rice coding of type-2 time differences, see bitunpack.c */
+#define RICE_QMAX 16 /* unary length at which a difference goes out in full */
+#define RICE_KMAX 27 /* keeps remainder and pattern within 32 bits */
+#define RICE_MEANSHIFT 4 /* running mean over about 16 events */
+
+/* Rice parameter for a running mean, which is kept times 2^RICE_MEANSHIFT.
+   Encoder and decoder have to use exactly this rule. */
+static inline int rice_k(unsigned long long mean) {
+    int k=63-__builtin_clzll(mean|1)-RICE_MEANSHIFT;
+    return k<0?0:(k>RICE_KMAX?RICE_KMAX:k);
+}
+static inline void rice_update(unsigned long long *mean, unsigned int diff) {
+    *mean+=diff-(*mean>>RICE_MEANSHIFT);
+}
+/* initial mean for a start parameter k0 from the packet header */
+#define RICE_MEAN0(k0) ((1ull<<(k0))<<RICE_MEANSHIFT)
+
+/* choice of the difference width for the packers, see bitunpack.c */
+#define WIDTHHIST_SIZE 33 /* bins for 0..32 significant bits */
+static inline int widthhist_bin(unsigned int d) {
+    return d?32-__builtin_clz(d):0;
+}
+
+typedef struct bitstream {
+    unsigned int *src; /* packed data after the header */
+    int words;         /* valid words in src */
+    long long pos;     /* bit position of the next field */
+    int timebits;      /* width of the time (or index) difference field */
+    int databits;      /* width of the pattern field */
+    int ended;         /* end-of-stream token was seen */
+    int rice;          /* stream is Rice coded */
+    unsigned int left; /* events left in a Rice coded stream */
+    unsigned long long mean; /* adaptation state of a Rice coded stream */
+} bs;
+
+void bitunpack_init(struct bitstream *s, unsigned int *src, int words,
+		    int timebits, int databits);
+void bitunpack_rice_init(struct bitstream *s, unsigned int *src, int words,
+			 int k0, int databits, unsigned int length);
+int bitunpack(struct bitstream *s, unsigned long long *t, unsigned int bias,
+	      unsigned long long *times, unsigned char *pattern, int n);
+int widthhist_best(unsigned int *hist, int minwidth, int maxwidth);
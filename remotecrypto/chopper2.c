@@ -39,7 +39,8 @@
 		   [-l logfile ] [-V verbosity] [ -F ]
 		   [-U | -L]
 		   [-m maxtime ]
-		   [-4 | -6] 
+		   [-s s1,s2,s3,s4 ] [-Y y1,y2,y3,y4 ]
+		   [-4 | -6] [-C profile]
 		   
    implemented options:
    
@@ -52,7 +53,12 @@
 		    named fname1
    -D dir1:         All type-1 packets are saved into the directory dir1, with
                     the file name being the epoch (filling zero expanded)
-		    in hex. Filename is not padded at end.
+		    in hex. Filename is not padded at end. If dir1 has the
+		    form shm:name, the packets go into the shared memory ring
+		    /dev/shm/name instead (see shmring.c), which a costream
+		    on the same machine reads with -D shm:name. With the form
+		    log:dir, they are appended to the segmented epoch log in
+		    directory dir (see epochlog.c).
  ENCODING OPTIONS:
    -U:      universal epoch; the epoch is not only derived from the timestamp
             unit digits, but normalized to unix time origin. This needs the
@@ -94,6 +100,23 @@ PROTECTION OPTION
 		 timing information. Default set to 0, which corresponds to
 		 this option being switched off. Time units is in microseconds.
 
+CORRECTION OPTIONS
+   -s s1,s2,s3,s4: detector skew in multiples of 125ps. This time is added
+                 to events of a single detector, as with readevents3 -d,
+		 before the events are cut into epochs. Events which the
+		 skew moves in front of earlier ones of the same read are
+		 put back into time order.
+   -Y y1,y2,y3,y4: detector dead times in multiples of 125ps. An event of a
+                 single detector within this time after the previous event
+		 of that detector is dropped, as with readevents3 -Y.
+		 Both corrections are done on each block of events read, in
+		 a separate pass (see evcorrect.c).
+
+PLACEMENT OPTION
+   -C profile:   cores, NUMA node and huge pages for this process, in the
+                 form cpus[:node[:h]] (see cpupin.c). With h, the type-1
+		 output buffer is backed by huge pages.
+
 History:
 started coding 21.8.05 chk
 compiles 22.8.05 chk
@@ -105,6 +128,11 @@ inserted -V 3 option
 checked rollover problem in neg difference test 070306chk
 merges with 6-detector version and introduced -4 compat option 29.7.09chk
 made debuglog file optional 10.2.13chk
+output into a shared memory ring with -D shm:name
+output into a segmented epoch log with -D log:dir
+detector skew -s and dead time -Y corrections (evcorrect.c)
+placement on cores, NUMA node and huge pages with -C (cpupin.c)
+type-1 output buffer grows with the event rate (growbuf.c)
 
 ToDo:
 check buffer sizes
@@ -121,6 +149,11 @@ remove fishyness correction; obsolete with USB hardware??
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
+#include "shmring.h"
+#include "epochlog.h"
+#include "evcorrect.h"
+#include "cpupin.h"
+#include "growbuf.h"
 
 /* default definitions etc. */
 #define DEFAULT_VERBOSITY 0
@@ -128,7 +161,7 @@ remove fishyness correction; obsolete with USB hardware??
 #define FNAMFORMAT "%200s"   /* for sscanf of filenames */
 #define DEFAULT_UEPOCH 0   /* choose no universal epoch option */
 #define INBUFENTRIES 1024 /* max. elements in input buffer */
-#define TYPE1_BUFFERSIZE 3200000  /* should be sufficient for 700kcps events */
+#define TYPE1_BUFFERSIZE 3200000  /* initial size; grows with the rate */
 #define DEFAULT_FIRSTEPOCHDELAY 60 /* first epoch delay in seconds */
 #define FILE_PERMISSONS 0644  /* for all output files */
 #define RETRYREADWAIT 500000 /* sleep time in usec after an empty read */
@@ -143,7 +176,10 @@ char fname1[FNAMELENGTH]="";  /* input file name */
 char logfname[FNAMELENGTH]="";   /* log file name */
 char debugfname[FNAMELENGTH]=""; /* for debugging info */
 int type1mode = 0; /* no mode defined. other tpyes:
-		      1: single file, 2: directory save, ... */
+		      1: single file, 2: directory save, 3: shared memory
+		      ring, 4: epoch log */
+struct shmring ring1; /* for type 3 */
+struct epochlog elog1; /* for type 4 */
 int uepoch= DEFAULT_UEPOCH; /* universal epoch mode 0: no, 1: yes */
 int handlein, handle1; /* in and out file handles */
 FILE* loghandle; /* for log file */
@@ -151,7 +187,8 @@ int thisepoch_converted_entries; /* for output buffer */
 int detcnts[16]; /* buffer for histogramming events */
 int sum[7]; /* do summation */
 int index1; /* index in outbuffer field */
-unsigned int *outbuf1; /* output buffer pointer */
+struct growbuf gbuf1; /* type-1 output buffer, kept across epochs */
+unsigned int *outbuf1; /* its current storage */
 int flushmode = DEFAULT_FLUSHMODE;
 FILE *debuglog;
 
@@ -184,7 +221,12 @@ char *errormessage[] = {
     "error reading max time difference value (must be >=0)",
     "cannot read debugfile name",
     "cannot open debug file",
-
+    "cannot attach shared memory ring.", /* 20 */
+    "cannot open epoch log directory.",
+    "wrong skew format. needs -s s1,s2,s3,s4",
+    "wrong dead time format. needs -Y y1,y2,y3,y4",
+    "error parsing -C profile (cpus[:node[:h]]).",
+    "cannot apply -C profile.", /* 25 */
 };
 
 int emsg(int code) {
@@ -285,11 +327,19 @@ int close_epoch() {
 	    break;
     }
     /* write header 1 and content */
-    retval=write(handle1,&head1,sizeof(struct header_1));
-    if (retval!=sizeof(struct header_1)) return 14;  /* cannot write header */
     i=index1*sizeof(unsigned int);
-    retval=write(handle1,outbuf1,i);
-    if (retval!=i) return 15; /* cannot write content */
+    if (type1mode==3) { /* one packet into the ring */
+	if (shmring_put(&ring1,1,head1.epoc,&head1,sizeof(struct header_1),
+			outbuf1,i,SHMRING_TIMEOUT_MS)) return 15;
+    } else if (type1mode==4) { /* append to the log */
+	if (epochlog_append(&elog1,1,head1.epoc,&head1,
+			    sizeof(struct header_1),outbuf1,i)) return 15;
+    } else {
+	retval=write(handle1,&head1,sizeof(struct header_1));
+	if (retval!=sizeof(struct header_1)) return 14; /* cannot write header */
+	retval=write(handle1,outbuf1,i);
+	if (retval!=i) return 15; /* cannot write content */
+    }
 
     /* eventually close stream 1 */
     switch (type1mode) {
@@ -369,11 +419,14 @@ int main (int argc, char *argv[]) {
     int fishyness = 0;  /* how many outlying events are acceptable */
     unsigned long long maxdiff = DEFAULT_MAXDIFF; /* max evt time difference */
     unsigned long long t_new, t_old, t_fine; /* for consistecy checks */
+    int dskew[4] = {0,0,0,0}; /* detector skews */
+    unsigned int ddead[4] = {0,0,0,0}; /* detector dead times */
+    struct evcorrect corr; /* skew and dead time correction */
 
 
     /* parse options */
     opterr=0; /* be quiet when there are no options */
-    while ((opt=getopt(argc, argv, "i:O:D:l:V:ULFm:4d:")) != EOF) {
+    while ((opt=getopt(argc, argv, "i:O:D:l:V:ULFm:4d:s:Y:C:")) != EOF) {
 	switch(opt) {
 	    case 'V': /* set verbosity level */
 		if (1!=sscanf(optarg,"%d",&verbosity_level)) return -emsg(1);
@@ -388,6 +441,8 @@ int main (int argc, char *argv[]) {
 		fname1[FNAMELENGTH-1]=0;  /* security termination */
 		if (type1mode) return -emsg(4); /* already defined mode */
 		if (opt=='O') type1mode=1; else type1mode=2;
+		if (opt=='D' && shmring_name(fname1)) type1mode=3;
+		if (opt=='D' && epochlog_name(fname1)) type1mode=4;
 		break;
 	    case 'U': /* universal time epoch mode */
 		uepoch=1;
@@ -414,6 +469,20 @@ int main (int argc, char *argv[]) {
 		if (sscanf(optarg,FNAMFORMAT,debugfname) != 1) return -emsg(18);
 		debugfname[FNAMELENGTH-1]=0;  /* security termination */
 		break;
+	    case 's': /* detector skews */
+		if (4!=sscanf(optarg,"%d,%d,%d,%d",&dskew[0],&dskew[1],
+			      &dskew[2],&dskew[3])) return -emsg(22);
+		break;
+	    case 'Y': /* detector dead times */
+		if (4!=sscanf(optarg,"%u,%u,%u,%u",&ddead[0],&ddead[1],
+			      &ddead[2],&ddead[3])) return -emsg(23);
+		break;
+	    case 'C': /* cores, node and huge pages */
+		switch (cpupin_setup(optarg)) {
+		    case CPUPIN_SYNTAX: return -emsg(24);
+		    case CPUPIN_ERROR: return -emsg(25);
+		}
+		break;
 	        
 	}
     }
@@ -427,13 +496,15 @@ int main (int argc, char *argv[]) {
    
     if (debuglog) fprintf(debuglog,"starting chopper2\n");
 
+    evcorrect_init(&corr,dskew,ddead,4,EVCORRECT_SHIFT);
+
     /* prepare input buffer */
     inbuffer=(struct rawevent *)malloc(INBUFENTRIES*sizeof(struct rawevent));
     ibf2=(char *)inbuffer; 
     if (!inbuffer) return -emsg(6); /* cannot get inbuffer */
     /* initiate output buffer */
-    outbuf1=(unsigned int*)malloc(TYPE1_BUFFERSIZE*sizeof(struct rawevent));
-    if (!outbuf1) return -emsg(7);
+    if (growbuf_init(&gbuf1,TYPE1_BUFFERSIZE)) return -emsg(7);
+    outbuf1=gbuf1.buf;
 
     /* open input file */
     if (!infilename[0]) { /* check if a name was assigned */
@@ -474,6 +545,13 @@ int main (int argc, char *argv[]) {
 	    handle1=open(fname1,O_WRONLY|O_CREAT|O_TRUNC,FILE_PERMISSONS);
 	    if (-1==handle1) return -emsg(11);
 	    break;
+	case 3: /* shared memory ring */
+	    if (shmring_open(&ring1,shmring_name(fname1),SHMRING_DEFAULTSIZE))
+		return -emsg(20);
+	    break;
+	case 4: /* epoch log */
+	    if (epochlog_open(&elog1,epochlog_name(fname1),1)) return -emsg(21);
+	    break;
     };
 
     /* main conversion loop */
@@ -501,6 +579,13 @@ int main (int argc, char *argv[]) {
 	inbytesread+=i1; /* add leftovers from last time */
 	inelements=inbytesread/sizeof(struct rawevent);
 	inpointer=inbuffer;
+	/* detector skew and dead time; only whole events are touched, so the
+	   leftover bytes stay in place */
+	inelements=evcorrect_apply(&corr,(unsigned int *)inbuffer,inelements);
+	if (!inelements) continue;
+	/* room for all of them and the terminal word in the current epoch */
+	if (growbuf_reserve(&gbuf1,index1+2*inelements+2)) return -emsg(7);
+	outbuf1=gbuf1.buf;
 
 	/* main digesting loop */
    	do {
@@ -597,6 +682,7 @@ int main (int argc, char *argv[]) {
     if (verbosity_level>=0) fclose(loghandle);
 
     /* free buffers */
-    free(inbuffer); free(outbuf1);
+    free(inbuffer);
+    growbuf_free(&gbuf1);
     return 0;    
 }
@@ -0,0 +1,103 @@
+/* chsh.c:       Part of the quantum key distribution software. Counts of
+                 the Bell test events of the device-independent protocols,
+		 and the CHSH value obtained from them.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   In the device-independent protocols (-p 3 and 4), every test event ends
+   up in stream 5 as a 4 bit value v=(A<<2)|B, with A the detector on side
+   A (splicer) and B the one on side B (costream). Bit 0 of a detector
+   index is the measurement setting, bit 1 the outcome. The Bell value was
+   so far obtained by external scripts from the stream-5 files.
+
+   Here, the events of a block are counted for all 16 values at once.
+   chsh_count takes the out patterns of a block as splicer has them, and
+   counts the ones which are tag+v; for each value, this is a loop of fixed
+   length without branches, which the compiler vectorizes. chsh_packed
+   does the same for the packed 4 bit values of a stream-5 buffer.
+
+   The counts are kept per epoch in the statistics page (epochstat.c), and
+   chsh_value turns the counts of any range of epochs into the CHSH value
+
+     S = E(0,0) - E(0,1) + E(1,0) + E(1,1)
+
+   with the correlation E(a,b) for settings a and b from the coincidences
+   with equal and different outcomes, and its standard error from the
+   binomial errors of the four correlations.
+
+*/
+
+#include <math.h>
+#include "chsh.h"
+
+#define BLOCK 1024 /* values unpacked at once by chsh_packed */
+
+/* add the number of entries tag+v in the n patterns pat to counts[v], for
+   all test values v */
+void chsh_count(unsigned int *counts, unsigned int *pat, int n,
+		unsigned int tag) {
+    const unsigned int * __restrict x=pat;
+    unsigned int s, t;
+    int v, j;
+
+    for (v=0;v<CHSH_PATTERNS;v++) {
+	t=tag+v; s=0;
+	for (j=0;j<n;j++) s+=(x[j]==t);
+	counts[v]+=s;
+    }
+}
+
+/* same for n 4 bit values, packed from the most significant bits of the
+   words on */
+void chsh_packed(unsigned int *counts, unsigned int *words, int n) {
+    unsigned int x[BLOCK];
+    int i, j, m;
+
+    for (i=0;i<n;i+=BLOCK) {
+	m=(n-i<BLOCK)?n-i:BLOCK;
+	for (j=0;j<m;j++)
+	    x[j]=(words[(i+j)/8]>>(28-4*((i+j)&7))) & 0xf;
+	chsh_count(counts,x,m,0);
+    }
+}
+
+/* CHSH value s and its standard error err from the counts of the 16 test
+   values. Returns 0, or -1 if a pair of settings has fewer than
+   CHSH_MINEVENTS events; with a handful of events, the correlations and
+   their error say nothing. */
+int chsh_value(double *counts, double *s, double *err) {
+    double eq, ne, n, e[4], var=0.;
+    int a, b, k;
+
+    for (k=0;k<4;k++) {
+	a=k>>1; b=k&1; /* settings on sides A and B */
+	/* outcomes equal: A and B differ only in the setting bit */
+	eq=counts[(a<<2)|b]+counts[(a<<2)|b|0xa];
+	ne=counts[(a<<2)|b|2]+counts[(a<<2)|b|8];
+	n=eq+ne;
+	if (n<CHSH_MINEVENTS) return -1;
+	e[k]=(eq-ne)/n;
+	var+=4.*eq*ne/(n*n*n);
+    }
+    *s=e[0]-e[1]+e[2]+e[3];
+    *err=sqrt(var);
+    return 0;
+}
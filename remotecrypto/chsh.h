@@ -0,0 +1,32 @@
+/* chsh.h:       Part of the quantum key distribution software. Header for
+                 the CHSH correlator counts of the device-independent
+		 protocols. Description see chsh.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define CHSH_BITS 4       /* bits of a stream-5 test value */
+#define CHSH_PATTERNS 16  /* test values (A<<2)|B */
+#define CHSH_MINEVENTS 100 /* events per pair of settings for a value */
+
+void chsh_count(unsigned int *counts, unsigned int *pat, int n,
+		unsigned int tag);
+void chsh_packed(unsigned int *counts, unsigned int *words, int n);
+int chsh_value(double *counts, double *s, double *err);
@@ -47,11 +47,15 @@
 		  [-l logfile1] [-L logfile2] [-m logfile3] [-M logfile4]
 		  [-n logfile5] [-V verbosity]
 		  [-T zeroeventpolicy ]
-		  [-G flushmode ]
-		  [-a accidendist ]
+		  [-G flushmode ] [-P statname ]
+		  [-a accidendist ] [-A windows[,step] ]
   		  [-H histogramname ]
   		  [-h histogramlength ] 
-		  [-S s1,s2,s3,s4 ]
+		  [-g depth[,binwidth] ]
+		  [-X candidates,spacing ]
+		  [-S s1,s2,s3,s4 ] [-Y y1,y2,y3,y4 ]
+		  [-j ] [-C profile ]
+	 costream -Z linkfile [-W workers] [-C profile ]
 		  
   DATA STREAM OPTIONS:
    -i infile2:      filename of type-2 packets. Can be a file or a socket
@@ -76,6 +80,15 @@
    -f dir3:         same as option -d, but for type-3 files
    -b bellfile:     same as option -O, but for type-3 BELL files
    -B belldir:      same as option -d, but for type-3 BELL directories
+                    Any of the directories dir1, dir2, dir3, dir4 and belldir
+		    can have the form shm:name; the packets then go through
+		    the shared memory ring /dev/shm/name (see shmring.c),
+		    written by chopper2 -D shm:name, chopper -D shm:name or
+		    read by splicer -d/-D shm:name on the same machine. Older
+		    epochs found in an input ring are skipped. With the form
+		    log:dir, they go through the segmented epoch log in the
+		    directory dir instead (see epochlog.c); -k and -K then
+		    remove input segments which have been read completely.
 
    -k :             if set, type-2 streams are removed after consumption
 		    if the directory input has been chosen.
@@ -92,6 +105,16 @@
    -a accdist       distance between the real coincidence winow and the 
                     window for accidental coincidences in 1/8 nsec. default is
 		    160 (corresp. to 20 nsec)
+   -A windows[,step] number of windows on each side of the coincidence peak
+                    used to estimate accidental coincidences (1 to 16,
+		    default 8). The windows have the width of the
+		    coincidence window; the first ends at accdist and the
+		    others follow outwards. Every step-th stream-2 event
+		    (default 4) is compared with all stream-1 events in these
+		    windows (accwin.c); the mean count, scaled to all events,
+		    and its standard error are logged with verbosity 6 and
+		    published with -P. A windows value of 0 switches this
+		    off.
 		    
    -p protocolindex defines the working protocol. Currently implemented:
                     0: service mode, emits all bits into stream 3 locally
@@ -111,7 +134,10 @@
    -R servoconst    filter time constant for stream 4 bitlength optimizer.
                     The larger the num, the longer the memory of the filter.
 		    for num=0, no change will take place. This is also the
-		    default.
+		    default. For num=-1, the bit number is chosen for each
+		    epoch from a histogram of its own index differences such
+		    that the type-4 packet is shortest; stream 4 is then
+		    packed when the epoch is complete.
    -t timediff      time difference between the t1 and t2 input streams. This
                     is a mandatory option, and defines the initial time
 		    difference between the two local reference clocks in
@@ -129,12 +155,36 @@
                     no histogram is taken or sent. For a histogram to be
                     prepred the mode of operation must be 0 (service info) to
 		    obtain the full 4x4 matrix (or 4x6 for proto3+4).
+                    If the name is of the form shm:name, the histograms are
+		    not written as text files but published in binary form
+		    in the shared memory segment /dev/shm/name (see
+		    histring.c), where monitoring programs can poll them.
    -h histolen      number of epochs to be included in a histogram file.
                     default is 10.
+   -g depth,width   geometry of the histogram: number of time bins (default
+                    128) and optionally the bin width in multiples of 125ps,
+		    which has to be a power of two (default 1).
+   -X num,spacing   offset bank for re-locking after time jumps. Besides the
+                    tracked time difference, num candidate offsets on each
+		    side of it, spaced by spacing (in multiples of 125ps),
+		    are checked for coincidences. Once one of them collects
+		    32 coincidences and four times more than the tracked
+		    value, the time difference jumps by its offset. num can
+		    be 1 to 7; the spacing should be at least twice the
+		    coincidence window. Default is off.
    -S s1,s1,s3,s4   detector skew information. This option adds a detector-
                     dependent skew time to single-detection events. This option
 		    makes only sense for some nonstandard applications and
 		    is similar to the detector skew option in readevent3.c
+		    Skews are in multiples of 125ps. Events which the skew
+		    moves in front of earlier ones are put back into time
+		    order.
+   -Y y1,y2,y3,y4   detector dead times in multiples of 125ps. An event of a
+                    single detector within this time after the previous event
+		    of that detector is ignored, as with readevents3 -Y.
+		    Skew and dead time are applied while a stream-1 packet
+		    is converted for the coincidence search (see evbatch.c
+		    and evcorrect.c).
    
   LOGGING & NOTIFICATION:
    -l logfile1:  notification target for consumed epochs of type-1 packets.
@@ -161,12 +211,54 @@
 		     difference,estimated accidental coincidences, and
 		     accepted coincidences with text
 		 5 : same as verbo 4, but without any text inbetween
+		 6 : same as verbo 5, followed by the accidentals estimated
+		     from the windows of the -A option and its standard
+		     error
    -G mode       flushmode. If 0, no fflush takes place after each processed
                  packet. different levels:
                  0: no flushing
 		 1: logfile4 gets flushed
 		 2: logfiles for stream3, stream4, standardlog get flushed
 		 3: all logs get flushed
+   -P statname   publish the statistics of every epoch (events in streams 1
+                 and 2, sifted events, accidental and true coincidences,
+		 servoed time difference, stream-4 bit width) together with
+		 running totals and histograms of the per-epoch rates in the
+		 shared memory page /dev/shm/statname (see epochstat.c),
+		 independent of verbosity and flush mode. A leading shm: is
+		 ignored. With protocol 3, the page also carries the counts
+		 of the 16 Bell test values of stream 5 per epoch and in
+		 total (see chsh.c), from which ecd2 -i -S takes the CHSH
+		 value.
+
+  PROCESSING OPTIONS:
+   -j            pipelined mode. The stream-2 packets are read and decoded
+                 in a separate thread, and the packing and writing of
+		 streams 3, 4 and 5 is done in another thread. The threads
+		 are connected to the coincidence matcher by lock-free single
+		 producer/single consumer rings. The output is identical to
+		 the default single-thread mode.
+   -Z linkfile   link mode: one process serves several links to different
+                 partners. Each line of linkfile holds the options of one
+		 link as they would be given on the command line; empty
+		 lines and lines starting with # are ignored. Every link
+		 has its own input and output streams, logs, time
+		 difference tracking and debug log costream_tlog.n, with n
+		 the number of the link in the file, and produces the same
+		 output as a separate costream process. Error messages are
+		 prefixed with the link number, and a failing link does
+		 not stop the others. The program ends when all links have
+		 ended.
+   -W workers    number of links which process data at the same time in link
+                 mode. A link waiting for an input file, or with -j for
+		 its decoder or encoder thread, does not count; these
+		 threads take no slots of their own.
+		 Default is the number of processors.
+   -C profile    run on the cores and NUMA node given in profile, of the form
+                 cpus[:node[:h]] (see cpupin.c); the pipeline threads and
+		 the links of -Z all inherit the placement. With h, the
+		 packet buffers and event batches go to huge pages. Like
+		 -Z and -W, this option is not accepted in a link file.
 
 
 
@@ -186,6 +278,38 @@
    hopefully repaired date overflow bug in bit #63  18.10.06chk
    added detector deskew option -S for special apps 11.5.10chk
    merged in Ekert protocol modifications from separate branch 29.7.11chk
+   split into decoder, matcher and encoder stages; option -j runs them as a
+   pipeline in separate threads.
+   coincidence loop and stream packing are compiled in variants for each
+   protocol, histogramming and tracking mode, and selected at startup.
+   input files in directories are picked up on inotify completion events
+   (see epochwait.c) instead of polling.
+   input files in directories are mapped and decoded in place; no size limit.
+   output buffers grow with the event rate (growbuf.c).
+   stream 2 is unpacked in blocks of events (bitunpack.c).
+   -R -1 picks the optimal stream-4 bit number for each epoch.
+   reads Rice coded stream-2 packets from chopper -R.
+   streams can go through shared memory rings (shm:name, see shmring.c).
+   streams can go through segmented epoch logs (log:dir, see epochlog.c).
+   histograms are double buffered and written out by the encoder stage;
+   -H shm:name publishes them in binary form (histring.c), -g sets depth and
+   bin width.
+   -X keeps a bank of candidate offsets to re-lock after time jumps.
+   catch-up: with a backlog of epoch files in the input directories, files
+   are taken without settling delay and read ahead, so stored epochs are
+   processed at full speed; live operation resumes by itself.
+   all state of a run is kept in a struct linkstate; -Z serves several links
+   from one process, scheduled on -W worker slots.
+   -S skew and new -Y dead time are applied to stream-1 packets while they
+   are converted into event batches instead of in the coincidence loop.
+   -P publishes the per-epoch statistics in shared memory (epochstat.c).
+   accidentals are also estimated from several windows around the peak, with
+   error (-A, accwin.c); verbosity 6 logs them.
+   stream-1 packets and stream-2 blocks are converted into column-oriented
+   event batches (evbatch.c) before the matcher reads them.
+   -C pins the process to cores, a NUMA node and huge pages (cpupin.c).
+   with protocol 3, -P counts the Bell test values of stream 5 per epoch for
+   the CHSH value (chsh.c).
 
 
   ToDo:
@@ -209,6 +333,21 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "epochwait.h"
+#include "growbuf.h"
+#include "bitunpack.h"
+#include "shmring.h"
+#include "epochlog.h"
+#include "histring.h"
+#include "epochstat.h"
+#include "evcorrect.h"
+#include "accwin.h"
+#include "evbatch.h"
+#include "chsh.h"
+#include "cpupin.h"
 
 /* default definitions */
 #define DEFAULT_VERBOSITY 0
@@ -235,21 +374,40 @@
 #define DEFAULT_WAITFORFILE 550000 /* usleep after unsuccessful file tsts */
 #define DEFAULT_WAITWRITTEN 100000 /* wait 100 ms after file has appeared */
 #define MAXFILETESTS 40 /* wait for about 22 seconds for a file to arrive */
+#define CATCHUP_DEPTH 4 /* epoch files read ahead when there is a backlog */
 #define DEFAULT_FLUSHMODE 0 /* no flush */
 #define DEFAULT_ACCDIST 160 /* 20 nsec outsinde coincidence window */
+#define DEFAULT_ACCWINDOWS 8 /* windows for accidentals on each side */
+#define DEFAULT_ACCSTEP 4 /* stream-2 events per event used for them */
 #define DEFAULT_HISTODEPTH 128 /* number of timebins recorded */
+#define MAX_HISTODEPTH 65536 /* largest number of timebins */
+#define MAX_HISTOBINWIDTH 65536 /* largest bin width in 1/8 nsec */
+#define HISTO_ROWS 25 /* detector combinations in a histogram */
+#define BANK_SLOTS 16 /* candidate offsets evaluated together */
+#define BANK_T1HIST 32 /* recent stream-1 times kept for the bank */
+#define BANK_T2PEND 64 /* stream-2 times waiting for later stream-1 times */
+#define BANK_MINCOUNTS 32 /* coincidences of the best candidate to decide */
+#define BANK_DOMINANCE 4 /* its advantage over the tracked offset to jump */
+#define BANK_UNUSED (1LL<<60) /* offset of a slot which never matches */
 #define DEFAULT_HISTOLEN 10 /* number of epochs to be integrated */
 #define DEFAULT_READLOOPS 40 /* number of read atempts to get a stream file */
 #define DEFAULT_SLEEP_LOOP 50000 /*  usec to sleep between read attempts */
-
-/* binary buffers */
+#define RING_ORDER_2 16 /* ring for decoded stream-2 events: 2^16 entries */
+#define RING_ORDER_ENC 14 /* ring for the encoder stage: 2^14 entries */
+#define RING_SPINS 200 /* polls on an empty/full ring before sleeping */
+#define RING_SLEEP 50 /* usec to sleep on an empty/full ring */
+#define MAX_LINKS 64 /* links in a link file (-Z) */
+#define MAX_LINKARGS 64 /* options of a link */
+#define MAX_LINKLINE 1024 /* line length in the link file */
+
+/* binary buffers. Input files in directories are mapped and have no size
+   limit; the sizes here apply only to streams from files/sockets (-i, -I) */
 #define RAW1_SIZE 6400000 /* should last for 1400 kcps */
 #define RAW2_SIZE 2000000 /* should last for 1400 kcps */ 
-#define RAW3_SIZE 150000  /* more than enough? */
-#define RAW4_SIZE  40000   /* plenty */
+#define RAW3_SIZE 150000  /* initial size; grows with the event rate */
+#define RAW4_SIZE  40000   /* initial size; grows with the event rate */
 
 
-FILE *debuglog;
 
 /* ---------------------------------------------------------------------- */
 
@@ -294,6 +452,8 @@ typedef struct header_4 {/* header for type-4 stream packet */
 #define TYPE_1_TAG_U 0x101
 #define TYPE_2_TAG 2
 #define TYPE_2_TAG_U 0x102
+#define TYPE_2_TAG_RICE 0x202 /* Rice coded time differences */
+#define TYPE_2_TAG_RICE_U 0x302
 #define TYPE_3_TAG 3
 #define TYPE_3_TAG_U 0x103
 #define TYPE_4_TAG 4
@@ -330,6 +490,35 @@ typedef struct protocol_details_B { /* used in costream program */
 } pd_B;
 
 #define PROTOCOL_MAXINDEX 5
+/* bit widths of the protocols in the order bitsperentry3, bitsperentry4,
+   bitsperentry5, detectorentries, expected2bits. They fill the protocol table
+   below, and serve as compile-time constants in the specialized coincidence
+   kernels via PROTO_WIDTH(protocol, WIDTH_xx). */
+#define PROTO0_WIDTHS 8,4,0,16,4
+#define PROTO1_WIDTHS 1,0,0,16,1
+#define PROTO2_WIDTHS 8,4,0,16,4
+#define PROTO3_WIDTHS 1,3,4,16,3
+#define PROTO4_WIDTHS 1,3,2,16,1
+#define PROTO5_WIDTHS 2,0,0,16,0
+#define WIDTH_B3(b3,b4,b5,de,e2) (b3)
+#define WIDTH_B4(b3,b4,b5,de,e2) (b4)
+#define WIDTH_B5(b3,b4,b5,de,e2) (b5)
+#define WIDTH_DE(b3,b4,b5,de,e2) (de)
+#define WIDTH_E2(b3,b4,b5,de,e2) (e2)
+#define PWIDTH_(f,...) f(__VA_ARGS__)
+#define PWIDTH(f,w) PWIDTH_(f,w)
+#define PROTO_WIDTH(p,f) ((p)==0?PWIDTH(f,PROTO0_WIDTHS):		\
+			  (p)==1?PWIDTH(f,PROTO1_WIDTHS):		\
+			  (p)==2?PWIDTH(f,PROTO2_WIDTHS):		\
+			  (p)==3?PWIDTH(f,PROTO3_WIDTHS):		\
+			  (p)==4?PWIDTH(f,PROTO4_WIDTHS):		\
+			  PWIDTH(f,PROTO5_WIDTHS))
+/* derived masks and shifts, see their use in main() */
+#define PROTO_LONGER(p) (PROTO_WIDTH(p,WIDTH_B3)>PROTO_WIDTH(p,WIDTH_B5)? \
+			 PROTO_WIDTH(p,WIDTH_B3):PROTO_WIDTH(p,WIDTH_B5))
+#define PROTO_KEEPMASK(p) (1<<(PROTO_LONGER(p)+PROTO_WIDTH(p,WIDTH_B4)))
+#define PROTO_TESTMASK(p) (PROTO_KEEPMASK(p)<<1)
+#define PROTO_DECIDXMASK(p) ((1<<(PROTO_WIDTH(p,WIDTH_E2)+4))-1)
 /* helper functions for filling in the decision table */
 void FILL_DEC_PROTO0(int *t) {/* parameter is 8 bits wide , with the stream-2
 				bits in bit7..4 of p3, stream-1 bits in lsbits.
@@ -411,13 +600,13 @@ void FILL_DEC_PROTO5(int*t) {/* modified BB84. parameter is 4 bits wide,
 
 struct protocol_details_B proto_table[] = {
     {/* protocol 0: all bits go everywhere */
-        8,4,0,16,4, /* 16 entries in the tables p3_1 and p3_2 */
+        PROTO0_WIDTHS, /* 16 entries in the tables p3_1 and p3_2 */
 	256, /* size of combined pattern */
 	&FILL_DEC_PROTO0,
     },
     { /* protocol 1: standard BB84. assumed sequence:  (LSB) V,-,H,+ (MSB);
 	 HV basis: 0, +-basis: 1, result: V-: 0, result: H+: 1 */
-        1,0,0,16,1,
+        PROTO1_WIDTHS,
 	32, /* size of combined pattern */
 	&FILL_DEC_PROTO1
     },
@@ -427,25 +616,25 @@ struct protocol_details_B proto_table[] = {
 	multi/no coincidence pattern (3) is recorded*/
     /* for the moment, this is just a copy of protocol 0 */
     {/* protocol 2: all bits go everywhere */
-	8,4,0,16,4, /* 16 entries in the tables p3_1 and p3_2 */
+	PROTO2_WIDTHS, /* 16 entries in the tables p3_1 and p3_2 */
 	256, /* size of combined pattern */
 	&FILL_DEC_PROTO0,
     },
     {/* protocol 3: deviceindependent - chopper on 6det side.
 	chopper transmits 1-out-of-6 info, costream returns
 	1-out-of-5 to first side. */
-	1,3,4,16,3,/* one keybit, 3 ack bits, 4 bellbits, 16??, 2 t2bits */
+	PROTO3_WIDTHS,/* one keybit, 3 ack bits, 4 bellbits, 16??, 2 t2bits */
 	128, /* size of combined pattern */
 	&FILL_DEC_PROTO3,
     },
     {/* protocol 4: all bits go everywhere */
-	1,3,2,16,1, /* one keybit, 3 ack bits, 2 bellbits, 16??, 1 t2bit */
+	PROTO4_WIDTHS, /* one keybit, 3 ack bits, 2 bellbits, 16??, 1 t2bit */
 	32, /* size of combined pattern */
 	&FILL_DEC_PROTO4,
     },
     {/* protocol 5: modified BB84. assumed sequence:  (LSB) V,-,H,+ (MSB);
 	HV basis: 0, +-basis: 1, result: V-: 0, result: H+: 1 */
-        2,0,0,16,0,
+        PROTO5_WIDTHS,
 	16, /* size of combined pattern */
 	&FILL_DEC_PROTO5
     },
@@ -453,6 +642,230 @@ struct protocol_details_B proto_table[] = {
     /* helper functions for filling in the decision table */
 };
 
+/* ---------------------------------------------------------------------- */
+/* state of a link. Everything a run works on is kept in one linkstate, so
+   that a process can serve several links (option -Z); lk points to the link
+   the calling thread works for. A plain run uses link0. */
+
+/* single producer/single consumer ring for the pipelined mode. head is only
+   written by the producer, tail only by the consumer. */
+typedef struct spsc_ring {
+    char *buf; /* element storage */
+    int elsize; /* element size in bytes */
+    unsigned int mask; /* number of elements - 1 */
+    unsigned int head __attribute__((aligned(64))); /* next to write */
+    unsigned int tail __attribute__((aligned(64))); /* next to read */
+} spr;
+
+/* memory mapping of an epoch file in a directory, see map_epochfile */
+typedef struct filemap {
+    char *base; /* start of mapping, or NULL */
+    size_t len; /* length of the whole mapping */
+} fm;
+
+struct encrecord;
+
+typedef struct linkstate {
+    FILE *debuglog;
+
+    /* histograms, see below */
+    unsigned int *histo; /* buffer the matcher counts into, [25][histodepth] */
+    unsigned int *histobuf[2]; /* both buffers */
+    int histoactive; /* index of the buffer in histo */
+    int histofree[2]; /* set by the encoder once a buffer is cleared */
+    int histos_to_go;
+    int histolen; /* numbers of histograms */
+    int histodepth; /* number of time bins */
+    int histobinwidth; /* bin width in 1/8 nsec */
+    int histoshift; /* log2 of histobinwidth */
+    char histologname[FNAMELENGTH]; /* log file name base */
+    int histidx[256]; /* histogram index */
+    int histopubmode; /* 1: publish into a shared memory segment */
+    struct histring histopub; /* segment for histopubmode */
+    int histopubopen; /* set once histopub is created */
+    char statname[FNAMELENGTH]; /* -P page, empty if none */
+    struct epochstat statpage;
+    int statopen; /* set once statpage is created */
+    struct accwin accw; /* multi-window accidentals, see accwin.c */
+
+    /* IO handling */
+    int verbosity_level;
+    int zeropolicy; /* what to do on no events */
+    char fname[6][FNAMELENGTH]; /* stream files */
+    char logfname[5][FNAMELENGTH]; /* all different logfiles */
+    FILE* loghandle[5]; /* for log files */
+    struct header_1 head1; /* infile header */
+    struct header_2 head2; /* infile header */
+    struct header_3 head3; /* raw key file header */
+    struct header_4 head4; /* confirmation file header */
+    struct header_3 head5; /* Bell file output */
+    char ffnam[FNAMELENGTH+10], ffn2[FNAMELENGTH+10];
+    struct epochwatch watch1, watch2; /* arrival of stream-1 and -2 files */
+    int watchopen[3]; /* set for watch1 and watch2 once initialized */
+    int typemode[6]; /* no mode defined. other types:
+			1: single file, 2: directory save,
+			3: shared memory ring, 4: epoch log */
+    struct shmring ring[6]; /* rings of streams in mode 3 */
+    struct epochlog elog[6]; /* logs of streams in mode 4 */
+    int streamopen[6]; /* set once ring[i] or elog[i] is open */
+    int killmode[3]; /* if !=1, delete infile after use */
+    int handle[6]; /* global handles for packet streams, -1 if closed */
+
+    unsigned int ecnt1, ecnt2,ecnt1initial; /* event counter for input
+					       streams */
+    unsigned int sendword3,sendword4,sendword5; /* for writing to stream 3
+						   to 5 */
+    int index3,index4,index5,type3datawidth,type4datawidth,type5datawidth;
+    int type4bitwidth; /* for packer */
+    int type4bitwidth_long; /* for servo, value times 256  */
+    int filterconst_stream4; /* for stream4 compression */
+#define FILTER_PEREPOCH -1 /* filterconst for optimal width per epoch */
+    struct growbuf gbufd4; /* index difference and data of this epoch's
+			      sifted events, for packing at the end of the
+			      epoch */
+    unsigned int widthhist4[WIDTHHIST_SIZE]; /* significant bits of these */
+    int bitstosend4,resbits3,resbits4,resbits5;
+    unsigned int tdiff4_bitmask;
+    unsigned int *outbuf3, *outbuf4, *outbuf5; /* point into the growbufs */
+    struct growbuf gbuf3, gbuf4, gbuf5; /* output buffers, kept across
+					   epochs */
+    unsigned int idiff4_bitmask;  /* detecting exception words */
+    int thisepoch_converted_entries; /* coincidences with basematch */
+    int thisepoch_siftevents; /* counts total entries in the target4 file */
+    int thisepoch_testevents; /* counts number of testevents. used for
+				 distinguishing test- and keyevents */
+    int uepoch; /* which type of stream file from stream 2 */
+    long int ft; /* for monitoring */
+    unsigned int accidentals,truecoincies;
+    int expected2bits; /* bits expected from the stream-2 packets */
+    int flushmode; /* for tracking flushmode */
+    unsigned int startepoch; /* epoch to start with */
+    unsigned int epochnumber; /* # of epochs to read  */
+
+    /* state of the stream-2 decoder stage */
+    char *buffer2; /* stream-2 buffer */
+    unsigned int epoch2; /* next stream-2 epoch to read */
+    unsigned int *pointer2; /* for parsing stream-2 */
+    struct bitstream bits2; /* unpacking state of the current packet */
+    struct evbatch blk2; /* a block of decoded events */
+    int blkpos2, blkn2; /* next and number of events in the block */
+    unsigned long long t2dec; /* running stream-2 time */
+    unsigned int ecnt2dec; /* decoded events in current stream-2 epoch */
+    int uepoch2; /* epoch type of the first stream-2 packet */
+    int decstate; /* where the decoder is, see below */
+#define DEC_EPOCHEND 0 /* epoch is complete, announce this next */
+#define DEC_LOAD 1 /* next stream-2 packet needs to be loaded */
+#define DEC_EVENTS 2 /* delivering events */
+#define DEC_DONE 3 /* end or error has been delivered */
+
+    /* state of the encoder stage not covered above */
+    unsigned int oldindex4; /* for saving index */
+    void (*sift_kernel)(struct encrecord *); /* selected in main */
+
+    /* pipelined mode */
+    struct spsc_ring ring2, ringenc; /* decoder->matcher, matcher->encoder */
+    int pipelined; /* 1 if decoder and encoder run in own threads */
+    pthread_t decoderthread, encoderthread;
+    int stages; /* 1: decoder thread started, 2: both threads started */
+    int stopstages; /* set to make the decoder thread give up */
+    int encerror; /* first error of the encoder stage, or 0 */
+
+    /* state of the coincidence matcher */
+    long long int timediff0; /* initial time difference */
+    long long int timediff; /* current time difference */
+    unsigned long long int t1, t2, t1old; /* extracted times  */
+    long long int coincwindow; /* in 1/8 nsec */
+    long long int trackwindow; /* in 1/8 nsec */
+    long long int referencewindow1,referencewindow2;
+    long long int floattime;  /* floating avg time difference in 1/8/4096 */
+    unsigned long long int lastservotime; /* for time-based servoing */
+    long long int servoofftime; /* prevent jumps */
+    long long int servo_p1; /* reduce calculation in filter */
+    char *buffer1; /* stream-1 buffer */
+    struct rawevent *pointer1; /* for parsing stream-1 */
+    struct evbatch ev1; /* events of the current stream-1 packet */
+    unsigned int epoch1; /* running epoch for read */
+    struct evcorrect corr1; /* detector skew and dead time of stream 1 */
+    int getone, gettwo;  /* for coincidence loop */
+    int firstrun; /* first run of reading stream 2 - no close 3,4 */
+    unsigned int currentepoch; /* stream-2 epoch in the matcher */
+    int *decisionmatrix; /* contains the protocol decision at this level */
+    struct filemap map1, map2; /* current stream-1 and stream-2 files */
+
+    /* offset bank, see init_bank */
+    int banksize; /* candidates on each side; 0: no bank */
+    long long int bankspacing; /* distance of candidates in 1/8 nsec */
+    long long int bankoffset[BANK_SLOTS]; /* offsets to the tracked value */
+    long long int bankreach; /* largest offset plus coincidence window */
+    unsigned int bankcount[BANK_SLOTS]; /* coincidences per candidate */
+    unsigned long long t1hist[BANK_T1HIST]; /* recent stream-1 times */
+    unsigned int t1histpos; /* next entry in t1hist */
+    unsigned long long t2pend[BANK_T2PEND]; /* queued stream-2 times */
+    unsigned int t2head, t2tail; /* queue positions */
+
+    /* link mode */
+    int linkid; /* number of the link in the link file, 0 for a plain run */
+    int largc; /* options of the link */
+    char *largv[MAX_LINKARGS+1];
+    char line[MAX_LINKLINE]; /* holds the option strings */
+    pthread_t thread; /* runs the link */
+    int parsed; /* set once the options are taken */
+    int retval; /* exit code of the link */
+} lks;
+
+struct linkstate link0; /* the only link of a plain run */
+__thread struct linkstate *lk = &link0; /* link of the calling thread */
+
+/* defaults of a freshly allocated link */
+void init_link(struct linkstate *l) {
+    int i;
+    l->histolen = DEFAULT_HISTOLEN;
+    l->histodepth = DEFAULT_HISTODEPTH;
+    l->histobinwidth = 1;
+    l->verbosity_level = DEFAULT_VERBOSITY;
+    l->zeropolicy = DEFAULT_ZEROPOLICY;
+    l->killmode[1] = DEFAULT_KILLMODE1;
+    l->killmode[2] = DEFAULT_KILLMODE2;
+    l->type4bitwidth = DEFAULT_STREAM4BITWIDTH;
+    l->filterconst_stream4 = DEFAULT_FILTERCONST_4;
+    l->flushmode = DEFAULT_FLUSHMODE;
+    l->startepoch = DEFAULT_STARTEPOCH;
+    l->epochnumber = DEFAULT_EPOCHNUMBER;
+    l->timediff0 = 17;
+    l->timediff = 18;
+    l->coincwindow = DEFAULT_COINCWINDOW;
+    l->trackwindow = DEFAULT_TRACKWINDOW;
+    l->servoofftime = MAX_SERVOOFFTIME;
+    for (i=0;i<6;i++) l->handle[i] = -1;
+}
+
+/* link mode (-Z). Each link runs in its own thread; a link only works while
+   it holds one of the worker slots, and gives it up while waiting for input
+   files or for its stage threads, so that the links share the processors. */
+int linkcount = 0; /* links from the link file; 0 for a plain run */
+sem_t linkslots; /* free worker slots */
+sem_t linkparsed; /* posted when a link has taken its options */
+__thread int holdslot = 0; /* calling thread takes part in the slots */
+pthread_mutex_t decisionlock = PTHREAD_MUTEX_INITIALIZER;
+int *decisiontables[PROTOCOL_MAXINDEX+1]; /* shared by links, see main */
+
+void link_idle(void) {
+    if (holdslot) sem_post(&linkslots);
+}
+void link_busy(void) {
+    if (holdslot) while (sem_wait(&linkslots) && errno==EINTR);
+}
+
+/* a link has taken its options; the next one may start parsing them. The
+   link then waits for a worker slot. */
+void link_parsed(void) {
+    if (!lk->linkid) return;
+    lk->parsed=1;
+    sem_post(&linkparsed);
+    holdslot=1;
+    link_busy();
+}
+
 /* ---------------------------------------------------------------------- */
 
 
@@ -461,37 +874,46 @@ struct protocol_details_B proto_table[] = {
    for all valid detector combinations. the 25th entry corresponds to
    detector events which do not correspond to pairs.
    old: 17th column, but that was never used so I changed it to 25
+   The matcher counts into one of two buffers, while the other one is written
+   out and cleared by the encoder stage, so a histogram costs the matcher no
+   file output.
 */
 
-unsigned int histo[25][DEFAULT_HISTODEPTH]; /* array for counting */
-int histos_to_go;
-int histolen = DEFAULT_HISTOLEN; /* numbers of histograms */
-char histologname[FNAMELENGTH]; /* log file name base */
-int histidx[256]; /* histogram index */
 
 
-/* clear histogram */
-void clear_histo(void) {
-    int i,j;
-    for (i=0;i<25;i++) for (j=0;j<DEFAULT_HISTODEPTH;j++) histo[i][j]=0;
-    histos_to_go = histolen;
-    fprintf(debuglog,"histolen: %d\n",histolen);
+/* clear histogram buffer */
+void clear_histo(unsigned int *h) {
+    memset(h,0,HISTO_ROWS*lk->histodepth*sizeof(unsigned int));
+    fprintf(lk->debuglog,"histolen: %d\n",lk->histolen);
 }
 
-/* initialize histogram index and clear field */
-void init_histo(void){
+/* initialize histogram index and buffers. Returns 0 or an error code. */
+int init_histo(void){
     int i,x,y;
-    for (i=0;i<256;i++) histidx[i]=24; /* most of them are illegal */
-    for (i=0;i<16;i++) histidx[(16<<((i>>2)&3))|(1<<(i&3))]=i; /* legal 4x4 */
+    for (i=0;i<256;i++) lk->histidx[i]=24; /* most of them are illegal */
+    for (i=0;i<16;i++)
+	lk->histidx[(16<<((i>>2)&3))|(1<<(i&3))]=i; /* legal 4x4 */
     /* for calibration: mix 2x4 detectors from all combinations. This is not
        entirely correct, but adds some wrong events onto the legal ones, but
        should be good enough for calibration.... */
     for (i=16;i<24;i++){
 	x=(i&4)>>2;y=i&3;
-	histidx[(0x30<<x)+(0x01<<y)]=i; /* remote has 6 detectors */
-	histidx[(0x03<<x)+(0x10<<y)]=i; /* local has 6 detectors */
+	lk->histidx[(0x30<<x)+(0x01<<y)]=i; /* remote has 6 detectors */
+	lk->histidx[(0x03<<x)+(0x10<<y)]=i; /* local has 6 detectors */
     }
-    clear_histo();
+    for (i=0;i<2;i++) {
+	lk->histobuf[i]=(unsigned int *)
+	    calloc(HISTO_ROWS*lk->histodepth,sizeof(unsigned int));
+	if (!lk->histobuf[i]) return 86;
+    }
+    lk->histo=lk->histobuf[0]; lk->histoactive=0; lk->histofree[1]=1;
+    lk->histos_to_go = lk->histolen;
+    fprintf(lk->debuglog,"histolen: %d\n",lk->histolen);
+    if (lk->histopubmode &&
+	histring_create(&lk->histopub,shmring_name(lk->histologname),HISTO_ROWS,
+			lk->histodepth,lk->histobinwidth)) return 87;
+    lk->histopubopen=lk->histopubmode;
+    return 0;
 }
 
 
@@ -504,27 +926,29 @@ void atohex(char* target,unsigned int v) {
     target[9]=0;
 }
 
-/* print out histogram; returns error code if any */
-int emit_histo(unsigned int epoch) {
+/* print out or publish a histogram buffer; returns error code if any */
+int emit_histo(unsigned int epoch, unsigned int *h) {
     char hl2[FNAMELENGTH+10];
     int i,j;
     FILE *hh; /* histogram handle */
-    if (histologname[0]) {
-	strncpy(hl2,histologname,FNAMELENGTH);
+    if (lk->histopubmode) {
+	histring_put(&lk->histopub,epoch-lk->histolen,lk->histolen,h);
+    } else if (lk->histologname[0]) {
+	strncpy(hl2,lk->histologname,FNAMELENGTH);
 	j=strlen(hl2);
 	for (i=0;i<8;i++) hl2[j+i] = hexdigits[(epoch>>(4*(7-i)))&0xf];
 	hl2[j+8]=0; /* string termination */
 	if (!(hh=fopen(hl2,"w"))) {
 	    return 68; /* cannot open histo file */
 	}
- fprintf(hh,"# time difference histogramming output. Start epoch: %08x, contains %d epochs.\n# The timing info in column 1 is in multiples of 125ps. The\n# next 24 columns contain legal events, column 26 the number of illegal events.\n",epoch-histolen,histolen);fflush(hh);
-	for (j=0;j<DEFAULT_HISTODEPTH;j++) {
-	    fprintf(hh,"%d ",j-DEFAULT_HISTODEPTH/2);
-	    for (i=0;i<25;i++) fprintf(hh,"%d%c",histo[i][j],i<24?' ':'\n');
+ fprintf(hh,"# time difference histogramming output. Start epoch: %08x, contains %d epochs.\n# The timing info in column 1 is in multiples of 125ps. The\n# next 24 columns contain legal events, column 26 the number of illegal events.\n",epoch-lk->histolen,lk->histolen);fflush(hh);
+	for (j=0;j<lk->histodepth;j++) {
+	    fprintf(hh,"%d ",(j-lk->histodepth/2)*lk->histobinwidth);
+	    for (i=0;i<HISTO_ROWS;i++)
+		fprintf(hh,"%d%c",h[i*lk->histodepth+j],i<HISTO_ROWS-1?' ':'\n');
 	}
 	fclose(hh);
     }
-    clear_histo();
     return 0;
 }
 
@@ -589,7 +1013,7 @@ char *errormessage[] = {
   "cannot write type-3 header", /* 55 */
   "cannot write type-3 data",
   "cannot convert compression filter constant.",
-  "filter constant in -R option out of range.",
+  "filter constant in -R option out of range (>=0 or -1).",
   "cannot convert stream-4 bitwidth",
   "stream-4 bitwidth in -r out of range ", /* 60 */
   "error converting zeroevent policy argument.",
@@ -612,9 +1036,32 @@ char *errormessage[] = {
   "cannot write type-5 header",
   "cannot write type-5 data",  
   "wrong skew format. needs -S v1,v2,v3,v4", /* 80 */
+  "cannot malloc pipeline rings",
+  "cannot start pipeline threads",
+  "cannot attach shared memory ring",
+  "cannot open epoch log directory",
+  "error reading histogram depth or bin width", /* 85 */
+  "cannot malloc histogram buffers",
+  "cannot create histogram segment",
+  "wrong offset bank format. needs -X num,spacing", /* 88 */
+  "cannot open link file (option -Z)",
+  "too many links or link options in link file", /* 90 */
+  "options -Z, -W and -C cannot be used in a link file",
+  "cannot start link thread",
+  "wrong number of workers (option -W)",
+  "cannot malloc link state",
+  "wrong dead time format. needs -Y y1,y2,y3,y4", /* 95 */
+  "cannot malloc stream-1 copy for corrections",
+  "cannot parse statistics page name (option -P)",
+  "cannot create statistics page", /* 98 */
+  "wrong accidental windows. needs -A windows[,step], windows 0 to 16",
+  "cannot malloc stream-1 event batch", /* 100 */
+  "cannot parse cpu profile. needs -C cpus[:node[:h]]",
+  "cannot apply cpu profile (option -C)",
 };
 
 int emsg(int code) {
+  if (lk->linkid) fprintf(stderr,"link %d: ",lk->linkid);
   fprintf(stderr,"%s\n",errormessage[code]);
   return code;
 };
@@ -627,44 +1074,51 @@ int openmode[6] = {0,O_RDONLY,O_RDONLY, /* modes for stream 1 and 2 */
 
 #define FILE_PERMISSIONS 0644  /* for all output files */
 
+/* close a packet stream file; the handle is marked closed for the cleanup
+   of a link */
+void close_handle(int i) {
+    close(lk->handle[i]);
+    lk->handle[i]=-1;
+}
+
+
+
+
+
+/* record passed from the stream-2 decoder to the coincidence matcher */
+typedef struct s2event {
+    unsigned long long t2; /* event time, or for S2_NEWEPOCH the epoch in
+			      the lower and the number of events in the
+			      upper 32 bits */
+    int kind; /* >=0: pattern of an event, <0: marker, see below */
+    unsigned int v; /* index of event in epoch, epoch type or error code */
+} s2e;
+#define S2_EPOCHEND -1 /* all events of the epoch have been delivered */
+#define S2_NEWEPOCH -2 /* a new epoch starts */
+#define S2_END -3 /* requested number of epochs processed */
+#define S2_ERROR -4 /* decoder failed */
+
+/* statistics of an epoch for logging in the encoder stage */
+typedef struct epochstats {
+    unsigned int ecnt2, ecnt1initial, accidentals, truecoincies;
+    long int ft;
+    float accest, accerr; /* multi-window estimate of accidentals */
+} es;
+
+/* record passed from the coincidence matcher to the encoder stage */
+typedef struct encrecord {
+    int kind; /* see below */
+    int d; /* decision value for ENC_SIFT, epoch type for ENC_OPEN */
+    unsigned int v; /* stream-2 index for ENC_SIFT, epoch for ENC_OPEN */
+    struct epochstats st; /* for ENC_CLOSE; st.ecnt2 also for ENC_OPEN */
+} enr;
+#define ENC_SIFT 0 /* a coincidence to be kept */
+#define ENC_OPEN 1 /* start an epoch */
+#define ENC_CLOSE 2 /* write out an epoch */
+#define ENC_END 3 /* terminate encoder thread */
+#define ENC_HISTO 4 /* write out histogram buffer d, emitted at epoch v */
+
 
-/* global variables for IO handling */
-int verbosity_level = DEFAULT_VERBOSITY;
-int zeropolicy = DEFAULT_ZEROPOLICY; /* what to do on no events */
-char fname[6][FNAMELENGTH]={"","","","","",""}; /* stream files */
-char logfname[5][FNAMELENGTH]={"","","","",""}; /* all different logfiles */
-FILE* loghandle[5]; /* for log files */
-struct header_1 head1; /* infile header */
-struct header_2 head2; /* infile header */
-struct header_3 head3; /* raw key file header */
-struct header_4 head4; /* confirmation file header */
-struct header_3 head5; /* Bell file output */
-char ffnam[FNAMELENGTH+10], ffn2[FNAMELENGTH+10];
-int typemode[6]={0,0,0,0,0,0}; /* no mode defined. other types:
-		 		  1: single file, 2: directory save, ... */
-int killmode[3] = {0,DEFAULT_KILLMODE1,
-		   DEFAULT_KILLMODE2 }; /* if !=1, delete infile after use */
-int handle[6]; /* global handles for packet streams */
-
-unsigned int ecnt1, ecnt2,ecnt1initial; /* event counter for input streams */
-unsigned int sendword3,sendword4,sendword5; /* for writing to stream 3 to 5 */
-int index3,index4,index5,type3datawidth,type4datawidth,type5datawidth;
-int type4bitwidth = DEFAULT_STREAM4BITWIDTH; /* for packer */ 
-int type4bitwidth_long; /* for servo, value times 256  */
-int filterconst_stream4 = DEFAULT_FILTERCONST_4; /* for stream4 compression */
-int bitstosend4,resbits3,resbits4,resbits5;
-unsigned int tdiff4_bitmask;
-unsigned int *outbuf3, *outbuf4, *outbuf5;
-unsigned int idiff4_bitmask;  /* detecting exception words */
-int thisepoch_converted_entries; /* coincidences with basematch */
-int thisepoch_siftevents; /* counts total entries in the target4 file */
-int thisepoch_testevents; /* counts number of testevents. used for
-			     distinguishing test- and keyevents */
-int uepoch; /* which type of stream file from stream 2 */
-long int ft; /* for monitoring */
-unsigned int accidentals,truecoincies;
-int expected2bits; /* bits expected from the stream-2 packets */
-int flushmode = DEFAULT_FLUSHMODE; /* for tracking flushmode */
 
 /* lookup table for correction of epoch in strem 1 */
 #define PL1 0x10000  /* +1 step fudge correction for epoc index mismatch */
@@ -675,91 +1129,165 @@ unsigned int overlay_correction[16]= {0,PL1,MI2,MI1, MI1,0,PL1,MI2,
 
 
 
+/* append an index difference and w4 data bits to stream 4 */
+static inline __attribute__((always_inline))
+void pack4(unsigned int indexdiff4, unsigned int stream4data, const int w4) {
+    unsigned int t4,t4a;
+
+    /* long index diff exception */
+    if (indexdiff4!=(t4=(indexdiff4 & lk->idiff4_bitmask))) { 
+	/* first batch is codeword zero plus a few bits  */
+	t4a=indexdiff4 >> lk->type4bitwidth;
+	/* save first part of this longer structure */
+	if (lk->resbits4==32) {
+	    lk->outbuf4[lk->index4++]=t4a;
+	} else {
+	    lk->sendword4 |= (t4a >> (32-lk->resbits4));
+	    lk->outbuf4[lk->index4++]=lk->sendword4;
+	    lk->sendword4=t4a << lk->resbits4;
+	}
+    } 
+
+    /* short word or rest of data, add state to shortword */
+    t4a = (t4<<w4) | stream4data;
+    /* save timing and transmit bits */
+    if (lk->resbits4>=lk->bitstosend4) {
+	lk->sendword4 |= (t4a << (lk->resbits4-lk->bitstosend4));
+	lk->resbits4 = lk->resbits4-lk->bitstosend4;
+	if (lk->resbits4==0) { 
+	    lk->outbuf4[lk->index4++]=lk->sendword4;
+	    lk->sendword4=0;lk->resbits4=32;
+	}
+    } else {
+	lk->resbits4=lk->bitstosend4-lk->resbits4;
+	lk->sendword4 |= (t4a >> lk->resbits4);
+	lk->outbuf4[lk->index4++]=lk->sendword4;
+	lk->resbits4=32-lk->resbits4;
+	lk->sendword4=t4a << lk->resbits4;
+    }
+}
+
 /* opening routine to target files stream 3 and 4 and (optionally) 5 */
-int open_epoch(unsigned int ep) { /* parameter is new epoch */
+int open_epoch(unsigned int ep, int n2) { /* parameters are new epoch and
+						the number of stream-2 events */
+    /* make room for the worst case of this epoch: every stream-2 event gets
+       sifted and needs a long index entry in stream 4 */
+    if (growbuf_reserve(&lk->gbuf3,(n2*lk->type3datawidth+31)/32+2)) return 24;
+    if (growbuf_reserve(&lk->gbuf4,2*n2+2)) return 25;
+    if (growbuf_reserve(&lk->gbuf5,(n2*lk->type5datawidth+31)/32+2)) return 74;
+    if (lk->filterconst_stream4==FILTER_PEREPOCH &&
+	growbuf_reserve(&lk->gbufd4,2*n2+2)) return 25;
+    memset(lk->widthhist4,0,sizeof(lk->widthhist4));
+    lk->outbuf3=lk->gbuf3.buf; lk->outbuf4=lk->gbuf4.buf;
+    lk->outbuf5=lk->gbuf5.buf;
   
     /* populate headers preliminary */
-    head3.tag = uepoch?TYPE_3_TAG_U:TYPE_3_TAG; head3.length = 0;
-    head3.epoc = ep; head3.bitsperentry = type3datawidth;
+    lk->head3.tag = lk->uepoch?TYPE_3_TAG_U:TYPE_3_TAG; lk->head3.length = 0;
+    lk->head3.epoc = ep; lk->head3.bitsperentry = lk->type3datawidth;
 
-    head4.tag = uepoch?TYPE_4_TAG_U:TYPE_4_TAG; head4.length = 0;
-    head4.epoc = ep;
-    head4.timeorder = type4bitwidth; head4.basebits = type4datawidth;
-    fprintf(debuglog,"costream: type4bitwidth: %d for epoch %08x\n",
-	    type4bitwidth,ep); fflush(debuglog);
+    lk->head4.tag = lk->uepoch?TYPE_4_TAG_U:TYPE_4_TAG; lk->head4.length = 0;
+    lk->head4.epoc = ep;
+    lk->head4.timeorder = lk->type4bitwidth;
+    lk->head4.basebits = lk->type4datawidth;
+    fprintf(lk->debuglog,"costream: type4bitwidth: %d for epoch %08x\n",
+	    lk->type4bitwidth,ep); fflush(lk->debuglog);
 
     /* initialize output buffers and temp storage*/
-    index3=0;sendword3=0;resbits3=32;
-    index4=0;sendword4=0;resbits4=32;
+    lk->index3=0;lk->sendword3=0;lk->resbits3=32;
+    lk->index4=0;lk->sendword4=0;lk->resbits4=32;
 
     /* optionally open stream 5 (Bell measurement results) */
-    head5.tag = uepoch?TYPE_3_TAG_U:TYPE_3_TAG; head5.length = 0;
-    head5.epoc = ep; head5.bitsperentry = type5datawidth;
-    index5=0;sendword5=0;resbits5=32;
+    lk->head5.tag = lk->uepoch?TYPE_3_TAG_U:TYPE_3_TAG; lk->head5.length = 0;
+    lk->head5.epoc = ep; lk->head5.bitsperentry = lk->type5datawidth;
+    lk->index5=0;lk->sendword5=0;lk->resbits5=32;
 
     return 0;
 }
 
-/* flush output buffers and submit files */
-int close_epoch() {
+/* flush output buffers and submit files. Statistics for logging are passed
+   from the matcher. */
+int close_epoch(struct epochstats *st) {
     char ffnam_c[FNAMELENGTH+10];
     int retval,i,optimal_width;
     unsigned int average_distance; /* for stream4 compress optimizer */
     unsigned int t4a;
-    int te = head3.epoc; /* holds this epoch */
+    unsigned int sv[EPOCHSTAT_QUANTITIES]; /* for the statistics page */
+    unsigned int bell[CHSH_PATTERNS], *bp=NULL; /* Bell test counts */
+    int te = lk->head3.epoc; /* holds this epoch */
     
-    if (thisepoch_siftevents || zeropolicy) { /* emit stream-4 files */
+    if (lk->filterconst_stream4==FILTER_PEREPOCH) {
+	/* choose the bit number for this epoch and pack it */
+	lk->type4bitwidth=widthhist_best(lk->widthhist4,MIN_4_BITWIDTH,
+				     MAX_4_BITWIDTH<31-lk->type4datawidth?
+				     MAX_4_BITWIDTH:31-lk->type4datawidth);
+	lk->idiff4_bitmask = (1<<lk->type4bitwidth)-1;
+	lk->bitstosend4=lk->type4bitwidth+lk->type4datawidth;
+	lk->head4.timeorder = lk->type4bitwidth;
+	for (i=0;i<lk->thisepoch_siftevents;i++)
+	    pack4(lk->gbufd4.buf[2*i],lk->gbufd4.buf[2*i+1],lk->type4datawidth);
+    }
+
+    if (lk->thisepoch_siftevents || lk->zeropolicy) { /* emit stream-4 files */
 	/* finish stream 4 entries */
-	t4a = TYPE_4_ENDWORD<<type4datawidth;
+	t4a = TYPE_4_ENDWORD<<lk->type4datawidth;
 	
 	/* save timing and transmit bits */
-	if (resbits4>=bitstosend4) {
-	    sendword4 |= (t4a << (resbits4-bitstosend4));
-	    resbits4 = resbits4-bitstosend4;
-	    if (resbits4==0) { 
-		outbuf4[index4++]=sendword4;
-		sendword4=0;resbits4=32;
+	if (lk->resbits4>=lk->bitstosend4) {
+	    lk->sendword4 |= (t4a << (lk->resbits4-lk->bitstosend4));
+	    lk->resbits4 = lk->resbits4-lk->bitstosend4;
+	    if (lk->resbits4==0) { 
+		lk->outbuf4[lk->index4++]=lk->sendword4;
+		lk->sendword4=0;lk->resbits4=32;
 	    }
 	} else {
-	    resbits4=bitstosend4-resbits4;
-	    sendword4 |= (t4a >> resbits4);
-	    outbuf4[index4++]=sendword4;
-	    resbits4=32-resbits4;
-	    sendword4=t4a << resbits4;
+	    lk->resbits4=lk->bitstosend4-lk->resbits4;
+	    lk->sendword4 |= (t4a >> lk->resbits4);
+	    lk->outbuf4[lk->index4++]=lk->sendword4;
+	    lk->resbits4=32-lk->resbits4;
+	    lk->sendword4=t4a << lk->resbits4;
 	}
 	
 	/* write out last word */
-	if (resbits4<32) outbuf4[index4++]=sendword4;
-	head4.length = thisepoch_siftevents; /* update header */
+	if (lk->resbits4<32) lk->outbuf4[lk->index4++]=lk->sendword4;
+	lk->head4.length = lk->thisepoch_siftevents; /* update header */
 	
 	/* eventually open stream 4 */
-	switch (typemode[4]) {
+	switch (lk->typemode[4]) {
 	    case 2: /* file in directory */
-		strncpy(ffnam_c, fname[4], FNAMELENGTH);
-		atohex(&ffnam_c[strlen(ffnam_c)],head4.epoc);
-		handle[4]=open(ffnam_c,openmode[4],FILE_PERMISSIONS);
-		if(-1==handle[4]) return 34;
+		strncpy(ffnam_c, lk->fname[4], FNAMELENGTH);
+		atohex(&ffnam_c[strlen(ffnam_c)],lk->head4.epoc);
+		lk->handle[4]=open(ffnam_c,openmode[4],FILE_PERMISSIONS);
+		if(-1==lk->handle[4]) return 34;
 		break;
 	}
 
 	/* write header 4 and content */
-	retval=write(handle[4],&head4,sizeof(struct header_4));
-	if (retval!=sizeof(struct header_4)) return 53;  /* cannot write header */
-	i=index4*sizeof(unsigned int);
-	retval=write(handle[4],outbuf4,i);
-	if (retval!=i) return 54; /* cannot write content */
+	i=lk->index4*sizeof(unsigned int);
+	if (lk->typemode[4]==3) { /* one packet into the ring */
+	    if (shmring_put(&lk->ring[4],4,lk->head4.epoc,&lk->head4,
+			    sizeof(struct header_4),lk->outbuf4,i,
+			    SHMRING_TIMEOUT_MS)) return 54;
+	} else if (lk->typemode[4]==4) { /* append to the log */
+	    if (epochlog_append(&lk->elog[4],4,lk->head4.epoc,&lk->head4,
+				sizeof(struct header_4),lk->outbuf4,i)) return 54;
+	} else {
+	    retval=write(lk->handle[4],&lk->head4,sizeof(struct header_4));
+	    if (retval!=sizeof(struct header_4)) return 53; /* cannot write */
+	    retval=write(lk->handle[4],lk->outbuf4,i);
+	    if (retval!=i) return 54; /* cannot write content */
+	}
 	
 	/* eventually close stream 4 */
-	switch (typemode[4]) {
+	switch (lk->typemode[4]) {
 	    case 2:
-		close(handle[4]);
+		close_handle(4);
 		break;
 	}
 
 	/* servo loop for optimal compression parameter of stream 4 */
-	if (thisepoch_siftevents) {
+	if (lk->thisepoch_siftevents) {
 	    average_distance = 
-		ecnt2 / thisepoch_siftevents;
+		st->ecnt2 / lk->thisepoch_siftevents;
 	    if (average_distance<8) average_distance=8;
 	    optimal_width= 
 		(int) ((log((float)average_distance)/log(2.)+2.2117)*16.);
@@ -767,167 +1295,266 @@ int close_epoch() {
 	    /*tmp=average_distance;optimal_width=0;
 	      while (tmp>31) {tmp /=2; optimal_width++;};
 	      optimal_width = optimal_width*16+log_correcttable[tmp&0xf];*/
-	    if (filterconst_stream4) {
-		type4bitwidth_long +=
-		    (optimal_width*16-type4bitwidth_long)/filterconst_stream4;
-		type4bitwidth=type4bitwidth_long>>8;
+	    if (lk->filterconst_stream4>0) {
+		lk->type4bitwidth_long +=
+		    (optimal_width*16-lk->type4bitwidth_long)/lk->filterconst_stream4;
+		lk->type4bitwidth=lk->type4bitwidth_long>>8;
 		/* avoid overshoot */
-		if (type4bitwidth<MIN_4_BITWIDTH) type4bitwidth=MIN_4_BITWIDTH;
-		if (type4bitwidth>MAX_4_BITWIDTH) type4bitwidth=MAX_4_BITWIDTH;
-		fprintf(debuglog,"loop: t4long: %d, optimal_width: %d, avg_dist: %d filterconst: %d, def: %d\n",type4bitwidth_long,optimal_width,average_distance,filterconst_stream4,DEFAULT_FILTERCONST_4);
+		if (lk->type4bitwidth<MIN_4_BITWIDTH) lk->type4bitwidth=MIN_4_BITWIDTH;
+		if (lk->type4bitwidth>MAX_4_BITWIDTH) lk->type4bitwidth=MAX_4_BITWIDTH;
+		fprintf(lk->debuglog,"loop: t4long: %d, optimal_width: %d, avg_dist: %d filterconst: %d, def: %d\n",lk->type4bitwidth_long,optimal_width,average_distance,lk->filterconst_stream4,DEFAULT_FILTERCONST_4);
 	    };
-	    idiff4_bitmask = (1<<type4bitwidth)-1; /* for packing */
+	    lk->idiff4_bitmask = (1<<lk->type4bitwidth)-1; /* for packing */
 	}
 
 	/* notify stream 4 */
-	if (logfname[4][0]) fprintf(loghandle[4],"%08x\n",te);
-	if (flushmode>0) fflush(loghandle[4]);
+	if (lk->logfname[4][0]) fprintf(lk->loghandle[4],"%08x\n",te);
+	if (lk->flushmode>0) fflush(lk->loghandle[4]);
     }
 
     /* keep this updated */
-    bitstosend4=type4bitwidth+type4datawidth; /* has to be <32 */
+    lk->bitstosend4=lk->type4bitwidth+lk->type4datawidth; /* has to be <32 */
 
-    if (thisepoch_siftevents || (zeropolicy>1)) { /* emit stream-3 and -5 */
+    if (lk->thisepoch_siftevents || (lk->zeropolicy>1)) {
+	/* emit stream-3 and -5 */
 	/* flush stream 3, write the length and close it */
-	if (resbits3<32) outbuf3[index3++]=sendword3;
-	head3.length = thisepoch_siftevents-thisepoch_testevents;
+	if (lk->resbits3<32) lk->outbuf3[lk->index3++]=lk->sendword3;
+	lk->head3.length = lk->thisepoch_siftevents-lk->thisepoch_testevents;
 
 	/* eventually open stream 3 */
-	switch (typemode[3]) {
+	switch (lk->typemode[3]) {
 	    case 2: /* file in directory */
-		strncpy(ffnam_c, fname[3], FNAMELENGTH);
-		atohex(&ffnam_c[strlen(ffnam_c)],head3.epoc);
-		handle[3]=open(ffnam_c,openmode[3],FILE_PERMISSIONS);
-		if(-1==handle[3]) return 33;
+		strncpy(ffnam_c, lk->fname[3], FNAMELENGTH);
+		atohex(&ffnam_c[strlen(ffnam_c)],lk->head3.epoc);
+		lk->handle[3]=open(ffnam_c,openmode[3],FILE_PERMISSIONS);
+		if(-1==lk->handle[3]) return 33;
 		break;
 	}
 	
 	/* write header 3 */
-	retval= write(handle[3],&head3,sizeof(struct header_3));
-	if (retval!=sizeof(struct header_3)) return 55; /* write error */
-	i=index3*sizeof(unsigned int);
-	retval=write(handle[3],outbuf3,i);
-	if (retval!=i) return 56; /* write error buffer */
+	i=lk->index3*sizeof(unsigned int);
+	if (lk->typemode[3]==3) { /* one packet into the ring */
+	    if (shmring_put(&lk->ring[3],3,lk->head3.epoc,&lk->head3,
+			    sizeof(struct header_3),lk->outbuf3,i,
+			    SHMRING_TIMEOUT_MS)) return 56;
+	} else if (lk->typemode[3]==4) { /* append to the log */
+	    if (epochlog_append(&lk->elog[3],3,lk->head3.epoc,&lk->head3,
+				sizeof(struct header_3),lk->outbuf3,i)) return 56;
+	} else {
+	    retval= write(lk->handle[3],&lk->head3,sizeof(struct header_3));
+	    if (retval!=sizeof(struct header_3)) return 55; /* write error */
+	    retval=write(lk->handle[3],lk->outbuf3,i);
+	    if (retval!=i) return 56; /* write error buffer */
+	}
 	
 
 	/* eventually close stream 3 */
-	switch (typemode[3]) {
+	switch (lk->typemode[3]) {
 	    case 2:
-		close(handle[3]);
+		close_handle(3);
 	}
 
 	/* eventually do stream 5 */
-	if (typemode[5]) { /* only generate this if necessary */
-	 	if (resbits5<32) outbuf5[index5++]=sendword5;
-		head5.length = thisepoch_testevents;
+	if (lk->typemode[5]) { /* only generate this if necessary */
+	 	if (lk->resbits5<32) lk->outbuf5[lk->index5++]=lk->sendword5;
+		lk->head5.length = lk->thisepoch_testevents;
 
 		/* eventually open stream 5 */
-		switch (typemode[5]) {
+		switch (lk->typemode[5]) {
 		    case 2: /* file in directory */
-			strncpy(ffnam_c, fname[5], FNAMELENGTH);
-			atohex(&ffnam_c[strlen(ffnam_c)],head5.epoc);
-			handle[5]=open(ffnam_c,openmode[5],FILE_PERMISSIONS);
-			if(-1==handle[5]) return 77;
+			strncpy(ffnam_c, lk->fname[5], FNAMELENGTH);
+			atohex(&ffnam_c[strlen(ffnam_c)],lk->head5.epoc);
+			lk->handle[5]=open(ffnam_c,openmode[5],FILE_PERMISSIONS);
+			if(-1==lk->handle[5]) return 77;
 			break;
 		}
 	
 		/* write header 5 */
-		retval= write(handle[5],&head5,sizeof(struct header_3));
-		if (retval!=sizeof(struct header_3)) return 78; /* writ err */
-		i=index5*sizeof(unsigned int);
-		retval=write(handle[5],outbuf5,i);
-		if (retval!=i) return 79; /* write error buffer */
+		i=lk->index5*sizeof(unsigned int);
+		if (lk->typemode[5]==3) { /* one packet into the ring */
+		    if (shmring_put(&lk->ring[5],5,lk->head5.epoc,&lk->head5,
+				    sizeof(struct header_3),lk->outbuf5,i,
+				    SHMRING_TIMEOUT_MS)) return 79;
+		} else if (lk->typemode[5]==4) { /* append to the log */
+		    if (epochlog_append(&lk->elog[5],5,lk->head5.epoc,&lk->head5,
+					sizeof(struct header_3),lk->outbuf5,i))
+			return 79;
+		} else {
+		    retval= write(lk->handle[5],&lk->head5,sizeof(struct header_3));
+		    if (retval!=sizeof(struct header_3)) return 78; /* err */
+		    retval=write(lk->handle[5],lk->outbuf5,i);
+		    if (retval!=i) return 79; /* write error buffer */
+		}
 		
 		
 		/* eventually close stream 5 */
-		switch (typemode[5]) {
+		switch (lk->typemode[5]) {
 		    case 2:
-			close(handle[5]);
+			close_handle(5);
 			break;
 		}
 		
 	}
 	
 	/* notify stream 3 */
-	if (logfname[3][0]) fprintf(loghandle[3],"%08x\n",te);
-	if (flushmode>1) fflush(loghandle[3]);
+	if (lk->logfname[3][0]) fprintf(lk->loghandle[3],"%08x\n",te);
+	if (lk->flushmode>1) fflush(lk->loghandle[3]);
+    }
+    /* statistics page */
+    if (lk->statname[0]) {
+	sv[EPOCHSTAT_EVENTS1]=st->ecnt1initial;
+	sv[EPOCHSTAT_EVENTS2]=st->ecnt2;
+	sv[EPOCHSTAT_SIFTED]=lk->thisepoch_siftevents;
+	sv[EPOCHSTAT_ACCIDENTAL]=(unsigned int)(st->accest+.5);
+	sv[EPOCHSTAT_TRUE]=st->truecoincies;
+	if (lk->type5datawidth==CHSH_BITS) { /* full test values in stream 5 */
+	    i=lk->thisepoch_testevents;
+	    if (i%8) lk->outbuf5[i/8]=lk->sendword5; /* last word */
+	    memset(bell,0,sizeof(bell));
+	    chsh_packed(bell,lk->outbuf5,i);
+	    bp=bell;
+	}
+	epochstat_put(&lk->statpage,te,lk->type4bitwidth,st->ft,sv,
+		      st->accerr,bp);
     }
     /* logging to general file */
-    if (verbosity_level>=0) {
-	switch (verbosity_level) {
+    if (lk->verbosity_level>=0) {
+	switch (lk->verbosity_level) {
 	    case 0: /* bare hex names of received streams */
-		fprintf(loghandle[0],"%08x\n",te);
+		fprintf(lk->loghandle[0],"%08x\n",te);
 		break;
 	    case 1: /* log length w/o text and epoch */
-		fprintf(loghandle[0],"%08x\t%d\n",
-			te,thisepoch_siftevents);
+		fprintf(lk->loghandle[0],"%08x\t%d\n",
+			te,lk->thisepoch_siftevents);
 		break;
 	    case 2: /* log length w text and epoch */
-		fprintf(loghandle[0],
+		fprintf(lk->loghandle[0],
 			"epoch: %08x\t survived raw entries: %d\n",
-			te,thisepoch_siftevents);
+			te,lk->thisepoch_siftevents);
 		break;
 	    case 3: /* log length w text and epoch and setbits */
-		fprintf(loghandle[0],
+		fprintf(lk->loghandle[0],
 			"epoch: %08x, stream2 evnts: %d, stream4 evnts: %d, new bitwidth4: %d\n",
-			te, ecnt2, thisepoch_siftevents,type4bitwidth);
+			te, st->ecnt2, lk->thisepoch_siftevents,lk->type4bitwidth);
 		break;
 	    case 4: /* log epoch, inlength, outlength, bitwidth for output,
 		       servoed time difference, est accidentals, accepted
 		       coincidences w text */
-		fprintf(loghandle[0],
+		fprintf(lk->loghandle[0],
 			"epoch: %08x, 2-evnts: %d, 4-evnts: %d, new bw4: %d, ft: %li, acc: %i, true: %i, 1-events: %d\n",
-			te, ecnt2, thisepoch_siftevents,type4bitwidth,
-			ft,accidentals,truecoincies,ecnt1initial);
+			te, st->ecnt2, lk->thisepoch_siftevents,lk->type4bitwidth,
+			st->ft,st->accidentals,st->truecoincies,
+			st->ecnt1initial);
 		break;
 	    case 5: /* log as in verbo mode 4 but without text */
-		fprintf(loghandle[0], "%08x\t%d\t%d\t%d\t%li\t%i\t%i\t%i\n",
-			te, ecnt2, thisepoch_siftevents,type4bitwidth,ft,
-			accidentals,truecoincies,ecnt1initial);
+		fprintf(lk->loghandle[0], "%08x\t%d\t%d\t%d\t%li\t%i\t%i\t%i\n",
+			te, st->ecnt2, lk->thisepoch_siftevents,lk->type4bitwidth,st->ft,
+			st->accidentals,st->truecoincies,st->ecnt1initial);
+		break;
+	    case 6: /* as verbo mode 5, plus window estimate of accidentals */
+		fprintf(lk->loghandle[0],
+			"%08x\t%d\t%d\t%d\t%li\t%i\t%i\t%i\t%.1f\t%.1f\n",
+			te, st->ecnt2, lk->thisepoch_siftevents,lk->type4bitwidth,st->ft,
+			st->accidentals,st->truecoincies,st->ecnt1initial,
+			st->accest,st->accerr);
 		break;
 
 	}
-	if (flushmode>1) fflush(loghandle[0]); /* main log flush */	
+	if (lk->flushmode>1) fflush(lk->loghandle[0]); /* main log flush */	
     }
 
     /* logging to notification files/streams 1 and 2  */
-    for (i=1;i<3;i++) if (logfname[i][0]) {
-	fprintf(loghandle[i],"%08x\n",te);
-	if (flushmode>2) fflush(loghandle[i]);
-    }
-
-    /* emit histogram if defined and due */
-    if (histologname[0]) {
-	histos_to_go--;
-	if (!histos_to_go) 
-	    emit_histo(te);
+    for (i=1;i<3;i++) if (lk->logfname[i][0]) {
+	fprintf(lk->loghandle[i],"%08x\n",te);
+	if (lk->flushmode>2) fflush(lk->loghandle[i]);
     }
     return 0;
 }
 
 
+/* memory mapping of an epoch file in a directory. The decoders read the
+   packet in place, so there is no size ceiling and no copy. */
+
+void unmap_epochfile(struct filemap *m) {
+    if (m->base) munmap(m->base,m->len);
+    m->base=NULL;
+}
+
+/* map a regular file, replacing a previous mapping. Returns a pointer to the
+   file content and its length in *bytes, or NULL if the file cannot be
+   mapped; the caller then reads it. An anonymous page behind the file
+   content allows the decoders to prefetch a word beyond the end. The mapping
+   is private and writable, since the stream-1 events may get corrected
+   in place (evcorrect.c). */
+char *map_epochfile(struct filemap *m, int handle, int *bytes) {
+    struct stat stbf;
+    size_t pg = sysconf(_SC_PAGESIZE);
+    char *base;
+
+    unmap_epochfile(m);
+    if (fstat(handle,&stbf) || !S_ISREG(stbf.st_mode) || !stbf.st_size)
+	return NULL;
+    m->len=((stbf.st_size+pg-1)/pg+1)*pg;
+    base=mmap(NULL,m->len,PROT_READ|PROT_WRITE,
+	      MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (base==MAP_FAILED) return NULL;
+    if (mmap(base,stbf.st_size,PROT_READ|PROT_WRITE,
+	     MAP_PRIVATE|MAP_FIXED|MAP_POPULATE,handle,0)==MAP_FAILED) {
+	munmap(base,m->len);
+	return NULL;
+    }
+    madvise(base,stbf.st_size,MADV_SEQUENTIAL);
+    m->base=base;
+    *bytes=stbf.st_size;
+    return base;
+}
+
 /* function to fill buffer with stream-1 raw data. eats an input bufferpointer,
    a file handle, a max size in bytes, and a pointer to a header_1 struct.
-   returns an error code.  */ 
-int get_stream_1(void *buffer, int handle, int maxsize,
-		 struct header_1 *head) {
+   If a filemap is given, a regular file is mapped instead of read into the
+   buffer. The start of the packet is returned in *data. With a handle of -1,
+   *data already points to a packet of maxsize bytes in a shared memory ring
+   or an epoch log. returns an error code.  */ 
+int get_stream_1(char **data, void *buffer, int handle, int maxsize,
+		 struct header_1 *head, struct filemap *m) {
     int retval;
     int eidx;
     int loops, bytelen; /* read-in game variables */
-    unsigned int *ib = buffer;
+    unsigned int *ib;
     struct header_1 *h; /* for local storage */
-
-    retval=read(handle,buffer,maxsize);
+    char *mapped = NULL;
+
+    if (handle==-1) { /* packet from a ring or log */
+	buffer=mapped=*data;
+	retval=maxsize;
+    } else if (m && (mapped=map_epochfile(m,handle,&retval))) {
+	buffer=mapped;
+	/* file may still grow; remap until it has the announced size */
+	h=(struct header_1 *)buffer;
+	for (loops=DEFAULT_READLOOPS;
+	     loops>0 && retval>=(int)sizeof(struct header_1) && h->length &&
+		 retval<(h->length+1)*sizeof(struct rawevent) +
+		 sizeof(struct header_1); loops--) {
+	    usleep(DEFAULT_SLEEP_LOOP);
+	    if (!(buffer=map_epochfile(m,handle,&retval))) return 40;
+	    h=(struct header_1 *)buffer;
+	}
+    } else {
+	retval=read(handle,buffer,maxsize);
+    }
+    *data=buffer; ib=buffer;
     if (!retval) return 39; /* nothing available */
     if (!(retval+1)) return 40; /* other error */
     if (retval<(int)sizeof(struct header_1)) return 41; /* incomplete read */
     h=(struct header_1 *)buffer; /* at beginning of stream */
     /* consistency check at end */
     if ((h->tag!=TYPE_1_TAG) && (h->tag!=TYPE_1_TAG_U)) return 42;
+    *head=h[0]; /* packets in rings and logs are read-only */
     if (h->length) {
 	eidx=(h->length*sizeof(struct rawevent)+sizeof(struct header_1))
 	    /sizeof(unsigned int);
 	if (eidx!=(retval/(int)sizeof(unsigned int)-2)) {
+	    if (mapped) return 41; /* incomplete file */
 	    /* we did not get everything */
 	    bytelen = retval; /* save number of already loaded bytes */
 	    for (loops=DEFAULT_READLOOPS;loops>0;loops--) {
@@ -955,31 +1582,38 @@ int get_stream_1(void *buffer, int handle, int maxsize,
 	eidx=retval/sizeof(unsigned int);
 	if (ib[eidx-1] |ib[eidx-2]) return 43; /* last word nonzero */
 	if (!(ib[eidx-3] |ib[eidx-4])) return 15; /* last real entry zero */ 
-	h->length=
+	head->length=
 	    (retval-sizeof(struct header_1))/sizeof(struct rawevent)-1;
     }
-    ecnt1initial=h->length;
-    *head=h[0]; /* return pointer to header */
+    lk->ecnt1initial=head->length;
     return 0;
 }
 
 /* function to fill buffer with stream-2 raw data. eats an input buffer, a
    file handle, a max size in bytes, and a pointer to a header_2 structure.
-   returns an error code. */
-int get_stream_2(void *buffer, int handle, int maxsize, 
-		 struct header_2 *head, int* realsize) {
+   With a filemap, a regular file is mapped instead; the start of the packet
+   is returned in *data. With a handle of -1, *data already points to a
+   packet of maxsize bytes in a shared memory ring or an epoch log. returns an
+   error code. */
+int get_stream_2(char **data, void *buffer, int handle, int maxsize, 
+		 struct header_2 *head, int* realsize, struct filemap *m) {
     int retval, bytelen,loops;
     int upper,lower; /* for consistency check */
     struct header_2* h;
     struct stat stbf; /* holds stat information */
+    char *mapped = NULL;
    
-    /* get stat of file */
-    if (fstat(handle,&stbf)) {
-	fprintf(stderr, "errno: %d ",errno);
+    if (handle==-1) { /* packet from a ring or log */
+	buffer=*data;
+	retval=bytelen=maxsize;
+	stbf.st_size=bytelen;
+    } else if (fstat(handle,&stbf)) { /* get stat of file */
+	fprintf(stderr, "errno: %d\n",errno);
 	return 71; 
-    }
-    /* do stat test if you can, i.e., ordinary file */
-    if (S_ISREG(stbf.st_mode)) { /* can use stat info to get length */
+    } else if (m && (mapped=map_epochfile(m,handle,&bytelen))) {
+	buffer=mapped; /* read in place */
+	retval=bytelen;
+    } else if (S_ISREG(stbf.st_mode)) { /* can use stat info to get length */
 	bytelen=0;
 	for (loops=DEFAULT_READLOOPS;loops>0;loops--) {
 	    retval=read(handle,&((char *)buffer)[bytelen],maxsize-bytelen);
@@ -989,7 +1623,7 @@ int get_stream_2(void *buffer, int handle, int maxsize,
 	    usleep(DEFAULT_SLEEP_LOOP); /* sleep a while */
 	}
 	if (!loops)  { /* failed to read all bytes */
-	    fprintf(stderr, "cannot get all bytes; got %d ",bytelen);
+	    fprintf(stderr, "cannot get all bytes; got %d\n",bytelen);
 	    return 46; /* incomplete read */
 	}
     } else { /* need to hope that I get correct length in first read */
@@ -997,13 +1631,24 @@ int get_stream_2(void *buffer, int handle, int maxsize,
 	if (!(retval+1)) return 45; /* other error */
 	bytelen= retval;
     }
+    *data=buffer;
     if (!retval) return 44; /* nothing available */
    
     if (bytelen<(int)sizeof(struct header_2)) return 46; /* incomplete read */
     h=(struct header_2 *)buffer; /* at beginning of stream */
     /* consistency check on length and tag */
-    if ((h->tag!=TYPE_2_TAG) && (h->tag!=TYPE_2_TAG_U)) return 47;
-    if (h->length) {
+    if ((h->tag==TYPE_2_TAG_RICE) || (h->tag==TYPE_2_TAG_RICE_U)) {
+	/* between a terminating bit and a full difference per event */
+	lower=(sizeof(struct header_2)*8+h->length*(1+h->basebits))/8;
+	upper=(sizeof(struct header_2)*8+
+	       h->length*(RICE_QMAX+32+h->basebits)+31)/8;
+	if ((lower>bytelen) | (upper<bytelen)) {
+	    fprintf(stderr, "len (elems): %d, bytelen: %d, u:%d, l:%d\n",
+		    h->length, bytelen,upper,lower);
+	    return 48;}
+    } else if ((h->tag!=TYPE_2_TAG) && (h->tag!=TYPE_2_TAG_U)) {
+	return 47;
+    } else if (h->length) {
         lower=(sizeof(struct header_2)*8+
 	       (h->length+1)*(h->basebits+h->timeorder))/8;
 	upper=(sizeof(struct header_2)*8+
@@ -1018,8 +1663,8 @@ int get_stream_2(void *buffer, int handle, int maxsize,
 	    return 48;}
     }
     /* protocol bit match? */
-    if (h->basebits != expected2bits) {
-	fprintf(stderr,"base: %d, expected: %d\n",h->basebits, expected2bits);
+    if (h->basebits != lk->expected2bits) {
+	fprintf(stderr,"base: %d, expected: %d\n",h->basebits, lk->expected2bits);
 	return 63;
     }
     *realsize = bytelen; /* read in bytes */
@@ -1029,76 +1674,769 @@ int get_stream_2(void *buffer, int handle, int maxsize,
 
 
 
-int main (int argc, char *argv[]) {
-    unsigned int startepoch = DEFAULT_STARTEPOCH; /* epoch to start with */
-    unsigned int epochnumber = DEFAULT_EPOCHNUMBER; /* # of epochs to read  */
-    long long int se_in; /* for entering startepoch both in hex and decimal */
-    int firstrun = 0; /* first run of reading stream 2 - no close 3,4 */
-    long long int timediff0 = 17; /* initial time difference */
-    long long int timediff = 18; /* current time difference */
-    long long int eventdiff = 0;
-    long long hdiff; /* for histogramming */
-    unsigned long long int t1=0, t2=0, t1old=0; /* extracted times  */
-    long long int coincwindow = DEFAULT_COINCWINDOW; /* in 1/8 nsec */
-    long long int trackwindow = DEFAULT_TRACKWINDOW; /* in 1/8 nsec */
-    int accidental_dist = DEFAULT_ACCDIST; /* in 1/8 nsec */
-    long long int referencewindow1,referencewindow2;
-    long long int floattime;  /* floating avg time difference in 1/8/4096 */
-    long long int servodiff; /* time since last servo event */
-    unsigned long long int lastservotime; /* for time-based servoing */
-    long long int servoofftime=MAX_SERVOOFFTIME; /* prevent jumps */
-    int servo_param = DEFAULT_FILTER; /* time/event const for tracker */
-    long long int servo_p1 = 0; /* reduce calculation in filter */
-    int proto_index = DEFAULT_PROTOCOL; /* defines which proto is used */
-    char *buffer1, *buffer2; /* stream buffers */
-    int getone, gettwo;  /* for coincidence loop */
+/* stream-2 decoder stage. Delivers the next record for the matcher in *ev:
+   the events of an epoch, framed by S2_NEWEPOCH and S2_EPOCHEND markers, or
+   S2_END when the requested number of epochs has been read. Returns 0 or an
+   error code. */
+int decode_stream2(struct s2event *ev) {
+    int retval, realsize2, n;
+    char *data2; /* stream-2 packet */
 
-    unsigned int epoch1, epoch2; /* running epochs for read/write */
-    struct rawevent *pointer1; /* for parsing stream-1 */
-    unsigned int localep; /* for initializing stream 1  epoch */
-    unsigned long long epoch1_offset = 0; /* for epoch correction */
-    int pattern1;
-    int raw_patternmask; /* which detectors to take; */
-
-    int realsize2; /* entries in buffer2 */
-    unsigned int *pointer2=NULL; /* for parsing stream-2 */
-    int idx2=0,resbits2=0,type2bitwidth=0,type2datawidth=0; /* for buffer2 */
-    int bitstoread2=0;
-    int pattern2=0,opatt2;
-    unsigned long long tdiff_bitmask2=0,patternmask2=0;
-    unsigned int tdiff2,readword2=0;
+    if (lk->decstate==DEC_EPOCHEND) { /* announce end of previous epoch */
+	ev->kind=S2_EPOCHEND;
+	lk->decstate=DEC_LOAD;
+	return 0;
+    }
+    if (lk->decstate==DEC_LOAD) { /* time to reload a stream-2 package */
+	/* check termination of this epoch for -q option */
+	if (lk->epochnumber && (lk->epoch2>=lk->startepoch+lk->epochnumber)) {
+	    ev->kind=S2_END;
+	    lk->decstate=DEC_DONE;
+	    return 0;
+	}
 
-    int *decisionmatrix; /* contains the protocol decision at this level */
-    int decisionindexmask,keepthatpairmask,stream4datashift;
-    int longerpattern;  /* the longer of stream 3 or stream 5 bitlengths */
-    int testeventmask;  /* to mask out the decision test/key */
-    int stream4datamask, stream3datamask, stream5datamask;
+	/* evtl. open stream 2 */
+	if (lk->typemode[2]==2) { /* file in directory */
+	    strncpy(lk->ffn2, lk->fname[2], FNAMELENGTH);
+	    atohex(&lk->ffn2[strlen(lk->ffn2)],lk->epoch2);
+	    link_idle(); /* no slot needed while waiting */
+	    retval=epochwait(&lk->watch2,lk->ffn2,MAXFILETESTS,
+			     DEFAULT_WAITFORFILE);
+	    link_busy();
+	    switch (retval) {
+		case EPOCHWAIT_ERROR:
+		    fprintf(stderr,"file(2):%s,errno:%d\n",lk->ffn2,errno);
+		    return 64;
+		case EPOCHWAIT_TIMEOUT:
+		    fprintf(stderr,"timeout for %s\n",lk->ffn2);
+		    return 32;
+	    }
+	    epochwait_backlog(&lk->watch2,lk->ffn2,CATCHUP_DEPTH); /* read-ahead */
+
+	    lk->handle[2]=open(lk->ffn2,openmode[2]);
+	    if(-1==lk->handle[2]) {
+		fprintf(stderr,"real open fail: errno %d\n",errno);
+		return 32;
+	    }
+	}
+
+	if (lk->typemode[2]==3) { /* packet from the ring */
+	    link_idle();
+	    retval=shmring_getepoch(&lk->ring[2],2,lk->epoch2,&data2,&realsize2,
+				    SHMRING_TIMEOUT_MS);
+	    link_busy();
+	    switch (retval) {
+		case SHMRING_OK:
+		    break;
+		case SHMRING_EPOCH:
+		    fprintf(stderr,"ring(2) has no epoch %08x\n",lk->epoch2);
+		    return 48;
+		default:
+		    fprintf(stderr,"timeout for epoch %08x in ring(2)\n",lk->epoch2);
+		    return 32;
+	    }
+	    lk->handle[2]=-1;
+	}
+	if (lk->typemode[2]==4) { /* packet from the log */
+	    link_idle();
+	    retval=epochlog_read(&lk->elog[2],2,lk->epoch2,&data2,&realsize2,
+				 MAXFILETESTS,DEFAULT_WAITFORFILE);
+	    link_busy();
+	    switch (retval) {
+		case EPOCHLOG_OK:
+		    break;
+		case EPOCHLOG_TIMEOUT:
+		    fprintf(stderr,"timeout for epoch %08x in log(2)\n",lk->epoch2);
+		    return 32;
+		case EPOCHLOG_ERROR:
+		    fprintf(stderr,"log(2):%s,errno:%d\n",lk->fname[2],errno);
+		    return 64;
+		default:
+		    fprintf(stderr,"log(2) has no epoch %08x\n",lk->epoch2);
+		    return 48;
+	    }
+	    /* remove segments before this one */
+	    if (lk->killmode[2] && epochlog_drop(&lk->elog[2],lk->epoch2)) return 51;
+	    lk->handle[2]=-1;
+	}
+
+	/* buffer stream 2 */
+	retval=get_stream_2(&data2,lk->buffer2,lk->handle[2],
+			    lk->typemode[2]>=3?realsize2:RAW2_SIZE,&lk->head2,
+			    &realsize2,lk->typemode[2]==2?&lk->map2:NULL);
+	if (retval) return retval;
+
+	/* check epoch consistency */
+	if (lk->head2.epoc!=lk->epoch2) return 48;
+	if (lk->epoch2==lk->startepoch) lk->uepoch2=(lk->head2.tag & 0x100?1:0);
+
+	/* close evtl stream 2 */ 
+	if (lk->typemode[2]==2) { /* file is in a directory */
+	    close_handle(2);
+	    /* eventually remove file */
+	    if (lk->killmode[2] && (lk->handle[2]!=0)) {
+		if (unlink(lk->ffn2)) return 51;
+	    }
+	}
+
+	/* process stream 2 */
+	lk->pointer2=(unsigned int *)(data2+sizeof(struct header_2));
+	/* adjust to current epoch origin */
+	lk->t2dec=((unsigned long long)lk->epoch2)<<32; 
+	/* prepare decompression */
+	if (lk->head2.tag & 0x200) { /* Rice coded */
+	    bitunpack_rice_init(&lk->bits2,lk->pointer2,
+		       (realsize2-sizeof(struct header_2))/sizeof(unsigned int),
+		       lk->head2.timeorder,lk->head2.basebits,lk->head2.length);
+	} else {
+	    bitunpack_init(&lk->bits2,lk->pointer2,
+		       (realsize2-sizeof(struct header_2))/sizeof(unsigned int),
+		       lk->head2.timeorder,lk->head2.basebits);
+	}
+	lk->blkpos2=0; lk->blkn2=0;
+	lk->ecnt2dec=0;/* count local events */
+
+	ev->kind=S2_NEWEPOCH; ev->v=lk->uepoch2;
+	ev->t2=((unsigned long long)lk->head2.length<<32) | lk->epoch2;
+	lk->epoch2++; /* prepare for next read */
+	lk->decstate=lk->head2.length?DEC_EVENTS:DEC_EPOCHEND;
+	return 0;
+    }
+
+    if (lk->blkpos2==lk->blkn2) { /* unpack the next block of events */
+	n=lk->head2.length-lk->ecnt2dec;
+	if (n>BITUNPACK_BLOCK) n=BITUNPACK_BLOCK;
+	lk->blkn2=evbatch_type2(&lk->blk2,&lk->bits2,&lk->t2dec,n);
+	if (lk->blkn2<n) return 49; /* stream ended early */
+	lk->blkpos2=0;
+    }
+    lk->ecnt2dec++;
+    ev->t2=lk->blk2.t[lk->blkpos2]; ev->kind=lk->blk2.p[lk->blkpos2];
+    ev->v=lk->ecnt2dec;
+    lk->blkpos2++;
+    if (lk->ecnt2dec>=lk->head2.length) lk->decstate=DEC_EPOCHEND;
+    return 0;
+}
+
+/* packing of a kept coincidence into streams 3, 4 and 5. The protocol is a
+   compile-time constant, so the bit widths and masks are folded in, and the
+   stream-5 branch disappears for protocols without Bell test events. */
+static inline __attribute__((always_inline))
+void encode_sift(struct encrecord *r, const int proto) {
+    int d = r->d;
     int stream3data, stream4data, stream5data;
+    unsigned int indexdiff4; /* temporary variable for index difference */
+    const int w3 = PROTO_WIDTH(proto,WIDTH_B3); /* stream-3 bits */
+    const int w4 = PROTO_WIDTH(proto,WIDTH_B4); /* stream-4 data bits */
+    const int w5 = PROTO_WIDTH(proto,WIDTH_B5); /* stream-5 bits */
+
+    if (w5 && (d & PROTO_TESTMASK(proto))) {
+	/* save as bell test event */
+	/* add to stream 5 */
+	stream5data = d & ((1<<w5)-1);
+	if (lk->resbits5>=w5) {
+	    lk->sendword5 |= (stream5data << (lk->resbits5-w5));
+	    lk->resbits5 = lk->resbits5-w5;
+	    if (lk->resbits5==0) { 
+		lk->outbuf5[lk->index5++]=lk->sendword5;
+		lk->sendword5=0;lk->resbits5=32;
+	    }
+	} else {
+	    lk->resbits5=w5-lk->resbits5;
+	    lk->sendword5 |= (stream5data >> lk->resbits5);
+	    lk->outbuf5[lk->index5++]=lk->sendword5;
+	    lk->resbits5=32-lk->resbits5;
+	    lk->sendword5=stream5data << lk->resbits5;
+	}
+	lk->thisepoch_testevents++;
+    } else { /* save as key event */
+	/* add to stream 3 */
+	stream3data = d & ((1<<w3)-1);
+	if (lk->resbits3>=w3) {
+	    lk->sendword3 |= (stream3data << (lk->resbits3-w3));
+	    lk->resbits3 = lk->resbits3-w3;
+	    if (lk->resbits3==0) { 
+		lk->outbuf3[lk->index3++]=lk->sendword3;
+		lk->sendword3=0;lk->resbits3=32;
+	    }
+	} else {
+	    lk->resbits3=w3-lk->resbits3;
+	    lk->sendword3 |= (stream3data >> lk->resbits3);
+	    lk->outbuf3[lk->index3++]=lk->sendword3;
+	    lk->resbits3=32-lk->resbits3;
+	    lk->sendword3=stream3data << lk->resbits3;
+	}
+    }
+
+    /* add to stream 4 */
+    stream4data = (d>>PROTO_LONGER(proto)) & ((1<<w4)-1);
+
+    indexdiff4=r->v-lk->oldindex4+2; /* index difference, corrected */
+    lk->oldindex4=r->v;
+
+    if (lk->filterconst_stream4==FILTER_PEREPOCH) { /* pack at end of epoch */
+	lk->gbufd4.buf[2*lk->thisepoch_siftevents]=indexdiff4;
+	lk->gbufd4.buf[2*lk->thisepoch_siftevents+1]=stream4data;
+	lk->widthhist4[widthhist_bin(indexdiff4)]++;
+    } else {
+	pack4(indexdiff4,stream4data,w4);
+    }
+
+    lk->thisepoch_siftevents++;
+}
+#define SIFT_KERNEL(p) \
+    void encode_sift_##p(struct encrecord *r) {encode_sift(r,p);}
+SIFT_KERNEL(0) SIFT_KERNEL(1) SIFT_KERNEL(2)
+SIFT_KERNEL(3) SIFT_KERNEL(4) SIFT_KERNEL(5)
+void (*sift_kernels[PROTOCOL_MAXINDEX+1])(struct encrecord *) = {
+    encode_sift_0, encode_sift_1, encode_sift_2,
+    encode_sift_3, encode_sift_4, encode_sift_5};
+
+/* encoder stage. Packs kept coincidences into streams 3, 4 and 5, and opens
+   and writes out the epochs. After an error, which the matcher picks up at
+   the next epoch boundary, the records are dropped; histogram buffers are
+   still handed back, as the matcher may wait for them. */
+void encode_record(struct encrecord *r) {
+    int retval;
+    if (lk->encerror) {
+	if (r->kind==ENC_HISTO)
+	    __atomic_store_n(&lk->histofree[r->d],1,__ATOMIC_RELEASE);
+	return;
+    }
+    switch (r->kind) {
+	case ENC_OPEN: /* prepare new stream 3 and 4 */
+	    lk->uepoch=r->d;
+	    if ((retval=open_epoch(r->v,r->st.ecnt2))) {
+		__atomic_store_n(&lk->encerror,retval,__ATOMIC_RELEASE);
+		return;
+	    }
+	    lk->oldindex4=1; /* first entry connected to ecnt2 */
+	    lk->thisepoch_siftevents=0;
+	    lk->thisepoch_testevents=0;
+	    return;
+	case ENC_CLOSE: /* save stream 3 and 4, and do logging */
+	    if ((retval=close_epoch(&r->st)))
+		__atomic_store_n(&lk->encerror,retval,__ATOMIC_RELEASE);
+	    return;
+	case ENC_HISTO: /* write out and hand back a histogram buffer */
+	    emit_histo(r->v,lk->histobuf[r->d]);
+	    clear_histo(lk->histobuf[r->d]);
+	    __atomic_store_n(&lk->histofree[r->d],1,__ATOMIC_RELEASE);
+	    return;
+    }
+
+    lk->sift_kernel(r);
+}
+
+/* ring buffer helpers for the pipelined mode */
+int ring_init(struct spsc_ring *r, int elsize, int order) {
+    r->buf=(char *)malloc(elsize<<order);
+    if (!r->buf) return 81;
+    r->elsize=elsize; r->mask=(1<<order)-1;
+    r->head=0; r->tail=0;
+    return 0;
+}
+/* spin for a while, then give up the cpu, and in link mode the worker
+   slot of the matcher */
+void ring_wait(int *spins) {
+    if (++*spins<RING_SPINS) return;
+    link_idle();
+    usleep(RING_SLEEP); *spins=0;
+    link_busy();
+}
+/* returns 0, or -1 if the decoder stage is told to stop while waiting for
+   room */
+int ring_put(struct spsc_ring *r, void *el) {
+    unsigned int h=r->head;
+    int spins=0;
+    while (h-__atomic_load_n(&r->tail,__ATOMIC_ACQUIRE)>r->mask) {
+	if (__atomic_load_n(&lk->stopstages,__ATOMIC_ACQUIRE)) return -1;
+	ring_wait(&spins);
+    }
+    memcpy(&r->buf[(h & r->mask)*r->elsize],el,r->elsize);
+    __atomic_store_n(&r->head,h+1,__ATOMIC_RELEASE);
+    return 0;
+}
+void ring_get(struct spsc_ring *r, void *el) {
+    unsigned int t=r->tail;
+    int spins=0;
+    while (__atomic_load_n(&r->head,__ATOMIC_ACQUIRE)==t)
+	ring_wait(&spins);
+    memcpy(el,&r->buf[(t & r->mask)*r->elsize],r->elsize);
+    __atomic_store_n(&r->tail,t+1,__ATOMIC_RELEASE);
+}
+
+/* decoder step which turns an error into an S2_ERROR record */
+void decode_next(struct s2event *ev) {
+    int retval;
+    if ((retval=decode_stream2(ev))) {
+	ev->kind=S2_ERROR; ev->v=retval;
+	lk->decstate=DEC_DONE;
+    }
+}
+void *decoder_thread(void *arg) {
+    struct s2event ev;
+    lk=arg; /* work for the link which started us */
+    do {
+	if (__atomic_load_n(&lk->stopstages,__ATOMIC_ACQUIRE)) break;
+	decode_next(&ev);
+	if (ring_put(&lk->ring2,&ev)) break;
+    } while (ev.kind!=S2_END && ev.kind!=S2_ERROR);
+    return NULL;
+}
+void *encoder_thread(void *arg) {
+    struct encrecord r;
+    lk=arg;
+    while (1) {
+	ring_get(&lk->ringenc,&r);
+	if (r.kind==ENC_END) break;
+	encode_record(&r);
+    }
+    return NULL;
+}
+
+/* stage connectors for the matcher, either direct or via the rings */
+void from_decoder(struct s2event *ev) {
+    if (lk->pipelined) {
+	ring_get(&lk->ring2,ev);
+    } else {
+	decode_next(ev);
+    }
+}
+void to_encoder(struct encrecord *r) {
+    if (lk->pipelined) {
+	ring_put(&lk->ringenc,r);
+    } else {
+	encode_record(r);
+    }
+}
+/* wait until the encoder has written out everything handed to it. Passes
+   through an error code for use in an exit path. */
+int drain_encoder(int code) {
+    struct encrecord r;
+    if (lk->pipelined) {
+	r.kind=ENC_END;
+	ring_put(&lk->ringenc,&r);
+	pthread_join(lk->encoderthread,NULL);
+	lk->pipelined=0;
+    }
+    return code;
+}
+/* end the stage threads which have been started. The decoder may be ahead
+   of a matcher which gave up, and is stopped. */
+void stop_stages(void) {
+    if (lk->stages) {
+	__atomic_store_n(&lk->stopstages,1,__ATOMIC_RELEASE);
+	pthread_join(lk->decoderthread,NULL);
+	lk->stopstages=0;
+    }
+    if (lk->stages==2) drain_encoder(0);
+    lk->pipelined=0; lk->stages=0;
+}
 
-    unsigned int oldindex4=0; /* for saving index */
-    unsigned int indexdiff4,t4,t4a; /* temporary variable for timedifference */
-    int opt,i,j,retval,d;
-    int opcnt;  /* limit counter for file waiting */
+/* hand the full histogram buffer to the encoder and continue counting in
+   the other one, which the encoder has normally cleared long ago */
+void swap_histo(unsigned int te) {
+    struct encrecord r;
+    int spins=0;
+    lk->histofree[lk->histoactive]=0;
+    r.kind=ENC_HISTO; r.v=te; r.d=lk->histoactive;
+    to_encoder(&r);
+    lk->histoactive^=1;
+    while (!__atomic_load_n(&lk->histofree[lk->histoactive],__ATOMIC_ACQUIRE))
+	ring_wait(&spins);
+    lk->histo=lk->histobuf[lk->histoactive];
+    lk->histos_to_go = lk->histolen;
+}
+
+/* matcher helper: count the noted stream-2 events in the windows for
+   accidentals against the current stream-1 packet */
+void count_accidentals(void) {
+    accwin_count(&lk->accw,lk->ev1.t,lk->ev1.n);
+}
+
+/* matcher part of closing an epoch: hand statistics to the encoder and emit
+   the histogram if due */
+void close_matched_epoch(unsigned int te) {
+    struct encrecord r;
+    double est, err;
+    r.kind=ENC_CLOSE;
+    r.st.ecnt2=lk->ecnt2; r.st.ecnt1initial=lk->ecnt1initial;
+    r.st.accidentals=lk->accidentals; r.st.truecoincies=lk->truecoincies;
+    r.st.ft=lk->ft;
+    if (lk->accw.windows) {
+	count_accidentals();
+	accwin_result(&lk->accw,&est,&err);
+	r.st.accest=est; r.st.accerr=err;
+    } else {
+	r.st.accest=lk->accidentals; r.st.accerr=0.;
+    }
+    to_encoder(&r);
+
+    /* emit histogram if defined and due */
+    if (lk->histologname[0]) {
+	lk->histos_to_go--;
+	if (!lk->histos_to_go) 
+	    swap_histo(te);
+    }
+}
+
+/* matcher helper to load the next stream-1 packet. Returns 0 or an error
+   code. */
+int load_stream1(void) {
+    int retval, len1;
+    char *data1; /* stream-1 packet */
+
+    /* the noted stream-2 events still need this packet */
+    if (lk->accw.nb) count_accidentals();
+
+    /* evtl. open stream 1 */
+    if (lk->typemode[1]==2) { /* file in directory */
+	strncpy(lk->ffnam, lk->fname[1], FNAMELENGTH);
+	atohex(&lk->ffnam[strlen(lk->ffnam)],lk->epoch1);
+
+	link_idle(); /* no slot needed while waiting */
+	retval=epochwait(&lk->watch1,lk->ffnam,MAXFILETESTS,
+			 DEFAULT_WAITFORFILE);
+	link_busy();
+	switch (retval) {
+	    case EPOCHWAIT_ERROR:
+		fprintf(stderr,"file(1):%s,errno:%d\n",lk->ffnam,errno);
+		return 64;
+	    case EPOCHWAIT_TIMEOUT:
+		fprintf(stderr,"waited too long for %s\n",lk->ffnam);
+		return 31;
+	}
+	/* in a backlog the file is complete, and the next ones are read
+	   ahead; otherwise let the writer finish if no completion was seen */
+	if (!epochwait_backlog(&lk->watch1,lk->ffnam,CATCHUP_DEPTH) &&
+	    retval==EPOCHWAIT_PRESENT) usleep(DEFAULT_WAITWRITTEN);
+	
+	lk->handle[1]=open(lk->ffnam,openmode[1]);
+	if(-1==lk->handle[1]) return 31;
+    }
+    if (lk->typemode[1]==3) { /* packet from the ring */
+	link_idle();
+	retval=shmring_getepoch(&lk->ring[1],1,lk->epoch1,&data1,&len1,
+				SHMRING_TIMEOUT_MS);
+	link_busy();
+	switch (retval) {
+	    case SHMRING_OK:
+		break;
+	    case SHMRING_EPOCH:
+		fprintf(stderr,"ring(1) has no epoch %08x\n",lk->epoch1);
+		return 43;
+	    default:
+		fprintf(stderr,"waited too long for epoch %08x in ring(1)\n",
+			lk->epoch1);
+		return 31;
+	}
+	lk->handle[1]=-1;
+    }
+    if (lk->typemode[1]==4) { /* packet from the log */
+	link_idle();
+	retval=epochlog_read(&lk->elog[1],1,lk->epoch1,&data1,&len1,
+			     MAXFILETESTS,DEFAULT_WAITFORFILE);
+	link_busy();
+	switch (retval) {
+	    case EPOCHLOG_OK:
+		break;
+	    case EPOCHLOG_TIMEOUT:
+		fprintf(stderr,"waited too long for epoch %08x in log(1)\n",
+			lk->epoch1);
+		return 31;
+	    case EPOCHLOG_ERROR:
+		fprintf(stderr,"log(1):%s,errno:%d\n",lk->fname[1],errno);
+		return 64;
+	    default:
+		fprintf(stderr,"log(1) has no epoch %08x\n",lk->epoch1);
+		return 43;
+	}
+	/* remove segments before this one */
+	if (lk->killmode[1] && epochlog_drop(&lk->elog[1],lk->epoch1)) return 50;
+	lk->handle[1]=-1;
+    }
+    /* buffer stream 1 */
+    retval=get_stream_1(&data1,lk->buffer1,lk->handle[1],
+			lk->typemode[1]>=3?len1:RAW1_SIZE,&lk->head1,
+			lk->typemode[1]==2?&lk->map1:NULL);
+    if (retval) return retval;
+    lk->pointer1=(struct rawevent *)(data1+sizeof(struct header_1));
+    /* check epoch consistency */
+    if (lk->head1.epoc!=lk->epoch1) return 43;
+    /* evtl close stream 1 */
+    if (lk->typemode[1]==2) { /* file is not a  directory */
+	close_handle(1);
+	/* eventually remove file */
+	if (lk->killmode[1] && (lk->handle[1]!=0)) {
+	    if (unlink(lk->ffnam)) return 50;
+	}
+    }
+
+    /* times with the upper bits from the epoch, and patterns. Detector
+       skew and dead time are corrected on the way; the packet itself is
+       not changed, as packets in rings and logs are shared with other
+       readers */
+    if (evbatch_reserve(&lk->ev1,lk->head1.length)) return 100;
+    if (lk->corr1.mode) {
+	lk->head1.length=evbatch_type1_corrected(&lk->ev1,
+		 (unsigned int *)lk->pointer1,lk->head1.length,lk->epoch1,
+		 &lk->corr1);
+    } else {
+	evbatch_type1(&lk->ev1,(unsigned int *)lk->pointer1,lk->head1.length,
+		      lk->epoch1);
+    }
+    lk->ecnt1=0; /* reset for this round */
+    lk->epoch1++;
+    return 0;
+}
+
+/* matcher helper for the epoch markers from the decoder. Returns 0 or an
+   error code. */
+int handle_marker(struct s2event *ev) {
+    struct encrecord er;
+    int retval;
+    if ((retval=__atomic_load_n(&lk->encerror,__ATOMIC_ACQUIRE)))
+	return retval; /* the encoder gave up */
+    switch (ev->kind) {
+	case S2_EPOCHEND: /* eventually save streams 3 and 4 */
+	    if (!lk->firstrun) close_matched_epoch(lk->currentepoch);
+	    break;
+	case S2_NEWEPOCH: /* prepare new stream 3 and 4 */
+	    lk->currentepoch=ev->t2 & 0xffffffff; lk->firstrun=0;
+	    er.kind=ENC_OPEN; er.v=lk->currentepoch; er.d=ev->v;
+	    er.st.ecnt2=ev->t2>>32; /* for sizing the output buffers */
+	    to_encoder(&er);
+	    lk->accidentals=0;lk->truecoincies=0;
+	    lk->thisepoch_converted_entries=0;
+	    break;
+	case S2_ERROR:
+	    return ev->v;
+    }
+    return 0;
+}
+
+/* offset bank. Every stream-2 event is compared with the recent stream-1
+   events for all candidate offsets at once; this has to wait until stream 1
+   has moved past the largest offset, so the stream-2 times are queued. The
+   candidate with index banksize is the tracked time difference itself. */
+
+void init_bank(void) {
+    int k;
+    for (k=0;k<BANK_SLOTS;k++)
+	lk->bankoffset[k]=(k<=2*lk->banksize)?
+	    (k-lk->banksize)*lk->bankspacing:BANK_UNUSED;
+    lk->bankreach=lk->banksize*lk->bankspacing+lk->coincwindow;
+}
+
+/* count coincidences of a stream-2 time for all candidates. The inner loop
+   has a fixed length and no branches, so it is vectorized. */
+static inline void bank_eval(unsigned long long tb) {
+    long long int e;
+    unsigned int p=lk->t1histpos;
+    int j,k;
+    const long long int cw=lk->coincwindow;
+    for (j=0;j<BANK_T1HIST;j++) {
+	e=((long long int)(lk->t1hist[(--p)&(BANK_T1HIST-1)]-tb))+lk->timediff;
+	if (e>lk->bankreach) continue; /* too late for all candidates */
+	if (e<-lk->bankreach) break;   /* this and all older ones too early */
+	for (k=0;k<BANK_SLOTS;k++)
+	    lk->bankcount[k]+=((unsigned long long)(e+lk->bankoffset[k]+cw-1)
+			       <(unsigned long long)(2*cw-1));
+    }
+}
+
+/* jump to a candidate which dominates the tracked offset */
+static void bank_decide(void) {
+    int k, best=lk->banksize;
+    for (k=0;k<=2*lk->banksize;k++)
+	if (lk->bankcount[k]>lk->bankcount[best]) best=k;
+    if (lk->bankcount[best]<BANK_MINCOUNTS) return;
+    if (best!=lk->banksize &&
+	lk->bankcount[best]>BANK_DOMINANCE*lk->bankcount[lk->banksize]) {
+	lk->timediff0+=lk->bankoffset[best]; lk->timediff+=lk->bankoffset[best];
+	fprintf(lk->debuglog,"offset bank: time difference changed by %lld to %lld\n",
+		lk->bankoffset[best],lk->timediff);
+    }
+    memset(lk->bankcount,0,sizeof(lk->bankcount));
+}
+
+/* evaluate a queued stream-2 time */
+static inline void bank_pop(void) {
+    bank_eval(lk->t2pend[(lk->t2tail++)&(BANK_T2PEND-1)]);
+    bank_decide();
+}
+
+/* coincidence matcher. Protocol, histogramming (0: off, 1: on), the
+   tracking mode (0: off, 1: event based, 2: time based) and the offset bank
+   (0: off, 1: on) are compile-time constants, so each combination below gets
+   its own loop without the corresponding tests, and with the protocol masks
+   folded in. Returns 0 on a benign end or a negative error code. */
+static inline __attribute__((always_inline))
+int merge_events(const int proto, const int histo_on, const int track,
+		 const int bank) {
+    long long int eventdiff;
+    long long hdiff; /* for histogramming */
+    long long int servodiff; /* time since last servo event */
+    int pattern1, pattern2=0, d, retval;
+    struct s2event ev2; /* from the decoder */
+    struct encrecord er; /* to the encoder */
+    const int raw_patternmask = PROTO_WIDTH(proto,WIDTH_DE)-1;
+
+    while (1) {
+	eventdiff=((long long int)(lk->t1-lk->t2))+lk->timediff;
+	if (eventdiff<-lk->trackwindow || lk->getone) {
+	    /* load event 1 */
+	    if (lk->ecnt1==lk->head1.length) { /* time to reload a stream-1 package */
+		retval=load_stream1();
+		if (retval) return -emsg(drain_encoder(retval));
+	    }
+	    /* get a value out of the list */
+	    lk->t1old=lk->t1;
+	    lk->t1=lk->ev1.t[lk->ecnt1];
+	    if (lk->t1<=lk->t1old) { /* something's fishy. ignore this value */
+		lk->ecnt1++;
+		lk->t1=lk->t1old;
+		lk->getone=1;
+		continue;
+	    }
+	    /* get pattern 1 later... */
+	    lk->ecnt1++;
+	    lk->getone=0;
+	    if (bank) { /* queued stream-2 times this one has passed */
+		lk->t1hist[(lk->t1histpos++)&(BANK_T1HIST-1)]=lk->t1;
+		while (lk->t2head!=lk->t2tail &&
+		       ((long long int)(lk->t1-lk->t2pend[lk->t2tail&(BANK_T2PEND-1)]))
+		       +lk->timediff>lk->bankreach) bank_pop();
+	    }
+	    continue;
+	}
+	if ((eventdiff>lk->referencewindow2)|| lk->gettwo) { /* clearly out-of-band */
+	    /* load event 2, handle epoch boundaries on the way */
+	    do {
+		from_decoder(&ev2);
+		if (ev2.kind<0 && (retval=handle_marker(&ev2)))
+		    return -emsg(drain_encoder(retval));
+	    } while (ev2.kind<0 && ev2.kind!=S2_END);
+	    /* check termination for -q option */
+	    if (ev2.kind==S2_END) break;
+	    /* we now have a valid event */
+	    lk->t2=ev2.t2; pattern2=ev2.kind; lk->ecnt2=ev2.v;
+	    lk->gettwo=0;
+	    if (lk->accw.windows &&
+		accwin_add(&lk->accw,(long long int)lk->t2-lk->timediff,
+			   lk->ecnt1))
+		count_accidentals();
+	    if (bank) {
+		if (lk->t2head-lk->t2tail==BANK_T2PEND) bank_pop(); /* queue full */
+		lk->t2pend[(lk->t2head++)&(BANK_T2PEND-1)]=lk->t2;
+	    }
+	    continue;
+	}
+	/* do histogramming */
+	if (histo_on) {
+	    hdiff=(eventdiff>>lk->histoshift)+lk->histodepth/2;
+	    if (hdiff<lk->histodepth && hdiff>=0) 
+		lk->histo[lk->histidx[((lk->ev1.p[lk->ecnt1-1] & raw_patternmask) |
+			       (pattern2<<4))&255]*lk->histodepth+hdiff]++;
+	}
+	/* monitor accidentals at the upper edge of the track window */
+	if (eventdiff>lk->referencewindow1) lk->accidentals++;
+	/* coinicidence check */
+	if ((eventdiff>-lk->coincwindow) && (eventdiff<lk->coincwindow)) { /* true */
+	    lk->truecoincies++;
+	    /* get pattern 1 */
+	    pattern1=lk->ev1.p[lk->ecnt1-1] & raw_patternmask;
+	    d=lk->decisionmatrix[(pattern1 | (pattern2<<4)) &
+			     PROTO_DECIDXMASK(proto)];
+	    if (d & PROTO_KEEPMASK(proto)) { /* hand over to encoder */
+		er.kind=ENC_SIFT; er.d=d; er.v=lk->ecnt2;
+		to_encoder(&er);
+	    }
+	    lk->thisepoch_converted_entries++;
+	}
+        /* do coincidence tracking  */
+	if (track && (eventdiff<lk->trackwindow)) {
+	    if (track==1) {
+		lk->floattime +=eventdiff*lk->servo_p1; /* event centered */
+	    } else { /* time-based correction calculation */
+		if (lk->lastservotime) /* is initialized */
+		    /* switch off servo if off for too long */
+		    if ((servodiff=(long long int)(lk->t1-lk->lastservotime))
+			<lk->servoofftime)
+			lk->floattime +=((eventdiff*servodiff)<<1)
+			    /lk->servo_p1;
+		lk->lastservotime=lk->t1;
+	    }
+	    lk->timediff = lk->timediff0-lk->floattime/SERVO_GRANULARITY;
+	    lk->ft=lk->floattime/SERVO_GRANULARITY;
+
+	}	    
+	/* prepare for new events */
+	lk->gettwo=1; lk->getone=1;
+    }
+    return 0;
+}
+#define MERGE_KERNEL(p,h,t,b) \
+    int merge_##p##h##t##b(void) {return merge_events(p,h,t,b);}
+#define MERGE_KERNEL2(p,h,t) MERGE_KERNEL(p,h,t,0) MERGE_KERNEL(p,h,t,1)
+#define MERGE_KERNELS(p) \
+    MERGE_KERNEL2(p,0,0) MERGE_KERNEL2(p,0,1) MERGE_KERNEL2(p,0,2) \
+    MERGE_KERNEL2(p,1,0) MERGE_KERNEL2(p,1,1) MERGE_KERNEL2(p,1,2)
+MERGE_KERNELS(0) MERGE_KERNELS(1) MERGE_KERNELS(2)
+MERGE_KERNELS(3) MERGE_KERNELS(4) MERGE_KERNELS(5)
+#define MERGE_PAIR(p,h,t) {merge_##p##h##t##0, merge_##p##h##t##1}
+#define MERGE_ROW(p) \
+    {{MERGE_PAIR(p,0,0), MERGE_PAIR(p,0,1), MERGE_PAIR(p,0,2)}, \
+     {MERGE_PAIR(p,1,0), MERGE_PAIR(p,1,1), MERGE_PAIR(p,1,2)}}
+/* indexed by protocol, histogramming, tracking mode and offset bank */
+int (*merge_kernels[PROTOCOL_MAXINDEX+1][2][3][2])(void) = {
+    MERGE_ROW(0), MERGE_ROW(1), MERGE_ROW(2),
+    MERGE_ROW(3), MERGE_ROW(4), MERGE_ROW(5)};
+
+int run_links(char *linkfile, int workers);
+
+void release_link(void);
+
+/* run of one link with the options in argv, see costream below */
+int costream_run(int argc, char *argv[]) {
+    long long int se_in; /* for entering startepoch both in hex and decimal */
+    int accidental_dist = DEFAULT_ACCDIST; /* in 1/8 nsec */
+    int accwindows = DEFAULT_ACCWINDOWS, accstep = DEFAULT_ACCSTEP; /* -A */
+    int servo_param = DEFAULT_FILTER; /* time/event const for tracker */
+    int proto_index = DEFAULT_PROTOCOL; /* defines which proto is used */
+    int opt,i,j,retval;
     int skewcorrectmode=0; /* now detector de-skew */
     int dskew[8]; /* detector deskew registers */
-    long long int skewtab[16];
+    int deadcorrectmode=0; /* no detector dead time */
+    unsigned int ddead[8]; /* detector dead times */
+    char linkfile[FNAMELENGTH]=""; /* for -Z */
+    int workers = 0; /* for -W; 0: one per processor */
    
+    init_link(lk);
     
     /* parsing options */
     opterr=0; /* be quiet when there are no options */
+    if (lk->linkid) optind=0; /* restart getopt for this link */
 
-    debuglog=fopen("costream_tlog","w+");
-    fprintf(debuglog,"this run filtercionst4: %d, width: %d\n",
-	    filterconst_stream4,type4bitwidth);
+    if (lk->linkid) {
+	sprintf(linkfile,"costream_tlog.%d",lk->linkid);
+	lk->debuglog=fopen(linkfile,"w+");
+	linkfile[0]=0;
+    } else {
+	lk->debuglog=fopen("costream_tlog","w+");
+    }
+    fprintf(lk->debuglog,"this run filtercionst4: %d, width: %d\n",
+	    lk->filterconst_stream4,lk->type4bitwidth);
 
 
-    while ((opt=getopt(argc, argv, "V:F:f:d:D:O:o:i:I:kKe:q:Q:M:m:L:l:n:t:w:u:r:R:p:T:G:a:h:H:S:b:B:")) != EOF) {
+    while ((opt=getopt(argc, argv, "V:F:f:d:D:O:o:i:I:kKe:q:Q:M:m:L:l:n:t:w:u:r:R:p:T:G:P:a:A:h:H:g:X:S:Y:b:B:jZ:W:C:")) != EOF) {
 	i=0; /* for setinf names/modes commonly */
 	/* fprintf(debuglog,"got option >>%c<<, filter: %d, width: %d\n",
 	   opt,filterconst_stream4,type4bitwidth); */
 	switch (opt) {
 	    case 'V': /* set verbosity level */
-		if (1!=sscanf(optarg,"%d",&verbosity_level)) return -emsg(1);
+		if (1!=sscanf(optarg,"%d",&lk->verbosity_level)) return -emsg(1);
 		break;
 		/* a funky way of parsing all file name options together.
 		   i contains the stream in the two lsb, and the mode in the
@@ -1112,31 +2450,38 @@ int main (int argc, char *argv[]) {
  	    case 'i': i++; /* stream 2, file */
  	    case 'I':      /* stream 1, file */
 		j=(i&3)+1; /* stream number */
-		if (1!=sscanf(optarg,FNAMFORMAT,fname[j])) return -emsg(1+j);
-		fname[j][FNAMELENGTH-1]=0;   /* security termination */
-		if (typemode[j]) return -emsg(5+j); /* already defined mode */
-		typemode[j]=(i&4?2:1);
+		if (1!=sscanf(optarg,FNAMFORMAT,lk->fname[j])) return -emsg(1+j);
+		lk->fname[j][FNAMELENGTH-1]=0;   /* security termination */
+		if (lk->typemode[j]) return -emsg(5+j); /* already defined mode */
+		lk->typemode[j]=(i&4?2:1);
+		if (shmring_name(lk->fname[j]) && (i&4)) lk->typemode[j]=3;
+		if (epochlog_name(lk->fname[j]) && (i&4)) lk->typemode[j]=4;
 		break;
 	    case 'B': i++;/* stream3 directory for BELL mesaurement */
 	    case 'b': /* stream3 file for BELL mesaurement */
 		j=5; /* stream number */
-		if (1!=sscanf(optarg,FNAMFORMAT,fname[j])) return -emsg(72);
-		fname[j][FNAMELENGTH-1]=0;   /* security termination */
-		if (typemode[j]) return -emsg(73); /* already defined mode */
-		typemode[j]=((i&1)?2:1); /* dirctory/file distinguisher */ 
+		if (1!=sscanf(optarg,FNAMFORMAT,lk->fname[j])) return -emsg(72);
+		lk->fname[j][FNAMELENGTH-1]=0;   /* security termination */
+		if (lk->typemode[j]) return -emsg(73); /* already defined mode */
+		lk->typemode[j]=((i&1)?2:1); /* dirctory/file distinguisher */ 
+		if (shmring_name(lk->fname[j]) && (i&1)) lk->typemode[j]=3;
+		if (epochlog_name(lk->fname[j]) && (i&1)) lk->typemode[j]=4;
 		break;
 	    case 'k': /* kill mode stream 2 */
-		killmode[2]=1;
+		lk->killmode[2]=1;
 		break;
 	    case 'K':/* kill mode stream 1 */
-		killmode[1]=1;
+		lk->killmode[1]=1;
+		break;
+	    case 'j': /* run decoder and encoder stages in own threads */
+		lk->pipelined=1;
 		break;
 	    case 'e': /* read startepoch */
 		if (1!=sscanf(optarg,"%lli",&se_in)) return -emsg(10);
-		startepoch=se_in & 0xffffffff;
+		lk->startepoch=se_in & 0xffffffff;
 		break;
 	    case 'q': /* read epoch number */
-		if (1!=sscanf(optarg,"%d",&epochnumber)) return -emsg(11);
+		if (1!=sscanf(optarg,"%d",&lk->epochnumber)) return -emsg(11);
 		break;
 	    case 'Q': /* choose filter factor for coincidence tracker */
 		if (1!=sscanf(optarg,"%d",&servo_param)) return -emsg(19);
@@ -1147,28 +2492,28 @@ int main (int argc, char *argv[]) {
 	    case 'L': i++; /* stream 2 notification */
 	    case 'l': i++; /* stream 1 notification */
 	    case 'n':      /* global logfile name */
-		if (sscanf(optarg,FNAMFORMAT,logfname[i]) != 1)
+		if (sscanf(optarg,FNAMFORMAT,lk->logfname[i]) != 1)
 		    return -emsg(12+i);
-		logfname[i][FNAMELENGTH-1]=0;  /* security termination */
+		lk->logfname[i][FNAMELENGTH-1]=0;  /* security termination */
 		break;
 	    case 't': /* read in timedifference */
-		if (1!= sscanf(optarg,"%lli",&timediff0)) return -emsg(17);
+		if (1!= sscanf(optarg,"%lli",&lk->timediff0)) return -emsg(17);
 		break;
 	    case 'w': /* coincidence time window */
-		if (1!= sscanf(optarg,"%lld",&coincwindow)) return -emsg(18);
+		if (1!= sscanf(optarg,"%lld",&lk->coincwindow)) return -emsg(18);
 		break;
 	    case 'u': /* tracking time window */
-		if (1!= sscanf(optarg,"%lld",&trackwindow)) return -emsg(18);
+		if (1!= sscanf(optarg,"%lld",&lk->trackwindow)) return -emsg(18);
 		break;
 	    case 'r': /* intitial stream-4 bitlength */
-		if (1!= scanf(optarg,"%i",&type4bitwidth)) return -emsg(59);
-		if ((type4bitwidth<MIN_4_BITWIDTH) ||
-		    (type4bitwidth>MAX_4_BITWIDTH)) return -emsg(60);
+		if (1!= scanf(optarg,"%i",&lk->type4bitwidth)) return -emsg(59);
+		if ((lk->type4bitwidth<MIN_4_BITWIDTH) ||
+		    (lk->type4bitwidth>MAX_4_BITWIDTH)) return -emsg(60);
 		break;
 	    case 'R': /* timedifference servo filter for stream-4 packer */
-		if (1!= sscanf(optarg,"%i",&filterconst_stream4)) 
+		if (1!= sscanf(optarg,"%i",&lk->filterconst_stream4)) 
 		    return -emsg(57);
-		if (filterconst_stream4<0) return -emsg(58);
+		if (lk->filterconst_stream4<FILTER_PEREPOCH) return -emsg(58);
 		break;
 	    case 'p': /* protocol index */
 		if (1!= sscanf(optarg,"%i",&proto_index)) return -emsg(20);
@@ -1176,124 +2521,178 @@ int main (int argc, char *argv[]) {
 		    return -emsg(21);
 		break;
 	    case 'T': /* zeroevent policy */
-		if (1!=sscanf(optarg,"%i",&zeropolicy)) return -emsg(61);
-		if ((zeropolicy<0) || (zeropolicy>2)) return -emsg(62);
+		if (1!=sscanf(optarg,"%i",&lk->zeropolicy)) return -emsg(61);
+		if ((lk->zeropolicy<0) || (lk->zeropolicy>2)) return -emsg(62);
 		break;
 	    case 'G': /* define flushmode */
-		if (1!=sscanf(optarg,"%i",&flushmode)) return -emsg(65);
-		if ((flushmode<0) || (flushmode>3)) return -emsg(66);
+		if (1!=sscanf(optarg,"%i",&lk->flushmode)) return -emsg(65);
+		if ((lk->flushmode<0) || (lk->flushmode>3)) return -emsg(66);
 		break;
 	    case 'a': /* accidental coincidence distance */
 		if (1!=sscanf(optarg,"%i",&accidental_dist)) return -emsg(67);
 		break;
+	    case 'A': /* windows for accidentals */
+		if (sscanf(optarg,"%i,%i",&accwindows,&accstep)<1 ||
+		    accwindows<0 || accwindows>ACCWIN_MAX || accstep<1)
+		    return -emsg(99);
+		break;
 	    case 'h': /* get num of epochs per histogram */
-		if (1!=sscanf(optarg,"%i",&histolen)) return -emsg(69);
-		if (histolen<1) return -emsg(69);
-		fprintf(debuglog,"entered histolen: %d\n",histolen);
+		if (1!=sscanf(optarg,"%i",&lk->histolen)) return -emsg(69);
+		if (lk->histolen<1) return -emsg(69);
+		fprintf(lk->debuglog,"entered histolen: %d\n",lk->histolen);
+		break;
+	    case 'P': /* statistics page */
+		if (sscanf(optarg,FNAMFORMAT,lk->statname) != 1)
+		    return -emsg(97);
 		break;
 	    case 'H': /* histogram name */
-		if (sscanf(optarg,FNAMFORMAT,histologname) != 1)
+		if (sscanf(optarg,FNAMFORMAT,lk->histologname) != 1)
 		    return -emsg(70);
+		lk->histopubmode=shmring_name(lk->histologname)?1:0;
+		break;
+	    case 'g': /* histogram depth and bin width */
+		i=sscanf(optarg,"%d,%d",&lk->histodepth,&lk->histobinwidth);
+		if (i<1 || lk->histodepth<2 || lk->histodepth>MAX_HISTODEPTH ||
+		    lk->histobinwidth<1 || lk->histobinwidth>MAX_HISTOBINWIDTH ||
+		    (lk->histobinwidth & (lk->histobinwidth-1))) return -emsg(85);
+		for (lk->histoshift=0;(1<<lk->histoshift)<lk->histobinwidth;lk->histoshift++);
+		break;
+	    case 'X': /* offset bank */
+		if (2!=sscanf(optarg,"%d,%lli",&lk->banksize,&lk->bankspacing) ||
+		    lk->banksize<1 || 2*lk->banksize+1>BANK_SLOTS || lk->bankspacing<1)
+		    return -emsg(88);
 		break;
 	    case 'S': /* detector skew correction */
 	        if (4!=sscanf(optarg,"%d,%d,%d,%d", &dskew[0],&dskew[1],
 			      &dskew[2],&dskew[3])) return -emsg(80);
 		skewcorrectmode =1;
 		break;
+	    case 'Y': /* detector dead times */
+	        if (4!=sscanf(optarg,"%u,%u,%u,%u", &ddead[0],&ddead[1],
+			      &ddead[2],&ddead[3])) return -emsg(95);
+		deadcorrectmode =1;
+		break;
+	    case 'Z': /* link file */
+		if (lk->linkid) return -emsg(91);
+		if (sscanf(optarg,FNAMFORMAT,linkfile) != 1) return -emsg(89);
+		linkfile[FNAMELENGTH-1]=0;
+		break;
+	    case 'W': /* worker slots for the links */
+		if (lk->linkid) return -emsg(91);
+		if (1!=sscanf(optarg,"%d",&workers) || workers<1)
+		    return -emsg(93);
+		break;
+	    case 'C': /* cores, node and huge pages for the process */
+		if (lk->linkid) return -emsg(91);
+		switch (cpupin_setup(optarg)) {
+		    case CPUPIN_SYNTAX: return -emsg(101);
+		    case CPUPIN_ERROR: return -emsg(102);
+		}
+		break;
 
 	    default: /* something fishy */
-		fprintf(debuglog,"got code I should not get: >>%c<<\n",opt);
+		fprintf(lk->debuglog,"got code I should not get: >>%c<<\n",opt);
 		break;
 	}
     }
 
+    /* the links have their own options */
+    if (linkfile[0]) {
+	fclose(lk->debuglog); lk->debuglog=NULL;
+	if (!workers) workers=sysconf(_SC_NPROCESSORS_ONLN);
+	return run_links(linkfile,workers);
+    }
+    link_parsed();
+
     /* check argument consistency */
-    fprintf(debuglog,"after parsing filterconst4: %d, width: %d\n",
-	    filterconst_stream4,type4bitwidth);
+    fprintf(lk->debuglog,"after parsing filterconst4: %d, width: %d\n",
+	    lk->filterconst_stream4,lk->type4bitwidth);
 
     /* eventually initiate histogram */
-    if (histologname[0]) init_histo();
+    if (lk->histologname[0] && (retval=init_histo())) return -emsg(retval);
 
-    /* initiate skew correction for t1 files */
-    for (i=0;i<16;i++) skewtab[i]=0;
-    if (skewcorrectmode==1) {
-      for (i=0;i<4;i++) skewtab[1<<i]=dskew[i];
-    }
+    /* statistics page */
+    if (lk->statname[0] &&
+	epochstat_create(&lk->statpage,shmring_name(lk->statname)?
+			 shmring_name(lk->statname):lk->statname))
+	return -emsg(98);
+    lk->statopen=(lk->statname[0]!=0);
+
+    /* initiate skew and dead time correction for t1 files */
+    evcorrect_init(&lk->corr1,skewcorrectmode?dskew:NULL,
+		   deadcorrectmode?ddead:NULL,4,EVCORRECT_SHIFT);
 
 
     /* to estimate background */
-    referencewindow2=accidental_dist;
-    referencewindow1=accidental_dist-coincwindow*2;
+    lk->referencewindow2=accidental_dist;
+    lk->referencewindow1=accidental_dist-lk->coincwindow*2;
+    accwin_init(&lk->accw,accwindows,accstep,accidental_dist,
+		lk->coincwindow*2);
     /* prepare servo parameters for coincidence tracker */
     if (servo_param>0) 
-	servo_p1 = SERVO_GRANULARITY/servo_param; /* event-based filter */
+	lk->servo_p1 = SERVO_GRANULARITY/servo_param; /* event-based filter */
     if (servo_param<0) {
-	servo_p1 = -((long long int)servo_param)*
+	lk->servo_p1 = -((long long int)servo_param)*
 	    SERVO_BASETIME/SERVO_GRANULARITY;
-	servoofftime=-1*(long long int)servo_param*SERVO_BASETIME; /* avoid overshoots */
+	/* avoid overshoots */
+	lk->servoofftime=-1*(long long int)servo_param*SERVO_BASETIME;
 	/* forget servoing for cnt rate below max_servoofftime */
-	if (servoofftime>MAX_SERVOOFFTIME) servoofftime=MAX_SERVOOFFTIME;
+	if (lk->servoofftime>MAX_SERVOOFFTIME) lk->servoofftime=MAX_SERVOOFFTIME;
     }
-    lastservotime=0; /* initialize servo first */
+    lk->lastservotime=0; /* initialize servo first */
     
     
     /* initialize bitwidth servo for stream 4 */
-    type4bitwidth_long = type4bitwidth<<8; /* servo variable */
-    idiff4_bitmask = (1<<type4bitwidth)-1; /* for packing */
+    lk->type4bitwidth_long = lk->type4bitwidth<<8; /* servo variable */
+    lk->idiff4_bitmask = (1<<lk->type4bitwidth)-1; /* for packing */
 
     /* allocate input and output buffers */
-    if (!(buffer1=(char*)malloc(RAW1_SIZE))) return -emsg(22);
-    if (!(buffer2=(char*)malloc(RAW2_SIZE))) return -emsg(23);
-    if (!(outbuf3=(unsigned int *)malloc(RAW3_SIZE))) return -emsg(24);
-    if (!(outbuf4=(unsigned int *)malloc(RAW4_SIZE))) return -emsg(25);
-    if (!(outbuf5=(unsigned int *)malloc(RAW3_SIZE))) return -emsg(74);
-
-    /* for processing stream 1 */
-    pointer1=(struct rawevent *)(buffer1+sizeof(struct header_1));
-
-    /* protocol preparation */
-    i=proto_table[proto_index].decsize; /* size of array */
-    if (!(decisionmatrix=(int*)malloc(i*sizeof(int)))) return -emsg(52);
-    proto_table[proto_index].fill_decision(decisionmatrix);
-
-    /* find longer of -3 or -5 pattern */
-    longerpattern = proto_table[proto_index].bitsperentry3;
-    if (longerpattern <	proto_table[proto_index].bitsperentry5) 
-	longerpattern = proto_table[proto_index].bitsperentry5;
-
-    keepthatpairmask= (1<<(longerpattern +
-			   proto_table[proto_index].bitsperentry4));
-    testeventmask = keepthatpairmask <<1; /* for Bell tests */
-
-    decisionindexmask=(1<<(proto_table[proto_index].expected2bits+4))-1;
-
-    expected2bits=proto_table[proto_index].expected2bits; /* consistency tst */
-    /* what detectors to expect */
-    raw_patternmask=proto_table[proto_index].detectorentries-1;
-
-    stream3datamask=(1<<proto_table[proto_index].bitsperentry3)-1;
-    stream5datamask=(1<<proto_table[proto_index].bitsperentry5)-1;
-
-    type3datawidth=proto_table[proto_index].bitsperentry3;
-    type5datawidth=proto_table[proto_index].bitsperentry5;
+    if (!(lk->buffer1=(char*)cpupin_alloc(RAW1_SIZE))) return -emsg(22);
+    if (!(lk->buffer2=(char*)cpupin_alloc(RAW2_SIZE))) return -emsg(23);
+    if (growbuf_init(&lk->gbuf3,RAW3_SIZE/sizeof(unsigned int)))
+	return -emsg(24);
+    if (growbuf_init(&lk->gbuf4,RAW4_SIZE/sizeof(unsigned int)))
+	return -emsg(25);
+    if (growbuf_init(&lk->gbuf5,RAW3_SIZE/sizeof(unsigned int)))
+	return -emsg(74);
+    if (growbuf_init(&lk->gbufd4,lk->filterconst_stream4==FILTER_PEREPOCH?
+		     RAW4_SIZE/sizeof(unsigned int):1)) return -emsg(25);
+    if (evbatch_init(&lk->ev1,BITUNPACK_BLOCK)) return -emsg(100);
+    if (evbatch_init(&lk->blk2,BITUNPACK_BLOCK)) return -emsg(23);
+
+    /* protocol preparation. The decision table depends only on the
+       protocol, so links share it */
+    pthread_mutex_lock(&decisionlock);
+    if (!decisiontables[proto_index]) {
+	i=proto_table[proto_index].decsize; /* size of array */
+	if ((decisiontables[proto_index]=(int*)malloc(i*sizeof(int))))
+	    proto_table[proto_index].fill_decision(decisiontables[proto_index]);
+    }
+    pthread_mutex_unlock(&decisionlock);
+    if (!(lk->decisionmatrix=decisiontables[proto_index])) return -emsg(52);
 
-    stream4datashift=longerpattern;
-    stream4datamask=((1<<proto_table[proto_index].bitsperentry4)-1)<<
-	stream4datashift;
-    type4datawidth =proto_table[proto_index].bitsperentry4;
-    bitstosend4=type4bitwidth+type4datawidth; /* has to be <32 !! */
+    /* the keep/test masks, the decision index mask, the detector mask and
+       the stream-4 data shift are compile-time constants in the kernels
+       selected below */
+    /* consistency tst */
+    lk->expected2bits=proto_table[proto_index].expected2bits;
+    lk->type3datawidth=proto_table[proto_index].bitsperentry3;
+    lk->type5datawidth=proto_table[proto_index].bitsperentry5;
+    lk->type4datawidth =proto_table[proto_index].bitsperentry4;
+    lk->sift_kernel=sift_kernels[proto_index];
+    lk->bitstosend4=lk->type4bitwidth+lk->type4datawidth; /* has to be <32 !! */
 
 
     /* open logfile streams */
     for (i=0;i<5;i++) {
-	if (logfname[i][0]) { /* check if filename is defined */
-	    loghandle[i]=fopen(logfname[i],"a");
-	    if (!loghandle[i]) return -emsg(26+i);
-	} else if (!i) {loghandle[i] = stdout;} /* use stdout for standard */
+	if (lk->logfname[i][0]) { /* check if filename is defined */
+	    lk->loghandle[i]=fopen(lk->logfname[i],"a");
+	    if (!lk->loghandle[i]) return -emsg(26+i);
+	} else if (!i) {lk->loghandle[i] = stdout;} /* use stdout for standard */
     }
     /* evtl. open stream files */
     for (i=1;i<6;i++) { /* allow for non-definition of stream-5 mode */
-	switch (typemode[i]) {
+	switch (lk->typemode[i]) {
 	    case 0: /* no mode defined */
 		if (i<5) return -emsg(34+i); /* need this file but no mode */
 		/* now we are at stream 5 */
@@ -1302,347 +2701,180 @@ int main (int argc, char *argv[]) {
 		}
 		break;
 	    case 1: /* single file */
-		handle[i]=open(fname[i],openmode[i],FILE_PERMISSIONS);
-		if (-1==handle[i]) return -emsg(30+i);
+		lk->handle[i]=open(lk->fname[i],openmode[i],FILE_PERMISSIONS);
+		if (-1==lk->handle[i]) return -emsg(30+i);
+		break;
+	    case 3: /* shared memory ring */
+		if (shmring_open(&lk->ring[i],shmring_name(lk->fname[i]),
+				 SHMRING_DEFAULTSIZE)) return -emsg(83);
+		lk->streamopen[i]=1;
+		break;
+	    case 4: /* epoch log; streams 1 and 2 are read */
+		if (epochlog_open(&lk->elog[i],epochlog_name(lk->fname[i]),i>2))
+		    return -emsg(84);
+		lk->streamopen[i]=1;
+		break;
 	}
     }
 
+    /* watch input directories for arriving files */
+    if (lk->typemode[1]==2) {
+	epochwait_init(&lk->watch1,lk->fname[1]); lk->watchopen[1]=1;
+    }
+    if (lk->typemode[2]==2) {
+	epochwait_init(&lk->watch2,lk->fname[2]); lk->watchopen[2]=1;
+    }
+
     /* prepare input/output buffers to be loaded */
-    head1.length=0; head2.length=0; /* emty buffers initially */
-    ecnt1=0; ecnt2=0;/* number of already processed events */
-    epoch1 = startepoch; /* epochs to read */
-    epoch2 = startepoch; /* epoch to read and master epoch for write */
-    getone=1; gettwo=1; /* mark for colletion */
-    timediff=timediff0;  /* start with initial time difference */
-    floattime=0; /* coincidence tracker hires state variable */
-    firstrun=1; /* to read in stream-2 without saving streams 3,4 */
-    thisepoch_converted_entries=0;
-    thisepoch_siftevents=0;  /* what ends up in the target files */
-    thisepoch_testevents=0;  /* no testevents so far */
-    accidentals=0;truecoincies=0;
+    lk->head1.length=0; lk->head2.length=0; /* emty buffers initially */
+    lk->ecnt1=0; lk->ecnt2=0;/* number of already processed events */
+    lk->epoch1 = lk->startepoch; /* epochs to read */
+    lk->epoch2 = lk->startepoch; /* epoch to read and master epoch for write */
+    lk->getone=1; lk->gettwo=1; /* mark for colletion */
+    lk->timediff=lk->timediff0;  /* start with initial time difference */
+    if (lk->banksize) init_bank(); /* candidate offsets around it */
+    lk->floattime=0; /* coincidence tracker hires state variable */
+    lk->firstrun=1; /* to read in stream-2 without saving streams 3,4 */
+    lk->decstate=DEC_LOAD; /* nothing to close before first stream-2 packet */
+    lk->thisepoch_converted_entries=0;
+    lk->thisepoch_siftevents=0;  /* what ends up in the target files */
+    lk->thisepoch_testevents=0;  /* no testevents so far */
+    lk->accidentals=0;lk->truecoincies=0;
+
+    /* start decoder and encoder threads in pipelined mode */
+    if (lk->pipelined) {
+	if (ring_init(&lk->ring2,sizeof(struct s2event),RING_ORDER_2) ||
+	    ring_init(&lk->ringenc,sizeof(struct encrecord),RING_ORDER_ENC))
+	    return -emsg(81);
+	if (pthread_create(&lk->decoderthread,NULL,decoder_thread,lk))
+	    return -emsg(82);
+	lk->stages=1;
+	if (pthread_create(&lk->encoderthread,NULL,encoder_thread,lk))
+	    return -emsg(82);
+	lk->stages=2;
+    }
 
     /* initialize to avoid 38 yr overrun */
-    t1=(unsigned long long)(startepoch-1)<<32; t2=t1; t1old=t1;
+    lk->t1=(unsigned long long)(lk->startepoch-1)<<32;
+    lk->t2=lk->t1; lk->t1old=lk->t1;
     /* main digest loop */
-    while (1) {
-	eventdiff=((long long int)(t1-t2))+timediff;
-	if (eventdiff<-trackwindow || getone) {
-	    /* load event 1 */
-	    if (ecnt1==head1.length) { /* time to reload a stream-1 package */
-		/* evtl. open stream 1 */
-		if (typemode[1]==2) { /* file in directory */
-		    strncpy(ffnam, fname[1], FNAMELENGTH);
-		    atohex(&ffnam[strlen(ffnam)],epoch1);
-
-		    opcnt=MAXFILETESTS;
- 		    while ((retval=access(ffnam,R_OK))) { 
- 			if (errno != ENOENT) {
-			    fprintf(stderr,"file(1):%s,errno:%d",ffnam,errno);
-			    return -emsg(64);
-			}
-			if (!(opcnt--)) {
-			    fprintf(stderr,"waited too long for %s;",ffnam);
-			    return -emsg(31);
-			}
-			usleep(DEFAULT_WAITFORFILE);
- 		    } 
-		    usleep(DEFAULT_WAITWRITTEN);
-		    
-		    handle[1]=open(ffnam,openmode[1]);
-		    if(-1==handle[1]) return -emsg(31);
-
-		}
-		/* buffer stream 1 */
-		retval=get_stream_1(buffer1,handle[1],RAW1_SIZE,&head1);
-		if (retval) return -emsg(retval);
-		/* check epoch consistency */
-		if (head1.epoc!=epoch1) return -emsg(43);
-		/* evtl close stream 1 */
-		if (typemode[1]==2) { /* file is not a  directory */
-		    close(handle[1]);
-		    /* eventually remove file */
-		    if (killmode[1] && (handle[1]!=0)) {
-			if (unlink(ffnam)) return -emsg(50);
-		    }
-		}
+    retval=merge_kernels[proto_index][lk->histologname[0]?1:0]
+	[servo_param?(servo_param>0?1:2):0][lk->banksize?1:0]();
+    if (retval) return retval;
+    
+    /* let the encoder write out the last epoch */
+    stop_stages();
+    if (lk->encerror) return -emsg(lk->encerror);
 
-		/* adjust absolute epoch */
-		localep=(pointer1[0].cv)>>15; /* from timestamp unit */
-		/* take upper 17 bit from epoch for offset */
-		epoch1_offset=(unsigned long long)
-		      ((epoch1 & 0xffff8000)-(localep & 0x00018000))<<32;
-		ecnt1=0; /* reset for this round */
-		/* printf("ep1: %08x, local %x ofs: %llx\n", 
-		   epoch1,localep,epoch1_offset>>32); */
-		epoch1++;
-	    }
-	    /* get a value out of the list */
-	    t1old=t1;
-	    t1=((unsigned long long)pointer1[ecnt1].cv<<17)
-		+(pointer1[ecnt1].dv>>15)+epoch1_offset
-	        + skewtab[(pointer1[ecnt1].dv & 0x0f)]; /* current timing */
-	    if (t1<=t1old) { /* something's fishy. ignore this value */
-		ecnt1++;
-		t1=t1old;
-		getone=1;
-		continue;
-	    }
-	    /* get pattern 1 later... */
-	    ecnt1++;
-	    getone=0;
-	    continue;
-	}
-	if ((eventdiff>referencewindow2)|| gettwo) { /* clearly out-of-band */
-	    /* load event 2 */
-	    if (ecnt2>=head2.length) { /* time to reload a stream-2 package */
-		/* eventually save streams 3 and 4 */
-		if (!firstrun) {
-		    /* save stream 3 and 4, and do logging */
-		    close_epoch();
-		}
-		
-		/* check termination of this epoch for -q option */
-		if (epochnumber && (epoch2>=startepoch+epochnumber)) {
-		    break;
-		}
-		
-		/* evtl. open stream 2 */
-		if (typemode[2]==2) { /* file in directory */
-		    strncpy(ffn2, fname[2], FNAMELENGTH);
-		    atohex(&ffn2[strlen(ffn2)],epoch2);
-		    opcnt=MAXFILETESTS;
- 		    while ((retval=access(ffn2,R_OK))) { 
- 			if (errno != ENOENT) { /* file does not exist */
-			    fprintf(stderr,"file(2):%s,errno:%d",ffn2,errno);
-			    return -emsg(64);
-			}
-			if (!(opcnt--)) {
-			    fprintf(stderr,"timeout for %s",ffn2);
-			    return -emsg(32);
-			}
-			usleep(DEFAULT_WAITFORFILE);
- 		    } 
-
-		    handle[2]=open(ffn2,openmode[2]);
-		    if(-1==handle[2]) {
-			fprintf(stderr,"real open fail: errno %d ",errno);
-			return -emsg(32);
-		    }
-		}
+    /* return benignly */
+    fprintf(stderr,"This is a benign end.\n");
+    fprintf(lk->debuglog,"benign end.\n");fflush(lk->debuglog);
+    return 0;
+}
 
-		/* buffer stream 2 */
-		retval=get_stream_2(buffer2,handle[2],RAW2_SIZE,&head2,
-				    &realsize2);
-		if (retval) return -emsg(retval);
+/* close and free what a link has opened and allocated so far; may be
+   called at any point of costream_run */
+void release_link(void) {
+    int i;
+    /* evtl. close stream files */
+    for (i=1;i<6;i++) if (lk->handle[i]!=-1) close_handle(i);
+    for (i=1;i<6;i++) {
+	if (!lk->streamopen[i]) continue;
+	if (lk->typemode[i]==3) shmring_close(&lk->ring[i]);
+	if (lk->typemode[i]==4) epochlog_close(&lk->elog[i]);
+	lk->streamopen[i]=0;
+    }
+    if (lk->watchopen[1]) epochwait_close(&lk->watch1);
+    if (lk->watchopen[2]) epochwait_close(&lk->watch2);
+    lk->watchopen[1]=0; lk->watchopen[2]=0;
 
-		/* check epoch consistency */
-		if (head2.epoc!=epoch2) return -emsg(48);
-		if (firstrun) {
-		    uepoch=(head2.tag==0x102?1:0);
-		    firstrun=0;
-		}
-		
-		/* close evtl stream 2 */ 
-		if (typemode[2]==2) { /* file is in a directory */
-		    close(handle[2]);
-		    /* eventually remove file */
-		    if (killmode[2] && (handle[2]!=0)) {
-			if (unlink(ffn2)) return -emsg(51);
-		    }
-		}
+    for (i=0;i<5;i++) { /* logs */
+	if (lk->logfname[i][0] && lk->loghandle[i]) fclose(lk->loghandle[i]);
+	lk->loghandle[i]=NULL;
+    }
+    unmap_epochfile(&lk->map1); unmap_epochfile(&lk->map2);
+    cpupin_free(lk->buffer1,RAW1_SIZE); /* buffers */
+    cpupin_free(lk->buffer2,RAW2_SIZE);
+    lk->buffer1=NULL; lk->buffer2=NULL;
+    growbuf_free(&lk->gbuf3); growbuf_free(&lk->gbuf4);
+    growbuf_free(&lk->gbuf5); growbuf_free(&lk->gbufd4);
+    evbatch_free(&lk->ev1); evbatch_free(&lk->blk2);
+    free(lk->ring2.buf); free(lk->ringenc.buf);
+    lk->ring2.buf=NULL; lk->ringenc.buf=NULL;
+    free(lk->histobuf[0]); free(lk->histobuf[1]);
+    lk->histobuf[0]=NULL; lk->histobuf[1]=NULL;
+    if (lk->histopubopen) histring_close(&lk->histopub);
+    if (lk->statopen) epochstat_close(&lk->statpage); /* page stays */
+    lk->histopubopen=0; lk->statopen=0;
+
+    if (lk->debuglog) fclose(lk->debuglog);
+    lk->debuglog=NULL;
+}
 
-		/* process stream 2 */
-		pointer2=(unsigned int *)(buffer2+sizeof(struct header_2));
-		/* adjust to current epoch origin */
-		t2=((unsigned long long)epoch2)<<32; 
-		/* prepare decompression */
-		idx2=0;readword2 = pointer2[idx2++]; /* raw buffer */
-		resbits2=32; /* how much to eat */
-		type2bitwidth=head2.timeorder; type2datawidth=head2.basebits;
-		bitstoread2=type2bitwidth+type2datawidth; /* has to be <32 */
-		tdiff_bitmask2 = (1<<type2bitwidth)-1; /* for unpacking */
-		patternmask2 = (1<<type2datawidth)-1;
-		//emergency_break=
-		//    (realsize2-sizeof(struct header_2))/sizeof(unsigned int);
-		ecnt2=0;/* count local events */
-
-		/* prepare new stream 3 and 4 */
-		open_epoch(epoch2);
-		oldindex4=1; /* first entry connected to ecnt2 */
-		
-		accidentals=0;truecoincies=0;
-		thisepoch_converted_entries=0;
-		thisepoch_siftevents=0;
-		thisepoch_testevents=0;
+/* run of one link with the options in argv. Returns 0 or the negative error
+   code. A link of a link file, which shares the process with others, also
+   cleans up after an error; a plain run just ends then. */
+int costream(int argc, char *argv[]) {
+    int retval=costream_run(argc,argv);
+    if (lk->linkid || !retval) {
+	stop_stages();
+	release_link();
+    }
+    return retval;
+}
 
-		epoch2++; /* prepare for next read */
-	    }
-	    /* extract one event */
-	    if (resbits2>=bitstoread2) {
-		tdiff2=(readword2>>(resbits2-bitstoread2));
-		resbits2-=bitstoread2;
-		if (!resbits2) {readword2=pointer2[idx2++];resbits2=32;}
-	    } else {
-		resbits2=bitstoread2-resbits2;
-		tdiff2=readword2<<resbits2;
-		readword2=pointer2[idx2++];
-		resbits2=32-resbits2;
-		tdiff2=(tdiff2 | (readword2>>resbits2));
-	    }
-	    pattern2= (tdiff2 & patternmask2);
-	    tdiff2>>=type2datawidth;
-	    /* we have a time difference word now in tdiff */
-	    if (tdiff2 &= tdiff_bitmask2) { /* check for exception */
-		/* test for end of stream */
-		if (tdiff2==1) return -emsg(49); /* exit digest routine for this stream */
-	    } else {
-		/* read in complete difference */
-		tdiff2=readword2<<(32-resbits2);
-		readword2=pointer2[idx2++];
-                /* catch shift 'feature' - normal */
-		if (resbits2 & 0x1f) tdiff2 |= readword2>>resbits2;
-		opatt2=pattern2;pattern2=tdiff2&patternmask2;
-		tdiff2 >>=type2datawidth;
-		tdiff2 |=  (opatt2<<(32-type2datawidth));
-	    }
-	    /* we now have a valid difference */
-	    t2 +=tdiff2; ecnt2++;
-	    gettwo=0;
-	    continue;
-	}
-	/* do histogramming */
-	if (histologname[0]) {
-	    hdiff=eventdiff+DEFAULT_HISTODEPTH/2;
-	    if (hdiff<DEFAULT_HISTODEPTH && hdiff>=0) 
-		histo[histidx[((pointer1[ecnt1-1].dv & raw_patternmask) |
-				(pattern2<<4))&255]][hdiff]++;
-	}
-	/* monitor accidentals at the upper edge of the track window */
-	if (eventdiff>referencewindow1) accidentals++;
-	/* coinicidence check */
-	if ((eventdiff>-coincwindow) && (eventdiff<coincwindow)) { /* true */
-	    truecoincies++;
-	    /* get pattern 1 */
-	    pattern1=pointer1[ecnt1-1].dv & raw_patternmask;
-	    d=decisionmatrix[(pattern1 | (pattern2<<4))&  decisionindexmask];
-	    /* printf("patt1: %d, patt2: %d, d:%d\n",pattern1,pattern2,d); */
-	    if (d & keepthatpairmask) {
-		if (d & testeventmask) { /* save as bell test event */
-		    /* add to stream 5 */
-		    stream5data = d & stream5datamask;
-		    /* printf("stream5data: %x\n",stream5data); */
-		    if (resbits5>=type5datawidth) {
-			sendword5 |= (stream5data << (resbits5-type5datawidth));
-			resbits5 = resbits5-type5datawidth;
-			if (resbits5==0) { 
-			    outbuf5[index5++]=sendword5;
-			    sendword5=0;resbits5=32;
-			}
-		    } else {
-			resbits5=type5datawidth-resbits5;
-			sendword5 |= (stream5data >> resbits5);
-			outbuf5[index5++]=sendword5;
-			resbits5=32-resbits5;
-			sendword5=stream5data << resbits5;
-		    }
-		    thisepoch_testevents++;
-		} else { /* save as key event */
-		    /* add to stream 3 */
-		    stream3data = d & stream3datamask;
-		    /* printf("stream3data: %x\n",stream3data); */
-		    if (resbits3>=type3datawidth) {
-			sendword3 |= (stream3data << (resbits3-type3datawidth));
-			resbits3 = resbits3-type3datawidth;
-			if (resbits3==0) { 
-			    outbuf3[index3++]=sendword3;
-			    sendword3=0;resbits3=32;
-			}
-		    } else {
-			resbits3=type3datawidth-resbits3;
-			sendword3 |= (stream3data >> resbits3);
-			outbuf3[index3++]=sendword3;
-			resbits3=32-resbits3;
-			sendword3=stream3data << resbits3;
-		    }
-		}
-		
-		/* add to stream 4 */
-		stream4data = ( d & stream4datamask)>>stream4datashift;
-		/* printf("index: %i\n",ecnt2); */
+void *link_thread(void *arg) {
+    lk=arg;
+    lk->retval=costream(lk->largc,lk->largv);
+    if (!lk->parsed) sem_post(&linkparsed); /* ended while parsing */
+    link_idle();
+    return NULL;
+}
 
-		indexdiff4=ecnt2-oldindex4+2; /* index difference, corrected */
-		oldindex4=ecnt2;
-		
-		/* long index diff exception */
-		if (indexdiff4!=(t4=(indexdiff4 & idiff4_bitmask))) { 
-		    /* first batch is codeword zero plus a few bits  */
-		    t4a=indexdiff4 >> type4bitwidth;
-		    /* save first part of this longer structure */
-		    if (resbits4==32) {
-			outbuf4[index4++]=t4a;
-		    } else {
-			sendword4 |= (t4a >> (32-resbits4));
-			outbuf4[index4++]=sendword4;
-			sendword4=t4a << resbits4;
-		    }
-		} 
-		
-		/* short word or rest of data, add state to shortword */
-		t4a = (t4<<type4datawidth) | stream4data;
-		/* save timing and transmit bits */
-		if (resbits4>=bitstosend4) {
-		    sendword4 |= (t4a << (resbits4-bitstosend4));
-		    resbits4 = resbits4-bitstosend4;
-		    if (resbits4==0) { 
-			outbuf4[index4++]=sendword4;
-			sendword4=0;resbits4=32;
-		    }
-		} else {
-		    resbits4=bitstosend4-resbits4;
-		    sendword4 |= (t4a >> resbits4);
-		    outbuf4[index4++]=sendword4;
-		    resbits4=32-resbits4;
-		    sendword4=t4a << resbits4;
-		}
-		
-		thisepoch_siftevents++;
-	    }
-	    thisepoch_converted_entries++;
+/* link mode: every line of the link file holds the options of one link.
+   Empty lines and lines starting with # are skipped. The links take their
+   options one after the other and then run in their own threads. Returns 0
+   or the error code of the first link which failed. */
+int run_links(char *linkfile, int workers) {
+    FILE *f;
+    struct linkstate *l, *links[MAX_LINKS];
+    char *tok, *pos;
+    int i, retval = 0;
+
+    if (!(f=fopen(linkfile,"r"))) return -emsg(89);
+    while (1) {
+	if (posix_memalign((void **)&l,64,sizeof(struct linkstate)))
+	    return -emsg(94);
+	memset(l,0,sizeof(struct linkstate));
+	if (!fgets(l->line,MAX_LINKLINE,f)) {free(l); break;}
+	l->largv[0]="costream";
+	for (tok=strtok_r(l->line," \t\n",&pos),l->largc=1; tok;
+	     tok=strtok_r(NULL," \t\n",&pos)) {
+	    if (l->largc==1 && tok[0]=='#') break; /* comment */
+	    if (l->largc==MAX_LINKARGS) return -emsg(90);
+	    l->largv[l->largc++]=tok;
 	}
-        /* do coincidence tracking  */
-	if (servo_param && (eventdiff<trackwindow)) {
-	    if (servo_param>0) {
-		floattime +=eventdiff*servo_p1; /* event centered */
-	    } else { /* time-based correction calculation */
-		if (lastservotime) /* is initialized */
-		    /* switch off servo if off for too long */
-		    if ((servodiff=(long long int)(t1-lastservotime))<servoofftime)
-			floattime +=((eventdiff*servodiff)<<1)
-			    /servo_p1;
-		lastservotime=t1;
-	    }
-	    timediff = timediff0-floattime/SERVO_GRANULARITY;
-	    ft=floattime/SERVO_GRANULARITY;
-
-	}	    
-	/* prepare for new events */
-	gettwo=1; getone=1;
+	if (l->largc==1) {free(l); continue;}
+	if (linkcount==MAX_LINKS) return -emsg(90);
+	l->linkid=linkcount+1;
+	links[linkcount++]=l;
     }
-    
-    /* return benignly */
-    fprintf(stderr,"This is a benign end.\n");
-    fprintf(debuglog,"benign end.\n");fflush(debuglog);
-
-    
-    /* evtl. close stream files */
-    for (i=1;i<6;i++) 
-	if (1== (typemode[i])) close(handle[i]); /* single file */
-    
-    for (i=0;i<5;i++) if (logfname[i][0]) fclose(loghandle[i]); /* logs */
-    free(buffer1); free(buffer2); free(outbuf3); free(outbuf4); /* buffers */
-    free(outbuf5);
+    fclose(f);
+
+    sem_init(&linkslots,0,workers);
+    sem_init(&linkparsed,0,0);
+    for (i=0;i<linkcount;i++) {
+	if (pthread_create(&links[i]->thread,NULL,link_thread,links[i]))
+	    return -emsg(92);
+	while (sem_wait(&linkparsed) && errno==EINTR);
+    }
+    for (i=0;i<linkcount;i++) {
+	pthread_join(links[i]->thread,NULL);
+	if (links[i]->retval && !retval) retval=links[i]->retval;
+    }
+    return retval;
+}
 
-    free(decisionmatrix);
-    fclose(debuglog);
-    return 0;
+int main (int argc, char *argv[]) {
+    return costream(argc,argv);
 }
@@ -0,0 +1,190 @@
+/* cpupin.c:     Part of the quantum key distribution software. Placement
+                 of a program of the sifting chain on chosen cores and a
+		 NUMA node, and huge pages for its large buffers.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   readevents, chopper, chopper2, costream, splicer, transferd and ecd2 run
+   as separate processes, which the scheduler moves between cores as it
+   likes. Their packet buffers are faulted in page by page during the first
+   epochs, possibly on another NUMA node than the one the process ends up
+   on, and every epoch walks through megabytes of them with 4k pages. On a
+   loaded machine, this shows up as epochs which take much longer than the
+   others.
+
+   All of these programs take the option -C profile, which is handed to
+   cpupin_setup while the options are parsed, before any buffer is
+   allocated or thread started. The profile has the form
+
+     cpus[:node[:h]]
+
+   with cpus a list of cores as for taskset -c (e.g. 2,3 or 4-7), node the
+   NUMA node for the memory of the process, and a trailing h for huge pages.
+   Empty fields are left alone, e.g. -C ::h only asks for huge pages. The
+   process (and all threads it starts later) is then bound to the cores,
+   and its memory comes from node; the policy is set with the plain
+   set_mempolicy system call, so no NUMA library is needed. Without a node,
+   memory is taken from the node of the core where it is first touched,
+   which is the local node once the process is pinned.
+
+   The large buffers are allocated with cpupin_alloc, cpupin_realloc and
+   cpupin_free, which the programs pass the buffer size to. Without huge
+   pages, they behave like posix_memalign, realloc and free. With huge
+   pages, buffers of at least CPUPIN_HUGEMIN bytes are mapped from the huge
+   page pool (/proc/sys/vm/nr_hugepages) and faulted in right away; if the
+   pool is empty, transparent huge pages are requested with madvise, and
+   the buffer is touched once so it does not fault during the first epochs.
+
+   A launcher gives each stage its own profile (see pinprofile in this
+   directory for the gui), and pinbench.c measures the effect on the
+   processing time per epoch.
+
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "cpupin.h"
+
+#define MPOL_PREFERRED 1 /* from linux/mempolicy.h */
+#define MAXNODE 1024     /* bits in the node mask */
+
+static int hugemode = 0; /* set by a profile with h */
+
+/* parse a core list into set. Returns 0 or -1. */
+static int parse_cpus(char *s, cpu_set_t *set) {
+    char *e;
+    long a, b;
+
+    CPU_ZERO(set);
+    while (*s) {
+	a=strtol(s,&e,10); if (e==s || a<0 || a>=CPU_SETSIZE) return -1;
+	b=a; s=e;
+	if (*s=='-') {
+	    s++; b=strtol(s,&e,10);
+	    if (e==s || b<a || b>=CPU_SETSIZE) return -1;
+	    s=e;
+	}
+	for (;a<=b;a++) CPU_SET(a,set);
+	if (*s==',') s++; else if (*s) return -1;
+    }
+    return 0;
+}
+
+/* bind the process to the cores, node and page size given in the profile
+   spec. Returns CPUPIN_OK, CPUPIN_SYNTAX or CPUPIN_ERROR. */
+int cpupin_setup(char *spec) {
+    char cpus[256], *node, *huge, *e;
+    cpu_set_t set;
+    unsigned long mask[MAXNODE/(8*sizeof(unsigned long))];
+    long n=-1;
+
+    strncpy(cpus,spec,sizeof(cpus)-1); cpus[sizeof(cpus)-1]=0;
+    huge=NULL;
+    if ((node=strchr(cpus,':'))) {
+	*node++=0;
+	if ((huge=strchr(node,':'))) *huge++=0;
+    }
+    if (cpus[0] && parse_cpus(cpus,&set)) return CPUPIN_SYNTAX;
+    if (node && node[0]) {
+	n=strtol(node,&e,10);
+	if (*e || n<0 || n>=MAXNODE) return CPUPIN_SYNTAX;
+    }
+    if (huge && huge[0] && strcmp(huge,"h")) return CPUPIN_SYNTAX;
+
+    if (cpus[0] && sched_setaffinity(0,sizeof(set),&set))
+	return CPUPIN_ERROR;
+    if (n>=0) {
+	memset(mask,0,sizeof(mask));
+	mask[n/(8*sizeof(unsigned long))]|=1ul<<(n%(8*sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy,MPOL_PREFERRED,mask,MAXNODE))
+	    return CPUPIN_ERROR;
+    }
+    hugemode=(huge && huge[0]);
+    return CPUPIN_OK;
+}
+
+/* 1 if large buffers go to huge pages */
+int cpupin_huge(void) {
+    return hugemode;
+}
+
+static size_t hugesize(size_t bytes) {
+    return (bytes+CPUPIN_HUGEPAGE-1) & ~(size_t)(CPUPIN_HUGEPAGE-1);
+}
+
+/* allocate bytes, aligned to CPUPIN_ALIGN. Returns NULL on failure. */
+void *cpupin_alloc(size_t bytes) {
+    void *p;
+    char *a;
+    size_t len, i, head;
+    long pg;
+
+    if (!hugemode || bytes<CPUPIN_HUGEMIN) {
+	if (posix_memalign(&p,CPUPIN_ALIGN,bytes)) return NULL;
+	return p;
+    }
+    len=hugesize(bytes);
+    p=mmap(NULL,len,PROT_READ | PROT_WRITE,
+	   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,-1,0);
+    if (p!=MAP_FAILED) return p;
+    /* no pool: transparent huge pages on a huge page boundary, faulted in
+       now */
+    p=mmap(NULL,len+CPUPIN_HUGEPAGE,PROT_READ | PROT_WRITE,
+	   MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if (p==MAP_FAILED) return NULL;
+    head=(-(size_t)p) & (CPUPIN_HUGEPAGE-1);
+    a=(char *)p+head;
+    if (head) munmap(p,head);
+    munmap(a+len,CPUPIN_HUGEPAGE-head);
+    madvise(a,len,MADV_HUGEPAGE);
+    pg=sysconf(_SC_PAGESIZE);
+    for (i=0;i<len;i+=pg) ((volatile char *)a)[i]=0;
+    return a;
+}
+
+/* resize a buffer of old bytes to bytes, keeping its content like
+   realloc. Returns NULL on failure, leaving the old buffer valid. */
+void *cpupin_realloc(void *p, size_t old, size_t bytes) {
+    void *n;
+
+    if (!p) return cpupin_alloc(bytes);
+    if (!hugemode || (old<CPUPIN_HUGEMIN && bytes<CPUPIN_HUGEMIN))
+	return realloc(p,bytes);
+    if (old>=CPUPIN_HUGEMIN && bytes>=CPUPIN_HUGEMIN &&
+	hugesize(old)==hugesize(bytes)) return p; /* same mapping */
+    if (!(n=cpupin_alloc(bytes))) return NULL;
+    memcpy(n,p,old<bytes?old:bytes);
+    cpupin_free(p,old);
+    return n;
+}
+
+/* release a buffer of the size it was allocated with */
+void cpupin_free(void *p, size_t bytes) {
+    if (!p) return;
+    if (hugemode && bytes>=CPUPIN_HUGEMIN) munmap(p,hugesize(bytes));
+    else free(p);
+}
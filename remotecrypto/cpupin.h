@@ -0,0 +1,40 @@
+/* cpupin.h:     Part of the quantum key distribution software. Header for
+                 the CPU, NUMA node and huge page placement of the programs
+		 of the sifting chain. Description see cpupin.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#include <stddef.h>
+
+#define CPUPIN_ALIGN 64              /* alignment of cpupin_alloc memory */
+#define CPUPIN_HUGEPAGE (2<<20)      /* huge page size assumed */
+#define CPUPIN_HUGEMIN (1<<20)       /* smaller buffers stay on the heap */
+
+/* return values of cpupin_setup */
+#define CPUPIN_OK 0
+#define CPUPIN_SYNTAX -1  /* cannot parse the profile */
+#define CPUPIN_ERROR -2   /* system error, see errno */
+
+int cpupin_setup(char *spec);
+int cpupin_huge(void);
+void *cpupin_alloc(size_t bytes);
+void *cpupin_realloc(void *p, size_t old, size_t bytes);
+void cpupin_free(void *p, size_t bytes);
@@ -0,0 +1,351 @@
+/* epochlog.c:   Part of the quantum key distribution software. Segmented
+                 append-only log of epoch packets, as an alternative to one
+		 file per epoch in a directory. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   With the directory modes, every packet of every stream is a file of its
+   own, named by its epoch in hex, which is created, looked up, read and
+   unlinked again. If a directory argument has the form log:dir instead, the
+   packets of that stream are appended to a log in the directory dir:
+
+     dir/XXXXXXXX.seg   packets as they would go into the epoch files, one
+                        after the other, each padded to 16 bytes with at
+			least 8 zero bytes behind it for decoder read-ahead
+     dir/XXXXXXXX.idx   one struct epochlog_entry per packet, giving epoch,
+                        stream type, offset and length
+
+   where XXXXXXXX is the first epoch of a segment. A writer starts a new
+   segment after EPOCHLOG_SEGEPOCHS packets or EPOCHLOG_SEGBYTES bytes, and
+   with each start of a program; if a segment of that name exists already,
+   it is continued rather than truncated, since readers may have it mapped.
+   An index entry is written after its packet and carries a check word, so
+   a reader never sees a packet before it is complete, and skips an entry
+   torn by a crash. A segment with a successor is complete.
+
+   Readers map the index and the segment read-only and hand out packets in
+   place; a program which has to change a packet works on a copy. They
+   look up an epoch from the last position, and wait for it with an inotify
+   watch on the directory, so a packet is picked up right after it has been
+   appended. Retention is by segment: a reader in kill mode (-k/-K) removes a
+   segment once it has read past its end, which replaces the per-file
+   unlink. There is one writer per log; several readers can share it.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/inotify.h>
+#include "epochlog.h"
+
+#define PAD 16     /* packet alignment in a segment */
+#define SPARE 8    /* minimum number of zero bytes behind a packet */
+#define CHECK_MAGIC 0x45704c67
+#define EVBUFSIZE 4096 /* for reading inotify events */
+
+static char zeros[PAD+SPARE];
+
+/* name of the log if path selects one, or NULL */
+char *epochlog_name(char *path) {
+    if (strncmp(path,EPOCHLOG_PREFIX,strlen(EPOCHLOG_PREFIX))) return NULL;
+    return path+strlen(EPOCHLOG_PREFIX);
+}
+
+static unsigned int checkword(struct epochlog_entry *e) {
+    return (unsigned int)e->offset ^ (unsigned int)(e->offset>>32) ^
+	e->epoch*0x9e3779b9u ^ e->length ^ (e->type<<24) ^ CHECK_MAGIC;
+}
+
+static void filename(char *target, struct epochlog *l, unsigned int first,
+		     char *ext) {
+    snprintf(target,sizeof(l->dir)+20,"%s/%08x.%s",l->dir,first,ext);
+}
+
+/* prepare a log in directory dir for writing (writer!=0) or reading.
+   Returns 0 or EPOCHLOG_ERROR. */
+int epochlog_open(struct epochlog *l, char *dir, int writer) {
+    struct stat st;
+    int i;
+
+    strncpy(l->dir,dir,sizeof(l->dir)-1); l->dir[sizeof(l->dir)-1]=0;
+    i=strlen(l->dir);
+    while (i>1 && l->dir[i-1]=='/') l->dir[--i]=0;
+    l->segfd=-1; l->idxfd=-1; l->segentries=0; l->segsize=0;
+    l->rfd=-1; l->ridx=-1; l->seg=NULL; l->idx=NULL; l->seglen=0;
+    l->entries=0; l->hint=0; l->hasnext=0; l->ino=-1; l->dropped=0;
+
+    if (writer && mkdir(l->dir,0755) && errno!=EEXIST) return EPOCHLOG_ERROR;
+    if (stat(l->dir,&st)) return EPOCHLOG_ERROR;
+    if (!S_ISDIR(st.st_mode)) {errno=ENOTDIR; return EPOCHLOG_ERROR;}
+    if (!writer) {
+	l->ino=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (l->ino!=-1 &&
+	    inotify_add_watch(l->ino,l->dir,IN_MODIFY | IN_CREATE)==-1) {
+	    close(l->ino); l->ino=-1; /* poll only */
+	}
+    }
+    return EPOCHLOG_OK;
+}
+
+/* append a packet made of two parts. Returns 0 or EPOCHLOG_ERROR. */
+int epochlog_append(struct epochlog *l, int type, unsigned int epoch,
+		    void *part1, int len1, void *part2, int len2) {
+    char fn[sizeof(l->dir)+20];
+    struct epochlog_entry e;
+    struct iovec iov[4];
+    struct stat st;
+    int pad, lead;
+
+    if (l->segfd==-1 || l->segentries>=EPOCHLOG_SEGEPOCHS ||
+	l->segsize>=EPOCHLOG_SEGBYTES) { /* start a new segment */
+	if (l->segfd!=-1) {close(l->segfd); close(l->idxfd);}
+	/* a restarted writer may find a segment of this name which readers
+	   have mapped; it is continued, never truncated */
+	filename(fn,l,epoch,"seg");
+	l->segfd=open(fn,O_WRONLY | O_CREAT | O_APPEND,0644);
+	if (l->segfd==-1) return EPOCHLOG_ERROR;
+	filename(fn,l,epoch,"idx");
+	l->idxfd=open(fn,O_WRONLY | O_CREAT | O_APPEND,0644);
+	if (l->idxfd==-1) return EPOCHLOG_ERROR;
+	if (fstat(l->idxfd,&st)) return EPOCHLOG_ERROR;
+	l->segentries=st.st_size/sizeof(struct epochlog_entry);
+	if (st.st_size%sizeof(struct epochlog_entry)) { /* torn last entry */
+	    memset(&e,0,sizeof(e));
+	    if (write(l->idxfd,&e,sizeof(e)-st.st_size%sizeof(e))
+		!=sizeof(e)-st.st_size%sizeof(e)) return EPOCHLOG_ERROR;
+	    l->segentries++;
+	}
+	if (fstat(l->segfd,&st)) return EPOCHLOG_ERROR;
+	l->segsize=st.st_size;
+    }
+    /* a packet cut short by a crash is skipped up to the alignment */
+    lead=(PAD-l->segsize%PAD)%PAD;
+    pad=PAD-(len1+len2)%PAD; if (pad<SPARE) pad+=PAD;
+    iov[0].iov_base=zeros; iov[0].iov_len=lead;
+    iov[1].iov_base=part1; iov[1].iov_len=len1;
+    iov[2].iov_base=part2; iov[2].iov_len=len2;
+    iov[3].iov_base=zeros; iov[3].iov_len=pad;
+    if (writev(l->segfd,iov,4)!=lead+len1+len2+pad) return EPOCHLOG_ERROR;
+    l->segsize+=lead;
+
+    e.offset=l->segsize; e.epoch=epoch; e.length=len1+len2; e.type=type;
+    e.check=checkword(&e);
+    if (write(l->idxfd,&e,sizeof(e))!=sizeof(e)) return EPOCHLOG_ERROR;
+    l->segsize+=len1+len2+pad;
+    l->segentries++;
+    return EPOCHLOG_OK;
+}
+
+static void unmap_segment(struct epochlog *l) {
+    if (l->seg) munmap(l->seg,l->seglen);
+    if (l->idx) munmap(l->idx,
+		       EPOCHLOG_SEGEPOCHS*sizeof(struct epochlog_entry));
+    if (l->rfd!=-1) close(l->rfd);
+    if (l->ridx!=-1) close(l->ridx);
+    l->seg=NULL; l->idx=NULL; l->rfd=-1; l->ridx=-1;
+    l->entries=0; l->hint=0;
+}
+
+/* map a segment for reading. The mappings reserve the largest size a
+   segment can reach, and pages become valid as the writer appends. */
+static int map_segment(struct epochlog *l, unsigned int first, size_t len) {
+    char fn[sizeof(l->dir)+20];
+
+    unmap_segment(l);
+    filename(fn,l,first,"idx");
+    if ((l->ridx=open(fn,O_RDONLY))==-1) return EPOCHLOG_ERROR;
+    filename(fn,l,first,"seg");
+    if ((l->rfd=open(fn,O_RDONLY))==-1) return EPOCHLOG_ERROR;
+    l->idx=mmap(NULL,EPOCHLOG_SEGEPOCHS*sizeof(struct epochlog_entry),
+		PROT_READ,MAP_SHARED,l->ridx,0);
+    if (l->idx==MAP_FAILED) {l->idx=NULL; return EPOCHLOG_ERROR;}
+    /* read-only and shared: a private copy of a page could be taken before
+       the writer has filled it. Packets are handed out in place, so readers
+       must not write into them. */
+    l->seglen=len;
+    l->seg=mmap(NULL,len,PROT_READ,MAP_SHARED | MAP_NORESERVE,l->rfd,0);
+    if (l->seg==MAP_FAILED) {l->seg=NULL; return EPOCHLOG_ERROR;}
+    l->first=first;
+    return EPOCHLOG_OK;
+}
+
+/* list the segments to find the one which should hold epoch, and its
+   successor. Returns 0, EPOCHLOG_TIMEOUT if there is no such segment yet,
+   EPOCHLOG_MISSING if the log starts after epoch, or EPOCHLOG_ERROR. */
+static int locate(struct epochlog *l, unsigned int epoch) {
+    DIR *d;
+    struct dirent *de;
+    unsigned int f, best=0, next=0;
+    int hasbest=0, hasnext=0;
+    char *end;
+
+    if (!(d=opendir(l->dir))) return EPOCHLOG_ERROR;
+    while ((de=readdir(d))) {
+	if (strlen(de->d_name)!=12 || strcmp(&de->d_name[8],".idx")) continue;
+	f=strtoul(de->d_name,&end,16);
+	if (end!=&de->d_name[8]) continue;
+	if ((int)(f-epoch)<=0) {
+	    if (!hasbest || (int)(f-best)>0) {best=f; hasbest=1;}
+	} else {
+	    if (!hasnext || (int)(f-next)<0) {next=f; hasnext=1;}
+	}
+    }
+    closedir(d);
+    if (!hasbest) return hasnext?EPOCHLOG_MISSING:EPOCHLOG_TIMEOUT;
+    if (!l->idx || best!=l->first)
+	if (map_segment(l,best,EPOCHLOG_MAPSIZE)) return EPOCHLOG_ERROR;
+    l->next=next; l->hasnext=hasnext;
+    return EPOCHLOG_OK;
+}
+
+/* look up an epoch in the mapped segment. Returns the entry index, or -1
+   if it is not (yet) there, or -2 if the segment has later epochs only. */
+static int find(struct epochlog *l, unsigned int epoch) {
+    struct stat st;
+    int i;
+
+    if (fstat(l->ridx,&st)) return -1;
+    l->entries=st.st_size/sizeof(struct epochlog_entry);
+    if (l->entries>EPOCHLOG_SEGEPOCHS) l->entries=EPOCHLOG_SEGEPOCHS;
+    i=l->hint;
+    if (i>=l->entries || (i>0 && (int)(l->idx[i].epoch-epoch)>0)) i=0;
+    for (;i<l->entries;i++) {
+	if (l->idx[i].check!=checkword(&l->idx[i])) continue; /* torn */
+	if (l->idx[i].epoch==epoch) return (l->hint=i);
+	if ((int)(l->idx[i].epoch-epoch)>0) return -2;
+    }
+    return -1;
+}
+
+/* one attempt to get the packet */
+static int lookup(struct epochlog *l, int type, unsigned int epoch,
+		  char **data, int *len) {
+    struct epochlog_entry *e;
+    int i, retval;
+
+    if (!l->idx || (int)(epoch-l->first)<0 ||
+	(l->hasnext && (int)(epoch-l->next)>=0)) {
+	if ((retval=locate(l,epoch))) return retval;
+    }
+    i=find(l,epoch);
+    if (i==-1 && !l->hasnext) { /* maybe the writer moved on */
+	if ((retval=locate(l,epoch))) return retval;
+	i=find(l,epoch);
+    }
+    if (i==-2 || (i==-1 && l->hasnext)) return EPOCHLOG_MISSING;
+    if (i<0) return EPOCHLOG_TIMEOUT;
+    e=&l->idx[i];
+    if (e->check!=checkword(e)) return EPOCHLOG_TIMEOUT; /* being written */
+    if (type>=0 && e->type!=(unsigned int)type) return EPOCHLOG_CORRUPT;
+    if (e->offset+e->length+SPARE>l->seglen) { /* beyond the reservation */
+	if (map_segment(l,l->first,e->offset+e->length+EPOCHLOG_MAPSIZE))
+	    return EPOCHLOG_ERROR;
+	e=&l->idx[i];
+    }
+    *data=l->seg+e->offset; *len=e->length;
+    return EPOCHLOG_OK;
+}
+
+/* get the packet of stream type (or any type for -1) for epoch; it stays
+   valid until the next call. Waits up to slices times sliceusec for it to show up. Returns 0,
+   EPOCHLOG_TIMEOUT, EPOCHLOG_MISSING if the log has moved on beyond the
+   epoch, EPOCHLOG_CORRUPT or EPOCHLOG_ERROR. */
+int epochlog_read(struct epochlog *l, int type, unsigned int epoch,
+		  char **data, int *len, int slices, int sliceusec) {
+    char evbuf[EVBUFSIZE];
+    struct pollfd pfd;
+    int retval;
+
+    for (;;) {
+	retval=lookup(l,type,epoch,data,len);
+	if (retval!=EPOCHLOG_TIMEOUT || slices--<=0) return retval;
+	if (l->ino==-1) {
+	    usleep(sliceusec);
+	} else { /* wait for the writer to append */
+	    pfd.fd=l->ino; pfd.events=POLLIN;
+	    if (poll(&pfd,1,sliceusec/1000)>0)
+		while (read(l->ino,evbuf,EVBUFSIZE)>0);
+	}
+    }
+}
+
+/* remove all segments which end before epoch. Called by readers after
+   each epoch; the directory is only listed when the reader has moved to
+   another segment. Returns 0 or EPOCHLOG_ERROR. */
+int epochlog_drop(struct epochlog *l, unsigned int epoch) {
+    char fn[sizeof(l->dir)+20];
+    DIR *d;
+    struct dirent *de;
+    unsigned int f, *firsts=NULL, *t;
+    int n=0, size=0, i, j, retval=EPOCHLOG_OK;
+    char *end;
+
+    if (l->idx && l->dropped && l->dropfirst==l->first &&
+	!(l->hasnext && (int)(l->next-epoch)<=0)) return EPOCHLOG_OK;
+    l->dropped=(l->idx!=NULL); l->dropfirst=l->first;
+
+    if (!(d=opendir(l->dir))) return EPOCHLOG_ERROR;
+    while ((de=readdir(d))) {
+	if (strlen(de->d_name)!=12 || strcmp(&de->d_name[8],".idx")) continue;
+	f=strtoul(de->d_name,&end,16);
+	if (end!=&de->d_name[8]) continue;
+	if (n==size) {
+	    size=size?2*size:64;
+	    if (!(t=realloc(firsts,size*sizeof(unsigned int)))) {
+		retval=EPOCHLOG_ERROR; break;
+	    }
+	    firsts=t;
+	}
+	firsts[n++]=f;
+    }
+    closedir(d);
+    /* a segment ends before epoch if a successor starts at or before it */
+    for (i=0;retval==EPOCHLOG_OK && i<n;i++) {
+	for (j=0;j<n;j++)
+	    if ((int)(firsts[j]-firsts[i])>0 && (int)(firsts[j]-epoch)<=0)
+		break;
+	if (j==n) continue;
+	if (l->idx && firsts[i]==l->first) unmap_segment(l);
+	filename(fn,l,firsts[i],"idx");
+	if (unlink(fn)) retval=EPOCHLOG_ERROR;
+	filename(fn,l,firsts[i],"seg");
+	if (unlink(fn)) retval=EPOCHLOG_ERROR;
+    }
+    free(firsts);
+    return retval;
+}
+
+void epochlog_close(struct epochlog *l) {
+    if (l->segfd!=-1) close(l->segfd);
+    if (l->idxfd!=-1) close(l->idxfd);
+    l->segfd=-1; l->idxfd=-1;
+    unmap_segment(l);
+    if (l->ino!=-1) close(l->ino);
+    l->ino=-1;
+}
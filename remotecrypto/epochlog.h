@@ -0,0 +1,72 @@
+/* epochlog.h:   Part of the quantum key distribution software. Header for
+                 the segmented append-only log of epoch packets. Description
+		 see epochlog.c. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define EPOCHLOG_PREFIX "log:" /* marks a log in place of a directory */
+#define EPOCHLOG_SEGEPOCHS 256 /* epochs per segment (about 2 minutes) */
+#define EPOCHLOG_SEGBYTES (1LL<<30) /* a segment is closed beyond this */
+#define EPOCHLOG_MAPSIZE (4LL<<30) /* address space reserved for a segment */
+
+/* return values */
+#define EPOCHLOG_OK 0
+#define EPOCHLOG_TIMEOUT -1 /* epoch not (yet) in the log */
+#define EPOCHLOG_ERROR -2   /* system error, see errno */
+#define EPOCHLOG_MISSING -3 /* log has moved on beyond the epoch */
+#define EPOCHLOG_CORRUPT -4 /* index entry does not match its segment */
+
+typedef struct epochlog_entry { /* one per packet in the .idx file */
+    unsigned long long offset; /* start of the packet in the .seg file */
+    unsigned int epoch;
+    unsigned int length; /* in bytes */
+    unsigned int type;   /* stream type */
+    unsigned int check;  /* over the fields above, for torn reads */
+} ele;
+
+typedef struct epochlog {
+    char dir[200];
+    /* writer */
+    int segfd, idxfd;        /* open segment, or -1 */
+    int segentries;          /* packets in the open segment */
+    unsigned long long segsize;
+    /* reader */
+    unsigned int first;      /* first epoch of the mapped segment */
+    unsigned int next;       /* first epoch of the segment after it */
+    int hasnext;             /* if next is valid */
+    int rfd, ridx;           /* segment and index file handles, or -1 */
+    int ino;                 /* inotify handle on the directory, or -1 */
+    char *seg;               /* segment mapping */
+    size_t seglen;
+    struct epochlog_entry *idx; /* index mapping */
+    int entries;             /* known valid index entries */
+    int hint;                /* where the last lookup ended */
+    unsigned int dropfirst;  /* mapped segment at the last drop */
+    int dropped;             /* if dropfirst is valid */
+} elg;
+
+char *epochlog_name(char *path);
+int epochlog_open(struct epochlog *l, char *dir, int writer);
+int epochlog_append(struct epochlog *l, int type, unsigned int epoch,
+		    void *part1, int len1, void *part2, int len2);
+int epochlog_read(struct epochlog *l, int type, unsigned int epoch,
+		  char **data, int *len, int slices, int sliceusec);
+int epochlog_drop(struct epochlog *l, unsigned int epoch);
+void epochlog_close(struct epochlog *l);
@@ -0,0 +1,196 @@
+/* epochstat.c:  Part of the quantum key distribution software. Shared
+                 memory page with the per-epoch statistics of costream.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   The numbers costream keeps for every epoch (events in streams 1 and 2,
+   sifted events, accidental and true coincidences, the servoed time
+   difference and the stream-4 bit width) otherwise only show up as text in
+   the main log, depending on verbosity and flush mode. Here they are kept
+   in a small page of POSIX shared memory, which monitoring programs and the
+   error correction can map and read at any time.
+
+   For every quantity, the page holds the value of the last epoch (gauge),
+   the sum since the writer started (counter), and a histogram of epochs
+   over the number of events per epoch, with bin k counting epochs with
+   2^(k-1) to 2^k-1 events (bin 0: no event). The accidentals come with
+   their standard error, and the sum of the squared errors is kept, so a
+   reader gets the error for any range of epochs from the difference of two
+   reads. In the device-independent protocols, the page also counts the
+   Bell test events per stream-5 value (see chsh.c), for the CHSH value of
+   any range of epochs.
+
+   There is one writer per page, which never waits. Every word is stored
+   atomically, so a single counter or gauge can be read directly from the
+   page at any time. For a consistent view of all values, the page carries
+   a sequence word which is odd while the writer updates the page and 2n
+   after epoch n; epochstat_read takes a copy and keeps it only if the word
+   did not change meanwhile.
+
+   A writer which starts over retires an existing page as histring.c does.
+   A page is removed with rm /dev/shm/<name>.
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "epochstat.h"
+
+#define EPOCHSTAT_MAGIC 0x45737461
+#define EPOCHSTAT_STALE 0x5374616c /* page replaced by a new writer */
+#define RETRIES 8 /* attempts to get a consistent copy */
+
+static void shmname(char *target, char *name) {
+    if (name[0]=='/') strncpy(target,name,255);
+    else {target[0]='/'; strncpy(&target[1],name,254);}
+    target[255]=0;
+}
+
+static int ratebin(unsigned int v) {
+    int k=v?32-__builtin_clz(v):0;
+    return k<EPOCHSTAT_BINS?k:EPOCHSTAT_BINS-1;
+}
+
+/* create the page name, replacing an existing one. Returns 0 or
+   EPOCHSTAT_ERROR. */
+int epochstat_create(struct epochstat *s, char *name) {
+    char sn[256];
+    int fd;
+    struct epochstat_page *old;
+
+    shmname(sn,name);
+    if ((fd=shm_open(sn,O_RDWR,0600))!=-1) {
+	old=mmap(NULL,sizeof(struct epochstat_page),PROT_READ | PROT_WRITE,
+		 MAP_SHARED,fd,0);
+	if (old!=MAP_FAILED) {
+	    __atomic_store_n(&old->magic,EPOCHSTAT_STALE,__ATOMIC_RELEASE);
+	    munmap(old,sizeof(struct epochstat_page));
+	}
+	close(fd);
+	shm_unlink(sn);
+    }
+
+    fd=shm_open(sn,O_RDWR | O_CREAT | O_EXCL,0644);
+    if (fd==-1) return EPOCHSTAT_ERROR;
+    if (ftruncate(fd,sizeof(struct epochstat_page))) {
+	close(fd); return EPOCHSTAT_ERROR;
+    }
+    s->p=mmap(NULL,sizeof(struct epochstat_page),PROT_READ | PROT_WRITE,
+	      MAP_SHARED,fd,0);
+    close(fd);
+    if (s->p==MAP_FAILED) return EPOCHSTAT_ERROR;
+    s->p->size=sizeof(struct epochstat_page); /* rest is zero from ftruncate */
+    __atomic_store_n(&s->p->magic,EPOCHSTAT_MAGIC,__ATOMIC_RELEASE);
+    s->last=0;
+    return EPOCHSTAT_OK;
+}
+
+/* enter the statistics of one epoch. values holds EPOCHSTAT_QUANTITIES
+   numbers in the order of the EPOCHSTAT_ constants, bell the counts of the
+   EPOCHSTAT_BELL test values, or is NULL if there are none. */
+void epochstat_put(struct epochstat *s, unsigned int epoch, int bitwidth4,
+		   long long ft, unsigned int *values, double accerr,
+		   unsigned int *bell) {
+    struct epochstat_page *p=s->p;
+    unsigned long long n=p->seq; /* only the writer changes these */
+    unsigned long long *r;
+    double v;
+    unsigned int b;
+    int i;
+
+    __atomic_store_n(&p->seq,n+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&p->epoch,epoch,__ATOMIC_RELAXED);
+    __atomic_store_n(&p->bitwidth4,bitwidth4,__ATOMIC_RELAXED);
+    __atomic_store_n(&p->ft,ft,__ATOMIC_RELAXED);
+    __atomic_store_n(&p->epochs,p->epochs+1,__ATOMIC_RELAXED);
+    __atomic_store(&p->accerr,&accerr,__ATOMIC_RELAXED);
+    v=p->accvar+accerr*accerr;
+    __atomic_store(&p->accvar,&v,__ATOMIC_RELAXED);
+    for (i=0;i<EPOCHSTAT_QUANTITIES;i++) {
+	__atomic_store_n(&p->last[i],values[i],__ATOMIC_RELAXED);
+	__atomic_store_n(&p->total[i],p->total[i]+values[i],
+			 __ATOMIC_RELAXED);
+	r=&p->rate[i][ratebin(values[i])];
+	__atomic_store_n(r,*r+1,__ATOMIC_RELAXED);
+    }
+    for (i=0;i<EPOCHSTAT_BELL;i++) {
+	b=bell?bell[i]:0;
+	__atomic_store_n(&p->bell[i],b,__ATOMIC_RELAXED);
+	__atomic_store_n(&p->belltotal[i],p->belltotal[i]+b,__ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&p->seq,n+2,__ATOMIC_RELEASE);
+}
+
+/* attach a reader to the page name. Returns 0, or EPOCHSTAT_ERROR if there
+   is no valid page. */
+int epochstat_attach(struct epochstat *s, char *name) {
+    char sn[256];
+    int fd;
+    struct stat st;
+
+    shmname(sn,name);
+    if ((fd=shm_open(sn,O_RDONLY,0))==-1) return EPOCHSTAT_ERROR;
+    if (fstat(fd,&st) || st.st_size<sizeof(struct epochstat_page)) {
+	close(fd); errno=EAGAIN; return EPOCHSTAT_ERROR;
+    }
+    s->p=mmap(NULL,sizeof(struct epochstat_page),PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (s->p==MAP_FAILED) return EPOCHSTAT_ERROR;
+    if (__atomic_load_n(&s->p->magic,__ATOMIC_ACQUIRE)!=EPOCHSTAT_MAGIC ||
+	s->p->size!=sizeof(struct epochstat_page)) {
+	munmap(s->p,sizeof(struct epochstat_page));
+	errno=EAGAIN; return EPOCHSTAT_ERROR;
+    }
+    s->last=0;
+    return EPOCHSTAT_OK;
+}
+
+/* take a consistent copy of the page if an epoch was entered since the last
+   read. Returns 0, EPOCHSTAT_NONE, or EPOCHSTAT_CHANGED if the reader has
+   to attach again. */
+int epochstat_read(struct epochstat *s, struct epochstat_page *copy) {
+    unsigned long long s1;
+    int i;
+
+    for (i=0;i<RETRIES;i++) {
+	if (__atomic_load_n(&s->p->magic,__ATOMIC_ACQUIRE)!=EPOCHSTAT_MAGIC)
+	    return EPOCHSTAT_CHANGED;
+	s1=__atomic_load_n(&s->p->seq,__ATOMIC_ACQUIRE);
+	if (s1==s->last) return EPOCHSTAT_NONE;
+	if (s1&1) continue; /* writer busy */
+	memcpy(copy,s->p,sizeof(struct epochstat_page));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&s->p->seq,__ATOMIC_RELAXED)!=s1) continue;
+	s->last=s1;
+	return EPOCHSTAT_OK;
+    }
+    return EPOCHSTAT_NONE;
+}
+
+void epochstat_close(struct epochstat *s) {
+    munmap(s->p,sizeof(struct epochstat_page));
+}
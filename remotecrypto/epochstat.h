@@ -0,0 +1,73 @@
+/* epochstat.h:  Part of the quantum key distribution software. Header for
+                 the shared memory statistics page of costream and
+		 splicer.
+		 Description see epochstat.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define EPOCHSTAT_BINS 32 /* rate histogram bins, log2 of events per epoch */
+
+/* quantities with a counter, a gauge and a rate histogram */
+#define EPOCHSTAT_EVENTS1 0   /* stream-1 events */
+#define EPOCHSTAT_EVENTS2 1   /* stream-2 events */
+#define EPOCHSTAT_SIFTED 2    /* events in stream 4 */
+#define EPOCHSTAT_ACCIDENTAL 3 /* estimated accidental coincidences */
+#define EPOCHSTAT_TRUE 4      /* coincidences in the window */
+#define EPOCHSTAT_QUANTITIES 5
+#define EPOCHSTAT_BELL 16    /* Bell test values, see chsh.c */
+
+/* return values */
+#define EPOCHSTAT_OK 0
+#define EPOCHSTAT_NONE -1    /* no epoch since the last read */
+#define EPOCHSTAT_ERROR -2   /* system error, see errno */
+#define EPOCHSTAT_CHANGED -3 /* writer restarted, attach again */
+
+typedef struct epochstat_page { /* the shared segment */
+    unsigned int magic;     /* set once the page is valid */
+    unsigned int size;      /* of this structure */
+    unsigned long long seq; /* odd while the writer updates the page */
+    /* gauges, values of the last epoch */
+    unsigned int epoch;
+    unsigned int bitwidth4; /* stream-4 compression bits */
+    long long ft;           /* servoed time difference, 1/8 nsec */
+    unsigned int last[EPOCHSTAT_QUANTITIES];
+    double accerr;          /* standard error of last[EPOCHSTAT_ACCIDENTAL] */
+    unsigned int bell[EPOCHSTAT_BELL]; /* test events per stream-5 value */
+    /* counters since the writer started */
+    unsigned long long epochs;
+    unsigned long long total[EPOCHSTAT_QUANTITIES];
+    double accvar;          /* sum of accerr^2, for the error of a sum */
+    unsigned long long belltotal[EPOCHSTAT_BELL];
+    unsigned long long rate[EPOCHSTAT_QUANTITIES][EPOCHSTAT_BINS];
+} esp;
+
+typedef struct epochstat {
+    struct epochstat_page *p;
+    unsigned long long last; /* seq seen at the last read */
+} est;
+
+int epochstat_create(struct epochstat *s, char *name);
+void epochstat_put(struct epochstat *s, unsigned int epoch, int bitwidth4,
+		   long long ft, unsigned int *values, double accerr,
+		   unsigned int *bell);
+int epochstat_attach(struct epochstat *s, char *name);
+int epochstat_read(struct epochstat *s, struct epochstat_page *copy);
+void epochstat_close(struct epochstat *s);
@@ -0,0 +1,179 @@
+/* epochwait.c:  Part of the quantum key distribution software. Event-driven
+                 wait for epoch files to arrive in a directory, used by
+		 costream, splicer and pfind. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   The stream programs used to poll for the next epoch file with access() and
+   sleep half a second between tests, and sleep again after a file showed up
+   to make sure the writer was done. Here, an inotify watch on the directory
+   reports files which were closed after writing (IN_CLOSE_WRITE) or moved
+   into the directory (IN_MOVED_TO). Such an event serves as the completion
+   marker of a file, so the consumer can start within microseconds after the
+   writer is done.
+
+   Names of completed files are kept in a short history, since they often
+   arrive before the consumer asks for them. A file which exists without a
+   completion event (e.g. written before the watch was set up, or on a file
+   system which does not deliver events) is reported as present, and the
+   caller can apply its old settling delay. The directory is still tested
+   once per time slice, so the worst case is the old polling behaviour. If
+   inotify is not available, epochwait() falls back to polling.
+
+   After an outage, a backlog of epoch files may be waiting. Since a writer
+   produces the epochs in order, a file is complete once the file of the
+   next epoch exists. epochwait_backlog() tests for this, so the caller can
+   skip its settling delay and go through the backlog at full speed, and it
+   asks the kernel to read the next few files ahead. Once the caller has
+   caught up, no next file is found and it is back to live operation.
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "epochwait.h"
+
+#define EVBUFSIZE 4096 /* for reading inotify events */
+
+/* remember the name of a completed file */
+static void note_done(struct epochwatch *w, char *name) {
+    if (strlen(name)>=EPOCHWAIT_NAMELEN) return; /* not an epoch name */
+    strcpy(w->done[w->donepos],name);
+    w->donepos=(w->donepos+1)%EPOCHWAIT_HISTORY;
+}
+
+/* read all pending events without blocking */
+static void drain_events(struct epochwatch *w) {
+    char buf[EVBUFSIZE]
+	__attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *ev;
+    int len, i;
+
+    while ((len=read(w->fd,buf,EVBUFSIZE))>0) {
+	for (i=0;i<len;i+=sizeof(struct inotify_event)+ev->len) {
+	    ev=(struct inotify_event *)&buf[i];
+	    if (ev->len && (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)))
+		note_done(w,ev->name);
+	}
+    }
+}
+
+/* check and clear a name in the history */
+static int take_done(struct epochwatch *w, char *name) {
+    int i;
+    for (i=0;i<EPOCHWAIT_HISTORY;i++) {
+	if (!strcmp(w->done[i],name)) {
+	    w->done[i][0]=0;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/* set up a watch on a directory. Returns 0 if events are available, or 1 if
+   the watch could not be established and epochwait() polls. */
+int epochwait_init(struct epochwatch *w, char *dirname) {
+    int i;
+    for (i=0;i<EPOCHWAIT_HISTORY;i++) w->done[i][0]=0;
+    w->donepos=0;
+    w->aheadvalid=0;
+    w->fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd==-1) return 1;
+    w->wd=inotify_add_watch(w->fd,dirname,IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (w->wd==-1) {
+	close(w->fd); w->fd=-1;
+	return 1;
+    }
+    return 0;
+}
+
+/* wait for file fullname in the watched directory for up to slices time
+   slices of sliceusec microseconds each. Returns one of the EPOCHWAIT_xx
+   codes in epochwait.h. */
+int epochwait(struct epochwatch *w, char *fullname, int slices,
+	      int sliceusec) {
+    struct pollfd pfd;
+    struct timeval now;
+    long long int deadline, rest; /* in microseconds */
+    char *name;
+
+    name=strrchr(fullname,'/'); name=name?name+1:fullname;
+    gettimeofday(&now,NULL);
+    deadline=now.tv_sec*1000000LL+now.tv_usec+(long long)slices*sliceusec;
+    while (1) {
+	if (w->fd!=-1) {
+	    drain_events(w);
+	    if (take_done(w,name)) return EPOCHWAIT_COMPLETE;
+	}
+	if (!access(fullname,R_OK)) return EPOCHWAIT_PRESENT;
+	if (errno!=ENOENT) return EPOCHWAIT_ERROR;
+
+	gettimeofday(&now,NULL);
+	rest=deadline-(now.tv_sec*1000000LL+now.tv_usec);
+	if (rest<=0) return EPOCHWAIT_TIMEOUT;
+	if (rest>sliceusec) rest=sliceusec;
+	if (w->fd==-1) {
+	    usleep(rest);
+	} else { /* sleep until something shows up, or for one slice */
+	    pfd.fd=w->fd; pfd.events=POLLIN;
+	    poll(&pfd,1,(rest+999)/1000);
+	}
+    }
+}
+
+/* backlog test for the epoch file fullname, whose name is the epoch in 8 hex
+   digits. Starts read-ahead for up to depth files of the following epochs.
+   Returns the number of following files found (0: live operation), which
+   means that fullname is complete if it is not 0. */
+int epochwait_backlog(struct epochwatch *w, char *fullname, int depth) {
+    char next[EPOCHWAIT_PATHLEN];
+    char *name, *end;
+    unsigned int epoch;
+    int i, fd, len=strlen(fullname);
+
+    if (len>=EPOCHWAIT_PATHLEN) return 0;
+    name=strrchr(fullname,'/'); name=name?name+1:fullname;
+    epoch=strtoul(name,&end,16);
+    if (end-name!=8 || *end) return 0; /* not an epoch name */
+    strcpy(next,fullname);
+    for (i=1;i<=depth;i++) {
+	snprintf(&next[len-8],9,"%08x",epoch+i);
+	if (access(next,R_OK)) break;
+	if (w->aheadvalid && (int)(epoch+i-w->ahead)<=0) continue;
+	if ((fd=open(next,O_RDONLY))!=-1) {
+	    posix_fadvise(fd,0,0,POSIX_FADV_WILLNEED);
+	    close(fd);
+	}
+	w->ahead=epoch+i; w->aheadvalid=1;
+    }
+    return i-1;
+}
+
+void epochwait_close(struct epochwatch *w) {
+    if (w->fd!=-1) close(w->fd);
+    w->fd=-1;
+}
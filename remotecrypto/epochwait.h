@@ -0,0 +1,49 @@
+/* epochwait.h:  Part of the quantum key distribution software. Header for
+                 the event-driven epoch file arrival used by costream,
+		 splicer and pfind. Description see epochwait.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+/* return values of epochwait() */
+#define EPOCHWAIT_COMPLETE 0 /* writer closed the file or moved it in */
+#define EPOCHWAIT_PRESENT 1  /* file was found by polling; may be in
+				the process of being written */
+#define EPOCHWAIT_TIMEOUT -1 /* file did not show up */
+#define EPOCHWAIT_ERROR -2   /* access error other than ENOENT, see errno */
+
+#define EPOCHWAIT_HISTORY 64 /* remembered names of completed files */
+#define EPOCHWAIT_NAMELEN 32 /* longer names are not remembered */
+#define EPOCHWAIT_PATHLEN 256 /* longest full name for the backlog test */
+
+typedef struct epochwatch {
+    int fd;  /* inotify handle, or -1 if polling only */
+    int wd;  /* watch descriptor for the directory */
+    char done[EPOCHWAIT_HISTORY][EPOCHWAIT_NAMELEN]; /* completed files */
+    int donepos; /* next entry in done */
+    unsigned int ahead; /* last epoch for which read-ahead was started */
+    int aheadvalid; /* if ahead is valid */
+} ew;
+
+int epochwait_init(struct epochwatch *w, char *dirname);
+int epochwait(struct epochwatch *w, char *fullname, int slices,
+	      int sliceusec);
+int epochwait_backlog(struct epochwatch *w, char *fullname, int depth);
+void epochwait_close(struct epochwatch *w);
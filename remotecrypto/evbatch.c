@@ -0,0 +1,200 @@
+/* evbatch.c:    Part of the quantum key distribution software. Column-
+                 oriented batches of events with conversion from the raw,
+		 type-1, type-2 and type-4 formats. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   Raw events and type-1 packets hold an event in two 32 bit words, with
+   the 49 bit time in the upper bits and the detector pattern in the lowest
+   bits of the second word (filespec.txt, section 0). Every program which
+   looked at them took the words apart again, event by event, inside its
+   main loop, and the decoded type-2 and type-4 streams came as separate
+   arrays of differences and patterns.
+
+   An evbatch holds a number of events as two columns: the absolute time as
+   a 64 bit number, and the pattern as a byte. The conversion kernels fill
+   a batch from one of the formats in a single pass over the input; the
+   loops for raw and type-1 events have no branches and are vectorized by
+   the compiler, and bitunpack() decodes type-2 and type-4 events straight
+   into the columns. Loops over a batch then only touch the column they need,
+   and the columns are aligned to CPUPIN_ALIGN bytes (cpupin.c).
+
+   The pattern column keeps the lowest 8 bits of the second raw word, or
+   the pattern field of a type-2 or type-4 stream. For type-4 streams, the
+   time column holds the event index of stream 2 instead of a time.
+
+   The detector skew and dead time corrections of costream -S/-Y (see
+   evcorrect.c) are done within the type-1 conversion, so they cost no
+   extra pass over the packet.
+
+   usage:
+     evbatch_init(&b, events);
+     evbatch_reserve(&b, n);   before a raw or type-1 conversion of n events
+     evbatch_raw(&b, words, n, offset);
+     while ((n=evbatch_type2(&b, &bitstream, &t, remaining))) { ... }
+
+*/
+
+#include <stdlib.h>
+#include "bitunpack.h"
+#include "evbatch.h"
+#include "evcorrect.h"
+#include "cpupin.h"
+
+#define RAW_BYTEMASK 0xff /* pattern bits kept from raw events */
+
+/* allocate a batch for a number of events. Returns 0 or -1. */
+int evbatch_init(struct evbatch *b, int events) {
+    b->t=NULL; b->p=NULL; b->n=0; b->size=0;
+    return evbatch_grow(b,events);
+}
+
+/* enlarge a batch to hold at least events entries. Returns 0 or -1; the old
+   columns stay valid on failure. */
+int evbatch_grow(struct evbatch *b, int events) {
+    long long newsize = b->size?b->size:BITUNPACK_BLOCK;
+    void *nt, *np;
+
+    while (newsize<events) newsize*=2;
+    if (newsize>0x7fffffff/(long long)sizeof(unsigned long long)) return -1;
+    if (!(nt=cpupin_alloc(newsize*sizeof(unsigned long long)))) return -1;
+    if (!(np=cpupin_alloc(newsize))) {
+	cpupin_free(nt,newsize*sizeof(unsigned long long)); return -1;
+    }
+    evbatch_free(b);
+    b->t=nt; b->p=np; b->size=newsize; b->n=0;
+    return 0;
+}
+
+void evbatch_free(struct evbatch *b) {
+    cpupin_free(b->t,b->size*sizeof(unsigned long long));
+    cpupin_free(b->p,b->size);
+    b->t=NULL; b->p=NULL; b->size=0; b->n=0;
+}
+
+/* n raw events in ev (pairs of words) into the batch, which has to have
+   room for them; offset is added to all times. */
+void evbatch_raw(struct evbatch *b, unsigned int *ev, int n,
+		 unsigned long long offset) {
+    unsigned long long * __restrict t=b->t;
+    unsigned char * __restrict p=b->p;
+    const unsigned int * __restrict e=ev;
+    int i;
+
+    for (i=0;i<n;i++) {
+	t[i]=((unsigned long long)e[2*i]<<17)+(e[2*i+1]>>15)+offset;
+	p[i]=e[2*i+1] & RAW_BYTEMASK;
+    }
+    b->n=n;
+}
+
+/* the n events of a type-1 packet of epoch epoch, ev pointing behind the
+   header. The upper bits of the times are taken from the epoch, which
+   overlaps with the timestamps in two bits. Returns the offset which was
+   added to the timestamps. */
+unsigned long long evbatch_type1(struct evbatch *b, unsigned int *ev, int n,
+				 unsigned int epoch) {
+    unsigned int localep=ev[0]>>15; /* from timestamp unit */
+    unsigned long long offset=(unsigned long long)
+	((epoch & 0xffff8000)-(localep & 0x00018000))<<32;
+
+    evbatch_raw(b,ev,n,offset);
+    return offset;
+}
+
+/* as evbatch_type1, with the corrections of c applied to the raw events on
+   the way. The packet is not changed. Events which a skew moves in front of
+   their predecessor are noted on the way, so the sorting pass only runs
+   for the few batches which need it. Returns the number of events kept. */
+int evbatch_type1_corrected(struct evbatch *b, unsigned int *ev, int n,
+			    unsigned int epoch, struct evcorrect *c) {
+    unsigned int localep=ev[0]>>15;
+    unsigned long long offset=(unsigned long long)
+	((epoch & 0xffff8000)-(localep & 0x00018000))<<32;
+    unsigned long long * __restrict t=b->t;
+    unsigned char * __restrict p=b->p;
+    const unsigned int * __restrict e=ev;
+    const unsigned long long * __restrict skew=c->skew;
+    unsigned long long r, tt, prev=0;
+    unsigned char pp;
+    int i, j, q, keep, inv=0;
+
+    if (c->mode & EVCORRECT_DEAD) {
+	for (i=0,j=0;i<n;i++) {
+	    q=e[2*i+1] & 0xf;
+	    r=((unsigned long long)e[2*i]<<32 | e[2*i+1])+skew[q];
+	    keep=(r-c->last[q]>c->dead[q]);
+	    c->last[q]=r;
+	    inv|=keep & (r<prev); prev=keep?r:prev;
+	    t[j]=(r>>EVCORRECT_SHIFT)+offset;
+	    p[j]=r & RAW_BYTEMASK;
+	    j+=keep;
+	}
+	n=j;
+    } else {
+	for (i=0;i<n;i++) {
+	    r=((unsigned long long)e[2*i]<<32 | e[2*i+1])+skew[e[2*i+1] & 0xf];
+	    inv|=(r<prev); prev=r;
+	    t[i]=(r>>EVCORRECT_SHIFT)+offset;
+	    p[i]=r & RAW_BYTEMASK;
+	}
+    }
+    b->n=n;
+
+    /* restore time order; events are displaced by a few places at most */
+    if (inv) {
+	for (i=1;i<n;i++) {
+	    if (t[i]>t[i-1] || (t[i]==t[i-1] && p[i]>=p[i-1])) continue;
+	    tt=t[i]; pp=p[i];
+	    for (j=i;j>0;j--) {
+		if (t[j-1]<tt || (t[j-1]==tt && p[j-1]<=pp)) break;
+		t[j]=t[j-1]; p[j]=p[j-1];
+	    }
+	    t[j]=tt; p[j]=pp;
+	}
+    }
+    return n;
+}
+
+/* unpack up to n events of a type-2 or type-4 stream, at most one block, and
+   add the differences less bias to *t. Returns the number of events. */
+static inline int unpack(struct evbatch *b, struct bitstream *s,
+			 unsigned long long *t, int n, unsigned int bias) {
+    if (n>BITUNPACK_BLOCK) n=BITUNPACK_BLOCK;
+    if (n>b->size) n=b->size;
+    n=bitunpack(s,t,bias,b->t,b->p,n);
+    b->n=n;
+    return n;
+}
+
+/* next block of up to n events of a type-2 stream; *t is the time of the
+   previous event, or the epoch origin for the first block, and is
+   updated. Returns the number of events, 0 at the end of the stream. */
+int evbatch_type2(struct evbatch *b, struct bitstream *s,
+		  unsigned long long *t, int n) {
+    return unpack(b,s,t,n,0);
+}
+
+/* same for a type-4 stream; its index differences are sent with an offset
+   of 2, which keeps them clear of the escape and end tokens. */
+int evbatch_type4(struct evbatch *b, struct bitstream *s,
+		  unsigned long long *index, int n) {
+    return unpack(b,s,index,n,2);
+}
@@ -0,0 +1,56 @@
+/* evbatch.h:    Part of the quantum key distribution software. Header for
+                 the column-oriented event batches used by costream,
+		 getrate2, pfind and splicer. Description see evbatch.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+typedef struct evbatch {
+    unsigned long long *t; /* absolute times in 1/8 nsec, or event indices */
+    unsigned char *p;      /* detector patterns */
+    int n;                 /* events in the batch */
+    int size;              /* capacity in events */
+} evb;
+
+int evbatch_init(struct evbatch *b, int events);
+int evbatch_grow(struct evbatch *b, int events);
+void evbatch_free(struct evbatch *b);
+
+struct bitstream; /* see bitunpack.h */
+
+/* conversion kernels, see evbatch.c */
+void evbatch_raw(struct evbatch *b, unsigned int *ev, int n,
+		 unsigned long long offset);
+unsigned long long evbatch_type1(struct evbatch *b, unsigned int *ev, int n,
+				 unsigned int epoch);
+struct evcorrect; /* see evcorrect.h */
+int evbatch_type1_corrected(struct evbatch *b, unsigned int *ev, int n,
+			    unsigned int epoch, struct evcorrect *c);
+int evbatch_type2(struct evbatch *b, struct bitstream *s,
+		  unsigned long long *t, int n);
+int evbatch_type4(struct evbatch *b, struct bitstream *s,
+		  unsigned long long *index, int n);
+
+/* make sure that events fit into the batch. Returns 0, or -1 if the memory
+   cannot be obtained. The columns may move; their content is not kept. */
+static inline int evbatch_reserve(struct evbatch *b, int events) {
+    if (events<=b->size) return 0;
+    return evbatch_grow(b,events);
+}
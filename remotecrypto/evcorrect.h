@@ -0,0 +1,39 @@
+/* evcorrect.h:  Part of the quantum key distribution software. Header for
+                 the detector skew and dead time correction of raw events
+		 used by readevents3, chopper2 and costream. Description
+		 see evcorrect.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define EVCORRECT_SHIFT 15 /* position of the 1/8 nsec unit in a raw event */
+#define EVCORRECT_SKEW 1 /* a skew is set for some detector */
+#define EVCORRECT_DEAD 2 /* a dead time is set for some detector */
+
+typedef struct evcorrect {
+    unsigned long long skew[16]; /* added to a raw event, by pattern */
+    unsigned long long dead[16]; /* dead time in raw units, by pattern */
+    unsigned long long last[16]; /* raw time of the last event, by pattern */
+    int mode; /* EVCORRECT_SKEW and/or EVCORRECT_DEAD, 0: nothing to do */
+} evc;
+
+void evcorrect_init(struct evcorrect *c, int *skew, unsigned int *dead,
+		    int detectors, int skewshift);
+int evcorrect_apply(struct evcorrect *c, unsigned int *ev, int n);
@@ -131,6 +131,9 @@
   added version that separates specially marked events with -b option,
    and cleaned up decision making process 15.8.2022chk
   added documentation for -b modes 22.10.2022chk
+  events are converted into column-oriented batches (evbatch.c) and counted
+   in runs up to the end of each time window; the time of an event is now
+   taken from its own words
   
 */
 
@@ -138,6 +141,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include "evbatch.h"
 
 #define FNAMELENGTH 200  /* length of file name buffers */
 #define FNAMFORMAT "%200s"   /* for sscanf of filenames */
@@ -269,10 +273,12 @@ int main (int argc, char *argv[]) {
     char outfilename[FNAMELENGTH]="";
     long long int timespan=DEFAULT_TIMESPAN;
     FILE *inhandle;
-    struct rawevent re; /* for reading in an event */
     struct rawevent *inbuf; /* input buffer */
+    struct evbatch batch; /* times and patterns of the input buffer */
+    unsigned long long *tb; /* time column of the batch */
+    unsigned char *pb; /* pattern column of the batch */
     int inh;
-    unsigned long long t0,t1, timeout1;
+    unsigned long long t0, timeout1;
     struct timeval tv;
     fd_set fd;  /* for timeout */
     FILE *outhandle;
@@ -280,8 +286,7 @@ int main (int argc, char *argv[]) {
     int numofrounds = DEFAULT_EVENTS; /* number of epochs to report */
     int j; /* index through counts */
     int numret=0;  /* number of returned events */
-    unsigned int dv=0; /* temporary buffer for dv */
-    int i; /* event counter */
+    int i, k; /* event counters */
     char *ibfraw; /* raw input buffer */
     unsigned int repairidx; /* contains bytes to skip not next read */
     unsigned int retval;
@@ -343,6 +348,8 @@ int main (int argc, char *argv[]) {
     ibfraw = (char *)malloc(sizeof(struct rawevent) 
 			    * BUF_IN_INENVENTS);
     if (!ibfraw) return -emsg(10);
+    if (evbatch_init(&batch,BUF_IN_INENVENTS)) return -emsg(10);
+    tb=batch.t; pb=batch.p;
     
     /* open out file */
     if (outfilename[0]) {
@@ -351,7 +358,7 @@ int main (int argc, char *argv[]) {
     } else {outhandle=stdout; };
     
     /* just to keep compiler quiet */
-    t0=0;t1=0;inbuf=NULL;
+    t0=0;inbuf=NULL;
 
     emergencybreak=0;
     repairidx=0;
@@ -422,45 +429,46 @@ int main (int argc, char *argv[]) {
 	/* repair possible buffer read mismatch for next round */
 	repairidx = (repairidx + retval) % sizeof(struct rawevent); 
 	
+	/* times and patterns in columns */
+	evbatch_raw(&batch,(unsigned int *)inbuf,numret,0);
+
+	i=0;
 	if (!firstshot) { /* load first timing event */
 	    firstshot=1;
-	    re=inbuf[0];inbuf=&inbuf[1];numret--;
-	    t0=((unsigned long long)re.cv<<17) +
-		((unsigned long long )re.dv >>15)
-		+timespan;
-	    t1=t0-1;
+	    t0=tb[0]+timespan;
+	    i=1;
 	}
 	
 	/* do actual counting */
-	for (i=0;i<numret;i++) {
-	    /* find out if timing is ripe for output*/
-	    t1=((unsigned long long)inbuf[i].cv<<17) +
-		((unsigned long long )dv >>15);
-	    if (t1>t0) { /* do output and update new timer */
-		generate_finalcounts();
-		/* print whatever detcount was selected */
-		for (j=0;j<number_of_counters;j++)
-		    fprintf(outhandle," %d",cnt[j]);
-		fprintf(outhandle,"\n"); /* terminate with newline */
-		fflush(outhandle);
+	while (i<numret) {
+	    /* run of events up to the end of the time window; increment
+	       according to six least signifciant bits in pattern */
+	    for (k=i;k<numret && tb[k]<=t0;k++);
+	    for (;i<k;i++) cntraw[pb[i] & 0x3f]++;
+	    if (i==numret) break;
+
+	    /* do output and update new timer */
+	    generate_finalcounts();
+	    /* print whatever detcount was selected */
+	    for (j=0;j<number_of_counters;j++)
+		fprintf(outhandle," %d",cnt[j]);
+	    fprintf(outhandle,"\n"); /* terminate with newline */
+	    fflush(outhandle);
 		
-		/* clear counters and update expiry timer t0 */
-		for (j=0;j<64;j++) cntraw[j]=0;
-		t0 += timespan;
+	    /* clear counters and update expiry timer t0 */
+	    for (j=0;j<64;j++) cntraw[j]=0;
+	    t0 += timespan;
 		
-		/* check for break conditions */
-		numofrounds--; /* result 0: terminate, <0: foreverloop */
-		if (numofrounds<0) numofrounds = -1; /* avoid overflow */
-		if (numofrounds==0) { /* we need to terminate */
-		    emergencybreak = 1;
-		    break;
-		}
-
+	    /* check for break conditions */
+	    numofrounds--; /* result 0: terminate, <0: foreverloop */
+	    if (numofrounds<0) numofrounds = -1; /* avoid overflow */
+	    if (numofrounds==0) { /* we need to terminate */
+		emergencybreak = 1;
+		break;
 	    }
 
-	    /* increment according to six least signifciant bits in pattern */
-	    dv=inbuf[i].dv;
-	    cntraw[dv & 0x3f]++; /* take least significant 6 bits of event */
+	    /* this event opens the new time window */
+	    cntraw[pb[i++] & 0x3f]++;
 	}
 
 	usleep(SLEEPTIME); /* should only be reached in case of a successful read */
@@ -482,7 +490,7 @@ int main (int argc, char *argv[]) {
 	    break;
     }
     
-    free(ibfraw);
+    free(ibfraw); evbatch_free(&batch);
     fclose(outhandle);
     fclose(inhandle);
     return retval;
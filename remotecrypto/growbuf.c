@@ -0,0 +1,68 @@
+/* growbuf.c:    Part of the quantum key distribution software. Growable
+                 buffers for packet streams, used by chopper, costream and
+		 splicer. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   The packet buffers used to have fixed sizes, tuned for some count rate;
+   beyond that, the programs either failed or wrote past the buffer end. A
+   growbuf starts at such a size and is enlarged by doubling whenever a
+   caller asks for more room with growbuf_reserve(), keeping its content.
+   A packet still goes out with one write() and so stays contiguous.
+
+   The buffers are kept from one epoch to the next and never shrink, so after
+   a short warm-up the programs run without further allocations. Callers
+   reserve the worst case of a packet or of a block of events ahead of time,
+   which keeps the test out of the bit packing loops. Large buffers go to
+   huge pages if the program was started with a -C profile asking for them
+   (see cpupin.c).
+
+*/
+
+#include <stdlib.h>
+#include "growbuf.h"
+#include "cpupin.h"
+
+/* allocate a buffer with an initial capacity. Returns 0 or -1. */
+int growbuf_init(struct growbuf *b, int words) {
+    b->buf=(unsigned int *)cpupin_alloc(words*sizeof(unsigned int));
+    b->size=b->buf?words:0;
+    return b->buf?0:-1;
+}
+
+/* enlarge a buffer to hold at least words entries. Returns 0 or -1; the old
+   buffer stays valid on failure. */
+int growbuf_grow(struct growbuf *b, int words) {
+    long long newsize = b->size?b->size:1024;
+    unsigned int *nb;
+
+    while (newsize<words) newsize*=2;
+    if (newsize>0x7fffffff/(long long)sizeof(unsigned int)) return -1;
+    nb=(unsigned int *)cpupin_realloc(b->buf,b->size*sizeof(unsigned int),
+				      newsize*sizeof(unsigned int));
+    if (!nb) return -1;
+    b->buf=nb; b->size=newsize;
+    return 0;
+}
+
+void growbuf_free(struct growbuf *b) {
+    cpupin_free(b->buf,b->size*sizeof(unsigned int));
+    b->buf=NULL; b->size=0;
+}
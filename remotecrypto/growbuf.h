@@ -0,0 +1,39 @@
+/* growbuf.h:    Part of the quantum key distribution software. Header for
+                 the growable packet buffers used by chopper, costream and
+		 splicer. Description see growbuf.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+typedef struct growbuf {
+    unsigned int *buf; /* storage; may move when growing */
+    int size;          /* capacity in 32 bit words */
+} gb;
+
+int growbuf_init(struct growbuf *b, int words);
+int growbuf_grow(struct growbuf *b, int words);
+void growbuf_free(struct growbuf *b);
+
+/* make sure that words fit into the buffer. Returns 0, or -1 if the memory
+   cannot be obtained. b->buf has to be re-read after a call. */
+static inline int growbuf_reserve(struct growbuf *b, int words) {
+    if (words<=b->size) return 0;
+    return growbuf_grow(b,words);
+}
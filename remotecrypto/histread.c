@@ -0,0 +1,156 @@
+/* histread.c:  Part of the quantum key distribution software. Reader for the
+                time difference histograms which costream publishes in
+		shared memory. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+   program to read the histograms which costream -H shm:name publishes in a
+   shared memory segment (histring.c), and to write them as text in the same
+   form as costream -H writes its histogram files: a comment header, then
+   one line per time bin with the time difference in multiples of 125ps
+   and the counts of all detector combinations. The monitoring in crgui_ec
+   plots these files.
+
+   In the default mode, the program polls the segment and writes every new
+   snapshot it sees; a slow reader just misses snapshots. It waits for the
+   segment to appear, and attaches again when costream restarts with a
+   new geometry. With -1, it writes the newest snapshot once and exits.
+
+   usage: histread -H name [-o target] [-1] [-t interval]
+
+   options:
+   -H name:      name of the segment, as given to costream -H, with or
+                 without the shm: prefix.
+   -o target:    without -1, a file name prefix; each snapshot goes into a
+                 file with the hex start epoch appended, as costream -H
+		 does for its text files. With -1, the name of the file.
+		 Without -o, the text goes to stdout.
+   -1:           write the newest snapshot and exit. Exits with an error if
+                 there is no segment or no snapshot yet.
+   -t interval:  poll interval in milliseconds. Default is 200.
+
+   example: costream ... -H shm:tfli -h 10
+            histread -H tfli -1 -o /tmp/cryptostuff/histodata
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "histring.h"
+#include "shmring.h"
+
+#define FNAMELENGTH 200
+#define DEFAULT_INTERVAL 200 /* poll interval in msec */
+
+char *errormessage[] = {
+  "No error.",
+  "error parsing segment name.", /* 1 */
+  "error parsing target name.",
+  "error parsing poll interval.",
+  "no segment name given (-H).",
+  "cannot attach to histogram segment.", /* 5 */
+  "no histogram in the segment yet.",
+  "cannot malloc histogram buffer.",
+  "cannot open target file.",
+};
+int emsg(int code) {
+  fprintf(stderr,"%s\n",errormessage[code]);
+  return code;
+};
+
+/* write one snapshot in the text form of costream */
+int writehisto(FILE *hh, struct histring *r, unsigned int epoch, int epochs,
+	       unsigned int *h) {
+    int i, j, depth=r->g.depth, rows=r->g.rows;
+    fprintf(hh,"# time difference histogramming output. Start epoch: %08x, contains %d epochs.\n# The timing info in column 1 is in multiples of 125ps. The\n# next 24 columns contain legal events, column 26 the number of illegal events.\n",epoch,epochs);
+    for (j=0;j<depth;j++) {
+	fprintf(hh,"%d ",(j-depth/2)*(int)r->g.binwidth);
+	for (i=0;i<rows;i++)
+	    fprintf(hh,"%d%c",h[i*depth+j],i<rows-1?' ':'\n');
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    char name[FNAMELENGTH]="", target[FNAMELENGTH]="", fn[FNAMELENGTH+10];
+    char *sn;
+    int once=0, interval=DEFAULT_INTERVAL, opt, attached=0, epochs, ret;
+    unsigned int epoch, *h=NULL;
+    struct histring r;
+    FILE *hh;
+
+    opterr=0; /* be quiet when there are no options */
+    while ((opt=getopt(argc, argv, "H:o:1t:")) != EOF) {
+	switch (opt) {
+	    case 'H':
+		if (1!=sscanf(optarg,"%199s",name)) return -emsg(1);
+		break;
+	    case 'o':
+		if (1!=sscanf(optarg,"%199s",target)) return -emsg(2);
+		break;
+	    case '1': once=1; break;
+	    case 't':
+		if (1!=sscanf(optarg,"%d",&interval) || interval<1)
+		    return -emsg(3);
+		break;
+	}
+    }
+    if (!name[0]) return -emsg(4);
+    sn=shmring_name(name)?shmring_name(name):name;
+
+    while (1) {
+	if (!attached) {
+	    if (histring_attach(&r,sn)) {
+		if (once) return -emsg(5);
+		usleep(interval*1000); continue;
+	    }
+	    attached=1;
+	    free(h);
+	    if (!(h=malloc(r.g.rows*r.g.depth*sizeof(unsigned int))))
+		return -emsg(7);
+	}
+	ret=histring_read(&r,&epoch,&epochs,h);
+	if (ret==HISTRING_CHANGED) { /* costream started over */
+	    histring_close(&r); attached=0;
+	    continue;
+	}
+	if (ret==HISTRING_OK) {
+	    if (!target[0]) {
+		writehisto(stdout,&r,epoch,epochs,h);
+		fflush(stdout);
+	    } else {
+		if (once) strcpy(fn,target);
+		else sprintf(fn,"%s%08x",target,epoch+epochs);
+		if (!(hh=fopen(fn,"w"))) return -emsg(8);
+		writehisto(hh,&r,epoch,epochs,h);
+		fclose(hh);
+	    }
+	}
+	if (once) {
+	    if (ret!=HISTRING_OK) return -emsg(6);
+	    break;
+	}
+	usleep(interval*1000);
+    }
+    histring_close(&r);
+    free(h);
+    return 0;
+}
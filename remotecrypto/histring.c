@@ -0,0 +1,182 @@
+/* histring.c:   Part of the quantum key distribution software. Shared
+                 memory publication of coincidence time histograms by
+		 costream. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   costream can collect a histogram of the time differences between the
+   events of both sides for every detector combination. Instead of a text
+   file per histogram, the histograms can be published into a segment of
+   POSIX shared memory, which monitoring programs map and poll. The segment
+   starts with a header describing the geometry (combinations, time bins,
+   bin width), followed by a fixed number of slots, each of which holds one
+   snapshot of the counts. The writer fills the slots in turn and never
+   waits for a reader; a reader which is slower than the writer just misses
+   snapshots.
+
+   Each slot carries a sequence word which is odd while the writer fills
+   it, and which is 2n+2 once snapshot n is complete. A reader copies the
+   newest slot and takes the copy only if the word is unchanged afterwards.
+
+   A writer which starts over marks an existing segment as stale and
+   replaces it, so readers find out about a new geometry and attach again.
+   A segment is removed with rm /dev/shm/<name>.
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "histring.h"
+
+#define HISTRING_MAGIC 0x48697374
+#define HISTRING_STALE 0x5374616c /* segment replaced by a new writer */
+#define RETRIES 8 /* attempts to get a consistent copy */
+
+static void shmname(char *target, char *name) {
+    if (name[0]=='/') strncpy(target,name,255);
+    else {target[0]='/'; strncpy(&target[1],name,254);}
+    target[255]=0;
+}
+
+static struct histring_slot *slot(struct histring *r, unsigned long long n) {
+    return (struct histring_slot *)((char *)r->h+r->g.slotsize*
+				   (1+n%r->g.slots));
+}
+
+/* create the segment name for histograms of rows x depth bins, replacing an
+   existing one. Returns 0 or HISTRING_ERROR. */
+int histring_create(struct histring *r, char *name, int rows, int depth,
+		    int binwidth) {
+    char sn[256];
+    int fd;
+    struct histring_head *old;
+
+    shmname(sn,name);
+    /* retire a segment left by an earlier writer */
+    if ((fd=shm_open(sn,O_RDWR,0600))!=-1) {
+	old=mmap(NULL,sizeof(struct histring_head),PROT_READ | PROT_WRITE,
+		 MAP_SHARED,fd,0);
+	if (old!=MAP_FAILED) {
+	    __atomic_store_n(&old->magic,HISTRING_STALE,__ATOMIC_RELEASE);
+	    munmap(old,sizeof(struct histring_head));
+	}
+	close(fd);
+	shm_unlink(sn);
+    }
+
+    r->g.rows=rows; r->g.depth=depth; r->g.binwidth=binwidth;
+    r->g.slots=HISTRING_SLOTS;
+    /* header and slots on cache line boundaries */
+    r->g.slotsize=(sizeof(struct histring_slot)+rows*depth*sizeof(int)+63)&~63;
+    if (r->g.slotsize<sizeof(struct histring_head))
+	r->g.slotsize=(sizeof(struct histring_head)+63)&~63;
+    r->maplen=(size_t)r->g.slotsize*(1+r->g.slots);
+
+    fd=shm_open(sn,O_RDWR | O_CREAT | O_EXCL,0644);
+    if (fd==-1) return HISTRING_ERROR;
+    if (ftruncate(fd,r->maplen)) {close(fd); return HISTRING_ERROR;}
+    r->h=mmap(NULL,r->maplen,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (r->h==MAP_FAILED) return HISTRING_ERROR;
+    r->g.seq=0; r->g.magic=HISTRING_MAGIC;
+    *r->h=r->g; r->h->magic=0;
+    __atomic_store_n(&r->h->magic,HISTRING_MAGIC,__ATOMIC_RELEASE);
+    r->last=0;
+    return HISTRING_OK;
+}
+
+/* publish a snapshot of rows x depth counts covering epochs starting at
+   epoch. Never blocks. */
+int histring_put(struct histring *r, unsigned int epoch, int epochs,
+		 unsigned int *counts) {
+    unsigned long long n=r->h->seq; /* only the writer changes it */
+    struct histring_slot *s=slot(r,n);
+
+    __atomic_store_n(&s->seq,2*n+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    s->epoch=epoch; s->epochs=epochs;
+    memcpy(&s[1],counts,r->g.rows*r->g.depth*sizeof(unsigned int));
+    __atomic_store_n(&s->seq,2*n+2,__ATOMIC_RELEASE);
+    __atomic_store_n(&r->h->seq,n+1,__ATOMIC_RELEASE);
+    return HISTRING_OK;
+}
+
+/* attach a reader to the segment name. The geometry is in r->g afterwards.
+   Returns 0, or HISTRING_ERROR if there is no valid segment. */
+int histring_attach(struct histring *r, char *name) {
+    char sn[256];
+    int fd;
+    struct stat st;
+
+    shmname(sn,name);
+    if ((fd=shm_open(sn,O_RDONLY,0))==-1) return HISTRING_ERROR;
+    if (fstat(fd,&st) || st.st_size<sizeof(struct histring_head)) {
+	close(fd); errno=EAGAIN; return HISTRING_ERROR;
+    }
+    r->maplen=st.st_size;
+    r->h=mmap(NULL,r->maplen,PROT_READ,MAP_SHARED,fd,0);
+    close(fd);
+    if (r->h==MAP_FAILED) return HISTRING_ERROR;
+    if (__atomic_load_n(&r->h->magic,__ATOMIC_ACQUIRE)!=HISTRING_MAGIC) {
+	munmap(r->h,r->maplen); errno=EAGAIN; return HISTRING_ERROR;
+    }
+    r->g=*r->h;
+    if ((size_t)r->g.slotsize*(1+r->g.slots)>r->maplen) {
+	munmap(r->h,r->maplen); errno=EINVAL; return HISTRING_ERROR;
+    }
+    r->last=0;
+    return HISTRING_OK;
+}
+
+/* copy the newest snapshot into counts (rows x depth entries) if there is
+   one which was not read before. Returns 0, HISTRING_NONE, or
+   HISTRING_CHANGED if the reader has to attach again. */
+int histring_read(struct histring *r, unsigned int *epoch, int *epochs,
+		  unsigned int *counts) {
+    unsigned long long n, s1;
+    struct histring_slot *s;
+    int i;
+
+    for (i=0;i<RETRIES;i++) {
+	if (__atomic_load_n(&r->h->magic,__ATOMIC_ACQUIRE)!=HISTRING_MAGIC)
+	    return HISTRING_CHANGED;
+	n=__atomic_load_n(&r->h->seq,__ATOMIC_ACQUIRE);
+	if (n==r->last) return HISTRING_NONE;
+	s=slot(r,n-1);
+	s1=__atomic_load_n(&s->seq,__ATOMIC_ACQUIRE);
+	if (s1!=2*n) continue; /* overtaken by the writer */
+	*epoch=s->epoch; *epochs=s->epochs;
+	memcpy(counts,&s[1],r->g.rows*r->g.depth*sizeof(unsigned int));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&s->seq,__ATOMIC_RELAXED)!=s1) continue;
+	r->last=n;
+	return HISTRING_OK;
+    }
+    return HISTRING_NONE;
+}
+
+void histring_close(struct histring *r) {
+    munmap(r->h,r->maplen);
+}
@@ -0,0 +1,63 @@
+/* histring.h:   Part of the quantum key distribution software. Header for
+                 the shared memory publication of coincidence time histograms
+		 by costream. Description see histring.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define HISTRING_SLOTS 8 /* snapshots kept in the ring */
+
+/* return values */
+#define HISTRING_OK 0
+#define HISTRING_NONE -1    /* no new snapshot since the last read */
+#define HISTRING_ERROR -2   /* system error, see errno */
+#define HISTRING_CHANGED -3 /* writer restarted with another geometry */
+
+typedef struct histring_head { /* at the start of the shared segment */
+    unsigned int magic;       /* set once the header is valid */
+    unsigned int rows;        /* detector combinations */
+    unsigned int depth;       /* time bins per combination */
+    unsigned int binwidth;    /* bin width in multiples of 125ps */
+    unsigned int slots;       /* number of snapshot slots */
+    unsigned int slotsize;    /* bytes per slot including its header */
+    unsigned long long seq;   /* snapshots published so far */
+} hrh;
+
+typedef struct histring_slot { /* in front of the counts of a snapshot */
+    unsigned long long seq; /* odd while the slot is written */
+    unsigned int epoch;     /* first epoch of the snapshot */
+    unsigned int epochs;    /* number of epochs integrated */
+} hrs; /* followed by rows x depth unsigned int counts, rows first */
+
+typedef struct histring {
+    struct histring_head *h;
+    struct histring_head g; /* geometry seen when attaching */
+    size_t maplen;
+    unsigned long long last; /* snapshot number last read */
+} hrr;
+
+int histring_create(struct histring *r, char *name, int rows, int depth,
+		    int binwidth);
+int histring_put(struct histring *r, unsigned int epoch, int epochs,
+		 unsigned int *counts);
+int histring_attach(struct histring *r, char *name);
+int histring_read(struct histring *r, unsigned int *epoch, int *epochs,
+		  unsigned int *counts);
+void histring_close(struct histring *r);
@@ -50,8 +50,11 @@
    -D dir1:         All type-1 packets are saved into the directory dir1, with
                     the file name being the epoch (filling zero expanded)
 		    in hex. Filename is not padded at end.
+		    dir1 and dir2 can also have the form log:dir for packets
+		    in a segmented epoch log (see epochlog.c).
    -k :             if set, type-2 streams are removed aafter consumption
-		    if the directory input has been chosen.
+		    if the directory input has been chosen. Segments of a log
+		    are removed once they have been read completely.
    -K :             if set, type-1 streams are removed aafter consumption
 		    if the directory input has been chosen.
 
@@ -82,6 +85,11 @@
   History:
   written specs: 21.8.05 chk
   added -q option for buffer order parameter 4.3.06chk
+  waits for files in directories with inotify (epochwait.c)
+  stream 2 is unpacked in blocks of events (bitunpack.c)
+  reads Rice coded stream-2 packets from chopper -R
+  reads packets from segmented epoch logs (epochlog.c)
+  events are converted into column-oriented batches (evbatch.c)
 
 
   ToDo:
@@ -106,6 +114,10 @@
 #include <fftw3.h>
 #include <time.h>
 #include <sys/time.h>
+#include "epochwait.h"
+#include "bitunpack.h"
+#include "epochlog.h"
+#include "evbatch.h"
 
 /* default definitions */
 #define DEFAULT_VERBOSITY 0
@@ -117,6 +129,8 @@
 #define DEFAULT_STARTEPOCH 0
 #define DEFAULT_EPOCHNUMBER 1 /* How many epochs to consider */
 #define DEFAULT_RESOLUTION 2 /* resolution in nanoseconds */
+#define DEFAULT_WAITFORFILE 550000 /* usec between directory tests */
+#define MAXFILETESTS 40 /* wait for about 22 seconds for a file to arrive */
 #define RAW1_SIZE 6400000 /* should last for 1400 kcps */ 
 #define RAW2_SIZE RAW1_SIZE  /* for this: buffer1=buffer2 */
 /* definitions for folding */
@@ -147,6 +161,8 @@ typedef struct header_2 { /* header for type-2 stream packet */
 #define TYPE_1_TAG_U 0x101
 #define TYPE_2_TAG 2
 #define TYPE_2_TAG_U 0x102
+#define TYPE_2_TAG_RICE 0x202 /* Rice coded time differences */
+#define TYPE_2_TAG_RICE_U 0x302
 #define TYPE_3_TAG 3
 #define TYPE_3_TAG_U 0x103
 #define TYPE_4_TAG 4
@@ -157,7 +173,7 @@ typedef struct rawevent {unsigned int cv; /* most significan word */
     unsigned int dv; /* least sig word */} re;
 
 /* error handling */
-char *errormessage[31] = {
+char *errormessage[32] = {
   "No error.",
   "Error reading in verbosity argument.", /* 1 */
   "Error reading file/directory name for type-2 packets.",
@@ -189,6 +205,7 @@ char *errormessage[31] = {
   "wrong stream type detected when looking for stream-2.",
   "cannot parse buffer bit width",
   "FFT size order out of range (must be 12..23)", /* 30 */
+  "cannot open epoch log directory",
 };
 
 int emsg(int code) {
@@ -202,12 +219,14 @@ char fname1[FNAMELENGTH]="";
 char fname2[FNAMELENGTH]="";
 char logfname[FNAMELENGTH]="";
 char ffnam[FNAMELENGTH+10];
+struct epochwatch watch; /* arrival of stream files in directories */
 int type1mode = 0; /* no mode defined. other tpyes:
-		      1: single file, 2: directory save, ... */
+		      1: single file, 2: directory save, 4: epoch log */
 int type2mode = 0; /* same as for type-1 files */
 int killmode1 = DEFAULT_KILLMODE1 ; /* if != 1, infile is deleted after use */
 int killmode2 = DEFAULT_KILLMODE2 ; /* if != 1, infile is deleted after use */
 int handle1, handle2; /* global handles for input files */
+struct epochlog elog; /* for streams in mode 4, one after the other */
 
 
 /* buffer for summation register */
@@ -220,6 +239,7 @@ fftw_plan plan1, plan2, plan3; /* ftrafo plans */
 
 /* function to fill buffer with stream-1 raw data. eats an input bufferpointer,
    a file handle, a max size in bytes, and a pointer to a header_1 struct.
+   With a handle of -1, the buffer holds a packet of maxsize bytes already.
    returns an error code.  */ 
 int get_stream_1(void *buffer, int handle, int maxsize,
 		 struct header_1 *head) {
@@ -227,13 +247,14 @@ int get_stream_1(void *buffer, int handle, int maxsize,
     int eidx;
     unsigned int *ib = buffer;
     struct header_1 *h; /* for local storage */
-    retval=read(handle,buffer,maxsize);
+    retval=(handle==-1)?maxsize:read(handle,buffer,maxsize);
     if (!retval) return 12; /* nothing available */
     if (!(retval+1)) return 13; /* other error */
     if (retval<(int)sizeof(struct header_1)) return 14; /* incomplete read */
     h=(struct header_1 *)buffer; /* at beginning of stream */
     /* consistency check at end */
     if ((h->tag!=TYPE_1_TAG) && (h->tag!=TYPE_1_TAG_U)) return 27;
+    *head=h[0]; /* a packet from the log is read-only */
     if (h->length) {
 	eidx=(h->length*sizeof(struct rawevent)+sizeof(struct header_1))
 	    /sizeof(unsigned int);
@@ -247,14 +268,14 @@ int get_stream_1(void *buffer, int handle, int maxsize,
 	eidx=retval/sizeof(unsigned int);
 	if (ib[eidx-1] |ib[eidx-2]) return 15; /* last word nonzero */
 	if (!(ib[eidx-3] |ib[eidx-4])) return 15; /* last real entry zero */ 
-	h->length=
+	head->length=
 	    (retval-sizeof(struct header_1))/sizeof(struct rawevent)-1;
     }
-    *head=h[0]; /* return pointer to header */
     return 0;
 }
 /* function to fill buffer with stream-2 raw data. eats an input buffer, a
    file handle, a max size in bytes, and a pointer to a header_2 structure.
+   With a handle of -1, the buffer holds a packet of maxsize bytes already.
    returns an error code. */
 int get_stream_2(void *buffer, int handle, int maxsize, 
 		 struct header_2 *head, int* realsize) {
@@ -262,14 +283,21 @@ int get_stream_2(void *buffer, int handle, int maxsize,
     int bitnum;
     struct header_2* h;
    
-    retval=read(handle,buffer,maxsize);
+    retval=(handle==-1)?maxsize:read(handle,buffer,maxsize);
     if (!retval) return 16; /* nothing available */
     if (!(retval+1)) return 17; /* other error */
     if (retval<(int)sizeof(struct header_2)) return 18; /* incomplete read */
     h=(struct header_2 *)buffer; /* at beginning of stream */
     /* consistency check on length and tag */
-    if ((h->tag!=TYPE_2_TAG) && (h->tag!=TYPE_2_TAG_U)) return 28;
-    if (h->length) {
+    if ((h->tag==TYPE_2_TAG_RICE) || (h->tag==TYPE_2_TAG_RICE_U)) {
+	/* at least a terminating bit and the pattern per event */
+	if ((retval-(int)sizeof(struct header_2))*8/(h->basebits+1)<
+	    h->length) {
+	    fprintf(stderr,"stream %08x too short, ",h->epoc);
+	    return 19;}
+    } else if ((h->tag!=TYPE_2_TAG) && (h->tag!=TYPE_2_TAG_U)) {
+	return 28;
+    } else if (h->length) {
 	bitnum=(retval-sizeof(struct header_2))*8/(h->length+1)
 	    - h->basebits-h->timeorder;
 	if ((bitnum<0) | (bitnum >32)) {
@@ -346,19 +374,21 @@ int main (int argc, char *argv[]) {
     int i,j,opt,retval; /* various working variables */
     unsigned int ju,ku; /* whereever it is needed */
     char *buffer1, *buffer2;  /* buffers for packed files */
+    char *packet; /* current packet, in a buffer or a log */
+    int packetlen;
     struct header_1 head1; /* for input stream 1 */
     struct header_2 head2; /* for input stream 2 */
     unsigned long long mask, intime;
     int fres,sres;  /* shift information for coarse / fine periode finder */
     int ecnt1,ecnt2; /* counting events in source files */
     unsigned long long epoch_offset; /* for epoch correction */
-    int resbits,realsize2,bitstoread2,pattern;
-    unsigned int tdiff,tdiff_bitmask,readword,patternmask;
-    int emergency_break; /* contains maximum index for strean-2 decompress */
+    int realsize2,n;
+    struct bitstream bits2; /* for unpacking stream 2 */
+    struct evbatch batch; /* times of a packet or block, both streams */
+    unsigned long long *times;
     long long int t0,timediff; /* final timedifference in 1/8 nsec */
     double maxval_s, maxval_f, sigma_s, sigma_f, mean_s, mean_f; /* results */
     int pos_s, pos_f; /* position of maximum */
-    int type2bitwidth,type2datawidth; /* for decompression */
     struct rawevent *pointer1; /* for parsing stream-1 */
     unsigned int *pointer2; /* for parsing stream 2 */
     unsigned int thisepoch; /* for epoch calculation */
@@ -379,12 +409,14 @@ int main (int argc, char *argv[]) {
 		fname2[FNAMELENGTH-1]=0;  /* security termination */
 		if (type2mode) return -emsg(3); /* already defined mode */
 		if (opt=='i') type2mode=1; else type2mode=2;
+		if (opt=='d' && epochlog_name(fname2)) type2mode=4;
 		break;
 	    case 'I': case 'D': /* stream-1 name and type */
 		if (1!=sscanf(optarg,FNAMFORMAT,fname1)) return -emsg(4);
 		fname1[FNAMELENGTH-1]=0;  /* security termination */
 		if (type1mode) return -emsg(5); /* already defined mode */
 		if (opt=='I') type1mode=1; else type1mode=2;
+		if (opt=='D' && epochlog_name(fname1)) type1mode=4;
 		break;
 	    case 'k': /* kill mode stream 2 */
 		killmode2=1;
@@ -432,6 +464,7 @@ int main (int argc, char *argv[]) {
     buffer1=(char *)malloc(RAW1_SIZE); /* double usage */
     buffer2=buffer1;
     if (!buffer1) return -emsg(11); /* cannot get inbuffer */
+    if (evbatch_init(&batch,BITUNPACK_BLOCK)) return -emsg(11);
 
     /* prepare integer buffers for folded timings */
     buf1_fast=(int*)calloc(zhs*4,sizeof(int));
@@ -453,12 +486,20 @@ int main (int argc, char *argv[]) {
 	    if (-1==(handle1=open(fname1,O_RDONLY))) return -emsg(20);
 	} else { handle1=0; } /* stdin */
     }
+    if (type1mode==2) epochwait_init(&watch,fname1);
+    if (type1mode==4 && epochlog_open(&elog,epochlog_name(fname1),0))
+	return -emsg(31);
     for (i=0;i<epochnumber;i++) {
 	thisepoch=startepoch+(unsigned int)i;
 	/* evtl. open stream 1 */
 	if (type1mode==2) { /* file in directory */
 	    strncpy(ffnam, fname1, FNAMELENGTH);
 	    atohex(&ffnam[strlen(ffnam)],thisepoch);
+	    switch (epochwait(&watch,ffnam,MAXFILETESTS,DEFAULT_WAITFORFILE)) {
+		case EPOCHWAIT_ERROR: case EPOCHWAIT_TIMEOUT:
+		    fprintf(stderr,"no file >>%s<< (errno %d).\n",ffnam,errno);
+		    return -emsg(20);
+	    }
 	    handle1=open(ffnam,O_RDONLY);
 	    if(-1==handle1) { 
 		fprintf(stderr,"ep:>%s<\n",ffnam);
@@ -466,14 +507,24 @@ int main (int argc, char *argv[]) {
 	    }
 	}
 
+	packet=buffer1; packetlen=RAW1_SIZE;
+	if (type1mode==4) { /* packet from the log */
+	    if (epochlog_read(&elog,1,thisepoch,&packet,&packetlen,
+			      MAXFILETESTS,DEFAULT_WAITFORFILE)) {
+		fprintf(stderr,"ep %08x not in log\n",thisepoch);
+		return -emsg(20);
+	    }
+	    handle1=-1;
+	}
+
 	/* buffer stream 1 */
-	retval=get_stream_1(buffer1,handle1,RAW1_SIZE,&head1);
+	retval=get_stream_1(packet,handle1,packetlen,&head1);
 	if (retval) return -emsg(retval);
 	/* check epoch consistency */
 	if (head1.epoc!=thisepoch) return -emsg(21);
 
 	/* process stream 1 */
-        pointer1=(struct rawevent *)(buffer1+sizeof(struct header_1)); 
+        pointer1=(struct rawevent *)(packet+sizeof(struct header_1)); 
 
 	/* adjust absolute epoch */
 	overlay=((pointer1[0].cv>>28)&0xc) | ((thisepoch>>15) & 3);
@@ -481,13 +532,14 @@ int main (int argc, char *argv[]) {
 	epoch_offset=((unsigned long long)
 		      ((thisepoch+overlay_correction[overlay]) & 0xfffe0000)
 	              )<<32;
+	if (evbatch_reserve(&batch,head1.length)) return -emsg(11);
+	evbatch_raw(&batch,(unsigned int *)pointer1,head1.length,epoch_offset);
+	times=batch.t;
 	for (ju=0;ju<head1.length;ju++) {
-	    intime=((unsigned long long)pointer1[ju].cv<<17)
-		+(pointer1[ju].dv>>15)+epoch_offset; /* current timing */
-	    buf1_fast[(int)(mask & (intime>>fres))]++;
-	    buf1_slow[(int)(mask & (intime>>sres))]++;
-	    ecnt1 ++;
+	    buf1_fast[(int)(mask & (times[ju]>>fres))]++;
+	    buf1_slow[(int)(mask & (times[ju]>>sres))]++;
 	}
+	ecnt1 += head1.length;
 	/* evtl close steam 1 */
 	if (type1mode==2) { /* file in directory */
 	    close(handle1);
@@ -497,6 +549,9 @@ int main (int argc, char *argv[]) {
 		if (unlink(ffnam)) return -emsg(22);
 	    }
 	}
+	/* segments before this one */
+	if (type1mode==4 && killmode1 && epochlog_drop(&elog,thisepoch))
+	    return -emsg(22);
     }
     /* evtl close stream 1 */
     if (type1mode==1) { /* file is not a  directory */
@@ -520,12 +575,22 @@ int main (int argc, char *argv[]) {
 		return -emsg(23);}
 	} else { handle2=0; } /* stdin */
     }
+    if (type1mode==2) epochwait_close(&watch);
+    if (type1mode==4) epochlog_close(&elog);
+    if (type2mode==2) epochwait_init(&watch,fname2);
+    if (type2mode==4 && epochlog_open(&elog,epochlog_name(fname2),0))
+	return -emsg(31);
     for (i=0;i<epochnumber;i++) {
 	thisepoch=startepoch+i;
 	/* evtl. open stream 2 */
 	if (type2mode==2) { /* file in directory */
 	    strncpy(ffnam, fname2, FNAMELENGTH);
 	    atohex(&ffnam[strlen(ffnam)],thisepoch);
+	    switch (epochwait(&watch,ffnam,MAXFILETESTS,DEFAULT_WAITFORFILE)) {
+		case EPOCHWAIT_ERROR: case EPOCHWAIT_TIMEOUT:
+		    fprintf(stderr,"(2) no file >>%s<< (errno %d).\n",ffnam,errno);
+		    return -emsg(23);
+	    }
 	    handle2=open(ffnam,O_RDONLY);
 	    if(-1==handle2) {
 		fprintf(stderr,"(2)errno:%d, file: %s ",errno,ffnam);
@@ -534,8 +599,18 @@ int main (int argc, char *argv[]) {
 	}
 	/* printf("control point 11\n"); */
 
+	packet=buffer2; packetlen=RAW2_SIZE;
+	if (type2mode==4) { /* packet from the log */
+	    if (epochlog_read(&elog,2,thisepoch,&packet,&packetlen,
+			      MAXFILETESTS,DEFAULT_WAITFORFILE)) {
+		fprintf(stderr,"(2) ep %08x not in log ",thisepoch);
+		return -emsg(23);
+	    }
+	    handle2=-1;
+	}
+
 	/* buffer stream 2 */
-	retval=get_stream_2(buffer2,handle2,RAW2_SIZE,&head2,&realsize2);
+	retval=get_stream_2(packet,handle2,packetlen,&head2,&realsize2);
 	if (retval) return -emsg(retval);
 	/* printf("control point 12\n"); */
 
@@ -545,61 +620,31 @@ int main (int argc, char *argv[]) {
 	/* printf("control point 13\n"); */
 
         /* process stream 2 */
-	pointer2=(unsigned int *)(buffer2+sizeof(struct header_2));
+	pointer2=(unsigned int *)(packet+sizeof(struct header_2));
         /* adjust to current epoch origin */
 	intime=((unsigned long long)thisepoch)<<32; 
 	/* prepare decompression */
-	j=0;readword = pointer2[j++]; /* raw buffer */
-	/* printf("first readw: %x\n",readword);*/
-	resbits=32; /* how much to eat */
-	type2bitwidth=head2.timeorder; type2datawidth=head2.basebits;
-	bitstoread2=type2bitwidth+type2datawidth; /* has to be <32 !! */
-	tdiff_bitmask = (1<<type2bitwidth)-1; /* for unpacking */
-	patternmask = (1<<type2datawidth)-1;
-	emergency_break=
-	    (realsize2-sizeof(struct header_2))/sizeof(unsigned int);
+	if (head2.tag & 0x200) { /* Rice coded */
+	    bitunpack_rice_init(&bits2,pointer2,
+		       (realsize2-sizeof(struct header_2))/sizeof(unsigned int),
+		       head2.timeorder,head2.basebits,head2.length);
+	} else {
+	    bitunpack_init(&bits2,pointer2,
+		       (realsize2-sizeof(struct header_2))/sizeof(unsigned int),
+		       head2.timeorder,head2.basebits);
+	}
 	ku=0;/* count local events */
-	do { /* go through buffer */
-	    if (resbits>=bitstoread2) {
-		tdiff=(readword>>(resbits-bitstoread2));
-		resbits-=bitstoread2;
-		if (!resbits) {readword=pointer2[j++];resbits=32;}
-	    } else {
-		resbits=bitstoread2-resbits;
-		tdiff=readword<<resbits;
-		readword=pointer2[j++];
-		resbits=32-resbits;
-		tdiff=(tdiff | (readword>>resbits));
+	/* go through buffer in blocks of events */
+	while ((n=evbatch_type2(&batch,&bits2,&intime,BITUNPACK_BLOCK))) {
+	    times=batch.t;
+	    for (j=0;j<n;j++) {
+		buf2_fast[(int)(mask & (times[j]>>fres))]++;
+		buf2_slow[(int)(mask & (times[j]>>sres))]++;
 	    }
-	    pattern= (tdiff & patternmask);
-	    tdiff>>=type2datawidth;
-	    /* printf("token: %x, pattern: %x; ",tdiff& tdiff_bitmask,pattern); */
-	    /* we have a time difference word now in tdiff */
-	    if (tdiff &= tdiff_bitmask) { /* check for exception */
-		/* test for end of stream */
-		if (tdiff==1) break; /* exit digest routine for this stream */
-	    } else {
-		/* read in complete difference */
-		tdiff=readword<<(32-resbits);
-		readword=pointer2[j++];
-		/* printf("e: rw=%x ",readword); */
-                /* catch shift 'feature' - normal */
-		if (resbits & 0x1f) tdiff |= readword>>resbits;
-		tdiff >>=type2datawidth;
-		tdiff |=  (pattern<<(32-type2datawidth));
-	    }
-	    /* we now have a valid difference */
-	    intime +=tdiff;
-	    /*  printf("k: %d, tdiff: %x, intime: %llx\n",k,tdiff,intime); */
-	    buf2_fast[(int)(mask & (intime>>fres))]++;
-	    buf2_slow[(int)(mask & (intime>>sres))]++;
-	    ku++;
-	} while (j<emergency_break);
-/* 	printf("control point 14\n");
-	printf("head2.length: %d, j:%d, eme: %d, k: %d,tdiff: %d\n",
-	head2.length,j,emergency_break,k,tdiff); */
+	    ku+=n;
+	}
 	/* consistency check */
-	if (head2.length || (j>=emergency_break)) if (ku!=head2.length) {
+	if (head2.length || !bits2.ended) if (ku!=head2.length) {
 	    fprintf(stderr,"ku: %d, announced len: %d ",ku,head2.length);
 	    return  -emsg(19);
 	}
@@ -612,9 +657,11 @@ int main (int argc, char *argv[]) {
 		if (unlink(ffnam)) return -emsg(25);
 	    }
 	}
-	
-	
+	/* segments before this one */
+	if (type2mode==4 && killmode2 && epochlog_drop(&elog,thisepoch))
+	    return -emsg(25);
     }
+    if (type2mode==4) epochlog_close(&elog);
 
     /* close evtl stream 2 */ 
     if (type2mode==1) { /* file is not a  directory */
@@ -656,7 +703,7 @@ int main (int argc, char *argv[]) {
     fftw_destroy_plan(plan1);fftw_destroy_plan(plan2);fftw_destroy_plan(plan3);
     /* do washup for buffers */
     fftw_free(f1);  fftw_free(f2); free(buf1_fast);
-    free(buffer1);
+    free(buffer1); evbatch_free(&batch);
  
     /* temporary log of raw data */
     fprintf(stderr,
@@ -0,0 +1,215 @@
+/* pinbench.c:  Part of the quantum key distribution software. Benchmark for
+                the processing time per epoch with and without a -C
+		profile. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+   program to measure what a placement profile (see cpupin.c) does to the
+   time a stage of the sifting chain needs for an epoch. Every epoch, a
+   packet of raw events is copied into a buffer as read() would do, turned
+   into an event batch (evbatch.c), and one bit per event is packed into a
+   growing output buffer (growbuf.c), as chopper and costream do. The
+   buffers are allocated in the same way as in the programs, so a profile
+   with h puts them on huge pages. The time of every epoch is taken, and
+   the distribution is printed at the end; the interesting part is the
+   tail, not the median.
+
+   To see the effect on a busy machine, -l starts some threads which stream
+   through memory of their own. They are started before the profile is
+   applied and stay unpinned, like other processes on the machine.
+
+   usage: pinbench [-C profile] [-n epochs] [-r rate] [-s sleep] [-l load]
+                   [-v]
+
+   options:
+   -C profile:   placement profile cpus[:node[:h]] as for the programs of
+                 the chain. Without it, the process runs where the
+		 scheduler puts it.
+   -n epochs:    number of epochs to time. Default is 200.
+   -r rate:      events per second. An epoch of 2^29 nsec then holds
+                 rate*0.537 events. Default is 1000000.
+   -s sleep:     pause between epochs in microseconds, as the programs wait
+                 for the next packet. Default is 0.
+   -l load:      number of background threads streaming through 64 MB each.
+                 Default is 0.
+   -v:           print the time of every epoch, in microseconds, before the
+                 summary.
+
+   output: the number of epochs and events per epoch, followed by the
+   minimum, median, 90%, 99% and 99.9% quantiles and the maximum of the
+   time per epoch in microseconds.
+
+   example: compare
+      pinbench -l 2 -s 100000
+      pinbench -l 2 -s 100000 -C 1:0:h
+
+   status: a benefit of the profiles on the tail is NOT demonstrated yet.
+   The only measurements so far are from a machine with one cpu and one
+   NUMA node, where pinning cannot move a stage away from the load. There,
+   with -n 1000 -s 2000, p99 was 4.8 to 11 msec and p99.9 8 to 17 msec with
+   and without -C, in no consistent order between runs. The comparison has
+   to be repeated on a host with several cores and NUMA nodes before a
+   profile is recommended.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "growbuf.h"
+#include "bitunpack.h"
+#include "evbatch.h"
+#include "cpupin.h"
+
+#define DEFAULT_EPOCHS 200
+#define DEFAULT_RATE 1000000
+#define MAX_LOAD 64
+#define LOADSIZE (64<<20) /* bytes per load thread */
+#define EPOCH_SECONDS 0.536870912 /* 2^29 nsec */
+
+char *errormessage[] = {
+  "No error.",
+  "error parsing number of epochs.", /* 1 */
+  "error parsing event rate.",
+  "error parsing sleep time.",
+  "error parsing number of load threads (0..64).",
+  "error parsing -C profile (cpus[:node[:h]]).", /* 5 */
+  "cannot apply -C profile.",
+  "cannot malloc event buffers.",
+  "cannot start load thread.",
+};
+int emsg(int code) {
+  fprintf(stderr,"%s\n",errormessage[code]);
+  return code;
+};
+
+/* background load: stream through a buffer forever */
+void *loadthread(void *arg) {
+    volatile unsigned int *m=arg;
+    unsigned int s=0;
+    int i;
+    while (1) for (i=0;i<LOADSIZE/4;i+=16) m[i]=s+=m[i];
+    return NULL;
+}
+
+int cmpll(const void *a, const void *b) {
+    long long x=*(long long *)a, y=*(long long *)b;
+    return (x>y)-(x<y);
+}
+
+long long quantile(long long *t, int n, double q) {
+    int i=(int)(q*(n-1)+.5);
+    return t[i];
+}
+
+int main(int argc, char *argv[]) {
+    int epochs = DEFAULT_EPOCHS, rate = DEFAULT_RATE, sleeptime = 0;
+    int load = 0, verbose = 0;
+    char *profile = NULL;
+    unsigned int *src, *raw; /* packet source and read buffer */
+    struct growbuf out;
+    struct evbatch b;
+    unsigned long long t=0, last;
+    unsigned int sendword, check=0;
+    int n, i, e, opt, resbits, index;
+    long long *tm;
+    struct timespec t0, t1;
+    pthread_t th;
+    void *m;
+
+    opterr=0; /* be quiet when there are no options */
+    while ((opt=getopt(argc, argv, "C:n:r:s:l:v")) != EOF) {
+	switch (opt) {
+	    case 'C': profile=optarg; break;
+	    case 'n':
+		if (1!=sscanf(optarg,"%d",&epochs) || epochs<1)
+		    return -emsg(1);
+		break;
+	    case 'r':
+		if (1!=sscanf(optarg,"%d",&rate) || rate<1) return -emsg(2);
+		break;
+	    case 's':
+		if (1!=sscanf(optarg,"%d",&sleeptime) || sleeptime<0)
+		    return -emsg(3);
+		break;
+	    case 'l':
+		if (1!=sscanf(optarg,"%d",&load) || load<0 || load>MAX_LOAD)
+		    return -emsg(4);
+		break;
+	    case 'v': verbose=1; break;
+	}
+    }
+
+    /* load threads first, so they stay where the scheduler wants them */
+    for (i=0;i<load;i++) {
+	if (!(m=calloc(1,LOADSIZE))) return -emsg(7);
+	if (pthread_create(&th,NULL,loadthread,m)) return -emsg(8);
+    }
+    if (profile) switch (cpupin_setup(profile)) {
+	case CPUPIN_SYNTAX: return -emsg(5);
+	case CPUPIN_ERROR: return -emsg(6);
+    }
+
+    /* one epoch of raw events; the source stands for the page cache */
+    n=(int)(rate*EPOCH_SECONDS);
+    if (!(src=malloc(2*sizeof(unsigned int)*n))) return -emsg(7);
+    srand(1);
+    for (i=0;i<n;i++) {
+	t+=1+rand()%(2*(int)(8e9/rate)); /* mean rate, 1/8 nsec */
+	src[2*i]=t>>17;
+	src[2*i+1]=(t<<15) | (1<<(rand()&3));
+    }
+    if (!(raw=cpupin_alloc(2*sizeof(unsigned int)*n))) return -emsg(7);
+    if (!(tm=malloc(epochs*sizeof(long long)))) return -emsg(7);
+    /* as in the programs, the output starts small and grows */
+    if (growbuf_init(&out,1024)) return -emsg(7);
+    if (evbatch_init(&b,BITUNPACK_BLOCK)) return -emsg(7);
+
+    for (e=0;e<epochs;e++) {
+	if (sleeptime) usleep(sleeptime);
+	clock_gettime(CLOCK_MONOTONIC,&t0);
+	memcpy(raw,src,2*sizeof(unsigned int)*n); /* the read() */
+	if (evbatch_reserve(&b,n)) return -emsg(7);
+	evbatch_raw(&b,raw,n,0);
+	if (growbuf_reserve(&out,n/32+2)) return -emsg(7);
+	sendword=0; resbits=32; index=0; last=b.t[0];
+	for (i=0;i<n;i++) { /* one bit per event, and the differences */
+	    check+=b.t[i]-last; last=b.t[i];
+	    sendword|=((b.p[i]>>1) & 1)<<--resbits;
+	    if (!resbits) {
+		out.buf[index++]=sendword; sendword=0; resbits=32;
+	    }
+	}
+	out.buf[index]=sendword;
+	clock_gettime(CLOCK_MONOTONIC,&t1);
+	tm[e]=(t1.tv_sec-t0.tv_sec)*1000000LL+(t1.tv_nsec-t0.tv_nsec)/1000;
+	if (verbose) printf("%d\t%lld\n",e,tm[e]);
+    }
+
+    qsort(tm,epochs,sizeof(long long),cmpll);
+    printf("epochs: %d, events per epoch: %d, profile: %s, check: %08x\n",
+	   epochs,n,profile?profile:"none",check);
+    printf("min %lld\tp50 %lld\tp90 %lld\tp99 %lld\tp99.9 %lld\tmax %lld\n",
+	   tm[0],quantile(tm,epochs,.5),quantile(tm,epochs,.9),
+	   quantile(tm,epochs,.99),quantile(tm,epochs,.999),tm[epochs-1]);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/* rawgen.c:    Part of the quantum key distribution software. Generator for
+                synthetic raw event files of both sides, for stress tests of
+		the sifting chain. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+   program to write the raw events of a BB84 source as the timestamp cards of
+   both sides would deliver them, at rates which no real source in the lab
+   reaches. The files go into chopper2 (side A) and chopper (side B); the
+   stresschain script runs the whole chain on them.
+
+   Events follow one Poisson process with the total rate of pairs and
+   singles, so that both files come out in time order. After each event,
+   the process is dead for a while, as a timestamp card would be; chopper
+   cannot encode two events much closer than a nanosecond anyway. A
+   pair has a random basis and value on side A. Side B sees the same basis
+   and the opposite value, which the protocol 1 table of costream turns into
+   the same key bit; the value is flipped at the given error rate. In half of
+   the cases, side B sees a random detector of the other basis instead. Singles hit a random detector of one side.
+   Side B is shifted by a constant time offset. The detector pattern is
+   1<<(basis+2*value), as for protocol 1 (V,-,H,+ from the lsb).
+
+   Raw events are the 64 bit words of the timestamp card: the upper 49 bits
+   are the time in 1/8 nsec, the lower bits the detector pattern. The time
+   starts at the beginning of the start epoch, so chopper and chopper2 with
+   their default local epoch (-L) number the epochs from there.
+
+   usage: rawgen -a fileA -b fileB [-e epoch] [-n epochs] [-r pairrate]
+                 [-s singlerate] [-t offset] [-d deadtime] [-q errorrate]
+		 [-x seed]
+
+   options:
+   -a fileA, -b fileB:  raw event files for the two sides.
+   -e epoch:     start epoch in hex. Default is 0x1234.
+   -n epochs:    number of epochs to fill. Default is 5. Since chopper only
+                 emits an epoch once the next one starts, the last one does
+		 not leave the chain.
+   -r pairrate:  pairs per second. Default is 5000000.
+   -s singlerate: singles per second on each side. Default is 5000000.
+   -t offset:    time of side B minus time of side A, in 1/8 nsec. Default
+                 is 12345; costream then needs -t 12345.
+   -d deadtime:  minimum distance of two events in 1/8 nsec. The mean
+                 distance stays as given by the rates. Default is 8.
+   -q errorrate: probability of a flipped value on side B. Default is 0.
+   -x seed:      seed of the random number generator. Default is 1.
+
+   output: one line per epoch on stdout with the epoch in hex and the number
+   of events of side A, of side B and of pairs in it. Events of side B are
+   counted in the epoch of their own, shifted time, as chopper sees them;
+   pairs in the epoch of side A.
+
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <math.h>
+
+#define DEFAULT_STARTEPOCH 0x1234
+#define DEFAULT_EPOCHS 5
+#define DEFAULT_PAIRRATE 5000000
+#define DEFAULT_SINGLERATE 5000000
+#define DEFAULT_OFFSET 12345
+#define DEFAULT_DEADTIME 8 /* 1 nsec */
+#define CHUNK 65536 /* events per write */
+
+char *errormessage[] = {
+  "No error.",
+  "need both output files (-a, -b).", /* 1 */
+  "error parsing start epoch.",
+  "error parsing number of epochs.",
+  "error parsing a rate.",
+  "error parsing time offset (>=0).", /* 5 */
+  "error parsing error rate (0..1).",
+  "error parsing seed.",
+  "cannot open output file.",
+  "cannot write output file.",
+  "cannot malloc count tables.", /* 10 */
+  "error parsing dead time (>=0, below the mean distance of events).",
+};
+int emsg(int code) {
+  fprintf(stderr,"%s\n",errormessage[code]);
+  return code;
+};
+
+/* xorshift64*, fast enough not to be the bottleneck */
+unsigned long long rs;
+static inline unsigned long long rnd64(void) {
+    rs^=rs>>12; rs^=rs<<25; rs^=rs>>27;
+    return rs*0x2545f4914f6cdd1dULL;
+}
+static inline double rnduni(void) { /* in (0,1] */
+    return ((rnd64()>>11)+1)*(1.0/9007199254740992.0);
+}
+
+typedef struct rawevent {unsigned int cv; unsigned int dv;} re;
+
+struct rawevent bufa[CHUNK], bufb[CHUNK];
+int na=0, nb=0;
+FILE *fa, *fb;
+
+static inline int put(struct rawevent *buf, int *n, FILE *f,
+		      unsigned long long t, int pattern) {
+    buf[*n].cv=t>>17; buf[*n].dv=((t & 0x1ffff)<<15) | pattern;
+    if (++*n<CHUNK) return 0;
+    *n=0;
+    return fwrite(buf,sizeof(struct rawevent),CHUNK,f)!=CHUNK;
+}
+
+int main(int argc, char *argv[]) {
+    char *fna=NULL, *fnb=NULL;
+    unsigned int epoch=DEFAULT_STARTEPOCH, ep;
+    int epochs=DEFAULT_EPOCHS, opt, seed=1;
+    double pr=DEFAULT_PAIRRATE, sr=DEFAULT_SINGLERATE, qber=0;
+    long long offset=DEFAULT_OFFSET;
+    int deadtime=DEFAULT_DEADTIME;
+    double tau, pp; /* mean spacing, probability of a pair */
+    unsigned long long t, tend, r;
+    double tf;
+    int i, basis, val, da, db, *ca, *cb, *cp;
+
+    opterr=0; /* be quiet when there are no options */
+    while ((opt=getopt(argc, argv, "a:b:e:n:r:s:t:d:q:x:")) != EOF) {
+	switch (opt) {
+	    case 'a': fna=optarg; break;
+	    case 'b': fnb=optarg; break;
+	    case 'e':
+		if (1!=sscanf(optarg,"%x",&epoch)) return -emsg(2);
+		break;
+	    case 'n':
+		if (1!=sscanf(optarg,"%d",&epochs) || epochs<1) return -emsg(3);
+		break;
+	    case 'r':
+		if (1!=sscanf(optarg,"%lf",&pr) || pr<0) return -emsg(4);
+		break;
+	    case 's':
+		if (1!=sscanf(optarg,"%lf",&sr) || sr<0) return -emsg(4);
+		break;
+	    case 't':
+		if (1!=sscanf(optarg,"%lld",&offset) || offset<0)
+		    return -emsg(5);
+		break;
+	    case 'd':
+		if (1!=sscanf(optarg,"%d",&deadtime) || deadtime<0)
+		    return -emsg(11);
+		break;
+	    case 'q':
+		if (1!=sscanf(optarg,"%lf",&qber) || qber<0 || qber>1)
+		    return -emsg(6);
+		break;
+	    case 'x':
+		if (1!=sscanf(optarg,"%d",&seed)) return -emsg(7);
+		break;
+	}
+    }
+    if (!fna || !fnb) return -emsg(1);
+    if (pr+2*sr<=0) return -emsg(4);
+    if (!(fa=fopen(fna,"w")) || !(fb=fopen(fnb,"w"))) return -emsg(8);
+    /* side B may run into one more epoch */
+    ca=calloc(epochs+1,sizeof(int)); cb=calloc(epochs+1,sizeof(int));
+    cp=calloc(epochs+1,sizeof(int));
+    if (!ca || !cb || !cp) return -emsg(10);
+
+    rs=0x9e3779b97f4a7c15ULL*(seed+1); /* never zero */
+    tau=8e9/(pr+2*sr)-deadtime; pp=pr/(pr+2*sr); /* tau: beyond dead time */
+    if (tau<=0) return -emsg(11);
+    t=(unsigned long long)epoch<<32; tf=0;
+    tend=(unsigned long long)(epoch+epochs)<<32;
+    while (1) {
+	tf+=deadtime-log(rnduni())*tau; /* keep the fraction across events */
+	t+=(unsigned long long)tf; tf-=(unsigned long long)tf;
+	if (t>=tend) break;
+	ep=(t>>32)-epoch;
+	r=rnd64(); /* bits for basis, values and detectors */
+	if (rnduni()<pp) { /* pair */
+	    basis=r&1; val=(r>>1)&1;
+	    da=1<<(basis+2*val);
+	    if (r & 4) { /* same basis on side B */
+		db=(rnduni()<qber)?da:1<<(basis+2*(1-val));
+	    } else {
+		db=1<<(1-basis+2*((r>>3)&1));
+	    }
+	    if (put(bufa,&na,fa,t,da)) return -emsg(9);
+	    if (put(bufb,&nb,fb,t+offset,db)) return -emsg(9);
+	    ca[ep]++; cb[((t+offset)>>32)-epoch]++; cp[ep]++;
+	} else if (r & 16) { /* single on side A */
+	    if (put(bufa,&na,fa,t,1<<((r>>5)&3))) return -emsg(9);
+	    ca[ep]++;
+	} else { /* single on side B */
+	    if (put(bufb,&nb,fb,t+offset,1<<((r>>5)&3))) return -emsg(9);
+	    cb[((t+offset)>>32)-epoch]++;
+	}
+    }
+    for (i=0;i<epochs;i++)
+	printf("%08x\t%d\t%d\t%d\n",epoch+i,ca[i],cb[i],cp[i]);
+    if (fwrite(bufa,sizeof(struct rawevent),na,fa)!=na) return -emsg(9);
+    if (fwrite(bufb,sizeof(struct rawevent),nb,fb)!=nb) return -emsg(9);
+    fclose(fa); fclose(fb);
+    return 0;
+}
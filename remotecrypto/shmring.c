@@ -0,0 +1,246 @@
+/* shmring.c:    Part of the quantum key distribution software. Shared
+                 memory transport of epoch packets between chopper, chopper2,
+		 costream and splicer. Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+--
+
+   Normally each epoch packet goes from one program to the next as a file in
+   a directory, with a notification line carrying its name. For streams which
+   stay on one machine, a ring buffer in POSIX shared memory can take the
+   place of the directory: if a directory name starts with "shm:", the rest
+   names a ring in /dev/shm, which is created by whichever side comes first.
+   The producer appends the packets (header and content, as they would go
+   into the file) together with their stream type and epoch; the consumer
+   reads them in place and releases each one when it asks for the next.
+
+   The ring has a producer cursor (head) and a consumer cursor (tail), both
+   counting bytes since creation. A packet is never split: if it does not
+   fit before the end of the data area, a filler packet takes the rest and
+   the packet starts over at the beginning. A producer which finds the ring
+   full waits for the consumer (backpressure), and a consumer waits for the
+   next packet; both sleep on a futex and are woken by the other side, so a
+   packet is picked up within microseconds.
+
+   There is one producer and one consumer per ring. Packets of earlier runs
+   stay in a ring; consumers skip packets of epochs before the one they
+   expect. A ring is removed with rm /dev/shm/<name>.
+
+*/
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "shmring.h"
+
+#define SHMRING_MAGIC 0x51726e67
+#define ALIGN 16 /* packet alignment in the data area */
+#define SLICE_MS 100 /* longest single futex sleep */
+#define SLACK 4096 /* mapped behind the data area for decoder read-ahead */
+
+/* name of the ring if path selects one, or NULL */
+char *shmring_name(char *path) {
+    if (strncmp(path,SHMRING_PREFIX,strlen(SHMRING_PREFIX))) return NULL;
+    return path+strlen(SHMRING_PREFIX);
+}
+
+static void wake(struct shmring *r) {
+    __atomic_add_fetch(&r->h->seq,1,__ATOMIC_RELEASE);
+    syscall(SYS_futex,&r->h->seq,FUTEX_WAKE,1,NULL,NULL,0);
+}
+
+/* sleep until the other side moves a cursor, or for at most a slice.
+   Returns 0, or -1 if the deadline has passed. */
+static int waitfor(struct shmring *r, int seq, struct timespec *deadline) {
+    struct timespec now, rest;
+    long long ms;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    ms=(deadline->tv_sec-now.tv_sec)*1000LL+
+	(deadline->tv_nsec-now.tv_nsec)/1000000;
+    if (ms<=0) return -1;
+    if (ms>SLICE_MS) ms=SLICE_MS;
+    rest.tv_sec=ms/1000; rest.tv_nsec=(ms%1000)*1000000;
+    syscall(SYS_futex,&r->h->seq,FUTEX_WAIT,seq,&rest,NULL,0);
+    return 0;
+}
+
+static void setdeadline(struct timespec *d, int timeout_ms) {
+    clock_gettime(CLOCK_MONOTONIC,d);
+    d->tv_sec+=timeout_ms/1000;
+    d->tv_nsec+=(timeout_ms%1000)*1000000;
+    if (d->tv_nsec>=1000000000) {d->tv_sec++; d->tv_nsec-=1000000000;}
+}
+
+/* create or attach to the ring name with a data area of size bytes (a
+   multiple of 16; ignored when attaching). Returns 0 or SHMRING_ERROR. */
+int shmring_open(struct shmring *r, char *name, unsigned long long size) {
+    char shmname[256];
+    int fd, created=1, i;
+    struct stat st;
+
+    if (name[0]=='/') strncpy(shmname,name,sizeof(shmname)-1);
+    else {shmname[0]='/'; strncpy(&shmname[1],name,sizeof(shmname)-2);}
+    shmname[sizeof(shmname)-1]=0;
+
+    fd=shm_open(shmname,O_RDWR | O_CREAT | O_EXCL,0600);
+    if (fd==-1) {
+	if (errno!=EEXIST) return SHMRING_ERROR;
+	created=0;
+	fd=shm_open(shmname,O_RDWR,0600);
+	if (fd==-1) return SHMRING_ERROR;
+	/* wait for the creator to size the segment */
+	for (i=0;i<1000;i++) {
+	    if (fstat(fd,&st)) {close(fd); return SHMRING_ERROR;}
+	    if (st.st_size>(off_t)(sizeof(struct shmring_head)+SLACK)) break;
+	    usleep(1000);
+	}
+	if (i==1000) {close(fd); errno=ETIMEDOUT; return SHMRING_ERROR;}
+	size=st.st_size-sizeof(struct shmring_head)-SLACK;
+    } else if (ftruncate(fd,sizeof(struct shmring_head)+size+SLACK)) {
+	close(fd); return SHMRING_ERROR;
+    }
+    r->maplen=sizeof(struct shmring_head)+size+SLACK;
+    r->h=mmap(NULL,r->maplen,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if (r->h==MAP_FAILED) return SHMRING_ERROR;
+    r->data=(char *)&r->h[1];
+    r->held=0;
+    if (created) {
+	r->h->size=size; r->h->head=0; r->h->tail=0; r->h->seq=0;
+	__atomic_store_n(&r->h->magic,SHMRING_MAGIC,__ATOMIC_RELEASE);
+    } else { /* wait for the creator to initialize the header */
+	for (i=0;i<1000;i++) {
+	    if (__atomic_load_n(&r->h->magic,__ATOMIC_ACQUIRE)==SHMRING_MAGIC)
+		break;
+	    usleep(1000);
+	}
+	if (i==1000) {
+	    munmap(r->h,r->maplen);
+	    errno=ETIMEDOUT; return SHMRING_ERROR;
+	}
+    }
+    r->size=r->h->size;
+    return SHMRING_OK;
+}
+
+/* append a packet made of two parts; waits for room for up to timeout_ms */
+int shmring_put(struct shmring *r, int type, unsigned int epoch,
+		void *part1, int len1, void *part2, int len2, int timeout_ms) {
+    unsigned long long head, tail, need, skip, off;
+    unsigned long long plen=(sizeof(struct shmring_packet)+len1+len2+ALIGN-1)
+	& ~(unsigned long long)(ALIGN-1);
+    struct shmring_packet *p;
+    struct timespec deadline;
+    int seq;
+
+    if (plen>r->size) return SHMRING_TOOBIG;
+    head=r->h->head; /* only the producer writes it */
+    off=head%r->size;
+    skip=(off+plen>r->size)?r->size-off:0; /* filler at the end */
+    need=skip+plen;
+    setdeadline(&deadline,timeout_ms);
+    while (1) { /* backpressure */
+	seq=__atomic_load_n(&r->h->seq,__ATOMIC_ACQUIRE);
+	tail=__atomic_load_n(&r->h->tail,__ATOMIC_ACQUIRE);
+	if (r->size-(head-tail)>=need) break;
+	if (waitfor(r,seq,&deadline)) return SHMRING_TIMEOUT;
+    }
+    if (skip) {
+	p=(struct shmring_packet *)&r->data[off];
+	p->len=skip-sizeof(struct shmring_packet); p->type=SHMRING_SKIP;
+	p->epoch=0;
+	head+=skip; off=0;
+    }
+    p=(struct shmring_packet *)&r->data[off];
+    p->len=len1+len2; p->type=type; p->epoch=epoch;
+    if (len1) memcpy(&p[1],part1,len1);
+    if (len2) memcpy((char *)&p[1]+len1,part2,len2);
+    __atomic_store_n(&r->h->head,head+plen,__ATOMIC_RELEASE);
+    wake(r);
+    return SHMRING_OK;
+}
+
+/* get the next packet; it stays valid until the next call or a release.
+   Waits for up to timeout_ms. */
+int shmring_get(struct shmring *r, int *type, unsigned int *epoch,
+		char **data, int *len, int timeout_ms) {
+    unsigned long long head, tail;
+    struct shmring_packet *p;
+    struct timespec deadline;
+    int seq;
+
+    shmring_release(r);
+    setdeadline(&deadline,timeout_ms);
+    while (1) {
+	seq=__atomic_load_n(&r->h->seq,__ATOMIC_ACQUIRE);
+	tail=r->h->tail; /* only the consumer writes it */
+	head=__atomic_load_n(&r->h->head,__ATOMIC_ACQUIRE);
+	if (head!=tail) {
+	    p=(struct shmring_packet *)&r->data[tail%r->size];
+	    r->held=(sizeof(struct shmring_packet)+p->len+ALIGN-1)
+		& ~(unsigned long long)(ALIGN-1);
+	    if (p->type!=SHMRING_SKIP) break;
+	    shmring_release(r); /* filler */
+	    continue;
+	}
+	if (waitfor(r,seq,&deadline)) return SHMRING_TIMEOUT;
+    }
+    *type=p->type; *epoch=p->epoch;
+    *data=(char *)&p[1]; *len=p->len;
+    return SHMRING_OK;
+}
+
+/* get the packet of stream type for epoch. Packets of earlier epochs are
+   dropped; a packet of a later epoch or another type stays in the ring and
+   leads to SHMRING_EPOCH, like a missing file in directory mode. */
+int shmring_getepoch(struct shmring *r, int type, unsigned int epoch,
+		     char **data, int *len, int timeout_ms) {
+    int t, retval;
+    unsigned int ep;
+
+    while (1) {
+	retval=shmring_get(r,&t,&ep,data,len,timeout_ms);
+	if (retval) return retval;
+	if (t!=type || (int)(ep-epoch)>0) {
+	    r->held=0; /* leave it for whoever wants it */
+	    return SHMRING_EPOCH;
+	}
+	if (ep==epoch) return SHMRING_OK;
+    }
+}
+
+/* hand the space of the current packet back to the producer */
+void shmring_release(struct shmring *r) {
+    if (!r->held) return;
+    __atomic_store_n(&r->h->tail,r->h->tail+r->held,__ATOMIC_RELEASE);
+    r->held=0;
+    wake(r);
+}
+
+void shmring_close(struct shmring *r) {
+    shmring_release(r);
+    munmap(r->h,r->maplen);
+}
@@ -0,0 +1,73 @@
+/* shmring.h:    Part of the quantum key distribution software. Header for
+                 the shared memory transport of epoch packets between chopper,
+		 chopper2, costream and splicer. Description see shmring.c.
+		 Version as of 20261018
+
+ Copyright (C) 2005-2006 Christian Kurtsiefer, National University
+                         of Singapore <christian.kurtsiefer@gmail.com>
+
+ This source code is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Public License as published
+ by the Free Software Foundation; either version 2 of the License,
+ or (at your option) any later version.
+
+ This source code is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ Please refer to the GNU Public License for more details.
+
+ You should have received a copy of the GNU Public License along with
+ this source code; if not, write to:
+ Free Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define SHMRING_PREFIX "shm:" /* marks a ring in place of a directory */
+#define SHMRING_DEFAULTSIZE (64<<20) /* bytes in the data area of a ring */
+#define SHMRING_TIMEOUT_MS 22000 /* as the file wait in the stream programs */
+
+/* return values */
+#define SHMRING_OK 0
+#define SHMRING_TIMEOUT -1 /* no packet, or no room for a packet */
+#define SHMRING_ERROR -2   /* system error, see errno */
+#define SHMRING_TOOBIG -3  /* packet cannot fit into the ring */
+#define SHMRING_EPOCH -4   /* packet of a later epoch or another stream */
+
+/* packet types; the stream types are used as they are */
+#define SHMRING_SKIP 0 /* filler at the end of the data area */
+
+typedef struct shmring_head { /* at the start of the shared segment */
+    unsigned int magic;      /* set once the ring is initialized */
+    unsigned int pad;
+    unsigned long long size; /* bytes in the data area */
+    unsigned long long head; /* bytes ever written by the producer */
+    unsigned long long tail; /* bytes ever released by the consumer */
+    int seq;                 /* changes with every cursor move; futex */
+    int pad2;
+} shh;
+
+typedef struct shmring_packet { /* in front of each packet in the ring */
+    unsigned int len;   /* payload bytes */
+    unsigned int type;  /* stream type or SHMRING_SKIP */
+    unsigned int epoch;
+    unsigned int pad;
+} shp;
+
+typedef struct shmring {
+    struct shmring_head *h;
+    char *data;              /* data area */
+    unsigned long long size;
+    unsigned long long held; /* bytes of the packet handed to the consumer */
+    size_t maplen;
+} shr;
+
+char *shmring_name(char *path);
+int shmring_open(struct shmring *r, char *name, unsigned long long size);
+int shmring_put(struct shmring *r, int type, unsigned int epoch,
+		void *part1, int len1, void *part2, int len2, int timeout_ms);
+int shmring_get(struct shmring *r, int *type, unsigned int *epoch,
+		char **data, int *len, int timeout_ms);
+int shmring_getepoch(struct shmring *r, int type, unsigned int epoch,
+		     char **data, int *len, int timeout_ms);
+void shmring_release(struct shmring *r);
+void shmring_close(struct shmring *r);
@@ -35,7 +35,8 @@
               [-e start epoch] [-q epochnumber] | [-E cmdpipeline]
 	      [-p protocol number]
 	      [-k] [-K]
-	      [-l logfile] [-V verbosity]
+	      [-l logfile] [-V verbosity] [-P statname]
+	      [-C profile]
 
 
   DATA STREAM OPTIONS:
@@ -68,6 +69,14 @@
 		    name (i.e., epoch number) is piped as text into the pipe
 		    specified in this option. If cmdpipe does not exist, it is
 		    created.
+   -d/-D shm:name:  the input packets of stream 3 or 4 are read from the
+                    shared memory ring /dev/shm/name (see shmring.c), as
+		    written by chopper -d shm:name or costream -F shm:name on
+		    the same machine. Older epochs in a ring are skipped.
+   -d/-D/-f/-B log:dir: the packets of that stream go through the segmented
+                    epoch log in directory dir (see epochlog.c). With -k or
+		    -K, input segments are removed once they have been read
+		    completely.
    -k :             if set, type-3 input streams are removed after consumption
 		    if the directory input has been chosen.
    -K :             if set, type-4 input streams are removed after consumption
@@ -99,12 +108,36 @@
                  to 0. The logging verbosity criteria are:
 		 level<0 : no output
 		 0 : epoch (in plaintext hex). This is default.
+   -P statname:  publish the numbers of every epoch in the shared memory
+                 page /dev/shm/statname (see epochstat.c), as costream -P
+		 does: the events of stream 3 as stream-1 events, the
+		 events of stream 4 as stream-2 events, and the key events
+		 as sifted events. With protocols 3 and 4, the page also
+		 carries the counts of the 16 Bell test values of stream 5
+		 (see chsh.c), from which ecd2 -i -S takes the CHSH value.
+		 A leading shm: is ignored.
+
+  PLACEMENT:
+   -C profile:   bind the process to cores and a NUMA node, in the form
+                 cpus[:node[:h]] (see cpupin.c). With h, the packet buffers
+		 and the stream-4 batch are backed by huge pages.
 
 History:
    written first specs 21.8.05 chk
    compiles; 29.8.05chk
    completed -l, -L, -m options 26.11.05chk
    integrated with E91 protocol branch with -b and -B options 29.7.11chk
+   input files in directories are awaited with inotify (epochwait.c)
+   packet buffers grow with the epoch size (growbuf.c)
+   stream 4 is unpacked in blocks of events (bitunpack.c)
+   input streams can come through shared memory rings (shmring.c)
+   streams can go through segmented epoch logs (epochlog.c)
+   input files in a backlog are read ahead (epochwait_backlog)
+   stream-4 blocks come as column-oriented batches (evbatch.c); the out
+   patterns of a block are looked up before they are packed
+   -P publishes the per-epoch numbers and, with protocols 3 and 4, the Bell
+   test counts of stream 5 in shared memory (epochstat.c, chsh.c)
+   -C pins the process to cores, a NUMA node and huge pages (cpupin.c)
 
 ToDo:
    checking -in progress, 
@@ -122,6 +155,15 @@ ToDo:
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include "epochwait.h"
+#include "growbuf.h"
+#include "bitunpack.h"
+#include "evbatch.h"
+#include "shmring.h"
+#include "epochlog.h"
+#include "epochstat.h"
+#include "chsh.h"
+#include "cpupin.h"
 
 
 /* default definitions */
@@ -133,11 +175,14 @@ ToDo:
 #define DEFAULT_STARTEPOCH 0
 #define DEFAULT_EPOCHNUMBER 0 /* How many epochs to consider; 0: eternal */
 #define DEFAULT_PROTOCOL 1 /* standard BB84 */
+#define DEFAULT_WAITFORFILE 550000 /* usec between directory tests */
+#define CATCHUP_DEPTH 4 /* epoch files read ahead when there is a backlog */
+#define MAXFILETESTS 40 /* wait for about 22 seconds for a file to arrive */
 
-/* binary buffers */
-#define RAW3i_SIZE 1500000  /* more than enough? */
-#define RAW4i_SIZE  4000000   /* plenty */
-#define RAW3o_SIZE  4000000   /* should be enough */
+/* binary buffers. initial sizes; they grow with the epoch files */
+#define RAW3i_SIZE 1500000
+#define RAW4i_SIZE  4000000
+#define RAW3o_SIZE  4000000
 
 /* ---------------------------------------------------------------------- */
 
@@ -332,6 +377,13 @@ char *errormessage[] = {
   "error opening target stream 5", 
   "Cannot write header of stream-5",
   "Error writing data to stream-3",
+  "cannot attach shared memory ring",
+  "cannot open epoch log directory", /* 50 */
+  "cannot malloc stream-4 event batch",
+  "Error reading statistics page name.",
+  "cannot create statistics page",
+  "error parsing -C profile (cpus[:node[:h]]).", /* 54 */
+  "cannot apply -C profile.",
 };
 int emsg(int code) {
   fprintf(stderr,"%s\n",errormessage[code]);
@@ -353,7 +405,13 @@ int verbosity_level = DEFAULT_VERBOSITY;
 char fname[5][FNAMELENGTH]={"","","","",""}; /* stream files / cmd pipeline */
 char ffnam[5][FNAMELENGTH+10]; /* combined dir/filenames */
 int typemode[5]={0,0,0,0,0}; /* 0: no mode defined. other types:
-			    1: single file, 2: directory save, ... */
+			    1: single file, 2: directory save,
+			    3: shared memory ring (input streams),
+			    4: epoch log */
+struct shmring ring[2]; /* for input streams in mode 3 */
+struct epochlog elog[5]; /* for streams in mode 4 */
+char statname[FNAMELENGTH]=""; /* -P page, empty if none */
+struct epochstat statpage;
 int killmode[2] = {DEFAULT_KILLMODE3,
 		   DEFAULT_KILLMODE4 }; /* if !=1, delete infile after use */
 FILE* loghandle[3]; /* index 0: cnsmd t3, 1: cnsmd t4, 2: made rawk */
@@ -367,12 +425,14 @@ struct header_3 head5o; /* outfile header for test file */
 
 int expected3bits, expected4bits;
 
+/* load a packet into buffer and check it. With a handle of -1, the buffer
+   already contains a packet of maxsize bytes from a shared memory ring. */
 int get_stream_3(void *buffer, int handle, int maxsize,
 		 struct header_3 *head) {
     int retval;
     int bytenum;
     struct header_3 *h; /* for local storage */
-    retval=read(handle,buffer,maxsize);
+    retval=(handle==-1)?maxsize:read(handle,buffer,maxsize);
     if (!retval) return 20; /* nothing available */
     if (!(retval+1)) return 21; /* other error */
     if (retval<(int)sizeof(struct header_3)) return 22; /* incomplete read */
@@ -394,7 +454,7 @@ int get_stream_4(void *buffer, int handle, int maxsize,
     int bitnum;
     struct header_4* h;
     
-    retval=read(handle,buffer,maxsize);
+    retval=(handle==-1)?maxsize:read(handle,buffer,maxsize);
 
     if (!retval) return 26; /* nothing available */
     if (!(retval+1)) return 27; /* other error */
@@ -426,12 +486,71 @@ void atohex(char* target,unsigned int v) {
     target[9]=0;
 }
 
-/* function to eventually open a stream. params: index, epoch */
-int openstream(int i, unsigned int ep) {
+struct epochwatch watch[2]; /* arrival of stream-3 and -4 input files */
+struct growbuf gbuf3i, gbuf4i, gbuf3o, gbuf5o; /* kept across epochs */
+
+/* make an input buffer large enough for a regular file, with a spare word
+   for the read-ahead of the decoders. Returns 0 or -1. */
+int fit_to_file(struct growbuf *b, int handle) {
+    struct stat stbf;
+    if (fstat(handle,&stbf) || !S_ISREG(stbf.st_mode)) return 0;
+    return growbuf_reserve(b,stbf.st_size/sizeof(unsigned int)+2);
+}
+
+/* function to eventually open a stream. params: index, epoch. For an input
+   ring or log, the packet of the epoch is placed in *data with its length in
+   *len; data can be NULL for other streams. */
+int openstream(int i, unsigned int ep, char **data, int *len) {
     switch (typemode[i]) {
+	case 3: /* input packet from a ring */
+	    switch (shmring_getepoch(&ring[i],3+i,ep,data,len,
+				     SHMRING_TIMEOUT_MS)) {
+		case SHMRING_OK:
+		    break;
+		case SHMRING_EPOCH:
+		    fprintf(stderr,"ring >>%s<< has no epoch %08x.",
+			    fname[i],ep);
+		    return 1;
+		default:
+		    fprintf(stderr,"no epoch %08x in ring >>%s<<.",ep,fname[i]);
+		    return 1;
+	    }
+	    handle[i]=-1;
+	    break;
+	case 4: /* input packet from a log; output is appended later */
+	    if (i>=2) break;
+	    switch (epochlog_read(&elog[i],3+i,ep,data,len,MAXFILETESTS,
+				  DEFAULT_WAITFORFILE)) {
+		case EPOCHLOG_OK:
+		    break;
+		case EPOCHLOG_TIMEOUT:
+		    fprintf(stderr,"no epoch %08x in log >>%s<<.",ep,fname[i]);
+		    return 1;
+		case EPOCHLOG_ERROR:
+		    fprintf(stderr,"log >>%s<< failed (errno %d).",
+			    fname[i],errno);
+		    return 1;
+		default:
+		    fprintf(stderr,"log >>%s<< has no epoch %08x.",
+			    fname[i],ep);
+		    return 1;
+	    }
+	    handle[i]=-1;
+	    break;
 	case 2: /* file in directory */
 	    strncpy(ffnam[i], fname[i], FNAMELENGTH);
 	    atohex(&ffnam[i][strlen(ffnam[i])],ep);
+	    if (i<2) { /* input file; wait until it is complete */
+		switch (epochwait(&watch[i],ffnam[i],MAXFILETESTS,
+				  DEFAULT_WAITFORFILE)) {
+		    case EPOCHWAIT_ERROR: case EPOCHWAIT_TIMEOUT:
+			fprintf(stderr,"no file >>%s<< (errno %d).",
+				ffnam[i],errno);
+			return 1;
+		}
+		/* read the next files ahead if there is a backlog */
+		epochwait_backlog(&watch[i],ffnam[i],CATCHUP_DEPTH);
+	    }
 	    handle[i]=open(ffnam[i],openmode[i],FILE_PERMISSIONS);
 	    if(-1==handle[i]) {
 		fprintf(stderr,"handle %d named >>%s<< failed.",
@@ -449,17 +568,22 @@ int main (int argc, char *argv[]) {
     int proto_index = DEFAULT_PROTOCOL; /* defines which proto is used */
     long long int se_in; /* for entering startepoch both in hex and decimal */
     char *buffer3i, *buffer4i, *buffer3o, *buffer5o; /* stream buffers */
+    int ringlen; /* size of an input packet or buffer */
 
     int realsize4i; /* for processing stream 4 */
     unsigned int *pointer4;
-    unsigned int diff4,tindex,opatt4;
-    unsigned int readword4,emergency_break,pattern4,patternmask4,diff4_bitmask;
-    int resbits4;
-    int type4bitwidth,type4datawidth,processed_4events,bitstoread4;
+    unsigned long long tindex, k3; /* stream-2 index, bit position in 3i */
+    struct bitstream bits4; /* for unpacking stream 4 */
+    struct evbatch ev4; /* indices and patterns of a block of stream 4 */
+    unsigned int dec4[BITUNPACK_BLOCK]; /* out patterns of the block */
+    int n4,j4,processed_4events;
     int processed_testevents; /* for type 5 events */
     int processed_keyevents; /* for type 3 events */
+    unsigned int bell[CHSH_PATTERNS]; /* Bell test counts of the epoch */
+    unsigned int sv[EPOCHSTAT_QUANTITIES]; /* for the statistics page */
+    int bellcount; /* count the test values for -P */
 
-    int k3i,n3i,type3ibits,u3i;
+    int k3i,n3i,type3ibits;
     unsigned int pattern3i, patternmask3i;
     unsigned int *pointer3i;
     int p3mask1[32],p3sh1[32],p3mask2[32],p3sh2[32],p3sh0[32],p3dec[32];
@@ -475,14 +599,13 @@ int main (int argc, char *argv[]) {
     unsigned int *outbuf3o, *lookup_table, *outbuf5o;
     
     int opt,i,j,retval;
-    unsigned int ju; /* wherever it is needed */
 
     int cmdmode = 0;  /* pipeline mode if !=0 */
     FILE *cmdhandle = NULL;
     struct stat cmdstat; /* for probing pipe */
 
     opterr=0; /* be quiet when there are no options */
-    while ((opt=getopt(argc, argv, "V:i:d:I:D:o:f:e:q:p:kKl:E:L:m:b:B:")) != EOF) {
+    while ((opt=getopt(argc, argv, "V:i:d:I:D:o:f:e:q:p:kKl:E:L:m:b:B:P:C:")) != EOF) {
 	i=0; /* for setinf names/modes commonly */
 	switch (opt) {
 	    case 'V': /* set verbosity level */
@@ -503,6 +626,8 @@ int main (int argc, char *argv[]) {
 		fname[j][FNAMELENGTH-1]=0;   /* security termination */
 		if (typemode[j]) return -emsg(5+j); /* already defined mode */
 		typemode[j]=(i&4?2:1);
+		if (j<2 && (i&4) && shmring_name(fname[j])) typemode[j]=3;
+		if ((i&4) && epochlog_name(fname[j])) typemode[j]=4;
 		break;
 	    case 'B': i++; /* stream 5 directory */
 	    case 'b':   /* stream 5 outfile */
@@ -510,6 +635,7 @@ int main (int argc, char *argv[]) {
 		fname[4][FNAMELENGTH-1]=0;   /* security termination */
 		if (typemode[4]) return -emsg(44); /* already defined mode */
 		typemode[4]=(i&1?2:1);
+		if ((i&1) && epochlog_name(fname[4])) typemode[4]=4;
 		break;
 	    case 'e': /* read startepoch */
 		if (1!=sscanf(optarg,"%lli",&se_in)) return -emsg(8);
@@ -537,6 +663,17 @@ int main (int argc, char *argv[]) {
 		    return -emsg(12);
 		logfname[i][FNAMELENGTH-1]=0;  /* security termination */
 		break;
+	    case 'P': /* statistics page */
+		if (sscanf(optarg,FNAMFORMAT,statname) != 1)
+		    return -emsg(52);
+		statname[FNAMELENGTH-1]=0;  /* security termination */
+		break;
+	    case 'C': /* cores, node and huge pages */
+		switch (cpupin_setup(optarg)) {
+		    case CPUPIN_SYNTAX: return -emsg(54);
+		    case CPUPIN_ERROR: return -emsg(55);
+		}
+		break;
 	}
     }
 
@@ -548,10 +685,15 @@ int main (int argc, char *argv[]) {
     }
 
     /* allocate input and output buffers */
-    if (!(buffer3i=(char*)malloc(RAW3i_SIZE))) return -emsg(13);
-    if (!(buffer4i=(char*)malloc(RAW4i_SIZE))) return -emsg(14);
-    if (!(buffer3o=(char*)malloc(RAW3o_SIZE))) return -emsg(15);
-    if (!(buffer5o=(char*)malloc(RAW3o_SIZE))) return -emsg(45);
+    if (growbuf_init(&gbuf3i,RAW3i_SIZE/sizeof(unsigned int)))
+	return -emsg(13);
+    if (growbuf_init(&gbuf4i,RAW4i_SIZE/sizeof(unsigned int)))
+	return -emsg(14);
+    if (growbuf_init(&gbuf3o,RAW3o_SIZE/sizeof(unsigned int)))
+	return -emsg(15);
+    if (evbatch_init(&ev4,BITUNPACK_BLOCK)) return -emsg(51);
+    if (growbuf_init(&gbuf5o,RAW3o_SIZE/sizeof(unsigned int)))
+	return -emsg(45);
 
     /* prepare protocol specific stuff */
     mostbits = proto_table[proto_index].transmittedbits;
@@ -563,6 +705,7 @@ int main (int argc, char *argv[]) {
     pattern5mask = (1<<type5odatawidth)-1;
     ignorepatternmask = (1<<mostbits); /* for extracting the ignore tag */
     testbitmask = ignorepatternmask<<1; /* for deciding which file to fill */
+    bellcount = statname[0] && (type5odatawidth==CHSH_BITS);
     
     expected3bits=proto_table[proto_index].expected3ibits;
     expected4bits=proto_table[proto_index].expected4ibits;
@@ -574,7 +717,6 @@ int main (int argc, char *argv[]) {
 
     type3ibits=expected3bits;
     patternmask3i=(1<<type3ibits)-1;
-    pointer3i=(unsigned int *)(buffer3i+sizeof(struct header_3));
     for (i=0;i<32;i++) { /* populate shift mask index */
 	p3mask1[i]=(1<<(32-i))-1;
 	p3sh1[i]=type3ibits-32+i;
@@ -600,12 +742,31 @@ int main (int argc, char *argv[]) {
 		handle[i]=open(fname[i],openmode[i],FILE_PERMISSIONS);
 		if(-1==handle[i]) return -emsg(17+i);
 		break;
+	    case 2: /* watch input directories for arriving files */
+		if (i<2) epochwait_init(&watch[i],fname[i]);
+		break;
+	    case 3: /* shared memory ring */
+		if (shmring_open(&ring[i],shmring_name(fname[i]),
+				 SHMRING_DEFAULTSIZE)) return -emsg(49);
+		break;
+	    case 4: /* epoch log */
+		if (epochlog_open(&elog[i],epochlog_name(fname[i]),i==2))
+		    return -emsg(50);
+		break;
 	}
     }
     if (typemode[4]==1) { /* open steam-5 output file */
 		handle[4]=open(fname[4],openmode[4],FILE_PERMISSIONS);
 		if(-1==handle[4]) return -emsg(46);
     }	
+    if (typemode[4]==4) { /* stream-5 output log */
+	if (epochlog_open(&elog[4],epochlog_name(fname[4]),1))
+	    return -emsg(50);
+    }
+    if (statname[0] &&
+	epochstat_create(&statpage,shmring_name(statname)?
+			 shmring_name(statname):statname))
+	return -emsg(53);
 
     if (cmdmode) { /* load initial epoch */
 	if (1!=fscanf(cmdhandle,"%x",&current_ep)) return -emsg(42);
@@ -615,19 +776,38 @@ int main (int argc, char *argv[]) {
     /* main digest loop */
     do {
 	/* eventually open input stream 3 */
-	if (openstream(0,current_ep)) return -emsg(17);
+	if (openstream(0,current_ep,&buffer3i,&ringlen)) return -emsg(17);
 	/* load instream-3 */
-        retval=get_stream_3(buffer3i,handle[0],RAW3i_SIZE,&head3i);
+	if (typemode[0]<3) {
+	    if (fit_to_file(&gbuf3i,handle[0])) return -emsg(13);
+	    buffer3i=(char *)gbuf3i.buf;
+	    ringlen=gbuf3i.size*sizeof(unsigned int);
+	}
+        retval=get_stream_3(buffer3i,handle[0],ringlen,&head3i);
 	if (retval) return -emsg(retval);
+	pointer3i=(unsigned int *)(buffer3i+sizeof(struct header_3));
 	/* eventually close input stream 3 */
 	if(typemode[0]==2) close(handle[0]);
 	/* consistency_check */
 	stream3imaxindex=(head3i.length*head3i.bitsperentry+31)/32-1;
 	/* eventually open input stream 4 */
-	if (openstream(1,current_ep)) return -emsg(18);
+	if (openstream(1,current_ep,&buffer4i,&ringlen)) return -emsg(18);
 	/* load instream-4 */
-	retval=get_stream_4(buffer4i,handle[1],RAW4i_SIZE,&head4i,&realsize4i);
+	if (typemode[1]<3) {
+	    if (fit_to_file(&gbuf4i,handle[1])) return -emsg(14);
+	    buffer4i=(char *)gbuf4i.buf;
+	    ringlen=gbuf4i.size*sizeof(unsigned int);
+	}
+	retval=get_stream_4(buffer4i,handle[1],ringlen,&head4i,&realsize4i);
 	if (retval) return -emsg(retval);
+	/* room for the output if all events end up in one stream */
+	if (growbuf_reserve(&gbuf3o,
+			    (head4i.length*type3odatawidth+31)/32+2))
+	    return -emsg(15);
+	if (growbuf_reserve(&gbuf5o,
+			    (head4i.length*type5odatawidth+31)/32+2))
+	    return -emsg(45);
+	buffer3o=(char *)gbuf3o.buf; buffer5o=(char *)gbuf5o.buf;
 	/* eventually close input stream 4 */
 	if(typemode[1]==2) close(handle[1]);
 	/* consistency_check */
@@ -649,17 +829,13 @@ int main (int argc, char *argv[]) {
 	/* prepare parsing instream-4 elements */
 	tindex=0; /* initial value */
 	pointer4=(unsigned int *)(buffer4i+sizeof(struct header_4));
-	ju=0;readword4=pointer4[ju++]; /* prepare read buffer */
-	resbits4=32;
-	type4bitwidth=head4i.timeorder; type4datawidth=head4i.basebits;
-	bitstoread4=type4bitwidth+type4datawidth;
-	emergency_break=
-	    (realsize4i-sizeof(struct header_4))/sizeof(unsigned int);
-	patternmask4=(1<<type4datawidth)-1;
-	diff4_bitmask=(1<<type4bitwidth)-1;
+	bitunpack_init(&bits4,pointer4,
+		       (realsize4i-sizeof(struct header_4))/sizeof(unsigned int),
+		       head4i.timeorder,head4i.basebits);
 	processed_4events=0; /* processed events */
 	processed_testevents=0; /* test events */
 	processed_keyevents=0; /* key events */
+	memset(bell,0,sizeof(bell));
 
         sendword3=0; sendword5=0;
 	outbuf3o=(unsigned int *)buffer3o;
@@ -667,93 +843,69 @@ int main (int argc, char *argv[]) {
 	resbits3o=32;index3o=0;resbits5o=32;index5o=0;
 
 
-	do { /* go through buffer */
-	    if (resbits4>=bitstoread4) {
-		diff4=(readword4>>(resbits4-bitstoread4));
-		resbits4-=bitstoread4;
-		if (!resbits4) {readword4=pointer4[ju++];resbits4=32;}
-	    } else {
-		resbits4=bitstoread4-resbits4;
-		diff4=readword4<<resbits4;
-		readword4=pointer4[ju++];
-		resbits4=32-resbits4;
-		diff4=(diff4 | (readword4>>resbits4));
-	    }
-	    pattern4= (diff4 & patternmask4);
-	    diff4>>=type4datawidth;
-	    /* we have a time difference word now in tdiff */
-	    if (diff4 &= diff4_bitmask) { /* check for exception */
-		/* test for end of stream */
-		if (diff4==1) break; /* exit digest routine for this stream */
-	    } else {
-		/* read in complete difference */
-		diff4=readword4<<(32-resbits4);
-		readword4=pointer4[ju++];
-                /* catch shift 'feature' - normal */
-		if (resbits4 & 0x1f) diff4 |= readword4>>resbits4;
-		opatt4=pattern4;pattern4=diff4&patternmask4;
-		diff4 >>=type4datawidth;
-		diff4 |=  (opatt4<<(32-type4datawidth));
-	    }
-	    /* we now have a valid difference */
-	    tindex +=diff4-2; /* correction for index compensation */
-
-
-	    /* extract pattern from 3i */
-	    k3i=tindex*type3ibits;n3i=k3i%32;/* shift info sourceword */
-	    if ( (u3i=k3i/32)>stream3imaxindex) return -emsg(37);
-	    if (p3dec[n3i]) { /* contained in one word */
-		pattern3i=(pointer3i[k3i/32]>>p3sh0[n3i])
-			       & patternmask3i;
-	    } else {
-		pattern3i  = (pointer3i[k3i/32]  & p3mask1[n3i]) << p3sh1[n3i];
-		pattern3i |= (pointer3i[k3i/32+1]& p3mask2[n3i]) >> p3sh2[n3i];
+	/* go through buffer in blocks of events */
+	while ((n4=evbatch_type4(&ev4,&bits4,&tindex,BITUNPACK_BLOCK))) {
+	    for (j4=0;j4<n4;j4++) {
+		/* extract pattern from 3i at the index of the event */
+		k3=ev4.t[j4]*type3ibits;
+		if ((long long)(k3/32)>stream3imaxindex) return -emsg(37);
+		k3i=k3;n3i=k3i%32;/* shift info sourceword */
+		if (p3dec[n3i]) { /* contained in one word */
+		    pattern3i=(pointer3i[k3i/32]>>p3sh0[n3i])
+				   & patternmask3i;
+		} else {
+		    pattern3i  = (pointer3i[k3i/32]  & p3mask1[n3i]) << p3sh1[n3i];
+		    pattern3i |= (pointer3i[k3i/32+1]& p3mask2[n3i]) >> p3sh2[n3i];
+		}
+		/* out pattern with the one from stream 4 */
+		dec4[j4]=lookup_table[pattern3i | (ev4.p[j4]<<type3ibits)];
 	    }
-	    /* we now have the pattern in pattern3i */
+	    if (bellcount) chsh_count(bell,dec4,n4,testbitmask);
 
 	    /* type-3 and type-5 stream filling */
-	    decpattern=lookup_table[pattern3i 
-				| (pattern4<<type3ibits)]; /* out pattern */
-	    if (!(decpattern & ignorepatternmask)) { /* don't ignore */
-		if (decpattern & testbitmask) { /* we have a stream-5 event */
-		    pattern5o = decpattern & pattern5mask;
-		    if (resbits5o>=type5odatawidth) {
-			sendword5 |= (pattern5o << (resbits5o-type5odatawidth));
-			resbits5o = resbits5o-type5odatawidth;
-			if (resbits5o==0) { 
+	    for (j4=0;j4<n4;j4++) {
+		decpattern=dec4[j4];
+		if (!(decpattern & ignorepatternmask)) { /* don't ignore */
+		    if (decpattern & testbitmask) { /* we have a stream-5 event */
+			pattern5o = decpattern & pattern5mask;
+			if (resbits5o>=type5odatawidth) {
+			    sendword5 |= (pattern5o << (resbits5o-type5odatawidth));
+			    resbits5o = resbits5o-type5odatawidth;
+			    if (resbits5o==0) { 
+				outbuf5o[index5o++]=sendword5;
+				sendword5=0;resbits5o=32;
+			    }
+			} else {
+			    resbits5o=type5odatawidth-resbits5o;
+			    sendword5 |= (pattern5o >> resbits5o);
+
 			    outbuf5o[index5o++]=sendword5;
-			    sendword5=0;resbits5o=32;
+			    resbits5o=32-resbits5o;
+			    sendword5=pattern5o << resbits5o;
 			}
-		    } else {
-			resbits5o=type5odatawidth-resbits5o;
-			sendword5 |= (pattern5o >> resbits5o);
-
-			outbuf5o[index5o++]=sendword5;
-			resbits5o=32-resbits5o;
-			sendword5=pattern5o << resbits5o;
-		    }
-		    processed_testevents++;
-		} else { /* we have a stream-3 event */
-		    pattern3o = decpattern & pattern3mask;
-		    if (resbits3o>=type3odatawidth) {
-			sendword3 |= (pattern3o << (resbits3o-type3odatawidth));
-			resbits3o = resbits3o-type3odatawidth;
-			if (resbits3o==0) { 
+			processed_testevents++;
+		    } else { /* we have a stream-3 event */
+			pattern3o = decpattern & pattern3mask;
+			if (resbits3o>=type3odatawidth) {
+			    sendword3 |= (pattern3o << (resbits3o-type3odatawidth));
+			    resbits3o = resbits3o-type3odatawidth;
+			    if (resbits3o==0) { 
+				outbuf3o[index3o++]=sendword3;
+				sendword3=0;resbits3o=32;
+			    }
+			} else {
+			    resbits3o=type3odatawidth-resbits3o;
+			    sendword3 |= (pattern3o >> resbits3o);
 			    outbuf3o[index3o++]=sendword3;
-			    sendword3=0;resbits3o=32;
+			    resbits3o=32-resbits3o;
+			    sendword3=pattern3o << resbits3o;
 			}
-		    } else {
-			resbits3o=type3odatawidth-resbits3o;
-			sendword3 |= (pattern3o >> resbits3o);
-			outbuf3o[index3o++]=sendword3;
-			resbits3o=32-resbits3o;
-			sendword3=pattern3o << resbits3o;
+			processed_keyevents++;
 		    }
-		    processed_keyevents++;
 		}
 	    }
-	    processed_4events++;
-	} while (ju<=emergency_break); /* make sure to eat up rest properly */
+	    processed_4events+=n4;
+	}
 	
 
 	/* finalize outstream-3 */
@@ -761,14 +913,20 @@ int main (int argc, char *argv[]) {
 	if (resbits3o<32) outbuf3o[index3o++]=sendword3; /* last word */
 	
 	/* eventually open output stream 3 */
-	if (openstream(2,current_ep)) return -emsg(19);
+	if (openstream(2,current_ep,NULL,NULL)) return -emsg(19);
 	/* write header 3 */
-	retval= write(handle[2],&head3o,sizeof(struct header_3));
-	if (retval!=sizeof(struct header_3)) 
-	    return -emsg(32); /* write head err */
 	i=index3o*sizeof(unsigned int);
-	retval=write(handle[2],outbuf3o,i);
-	if (retval!=i) return -emsg(33); /* write error buffer */
+	if (typemode[2]==4) { /* append to the log */
+	    if (epochlog_append(&elog[2],3,current_ep,&head3o,
+				sizeof(struct header_3),outbuf3o,i))
+		return -emsg(33);
+	} else {
+	    retval= write(handle[2],&head3o,sizeof(struct header_3));
+	    if (retval!=sizeof(struct header_3)) 
+		return -emsg(32); /* write head err */
+	    retval=write(handle[2],outbuf3o,i);
+	    if (retval!=i) return -emsg(33); /* write error buffer */
+	}
 	/* eventually close stream 3 */
 	if (typemode[2]==2) close(handle[2]);
 
@@ -777,9 +935,14 @@ int main (int argc, char *argv[]) {
 	if (resbits5o<32) outbuf5o[index5o++]=sendword5; /* last word */
 	
 	/* eventually open output stream 5 */
-	if (openstream(4,current_ep)) return -emsg(46);
+	if (openstream(4,current_ep,NULL,NULL)) return -emsg(46);
 	/* eventually write header+data of stream 5 */
-	if (typemode[4]) {
+	if (typemode[4]==4) { /* append to the log */
+	    if (epochlog_append(&elog[4],5,current_ep,&head5o,
+				sizeof(struct header_3),outbuf5o,
+				index5o*sizeof(unsigned int)))
+		return -emsg(48);
+	} else if (typemode[4]) {
 	    retval= write(handle[4],&head5o,sizeof(struct header_3));
 	    if (retval!=sizeof(struct header_3)) 
 		return -emsg(47); /* write head err */
@@ -789,11 +952,25 @@ int main (int argc, char *argv[]) {
 	}  
 	/* eventually close stream 3 */
 	if (typemode[4]==2) close(handle[4]);
+
+	/* statistics page */
+	if (statname[0]) {
+	    sv[EPOCHSTAT_EVENTS1]=head3i.length;
+	    sv[EPOCHSTAT_EVENTS2]=processed_4events;
+	    sv[EPOCHSTAT_SIFTED]=processed_keyevents;
+	    sv[EPOCHSTAT_ACCIDENTAL]=0; sv[EPOCHSTAT_TRUE]=0;
+	    epochstat_put(&statpage,current_ep,head4i.timeorder,0,sv,0.,
+			  bellcount?bell:NULL);
+	}
 	
 	/* eventually remove instreams */
 	for (i=0;i<2;i++) if (killmode[i] && (typemode[i]==2)) {
 	    if (unlink(ffnam[i])) return -emsg(34+i);
 	}
+	for (i=0;i<2;i++) if (killmode[i] && (typemode[i]==4)) {
+	    /* segments before the current one */
+	    if (epochlog_drop(&elog[i],current_ep)) return -emsg(34+i);
+	}
 	
        /* do logging */
 	for (i=0;i<3;i++) {
@@ -828,9 +1005,14 @@ int main (int argc, char *argv[]) {
     for (i=1;i<3;i++) 
 	if (1== (typemode[i])) close(handle[i]); /* single file */
     if (1==typemode[4]) close(handle[4]);
+    for (i=0;i<2;i++) if (typemode[i]==3) shmring_close(&ring[i]);
+    for (i=0;i<5;i++) if (typemode[i]==4) epochlog_close(&elog[i]);
+    if (statname[0]) epochstat_close(&statpage); /* page stays */
 
     for (i=0;i<3;i++) if (logfname[i][0]) fclose(loghandle[i]);
     /* free buffers */
-    free(buffer3i);free(buffer4i);free(buffer3o);free(buffer5o);
+    growbuf_free(&gbuf3i); growbuf_free(&gbuf4i);
+    growbuf_free(&gbuf3o); growbuf_free(&gbuf5o);
+    evbatch_free(&ev4);
     return 0;
 }
@@ -39,15 +39,19 @@
 		  [-m messagesource -M messagedestintion ]
 		  [-p portnumber]
 		  [-v verbosity]
+		  [-C profile]
 
  parameters:
   
-  -d srcdir:        source directory for files to be transferred
+  -d srcdir:        source directory for files to be transferred. With the
+                    form log:dir, the packets are taken from the segmented
+		    epoch log in dir (see epochlog.c) by their epoch.
   -c commandpipe:   where to create a fifo in the file system to
                     listen to files to be transferred. the path has to be
 		    absolute.
   -t target:        IP address of target machine
-  -D destdir:       destination directory
+  -D destdir:       destination directory. With the form log:dir, received
+                    packets are appended to the segmented epoch log in dir.
   -l notify:        if a packet arrives and has been saved, a notification
                     (the file name itself) is sent to the file or pipe named
 		    in the parameter of this option
@@ -55,7 +59,8 @@
                     paremeter. By default, the system listens on all ip
 		    addresses of the machine.
   -k:               killoption. If this is activated, a file gets destroyed in
-                    the source directory after it has been sent.
+                    the source directory after it has been sent. For a source
+		    log, segments are removed once they have been sent.
   -m src:           message source pipe. this opens a local fifo in the file
                     tree where commands can be tunneled over to the other side.
   -M dest:          if a command message is sent in from the other side, it
@@ -69,6 +74,9 @@
 		    3: include file error events
   -e ec_in_pipe:    pipe for receiving packets from errorcorrecting demon
   -E ec_out_pipe:   pipe to send packes to the error correcting deamon
+  -C profile:       cores and NUMA node for this process, and huge pages for
+                    the send and receive buffers, in the form
+		    cpus[:node[:h]] (see cpupin.c).
 
 		    
   momentarily, the communication is implemented via tcp/ip packets. the program
@@ -90,6 +98,8 @@
 History: first test seems to work 6.9.05chk
   stable version 16.9. started modifying for errorcorrecting packets
   modified for closing many open files feb4 06 chk
+  source and destination can be segmented epoch logs (epochlog.c)
+  -C placement on cores, NUMA node and huge pages (cpupin.c)
 
 To Do:
 - use udp protocol instead of tcp, and/or allow for setting more robust
@@ -111,6 +121,8 @@ To Do:
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <sys/select.h>
+#include "epochlog.h"
+#include "cpupin.h"
 
 #undef DEBUG
 
@@ -153,12 +165,15 @@ char fname[10][FNAMELENGTH]={"","","","","","","","","",""}; /* stream files */
 char ffnam[10][FNAMELENGTH+10], ffn2[FNAMELENGTH+10];
 char f3tmpname [FNAMELENGTH+10]; /* stores temporary file name */
 int killmode = DEFAULT_KILLMODE; /* if !=1, delete infile after use */
+struct epochlog srclog, destlog; /* if source/destination are logs */
+int srclogmode = 0, destlogmode = 0;
+char *logpacket; /* packet to be sent from the source log */
 int handle[10]; /* global handles for packet streams */
 FILE *debuglog;
 
 
 /* error handling */
-char *errormessage[76] = {
+char *errormessage[79] = {
   "No error.",
   "error parsing source directory name", /* 1 */
   "error parsing command socket name",
@@ -222,7 +237,7 @@ char *errormessage[76] = {
   "transferred larger than buffer", /* 60 */
   "socket probably closed.",
   "reached end of command pipe??????",
-  "cannot remove source file."
+  "cannot remove source file.",
   "cannot set reuseaddr socket option",
   "error parsing port number", /* 65 */
   "port number out of range",
@@ -235,6 +250,9 @@ char *errormessage[76] = {
   "received packet longer than erc buffer.",
   "error reading erc packet",
   "error renaming target file", /* 75 */
+  "cannot open epoch log directory",
+  "error parsing -C profile (cpus[:node[:h]])",
+  "cannot apply -C profile",
 };
 
 int emsg(int code) {
@@ -310,7 +328,7 @@ int main(int argc, char *argv[]) {
     
     /* parsing options */
     opterr=0; /* be quiet when there are no options */
-    while ((opt=getopt(argc, argv, "d:c:t:D:l:s:km:M:p:e:E:")) != EOF) {
+    while ((opt=getopt(argc, argv, "d:c:t:D:l:s:km:M:p:e:E:C:")) != EOF) {
 	i=0; /* for setinf names/modes commonly */
 	switch (opt) {
 	    case 'E': i++;
@@ -336,14 +354,22 @@ int main(int argc, char *argv[]) {
 		if (sscanf(optarg,"%d",&portnumber)!=1) return -emsg(65);
 		if ((portnumber<MINPORT) || (portnumber>MAXPORT)) return -emsg(66);
 		break;
+	    case 'C': /* cores, node and huge pages */
+		switch (cpupin_setup(optarg)) {
+		    case CPUPIN_SYNTAX: return -emsg(77);
+		    case CPUPIN_ERROR: return -emsg(78);
+		}
+		break;
 	}
     }
 
     /* check argument completeness */
     for (i=0;i<5;i++) if (typemode[i]==0 ) return -emsg(i+67);
     if (typemode[6]!=typemode[7]) return -emsg(15); /* not same message mode */
+    if (epochlog_name(fname[0])) srclogmode=1;
+    if (epochlog_name(fname[3])) destlogmode=1;
     /* add directory slash for sourcefile if missing */
-    if (fname[0][strlen(fname[0])-1]!='/') {
+    if (!srclogmode && fname[0][strlen(fname[0])-1]!='/') {
 	strncat(fname[0],"/",FNAMELENGTH);
 	fname[0][FNAMELENGTH-1]=0;
     }
@@ -436,15 +462,25 @@ int main(int argc, char *argv[]) {
     if (listen(recskt,RECEIVE_BACKLOG)) return -emsg(32);
 
     /* try to test directory existence */
-    if (stat(fname[0],&dirstat)) return -emsg(27); /* src directory */
-    if ((dirstat.st_mode & S_IFMT)!=S_IFDIR) return -emsg(28); /* no dir */
+    if (srclogmode) {
+	if (epochlog_open(&srclog,epochlog_name(fname[0]),0))
+	    return -emsg(76);
+    } else {
+	if (stat(fname[0],&dirstat)) return -emsg(27); /* src directory */
+	if ((dirstat.st_mode & S_IFMT)!=S_IFDIR) return -emsg(28); /* no dir */
+    }
 
-    if (stat(fname[3],&dirstat)) return -emsg(29); /* src directory */
-    if ((dirstat.st_mode & S_IFMT)!=S_IFDIR) return -emsg(30); /* no dir */ 
+    if (destlogmode) {
+	if (epochlog_open(&destlog,epochlog_name(fname[3]),1))
+	    return -emsg(76);
+    } else {
+	if (stat(fname[3],&dirstat)) return -emsg(29); /* src directory */
+	if ((dirstat.st_mode & S_IFMT)!=S_IFDIR) return -emsg(30); /* no dir */ 
+    }
 
     /* try to get send/receive buffers */
-    filebf=(char *)malloc(LOC_BUFSIZE);
-    recbf=(char *)malloc(LOC_BUFSIZE);
+    filebf=(char *)cpupin_alloc(LOC_BUFSIZE);
+    recbf=(char *)cpupin_alloc(LOC_BUFSIZE);
     ercbf=(char *)malloc(LOC_BUFSIZE2);
     if (!filebf || !recbf || !ercbf ) return -emsg(41);
     ehead = (struct errc_header*)ercbf; /* for header */
@@ -617,6 +653,13 @@ int main(int argc, char *argv[]) {
 			    fprintf(debuglog,"got file via tcp, len:%d\n",
 				    rhead.length);fflush(debuglog);
 #endif
+			    if (destlogmode) { /* stream type from the tag */
+				if (epochlog_append(&destlog,
+					 ((unsigned int *)recbf)[0] & 0xff,
+					 rhead.epoch,recbf,rhead.length,
+					 NULL,0)) return -emsg(44);
+				goto notify;
+			    }
 			    /* open target file */
 			    strncpy(ffnam[3],fname[3],FNAMELENGTH);
 			    atohex(&ffnam[3][strlen(ffnam[3])],rhead.epoch);
@@ -643,6 +686,7 @@ int main(int argc, char *argv[]) {
 				fprintf(stderr,"rename errno: %d ",errno);
 				return -emsg(75);
 			    }
+			notify:
 			    /* send notification */
 			    loghandle=fopen(fname[4],"a");
 			    if (!loghandle) return -emsg(49);
@@ -750,6 +794,17 @@ int main(int argc, char *argv[]) {
 		oldsrcepoch=srcepoch;
 		fprintf(cmdinhandle,"cmdin: %s\n",transfername);
 		fflush(cmdinhandle);
+		if (srclogmode) { /* packet from the log, sent in place */
+		    if (epochlog_read(&srclog,-1,srcepoch,&logpacket,&retval,
+				      0,0)) {
+			if (ignorefileerror) { goto parseescape;
+			} else { return -emsg(50);}
+		    }
+		    if (retval > LOC_BUFSIZE) return -emsg(60);
+		    srcfilestat.st_size=retval;
+		    cmdmode=1;
+		    goto parseescape;
+		}
 		strncpy(ftnam,fname[0],FNAMELENGTH-1);
 		ftnam[FNAMELENGTH-1]=0;
 		strncat(ftnam,transfername,FNAMELENGTH-1);
@@ -837,7 +892,11 @@ int main(int argc, char *argv[]) {
 			switch (shead.type) {
 			    case 0: cmdmode=0; /* file has been sent */
 				/* remove source file */
-				if (killmode) {
+				if (killmode && srclogmode) {
+				    /* segments before this one */
+				    if (epochlog_drop(&srclog,srcepoch))
+					return -emsg(63);
+				} else if (killmode) {
 				    if (unlink(ftnam)) return -emsg(63);
 				}
 				sendbf=NULL; /* nothing to be sent from this */
@@ -862,6 +921,13 @@ int main(int argc, char *argv[]) {
 		writemode=1;writeindex=0; sendbf=message;
 		continue; /* skip other tests for writing */
 	    } 
+	    if (cmdmode && !writemode && srclogmode) {
+		shead.type=0; shead.length=srcfilestat.st_size;
+		shead.epoch=srcepoch;
+		writemode=1; writeindex=0; /* indicate header writing */
+		sendbf=logpacket;
+		continue; /* skip other test for writing */
+	    }
 	    if (cmdmode && !writemode) {
 		/* read source file */
 		srcfile=open(ftnam,READFILEMODE);
@@ -937,7 +1003,8 @@ int main(int argc, char *argv[]) {
     if (typemode[8]) { close(ercinhandle); close(keepawake_h3); }
     if (typemode[9])  close(ercouthandle);
     /* free buffer */
-    free(recbf); free(filebf); free(ercbf);
+    cpupin_free(recbf,LOC_BUFSIZE); cpupin_free(filebf,LOC_BUFSIZE);
+    free(ercbf);
     fclose(cmdinhandle);
 
     fclose(debuglog);
@@ -98,12 +98,15 @@
 		      (default). for opt=2, all bits are zero.
    -d s1,s2,s3,s4:    add skew times to individual detectors. The supplied
                       values must be comma-separated and identify corrections
- 		      in multiples of 125 ps for each detector. This skew
- 		      is added to the timing information in case only a single
- 		      detector fires. Values can be positive or negative.
- 		      This option is only executed if the -A option is active
- 		      in order to minimize processing in the central timing
- 		      routine.
+ 		      for each detector. This skew is added to the timing
+ 		      information in case only a single detector fires.
+ 		      Values can be positive or negative. The values are
+ 		      added to the 64 bit output word as they are, i.e. in
+ 		      units of 125 ps/32768; this is what the program always
+ 		      did, although this text used to say 125 ps. As before,
+ 		      this option is only executed if the -A option is active.
+ 		      Events which the skew moves in front of earlier ones
+ 		      are put back into time order.
    -D s1,s2,s3,s4,s5,s6,s7,s8 : Same as the -d option, but this time for
                       taking care of up to 8 detectors. Detector assignment:
                       line 1:    det 1
@@ -114,6 +117,9 @@
 		      line 2-3:  det 6
 		      line 3-4:  det 7
 		      line 4-1:  det 8
+                      As before, only the skews of detectors 1 to 4 are
+ 		      applied; values for detectors 5 to 8 are accepted and
+ 		      ignored.
    -u                 usb flush mode is on. If no events were detected
                       during one periode, the flush option is activated
 
@@ -121,7 +127,20 @@
                       If not specified, the default is /dev/ioboards/timestamp0
    -Y y1,y2,y3,y4:    ignores detector events if they fall within a certain time
                       of the last event seen by a particular detector. The dead times
-		      y1...y4 are measured in multiples of 125ps.
+		      y1...y4 are measured in multiples of 125ps. Up to 8 values
+		      can be given, with the detector assignment of -D. Only
+		      executed if the -A option is active.
+		      Skew and dead time are applied to each batch of events
+		      in a separate pass after timing reconstruction (see
+		      evcorrect.c in the remotecrypto directory).
+   -C profile:        run on the cores and NUMA node given in profile, in the
+                      form cpus[:node[:h]] (see cpupin.c in the remotecrypto
+		      directory). The device is opened after that, so the
+		      driver allocates the DMA buffer on that node, and its
+		      mapping is set up completely at start instead of page
+		      by page. The DMA buffer belongs to the driver and
+		      cannot come from huge pages; h is accepted for a
+		      common profile but has no effect here.
 
    Signals:
    SIGUSR1:   enable data acquisition. This causes the inhibit flag
@@ -170,6 +189,13 @@
    - cleanup of usb flush option call
    - added forced dead times for detectors with -Y option 15.7.19chk
    - hopefully fixed dead time correction 18.7.19chk
+   - skew and dead time moved into a batch pass (evcorrect.c); units and
+     the need for -A stay as they were. The table from pattern to detector
+     was wrong: skew and dead time of detector 3 acted on detector 1, those
+     of detector 5 on detector 2, and those of detectors 1, 2 and 4 on no
+     single detector. Now detectors 1 to 4 are patterns 1, 2, 4 and 8, and
+     dead times of detectors 5-8 act on the pairs of -D. 20261018
+   - placement on cores and NUMA node with -C (cpupin.c)
 
 
    ToDo:
@@ -196,6 +222,8 @@
 
 #include "timetag_io2.h"
 #include "usbtimetagio.h"
+#include "evcorrect.h"
+#include "cpupin.h"
 
 
 /* default settings */
@@ -321,6 +349,8 @@ char *errormessage[] = {
 	"wrong skew format. needs -d v1,v2,v3,v4",
 	"Cannot parse device name", /* 15 */
 	"needs at least 4 dead time entries: -Y d1,d2,d3,d4[,d5[,d6...]]",
+	"cannot parse cpu profile. needs -C cpus[:node[:h]]",
+	"cannot apply cpu profile (option -C)",
 };
 int emsg(int code) {
 	fprintf(stderr, "%s\n", errormessage[code]);
@@ -331,11 +361,7 @@ int emsg(int code) {
 /* -------- Accquring the local time ------- */
 unsigned long long dayoffset_1; /* contains local time in 1/8 nsecs
 				   when starting the timestamp card */
-unsigned long long dayoffset[16]; /* to hold timings */
-unsigned long long lasttime[16]; /* holds last event for a given detector pattern */
-unsigned int ddeadpatt[16]; /* dead time correction, indexed by pattern */
-char patt2det[16] = { 1, 2, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}; /* translation table patt->det */
-int deadtimecorrect = 0;
+struct evcorrect corr; /* detector skew and dead time tables */
 
 struct timeval timerequest_pointer; /*  structure to hold time requeste  */
 
@@ -442,7 +468,6 @@ int process_quads(void *sourcebuffer, int startquad, int endquad) {
 	static char formatstring_2[] = "%08x%08x\n";
 	int markit = 0;   /* for debugging time error */
 	unsigned long long current_time;
-	int pattern; /* holds detector pattern */
 
 	events = (unsigned int *)sourcebuffer;
 	numberofquads = (endquad - startquad) & QUADMASK3 ; /* anticipate roll over*/
@@ -531,24 +556,10 @@ int process_quads(void *sourcebuffer, int startquad, int endquad) {
 			}
 
 			if (timemode == 1) {
-				pattern = dv & 0xf; /* detector pattern */
 				current_time = (((unsigned long long)cv) << 32)
-				               + (unsigned long long)dv
-				               /* correction for time skew of individual detectors */
-				               + dayoffset[pattern];
-				if (!deadtimecorrect) {
-					outbuf[j].cv = (unsigned int) (current_time >> 32);
-					outbuf[j].dv = (unsigned int) (current_time & 0xffffffff);
-				} else {
-					if (current_time - lasttime[pattern] > ddeadpatt[pattern]) {
-						lasttime[pattern] = current_time;
-						outbuf[j].cv = (unsigned int) (current_time >> 32);
-						outbuf[j].dv = (unsigned int) (current_time & 0xffffffff);
-					} else {
-						lasttime[pattern] = current_time;
-						continue; /* next element in for loop */
-					}
-				}
+				               + (unsigned long long)dv + dayoffset_1;
+				outbuf[j].cv = (unsigned int) (current_time >> 32);
+				outbuf[j].dv = (unsigned int) (current_time & 0xffffffff);
 			} else {
 				outbuf[j].cv = cv; outbuf[j].dv = dv;
 			}
@@ -584,6 +595,9 @@ dontcount: trap_n++;
 			}
 		}
 
+		/* detector skew and dead time correction on the whole batch */
+		if (corr.mode) j = evcorrect_apply(&corr, (unsigned int *)outbuf, j);
+
 		/* dump event */
 		switch (outmode) {
 		case 1: /* output as binary values */
@@ -698,20 +712,23 @@ int main(int argc, char *argv[]) {
 	//int skewcorrectmode = DEFAULT_SKEWCORRECT;
 	int dskew[8]; /* for detector skew correction, indexed by detector number */
 	unsigned int ddead[8]; /* dead time correction, indexed by detector number */
-	int i, j;
+	int i;
 	int USBflushmode = 0; /* to toggle the flush mode of the firmware */
 	int USBflushoption = 0; /* indicates activated flush option */
 	int usberrstat = 0;
+	int mapflags = MAP_SHARED; /* for the DMA buffer */
 
 	/* set skew to zero by default */
-	for (i = 0; i < 8; i++) dskew[i] = 0;
+	for (i = 0; i < 8; i++) {
+		dskew[i] = 0; ddead[i] = 0;
+	}
 
 
 
 	/* --------parsing arguments ---------------------------------- */
 
 	opterr = 0; /* be quiet when there are no options */
-	while ((opt = getopt(argc, argv, "t:q:rRAa:v:s:c:j:p:FiexS:m:d:D:uU:Y:")) != EOF) {
+	while ((opt = getopt(argc, argv, "t:q:rRAa:v:s:c:j:p:FiexS:m:d:D:uU:Y:C:")) != EOF) {
 		switch (opt) {
 		case 'v': /* set verbosity level */
 			sscanf(optarg, "%d", &verbosity_level);
@@ -810,7 +827,13 @@ int main(int argc, char *argv[]) {
 			while (i < 8) {
 				ddead[i] = 0; i++;
 			}
-			deadtimecorrect = 1;
+			break;
+		case 'C': /* cores and node */
+			switch (cpupin_setup(optarg)) {
+			case CPUPIN_SYNTAX: return -emsg(17);
+			case CPUPIN_ERROR: return -emsg(18);
+			}
+			mapflags |= MAP_POPULATE; /* no faults on first use */
 			break;
 		default:
 			fprintf(stderr, "usage not correct. see source code.\n");
@@ -841,7 +864,7 @@ default: case -1:
 
 
 	/* initialize DMA buffer */
-	startad = mmap(NULL, size_dma, PROT_READ | PROT_WRITE, MAP_SHARED, fh, 0);
+	startad = mmap(NULL, size_dma, PROT_READ | PROT_WRITE, mapflags, fh, 0);
 	if (startad == MAP_FAILED) return -emsg(5);
 
 	/* prepare device */
@@ -896,12 +919,11 @@ default: case -1:
 
 	dayoffset_1 = my_time();
 
-	/* translate detector pattern into dead time index, and detector skew into dayoffset */
-	for (i = 0; i < 16; i++) {
-		j = patt2det[i];
-		ddeadpatt[i] = (j < 0) ? 0 : (ddead[j] << 15); /* correct position of time shift */
-		dayoffset[i] = dayoffset_1 + ((j < 0) ? 0 : (long long int)dskew[j]);
-	}
+	/* translate detector skews and dead times into tables by pattern. As
+	   before, they only act on absolute times (-A), skews are in raw
+	   units and only for detectors 1 to 4 */
+	for (i = 4; i < 8; i++) dskew[i] = 0;
+	if (timemode == 1) evcorrect_init(&corr, dskew, ddead, 8, 0);
 
 
 	setitimer(ITIMER_REAL, &newtimer, NULL);